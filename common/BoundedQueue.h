@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef BoundedQueue_h
+#define BoundedQueue_h
+
+#include "common/condition.h"
+#include "common/lock.h"
+#include "common/NonCopyable.h"
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace YamiMediaCodec {
+
+/**
+ * Blocking FIFO with a fixed capacity, for producer/consumer threads.
+ * push() waits while full, pop() waits while empty. After close(),
+ * push() fails at once and pop() returns what is left, then fails.
+ * So close() is both "end of stream" and "wake up and quit".
+ */
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+        : m_notEmpty(m_lock)
+        , m_notFull(m_lock)
+        , m_capacity(capacity)
+        , m_closed(false)
+    {
+    }
+
+    bool push(const T& item)
+    {
+        AutoLock lock(m_lock);
+        while (m_items.size() >= m_capacity && !m_closed)
+            m_notFull.wait();
+        return push_l(item);
+    }
+
+    bool tryPush(const T& item)
+    {
+        AutoLock lock(m_lock);
+        if (m_items.size() >= m_capacity)
+            return false;
+        return push_l(item);
+    }
+
+    bool pop(T& item)
+    {
+        AutoLock lock(m_lock);
+        while (m_items.empty() && !m_closed)
+            m_notEmpty.wait();
+        return pop_l(item);
+    }
+
+    bool tryPop(T& item)
+    {
+        AutoLock lock(m_lock);
+        return pop_l(item);
+    }
+
+    //false if nothing came in ms milliseconds
+    bool popFor(T& item, uint32_t ms)
+    {
+        AutoLock lock(m_lock);
+        while (m_items.empty() && !m_closed) {
+            if (!m_notEmpty.waitFor(ms))
+                break;
+        }
+        return pop_l(item);
+    }
+
+    void close()
+    {
+        AutoLock lock(m_lock);
+        m_closed = true;
+        m_notEmpty.broadcast();
+        m_notFull.broadcast();
+    }
+
+    bool isClosed()
+    {
+        AutoLock lock(m_lock);
+        return m_closed;
+    }
+
+    size_t size()
+    {
+        AutoLock lock(m_lock);
+        return m_items.size();
+    }
+
+    size_t capacity() const { return m_capacity; }
+
+private:
+    bool push_l(const T& item)
+    {
+        if (m_closed)
+            return false;
+        m_items.push_back(item);
+        m_notEmpty.signal();
+        return true;
+    }
+
+    bool pop_l(T& item)
+    {
+        if (m_items.empty())
+            return false;
+        item = m_items.front();
+        m_items.pop_front();
+        m_notFull.signal();
+        return true;
+    }
+
+    Lock m_lock;
+    Condition m_notEmpty;
+    Condition m_notFull;
+    std::deque<T> m_items;
+    size_t m_capacity;
+    bool m_closed;
+    DISALLOW_COPY_AND_ASSIGN(BoundedQueue);
+};
+};
+
+#endif //BoundedQueue_h
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef CountedFrameAllocator_h
+#define CountedFrameAllocator_h
+
+#include "common/PooledFrameAllocator.h"
+#include <stdint.h>
+
+namespace YamiMediaCodec {
+
+/**
+ * Wraps an allocator and counts the frames it handed out that are not
+ * released yet, the pool occupancy for stats. The count is kept here,
+ * PooledFrameAllocator and its pool are built inside libyami and have no
+ * api for it.
+ */
+class CountedFrameAllocator : public FrameAllocator {
+public:
+    //size is the pool size the wrapped allocator was created with
+    CountedFrameAllocator(const SharedPtr<FrameAllocator>& allocator, uint32_t size)
+        : m_allocator(allocator)
+        , m_used(new uint32_t(0))
+        , m_size(size)
+    {
+    }
+
+    bool setFormat(uint32_t fourcc, int width, int height)
+    {
+        return m_allocator->setFormat(fourcc, width, height);
+    }
+
+    SharedPtr<VideoFrame> alloc()
+    {
+        SharedPtr<VideoFrame> frame = m_allocator->alloc();
+        if (!frame)
+            return frame;
+        __atomic_add_fetch(m_used.get(), 1, __ATOMIC_RELAXED);
+        return SharedPtr<VideoFrame>(frame.get(), Release(m_used, frame));
+    }
+
+    //for stats only, it may change right after you read it
+    uint32_t used() const { return __atomic_load_n(m_used.get(), __ATOMIC_RELAXED); }
+    uint32_t freeCount() const
+    {
+        uint32_t n = used();
+        return n < m_size ? m_size - n : 0;
+    }
+    uint32_t size() const { return m_size; }
+
+private:
+    //gives the frame back to the wrapped pool, and counts it
+    class Release {
+    public:
+        Release(const SharedPtr<uint32_t>& used, const SharedPtr<VideoFrame>& frame)
+            : m_used(used)
+            , m_frame(frame)
+        {
+        }
+        void operator()(VideoFrame*)
+        {
+            m_frame.reset();
+            __atomic_sub_fetch(m_used.get(), 1, __ATOMIC_RELAXED);
+        }
+
+    private:
+        //outlives the allocator, frames may be held after it is gone
+        SharedPtr<uint32_t> m_used;
+        SharedPtr<VideoFrame> m_frame;
+    };
+
+    SharedPtr<FrameAllocator> m_allocator;
+    SharedPtr<uint32_t> m_used;
+    uint32_t m_size;
+};
+};
+
+#endif //CountedFrameAllocator_h
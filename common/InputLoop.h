@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef InputLoop_h
+#define InputLoop_h
+
+#include "common/latency.h"
+#include <stdint.h>
+#include <stdio.h>
+
+namespace YamiMediaCodec {
+
+/**
+ * --loop and --duration of the test apps. The input is rewound at EOF
+ * while again() says so, the decoder or encoder keeps running and only
+ * sees EOS at the very end. expired() is cheap, check it per frame.
+ */
+class InputLoop {
+public:
+    //passes: how many times the input is played, 0 for no limit,
+    //negative if not given: once, or till the duration is up
+    //seconds: stop feeding after this long, 0 for no limit
+    explicit InputLoop(int passes = -1, uint32_t seconds = 0)
+        : m_passes(passes < 0 ? (seconds ? 0 : 1) : passes)
+        , m_durationNs(seconds * 1000000000ULL)
+        , m_pass(1)
+        , m_start(getMonotonicNs())
+        , m_repeat(true)
+    {
+    }
+
+    //the duration counts from here, call it once setup is done.
+    //Setup may read ahead, rewinds it made stay counted
+    void start() { __atomic_store_n(&m_start, getMonotonicNs(), __ATOMIC_RELAXED); }
+
+    //more than one pass may happen
+    bool enabled() const { return m_passes != 1; }
+
+    bool expired() const
+    {
+        return m_durationNs && getMonotonicNs() - __atomic_load_n(&m_start, __ATOMIC_RELAXED) >= m_durationNs;
+    }
+
+    //at EOF, true if the input should be rewound for one more pass
+    bool again() const
+    {
+        return __atomic_load_n(&m_repeat, __ATOMIC_RELAXED) && !expired() && (!m_passes || pass() < m_passes);
+    }
+
+    //false stops the passes at the next EOF, till it is set again.
+    //Any thread may call it, the input checks it on its own thread
+    void setRepeat(bool repeat) { __atomic_store_n(&m_repeat, repeat, __ATOMIC_RELAXED); }
+
+    //the input is rewound, on the thread that reads it
+    void addPass() { __atomic_add_fetch(&m_pass, 1, __ATOMIC_RELAXED); }
+
+    //any thread may read it
+    uint32_t pass() const { return __atomic_load_n(&m_pass, __ATOMIC_RELAXED); }
+
+    void log(const char* name) const
+    {
+        if (enabled())
+            printf("%s: input played %u times\n", name, pass());
+    }
+
+private:
+    uint32_t m_passes;
+    uint64_t m_durationNs;
+    uint32_t m_pass;
+    uint64_t m_start;
+    bool m_repeat;
+};
+};
+
+#endif //InputLoop_h
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef MappedFrameFile_h
+#define MappedFrameFile_h
+
+#include "common/log.h"
+#include "common/NonCopyable.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace YamiMediaCodec {
+
+/**
+ * A raw yuv file mapped read only, as an array of fixed size frames.
+ * next() is a pointer into the mapping, no copy. The frames a window
+ * ahead of the cursor are advised with MADV_WILLNEED, so the kernel
+ * reads them while the current one is used. seek() is free, so is
+ * starting from any frame or looping over the file.
+ */
+class MappedFrameFile {
+public:
+    MappedFrameFile()
+        : m_fd(-1)
+        , m_data(NULL)
+        , m_size(0)
+        , m_frameSize(0)
+        , m_frameCount(0)
+        , m_window(0)
+        , m_cursor(0)
+        , m_advised(0)
+    {
+    }
+
+    ~MappedFrameFile()
+    {
+        close();
+    }
+
+    bool open(const char* name, size_t frameSize)
+    {
+        close();
+        if (!frameSize)
+            return false;
+        m_fd = ::open(name, O_RDONLY);
+        if (m_fd == -1) {
+            ERROR("open %s failed, %s", name, strerror(errno));
+            return false;
+        }
+        struct stat st;
+        if (fstat(m_fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+            ERROR("%s is not a regular file, can't map it", name);
+            close();
+            return false;
+        }
+        m_size = st.st_size;
+        void* data = mmap(NULL, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+        if (data == MAP_FAILED) {
+            ERROR("map %s failed, %s", name, strerror(errno));
+            m_size = 0;
+            close();
+            return false;
+        }
+        m_data = static_cast<uint8_t*>(data);
+        madvise(m_data, m_size, MADV_SEQUENTIAL);
+        m_frameSize = frameSize;
+        m_frameCount = m_size / frameSize;
+        m_window = kWindowBytes / frameSize;
+        if (m_window < kMinWindowFrames)
+            m_window = kMinWindowFrames;
+        seek(0);
+        return true;
+    }
+
+    void close()
+    {
+        if (m_data)
+            munmap(m_data, m_size);
+        if (m_fd != -1)
+            ::close(m_fd);
+        m_fd = -1;
+        m_data = NULL;
+        m_size = 0;
+        m_frameCount = 0;
+    }
+
+    //whole frames, a short tail is left out
+    uint64_t getFrameCount() const { return m_frameCount; }
+    //bytes after the last whole frame
+    size_t getTailSize() const { return m_size - m_frameCount * m_frameSize; }
+    //the frame next() gives
+    uint64_t tell() const { return m_cursor; }
+    bool contains(const void* p) const
+    {
+        return m_data && p >= m_data && p < m_data + m_size;
+    }
+
+    //false past the end, the cursor is not moved then
+    bool seek(uint64_t frame)
+    {
+        if (frame > m_frameCount)
+            return false;
+        m_cursor = frame;
+        m_advised = frame;
+        return true;
+    }
+
+    //the frame at the cursor, and moves the cursor on, NULL at the end
+    uint8_t* next()
+    {
+        if (m_cursor >= m_frameCount)
+            return NULL;
+        //keep at least half a window in flight
+        if (m_cursor + m_window / 2 >= m_advised)
+            advise();
+        return m_data + m_cursor++ * m_frameSize;
+    }
+
+private:
+    static const size_t kWindowBytes = 16 * 1024 * 1024;
+    static const uint64_t kMinWindowFrames = 4;
+
+    void advise()
+    {
+        uint64_t end = m_advised + m_window;
+        if (end > m_frameCount)
+            end = m_frameCount;
+        if (end <= m_advised)
+            return;
+        static const size_t page = sysconf(_SC_PAGESIZE);
+        size_t start = m_advised * m_frameSize / page * page;
+        size_t length = end * m_frameSize - start;
+        madvise(m_data + start, length, MADV_WILLNEED);
+        m_advised = end;
+    }
+
+    int m_fd;
+    uint8_t* m_data;
+    size_t m_size;
+    size_t m_frameSize;
+    uint64_t m_frameCount;
+    uint64_t m_window;
+    uint64_t m_cursor;
+    //frames before this are advised
+    uint64_t m_advised;
+    DISALLOW_COPY_AND_ASSIGN(MappedFrameFile);
+};
+};
+
+#endif //MappedFrameFile_h
@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef StatsServer_h
+#define StatsServer_h
+
+#include "common/lock.h"
+#include "common/log.h"
+#include "common/NonCopyable.h"
+#include <VideoCommonDefs.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+/**
+ * A counter bumped on the hot path and read by the stats server thread.
+ * It's a relaxed atomic add, no lock.
+ */
+class StatsCounter {
+public:
+    StatsCounter()
+        : m_value(0)
+    {
+    }
+    void add(uint64_t n = 1) { __atomic_add_fetch(&m_value, n, __ATOMIC_RELAXED); }
+    uint64_t get() const { return __atomic_load_n(&m_value, __ATOMIC_RELAXED); }
+
+private:
+    uint64_t m_value;
+    DISALLOW_COPY_AND_ASSIGN(StatsCounter);
+};
+
+/**
+ * Serves live counters on a unix domain socket. Every connection gets one
+ * snapshot and is closed. A client sending an http request is answered
+ * with an http response, so both of these work:
+ *     curl --unix-socket /tmp/yami.sock http://localhost/metrics
+ *     socat - UNIX-CONNECT:/tmp/yami.sock
+ * The snapshot is Prometheus text, or JSON if the request mentions "json".
+ *
+ * Probes are sampled on the server thread, so they must be thread safe,
+ * and the objects they read must outlive stop().
+ */
+class StatsServer {
+public:
+    class Probe {
+    public:
+        virtual uint64_t value() = 0;
+        virtual ~Probe() {}
+    };
+
+    enum Type {
+        COUNTER,
+        GAUGE
+    };
+
+    StatsServer()
+        : m_listen(-1)
+        , m_running(false)
+    {
+        m_wake[0] = m_wake[1] = -1;
+    }
+
+    ~StatsServer()
+    {
+        stop();
+    }
+
+    //labels is "key=value,key=value", may be empty
+    void add(const char* name, Type type, const char* help,
+        const SharedPtr<Probe>& probe, const std::string& labels = std::string())
+    {
+        Metric m;
+        m.name = name;
+        m.type = type;
+        m.help = help;
+        m.probe = probe;
+        m.labels = labels;
+        AutoLock lock(m_lock);
+        m_metrics.push_back(m);
+    }
+
+    void add(const char* name, const char* help, const StatsCounter& counter,
+        const std::string& labels = std::string())
+    {
+        add(name, COUNTER, help, SharedPtr<Probe>(new CounterProbe(counter)), labels);
+    }
+
+    //gauge read from obj->fn() on the server thread
+    template <class T, class R>
+    void add(const char* name, const char* help, T* obj, R (T::*fn)(),
+        const std::string& labels = std::string(), Type type = GAUGE)
+    {
+        add(name, type, help, SharedPtr<Probe>(new MethodProbe<T, R (T::*)()>(obj, fn)), labels);
+    }
+
+    template <class T, class R>
+    void add(const char* name, const char* help, T* obj, R (T::*fn)() const,
+        const std::string& labels = std::string(), Type type = GAUGE)
+    {
+        add(name, type, help, SharedPtr<Probe>(new MethodProbe<T, R (T::*)() const>(obj, fn)), labels);
+    }
+
+    bool start(const char* path)
+    {
+        struct sockaddr_un addr;
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+            ERROR("stats socket path %s is too long", path);
+            return false;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        //a stale socket from a killed run, but never remove anything else
+        struct stat st;
+        if (!lstat(path, &st)) {
+            if (!S_ISSOCK(st.st_mode)) {
+                ERROR("stats socket path %s exists and is not a socket", path);
+                return false;
+            }
+            unlink(path);
+        }
+        m_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_listen < 0
+            || bind(m_listen, (struct sockaddr*)&addr, sizeof(addr))
+            || listen(m_listen, 4)) {
+            ERROR("can't listen on %s: %s", path, strerror(errno));
+            closeFds();
+            return false;
+        }
+        if (pipe(m_wake)) {
+            ERROR("create pipe failed");
+            closeFds();
+            return false;
+        }
+        m_path = path;
+        if (pthread_create(&m_thread, NULL, start, this)) {
+            ERROR("create thread failed");
+            closeFds();
+            return false;
+        }
+        m_running = true;
+        return true;
+    }
+
+    void stop()
+    {
+        if (!m_running)
+            return;
+        char c = 0;
+        if (write(m_wake[1], &c, 1) != 1)
+            ERROR("wake stats server failed");
+        pthread_join(m_thread, NULL);
+        m_running = false;
+        closeFds();
+        unlink(m_path.c_str());
+    }
+
+    //one snapshot, in Prometheus text or json
+    std::string snapshot(bool json)
+    {
+        AutoLock lock(m_lock);
+        std::string out;
+        if (json) {
+            out += "{\"metrics\":[";
+            for (size_t i = 0; i < m_metrics.size(); i++) {
+                Metric& m = m_metrics[i];
+                out += i ? ",{\"name\":\"" : "{\"name\":\"";
+                out += m.name + "\",";
+                appendLabels(out, m.labels, true);
+                out += "\"value\":" + value(m) + "}";
+            }
+            out += "]}\n";
+            return out;
+        }
+        //all label sets of a metric go under one help and type
+        std::vector<bool> done(m_metrics.size(), false);
+        for (size_t i = 0; i < m_metrics.size(); i++) {
+            if (done[i])
+                continue;
+            Metric& m = m_metrics[i];
+            out += "# HELP " + m.name + " " + m.help + "\n";
+            out += "# TYPE " + m.name + (m.type == COUNTER ? " counter\n" : " gauge\n");
+            for (size_t j = i; j < m_metrics.size(); j++) {
+                Metric& same = m_metrics[j];
+                if (done[j] || same.name != m.name)
+                    continue;
+                out += same.name;
+                appendLabels(out, same.labels, false);
+                out += " " + value(same) + "\n";
+                done[j] = true;
+            }
+        }
+        return out;
+    }
+
+private:
+    class CounterProbe : public Probe {
+    public:
+        CounterProbe(const StatsCounter& counter)
+            : m_counter(counter)
+        {
+        }
+        uint64_t value() { return m_counter.get(); }
+
+    private:
+        const StatsCounter& m_counter;
+    };
+
+    template <class T, class F>
+    class MethodProbe : public Probe {
+    public:
+        MethodProbe(T* obj, F fn)
+            : m_obj(obj)
+            , m_fn(fn)
+        {
+        }
+        uint64_t value() { return (uint64_t)(m_obj->*m_fn)(); }
+
+    private:
+        T* m_obj;
+        F m_fn;
+    };
+
+    struct Metric {
+        std::string name;
+        Type type;
+        std::string help;
+        std::string labels;
+        SharedPtr<Probe> probe;
+    };
+
+    static std::string value(Metric& m)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%lu", (unsigned long)m.probe->value());
+        return buf;
+    }
+
+    //k=v,k=v to {k="v",k="v"} or "k":"v","k":"v",
+    static void appendLabels(std::string& out, const std::string& labels, bool json)
+    {
+        if (labels.empty())
+            return;
+        if (!json)
+            out += "{";
+        size_t pos = 0;
+        while (pos < labels.size()) {
+            size_t end = labels.find(',', pos);
+            if (end == std::string::npos)
+                end = labels.size();
+            size_t eq = labels.find('=', pos);
+            if (eq != std::string::npos && eq < end) {
+                std::string key = labels.substr(pos, eq - pos);
+                std::string value = labels.substr(eq + 1, end - eq - 1);
+                if (json)
+                    out += "\"" + key + "\":\"" + value + "\",";
+                else
+                    out += (pos ? "," : "") + key + "=\"" + value + "\"";
+            }
+            pos = end + 1;
+        }
+        if (!json)
+            out += "}";
+    }
+
+    static void* start(void* server)
+    {
+        ((StatsServer*)server)->loop();
+        return NULL;
+    }
+
+    void loop()
+    {
+        struct pollfd fds[2];
+        fds[0].fd = m_listen;
+        fds[0].events = POLLIN;
+        fds[1].fd = m_wake[0];
+        fds[1].events = POLLIN;
+        while (1) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                ERROR("stats server poll failed: %s", strerror(errno));
+                return;
+            }
+            if (fds[1].revents)
+                return;
+            if (fds[0].revents & POLLIN) {
+                int fd = accept(m_listen, NULL, NULL);
+                if (fd >= 0) {
+                    serve(fd);
+                    close(fd);
+                }
+            }
+        }
+    }
+
+    void serve(int fd)
+    {
+        //give the client 100ms to send a request, plain readers send nothing
+        char req[1024];
+        size_t len = 0;
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        while (len < sizeof(req) - 1 && poll(&pfd, 1, 100) > 0) {
+            ssize_t n = read(fd, req + len, sizeof(req) - 1 - len);
+            if (n <= 0)
+                break;
+            len += n;
+            req[len] = '\0';
+            if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+                break;
+        }
+        req[len] = '\0';
+        bool json = strstr(req, "json");
+        std::string body = snapshot(json);
+        std::string out;
+        if (!strncmp(req, "GET ", 4)) {
+            char header[128];
+            snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %lu\r\n\r\n",
+                json ? "application/json" : "text/plain; version=0.0.4", (unsigned long)body.size());
+            out = header;
+        }
+        out += body;
+        const char* p = out.data();
+        size_t left = out.size();
+        while (left) {
+            ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            p += n;
+            left -= n;
+        }
+    }
+
+    void closeFds()
+    {
+        if (m_listen >= 0)
+            close(m_listen);
+        for (int i = 0; i < 2; i++) {
+            if (m_wake[i] >= 0)
+                close(m_wake[i]);
+            m_wake[i] = -1;
+        }
+        m_listen = -1;
+    }
+
+    Lock m_lock;
+    std::vector<Metric> m_metrics;
+    std::string m_path;
+    int m_listen;
+    int m_wake[2];
+    pthread_t m_thread;
+    bool m_running;
+    DISALLOW_COPY_AND_ASSIGN(StatsServer);
+};
+};
+
+#endif //StatsServer_h
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef StatsSink_h
+#define StatsSink_h
+
+#include "common/latency.h"
+#include "common/log.h"
+#include "common/NonCopyable.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+namespace YamiMediaCodec {
+
+/**
+ * Machine readable stats for the tools. Feed it from the main loop and
+ * call tick() once per frame, a record is written every interval.
+ * Target is a file name or "fd:N", format is "json" (one object per
+ * line) or "csv", guessed from the file extension if not given.
+ * Stage latencies are cumulative since start.
+ * pool_used and pool_size are only written by tools that own the pool,
+ * the decoder and encoder surfaces live in libyami and are not counted.
+ */
+class StatsSink {
+public:
+    StatsSink(const char* tool)
+        : m_tool(tool)
+        , m_fp(NULL)
+        , m_csv(false)
+        , m_interval(0)
+        , m_start(0)
+        , m_last(0)
+        , m_lastFrames(0)
+        , m_frames(0)
+        , m_bytesIn(0)
+        , m_bytesOut(0)
+        , m_poolUsed(0)
+        , m_poolSize(0)
+        , m_timer(NULL)
+    {
+    }
+
+    ~StatsSink()
+    {
+        close();
+    }
+
+    //write the final record, the stage timer must still be alive here
+    void close()
+    {
+        if (m_fp) {
+            write(true);
+            fclose(m_fp);
+            m_fp = NULL;
+        }
+    }
+
+    bool open(const char* target, const char* format, uint32_t intervalMs)
+    {
+        if (!target)
+            return false;
+        if (strncmp(target, "fd:", 3) == 0) {
+            char* end;
+            long fd = strtol(target + 3, &end, 10);
+            if (end == target + 3 || *end || fd < 0 || fd > INT_MAX) {
+                ERROR("invalid stats fd %s", target);
+                return false;
+            }
+            //dup it, so fclose will not close the caller's fd
+            int copy = dup(fd);
+            if (copy >= 0) {
+                m_fp = fdopen(copy, "w");
+                if (!m_fp)
+                    ::close(copy);
+            }
+        }
+        else {
+            m_fp = fopen(target, "w");
+        }
+        if (!m_fp) {
+            ERROR("can't open stats target %s", target);
+            return false;
+        }
+        if (format) {
+            m_csv = !strcasecmp(format, "csv");
+        }
+        else {
+            const char* ext = strrchr(target, '.');
+            m_csv = ext && !strcasecmp(ext, ".csv");
+        }
+        m_interval = intervalMs * 1000000ULL;
+        m_start = m_last = getMonotonicNs();
+        if (m_csv)
+            writeCsvHeader();
+        return true;
+    }
+
+    bool isOpen() const { return m_fp; }
+
+    void addFrames(uint32_t frames = 1) { m_frames += frames; }
+    //totals since start
+    void setBytesIn(uint64_t bytes) { m_bytesIn = bytes; }
+    void setBytesOut(uint64_t bytes) { m_bytesOut = bytes; }
+    //buffers of the tool's own pool or queue in use, and how many it has
+    void setPool(uint32_t used, uint32_t size)
+    {
+        m_poolUsed = used;
+        m_poolSize = size;
+    }
+    //stage timings are read from timer when a record is written
+    void setStageTimer(const StageTimer* timer) { m_timer = timer; }
+
+    //cheap when not due, call it once per frame
+    void tick()
+    {
+        if (!m_fp)
+            return;
+        uint64_t now = getMonotonicNs();
+        if (now - m_last < m_interval)
+            return;
+        write(false, now);
+    }
+
+private:
+    void write(bool final, uint64_t now = 0)
+    {
+        if (!now)
+            now = getMonotonicNs();
+        double elapsed = (now - m_start) / 1e9;
+        double interval = (now - m_last) / 1e9;
+        double fps = interval > 0 ? (m_frames - m_lastFrames) / interval : 0;
+        double avgFps = elapsed > 0 ? m_frames / elapsed : 0;
+        if (m_csv) {
+            fprintf(m_fp, "%s,%d,%.3f,%lu,%.2f,%.2f,%lu,%lu", m_tool, final, elapsed,
+                (unsigned long)m_frames, fps, avgFps,
+                (unsigned long)m_bytesIn, (unsigned long)m_bytesOut);
+            //empty when there is no pool
+            if (m_poolSize)
+                fprintf(m_fp, ",%u,%u", m_poolUsed, m_poolSize);
+            else
+                fprintf(m_fp, ",,");
+            for (int i = 0; i <= StageTimer::STAGE_COUNT; i++) {
+                const LatencyHistogram& h = histogram(i);
+                fprintf(m_fp, ",%.3f,%.3f", h.percentile(50) / 1e6, h.percentile(99) / 1e6);
+            }
+            fprintf(m_fp, "\n");
+        }
+        else {
+            fprintf(m_fp, "{\"tool\":\"%s\",\"final\":%s,\"elapsed\":%.3f,\"frames\":%lu,"
+                          "\"fps\":%.2f,\"avg_fps\":%.2f,\"bytes_in\":%lu,\"bytes_out\":%lu",
+                m_tool, final ? "true" : "false", elapsed,
+                (unsigned long)m_frames, fps, avgFps,
+                (unsigned long)m_bytesIn, (unsigned long)m_bytesOut);
+            if (m_poolSize)
+                fprintf(m_fp, ",\"pool_used\":%u,\"pool_size\":%u", m_poolUsed, m_poolSize);
+            if (m_timer) {
+                fprintf(m_fp, ",\"latency_ms\":{");
+                bool first = true;
+                for (int i = 0; i <= StageTimer::STAGE_COUNT; i++) {
+                    const LatencyHistogram& h = histogram(i);
+                    if (!h.count())
+                        continue;
+                    fprintf(m_fp, "%s\"%s\":{\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+                        first ? "" : ",", StageTimer::name(i), h.percentile(50) / 1e6,
+                        h.percentile(95) / 1e6, h.percentile(99) / 1e6, h.max() / 1e6);
+                    first = false;
+                }
+                fprintf(m_fp, "}");
+            }
+            fprintf(m_fp, "}\n");
+        }
+        fflush(m_fp);
+        m_last = now;
+        m_lastFrames = m_frames;
+    }
+
+    void writeCsvHeader()
+    {
+        fprintf(m_fp, "tool,final,elapsed,frames,fps,avg_fps,bytes_in,bytes_out,pool_used,pool_size");
+        for (int i = 0; i <= StageTimer::STAGE_COUNT; i++)
+            fprintf(m_fp, ",%s_p50_ms,%s_p99_ms", StageTimer::name(i), StageTimer::name(i));
+        fprintf(m_fp, "\n");
+    }
+
+    //STAGE_COUNT is the whole frame
+    const LatencyHistogram& histogram(int i)
+    {
+        static const LatencyHistogram empty;
+        if (!m_timer)
+            return empty;
+        if (i == StageTimer::STAGE_COUNT)
+            return m_timer->frame();
+        return m_timer->stage((StageTimer::Stage)i);
+    }
+
+    const char* m_tool;
+    FILE* m_fp;
+    bool m_csv;
+    uint64_t m_interval;
+    uint64_t m_start;
+    uint64_t m_last;
+    uint64_t m_lastFrames;
+    uint64_t m_frames;
+    uint64_t m_bytesIn;
+    uint64_t m_bytesOut;
+    uint32_t m_poolUsed;
+    uint32_t m_poolSize;
+    const StageTimer* m_timer;
+    DISALLOW_COPY_AND_ASSIGN(StatsSink);
+};
+};
+
+#endif //StatsSink_h
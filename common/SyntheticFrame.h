@@ -0,0 +1,462 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef SyntheticFrame_h
+#define SyntheticFrame_h
+
+#include "common/common_def.h"
+#include "common/log.h"
+#include "common/utils.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+/**
+ * Procedural 4:2:0 frames for I/O free benchmarks, named by a pseudo path
+ * "synthetic:<w>x<h>:<nv12|i420|yv12>:<pattern>[:<frames>[:<seed>]]".
+ *
+ *  gradient:     luma and chroma ramps, scrolling
+ *  noise:        random samples, the worst case for an encoder
+ *  moving-boxes: boxes bouncing over a still gradient, like examples/bumpbox.h
+ *  moving-bars:  color bars scrolling sideways
+ *  scene-cuts:   one of the above, switched with a new seed every kSceneFrames
+ *
+ * frames is the length of the clip, 0 for no end, default kDefaultFrames.
+ * The same spec gives the same frames, on any machine and in any order.
+ * Frames are made a row at a time, so they can be written straight into
+ * a mapped surface. Noise is written 8 bytes a store. Other rows only
+ * change with the ramp value or the boxes they cross, a row is built
+ * when that key changes and copied down until it changes again.
+ */
+class SyntheticFrame {
+public:
+    enum Pattern {
+        GRADIENT,
+        NOISE,
+        MOVING_BOXES,
+        MOVING_BARS,
+        SCENE_CUTS,
+    };
+    enum { kDefaultFrames = 300 };
+    enum { kSceneFrames = 30 };
+
+    static bool isSpec(const char* name)
+    {
+        return name && !strncmp(name, "synthetic:", strlen("synthetic:"));
+    }
+
+    SyntheticFrame()
+        : m_width(0)
+        , m_height(0)
+        , m_fourcc(0)
+        , m_pattern(GRADIENT)
+        , m_frames(kDefaultFrames)
+        , m_seed(0)
+        , m_planes(0)
+        , m_current(GRADIENT)
+        , m_time(0)
+        , m_frameSeed(0)
+        , m_lumaKey(kNoKey)
+        , m_chromaKey(kNoKey)
+    {
+    }
+
+    bool parse(const char* spec)
+    {
+        if (!isSpec(spec))
+            return false;
+        char fourcc[8], pattern[32];
+        unsigned long long frames = kDefaultFrames, seed = 0;
+        int fields = sscanf(spec + strlen("synthetic:"), "%ux%u:%7[^:]:%31[^:]:%llu:%llu",
+            &m_width, &m_height, fourcc, pattern, &frames, &seed);
+        if (fields < 4 || !m_width || !m_height || m_width > 8192 || m_height > 8192) {
+            ERROR("bad synthetic input %s, want synthetic:<w>x<h>:<fourcc>:<pattern>[:<frames>[:<seed>]]", spec);
+            return false;
+        }
+        if (!parseFourcc(fourcc) || !parsePattern(pattern)) {
+            ERROR("unsupported synthetic input %s", spec);
+            return false;
+        }
+        m_frames = frames;
+        m_seed = seed;
+        if (!getPlaneResolution(m_fourcc, m_width, m_height, m_byteWidth, m_byteHeight, m_planes))
+            return false;
+
+        //chroma samples of a row
+        uint32_t samples = (m_width + 1) / 2;
+        m_u.resize(samples);
+        m_v.resize(samples);
+        m_chroma.resize(samples * 2);
+        m_luma.resize(m_width);
+        m_ramp.resize(m_width);
+        m_chromaRamp.resize(samples);
+        for (uint32_t x = 0; x < m_width; x++)
+            m_ramp[x] = x * 256 / m_width;
+        for (uint32_t x = 0; x < samples; x++)
+            m_chromaRamp[x] = x * 256 / samples;
+        setupBoxes(m_seed);
+        return true;
+    }
+
+    uint32_t getWidth() const { return m_width; }
+    uint32_t getHeight() const { return m_height; }
+    uint32_t getFourcc() const { return m_fourcc; }
+    //0 for no end
+    uint64_t getFrameCount() const { return m_frames; }
+    uint32_t getPlaneCount() const { return m_planes; }
+    uint32_t getPlaneHeight(uint32_t plane) const { return m_byteHeight[plane]; }
+    size_t getFrameSize() const
+    {
+        size_t size = 0;
+        for (uint32_t i = 0; i < m_planes; i++)
+            size += m_byteWidth[i] * m_byteHeight[i];
+        return size;
+    }
+
+    //per frame state, call it before the rows of frame n
+    void begin(uint64_t n)
+    {
+        m_current = m_pattern;
+        m_time = n;
+        uint64_t seed = m_seed;
+        if (m_pattern == SCENE_CUTS) {
+            uint64_t scene = n / kSceneFrames;
+            seed = mix(m_seed + scene);
+            m_current = (Pattern)(seed % SCENE_CUTS);
+            //a scene starts where the last one did not end
+            m_time = n % kSceneFrames + (seed >> 8) % 1024;
+            if (m_current == MOVING_BOXES)
+                setupBoxes(seed);
+        }
+        m_frameSeed = mix(seed ^ (n * 0x9e3779b97f4a7c15ULL));
+        if (m_current == MOVING_BOXES)
+            moveBoxes();
+        m_lumaKey = kNoKey;
+        m_chromaKey = kNoKey;
+    }
+
+    //row y of a plane, size bytes as getPlaneResolution() gives them
+    void row(uint32_t plane, uint32_t y, uint8_t* dst, uint32_t size)
+    {
+        if (!plane) {
+            lumaRow(y, dst, size);
+            return;
+        }
+        if (m_current == NOISE) {
+            //no need to keep u and v apart
+            noise(dst, size, mix(m_frameSeed + ((uint64_t)plane << 32) + y));
+            return;
+        }
+        bool interleaved = m_planes == 2;
+        uint32_t key = chromaKey(y);
+        if (key != m_chromaKey) {
+            buildChroma(y, interleaved);
+            m_chromaKey = key;
+        }
+        if (interleaved) {
+            memcpy(dst, &m_chroma[0], std::min<size_t>(size, m_chroma.size()));
+            return;
+        }
+        //yv12 has v first
+        bool isU = (plane == 1) == (m_fourcc != YAMI_FOURCC('Y', 'V', '1', '2'));
+        memcpy(dst, isU ? &m_u[0] : &m_v[0], std::min<size_t>(size, m_u.size()));
+    }
+
+    //frame n to planes at data[i], pitch[i] apart
+    void fill(uint64_t n, uint8_t* const data[3], const uint32_t pitch[3])
+    {
+        begin(n);
+        for (uint32_t p = 0; p < m_planes; p++) {
+            for (uint32_t y = 0; y < m_byteHeight[p]; y++)
+                row(p, y, data[p] + y * pitch[p], m_byteWidth[p]);
+        }
+    }
+
+    //frame n packed as fillFrameRawData() lays it out
+    void fill(uint64_t n, uint8_t* buffer)
+    {
+        uint8_t* data[3];
+        uint32_t pitch[3];
+        for (uint32_t p = 0; p < m_planes; p++) {
+            data[p] = buffer;
+            pitch[p] = m_byteWidth[p];
+            buffer += m_byteWidth[p] * m_byteHeight[p];
+        }
+        fill(n, data, pitch);
+    }
+
+private:
+    struct Box {
+        uint32_t width;
+        uint32_t height;
+        uint32_t startX, startY;
+        uint32_t speedX, speedY;
+        uint8_t y, u, v;
+        //position in this frame
+        uint32_t x0, y0;
+    };
+    enum { kBoxCount = 4 };
+    static const uint32_t kNoKey = 0xffffffff;
+
+    //splitmix64 finalizer
+    static uint64_t mix(uint64_t z)
+    {
+        z += 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    //xorshift64*, 8 bytes a step
+    static void noise(uint8_t* dst, uint32_t size, uint64_t state)
+    {
+        state |= 1;
+        uint32_t i = 0;
+        while (i < size) {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            uint64_t r = state * 2685821657736338717ULL;
+            uint32_t n = size - i < 8 ? size - i : 8;
+            memcpy(dst + i, &r, n);
+            i += n;
+        }
+    }
+
+    //bounce between 0 and range, like BumpBox
+    static uint32_t bounce(uint64_t position, uint32_t range)
+    {
+        if (!range)
+            return 0;
+        uint64_t p = position % (2 * range);
+        return p < range ? p : 2 * range - p;
+    }
+
+    bool parseFourcc(const char* name)
+    {
+        if (strlen(name) != 4)
+            return false;
+        m_fourcc = YAMI_FOURCC(toupper(name[0]), toupper(name[1]), toupper(name[2]), toupper(name[3]));
+        return m_fourcc == YAMI_FOURCC('N', 'V', '1', '2')
+            || m_fourcc == YAMI_FOURCC('I', '4', '2', '0')
+            || m_fourcc == YAMI_FOURCC('Y', 'V', '1', '2');
+    }
+
+    bool parsePattern(const char* name)
+    {
+        static const char* names[] = { "gradient", "noise", "moving-boxes", "moving-bars", "scene-cuts" };
+        for (size_t i = 0; i < N_ELEMENTS(names); i++) {
+            if (!strcmp(name, names[i])) {
+                m_pattern = (Pattern)i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void setupBoxes(uint64_t seed)
+    {
+        for (uint32_t i = 0; i < kBoxCount; i++) {
+            Box& b = m_boxes[i];
+            uint64_t r = mix(seed + i + 1);
+            //even, so chroma lines up
+            b.width = (m_width / 8 + m_width * i / 32) & ~1;
+            b.height = (m_height / 8 + m_height * i / 32) & ~1;
+            b.startX = r % 4096;
+            b.startY = (r >> 12) % 4096;
+            b.speedX = 2 + (r >> 24) % 8;
+            b.speedY = 2 + (r >> 28) % 8;
+            b.y = 16 + (r >> 32) % 220;
+            b.u = 16 + (r >> 40) % 225;
+            b.v = 16 + (r >> 48) % 225;
+        }
+    }
+
+    void moveBoxes()
+    {
+        for (uint32_t i = 0; i < kBoxCount; i++) {
+            Box& b = m_boxes[i];
+            b.x0 = bounce(b.startX + b.speedX * m_time, m_width - b.width) & ~1;
+            b.y0 = bounce(b.startY + b.speedY * m_time, m_height - b.height) & ~1;
+        }
+    }
+
+    //boxes crossing luma row y
+    uint32_t boxMask(uint32_t y) const
+    {
+        uint32_t mask = 0;
+        for (uint32_t i = 0; i < kBoxCount; i++) {
+            const Box& b = m_boxes[i];
+            if (y >= b.y0 && y < b.y0 + b.height)
+                mask |= 1 << i;
+        }
+        return mask;
+    }
+
+    uint8_t rampOffset(uint32_t y) const
+    {
+        uint64_t time = m_current == MOVING_BOXES ? 0 : m_time;
+        return y * 256 / m_height + time * 2;
+    }
+
+    uint8_t chromaOffset(uint32_t y) const
+    {
+        uint64_t time = m_current == MOVING_BOXES ? 0 : m_time;
+        return y * 256 / ((m_height + 1) / 2) - time;
+    }
+
+    //rows with the same key are the same
+    uint32_t lumaKey(uint32_t y) const
+    {
+        if (m_current == MOVING_BARS)
+            return 0;
+        uint32_t key = rampOffset(y);
+        if (m_current == MOVING_BOXES)
+            key |= boxMask(y) << 8;
+        return key;
+    }
+
+    uint32_t chromaKey(uint32_t y) const
+    {
+        if (m_current == MOVING_BARS)
+            return 0;
+        uint32_t key = chromaOffset(y);
+        if (m_current == MOVING_BOXES)
+            key |= boxMask(2 * y) << 8;
+        return key;
+    }
+
+    //75% bars, bt.601
+    const uint8_t* bar(uint32_t x) const
+    {
+        static const uint8_t bars[8][3] = {
+            { 180, 128, 128 }, { 162, 44, 142 }, { 131, 156, 44 }, { 112, 72, 58 },
+            { 84, 184, 198 }, { 65, 100, 212 }, { 35, 212, 114 }, { 16, 128, 128 }
+        };
+        uint32_t shift = (m_time * 4) % m_width;
+        return bars[(uint64_t)((x + shift) % m_width) * 8 / m_width];
+    }
+
+    void lumaRow(uint32_t y, uint8_t* dst, uint32_t size)
+    {
+        if (size > m_width)
+            size = m_width;
+        if (m_current == NOISE) {
+            noise(dst, size, mix(m_frameSeed + y));
+            return;
+        }
+        uint32_t key = lumaKey(y);
+        if (key != m_lumaKey) {
+            buildLuma(y);
+            m_lumaKey = key;
+        }
+        memcpy(dst, &m_luma[0], size);
+    }
+
+    void buildLuma(uint32_t y)
+    {
+        uint8_t* luma = &m_luma[0];
+        if (m_current == MOVING_BARS) {
+            for (uint32_t x = 0; x < m_width; x++)
+                luma[x] = bar(x)[0];
+            return;
+        }
+        //gradient, still under the boxes
+        uint8_t offset = rampOffset(y);
+        const uint8_t* ramp = &m_ramp[0];
+        for (uint32_t x = 0; x < m_width; x++)
+            luma[x] = ramp[x] + offset;
+        if (m_current != MOVING_BOXES)
+            return;
+        for (uint32_t i = 0; i < kBoxCount; i++) {
+            const Box& b = m_boxes[i];
+            if (y >= b.y0 && y < b.y0 + b.height)
+                memset(luma + b.x0, b.y, b.width);
+        }
+    }
+
+    //chroma row y to m_u and m_v, and m_chroma when interleaved
+    void buildChroma(uint32_t y, bool interleaved)
+    {
+        uint32_t samples = m_u.size();
+        uint8_t* u = &m_u[0];
+        uint8_t* v = &m_v[0];
+        if (m_current == MOVING_BARS) {
+            for (uint32_t x = 0; x < samples; x++) {
+                const uint8_t* c = bar(2 * x);
+                u[x] = c[1];
+                v[x] = c[2];
+            }
+        } else {
+            uint8_t offset = m_current == MOVING_BOXES ? 0 : m_time;
+            const uint8_t* ramp = &m_chromaRamp[0];
+            for (uint32_t x = 0; x < samples; x++)
+                u[x] = ramp[x] + offset;
+            memset(v, chromaOffset(y), samples);
+            if (m_current == MOVING_BOXES) {
+                for (uint32_t i = 0; i < kBoxCount; i++) {
+                    const Box& b = m_boxes[i];
+                    if (2 * y >= b.y0 && 2 * y < b.y0 + b.height) {
+                        memset(u + b.x0 / 2, b.u, b.width / 2);
+                        memset(v + b.x0 / 2, b.v, b.width / 2);
+                    }
+                }
+            }
+        }
+        if (!interleaved)
+            return;
+        uint8_t* uv = &m_chroma[0];
+        for (uint32_t x = 0; x < samples; x++) {
+            uv[2 * x] = u[x];
+            uv[2 * x + 1] = v[x];
+        }
+    }
+
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_fourcc;
+    Pattern m_pattern;
+    uint64_t m_frames;
+    uint64_t m_seed;
+    uint32_t m_planes;
+    uint32_t m_byteWidth[3];
+    uint32_t m_byteHeight[3];
+
+    //tables made once
+    std::vector<uint8_t> m_ramp;
+    std::vector<uint8_t> m_chromaRamp;
+
+    //this frame
+    Pattern m_current;
+    uint64_t m_time;
+    uint64_t m_frameSeed;
+    Box m_boxes[kBoxCount];
+    //the rows last built, and their keys
+    uint32_t m_lumaKey;
+    uint32_t m_chromaKey;
+    std::vector<uint8_t> m_luma;
+    std::vector<uint8_t> m_u;
+    std::vector<uint8_t> m_v;
+    std::vector<uint8_t> m_chroma;
+};
+};
+
+#endif //SyntheticFrame_h
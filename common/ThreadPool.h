@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ThreadPool_h
+#define ThreadPool_h
+
+#include "common/BoundedQueue.h"
+#include "common/condition.h"
+#include "common/lock.h"
+#include "common/log.h"
+#include "common/NonCopyable.h"
+#include <VideoCommonDefs.h>
+#include <pthread.h>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+/**
+ * Fixed set of worker threads running posted tasks in FIFO order.
+ * post() blocks when queueSize tasks are waiting, waitIdle() returns
+ * when every posted task has finished. stop(), also called by the
+ * destructor, runs the tasks already posted and joins the workers.
+ */
+class ThreadPool {
+public:
+    class Task {
+    public:
+        virtual void run() = 0;
+        virtual ~Task() {}
+    };
+
+    explicit ThreadPool(uint32_t queueSize = 64)
+        : m_tasks(queueSize)
+        , m_idle(m_lock)
+        , m_pending(0)
+    {
+    }
+
+    ~ThreadPool()
+    {
+        stop();
+    }
+
+    bool start(uint32_t threads)
+    {
+        for (uint32_t i = 0; i < threads; i++) {
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, entry, this)) {
+                ERROR("create thread failed");
+                stop();
+                return false;
+            }
+            m_threads.push_back(thread);
+        }
+        return true;
+    }
+
+    //false if the pool is stopped
+    bool post(const SharedPtr<Task>& task)
+    {
+        {
+            AutoLock lock(m_lock);
+            m_pending++;
+        }
+        if (!m_tasks.push(task)) {
+            done();
+            return false;
+        }
+        return true;
+    }
+
+    void waitIdle()
+    {
+        AutoLock lock(m_lock);
+        while (m_pending)
+            m_idle.wait();
+    }
+
+    void stop()
+    {
+        m_tasks.close();
+        for (size_t i = 0; i < m_threads.size(); i++)
+            pthread_join(m_threads[i], NULL);
+        m_threads.clear();
+    }
+
+    size_t size() const { return m_threads.size(); }
+
+private:
+    static void* entry(void* pool)
+    {
+        ((ThreadPool*)pool)->loop();
+        return NULL;
+    }
+
+    void loop()
+    {
+        SharedPtr<Task> task;
+        while (m_tasks.pop(task)) {
+            task->run();
+            task.reset();
+            done();
+        }
+    }
+
+    void done()
+    {
+        AutoLock lock(m_lock);
+        if (!--m_pending)
+            m_idle.broadcast();
+    }
+
+    BoundedQueue<SharedPtr<Task> > m_tasks;
+    std::vector<pthread_t> m_threads;
+    Lock m_lock;
+    Condition m_idle;
+    uint32_t m_pending;
+    DISALLOW_COPY_AND_ASSIGN(ThreadPool);
+};
+};
+
+#endif //ThreadPool_h
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef VaapiImageCache_h
+#define VaapiImageCache_h
+
+#include "common/log.h"
+#include "common/lock.h"
+#include "common/VaapiUtils.h"
+#include <VideoCommonDefs.h>
+#include <va/va.h>
+#include <map>
+
+namespace YamiMediaCodec {
+
+/**
+ * One mapping of a surface's derived image, unmapped when this goes away.
+ * Use it when the cpu writes the surface, or the surface is not ours to keep
+ * mapped. Some drivers back a derived image with a shadow copy that only
+ * reaches the surface at vaUnmapBuffer, and vaGetImage/vaPutImage on the
+ * surface fail with SURFACE_BUSY while the image exists.
+ */
+class ScopedImageMapping {
+public:
+    ScopedImageMapping(VADisplay display, const SharedPtr<VideoFrame>& frame)
+        : m_display(display)
+    {
+        m_data = mapSurfaceToImage(display, frame->surface, m_image);
+    }
+    ~ScopedImageMapping()
+    {
+        if (m_data)
+            unmapImage(m_display, m_image);
+    }
+    //NULL if the surface can't be mapped
+    uint8_t* data() const { return m_data; }
+    const VAImage& image() const { return m_image; }
+
+private:
+    VADisplay m_display;
+    VAImage m_image;
+    uint8_t* m_data;
+    DISALLOW_COPY_AND_ASSIGN(ScopedImageMapping);
+};
+
+/**
+ * Keeps derived and mapped VAImages alive across frames, keyed by surface id.
+ * Surfaces from a fixed pool come back again and again, so we only pay
+ * vaDeriveImage/vaMapBuffer once per surface instead of once per frame.
+ * Only for reading back surfaces of a pool of our own that the gpu renders
+ * into and the cpu never writes, see ScopedImageMapping for the others.
+ *
+ * An entry is dropped when the frame's fourcc changes or its crop no longer
+ * fits the derived image. Call clear() when the surface pool is reset,
+ * and destroy the cache before the surfaces and the display go away.
+ */
+class VaapiImageCache {
+public:
+    VaapiImageCache(VADisplay display)
+        : m_display(display)
+        , m_hits(0)
+        , m_misses(0)
+    {
+    }
+
+    ~VaapiImageCache()
+    {
+        clear();
+        DEBUG("image cache: %lu hits, %lu misses", (unsigned long)m_hits, (unsigned long)m_misses);
+    }
+
+    //return mapped address of frame's surface, image is filled with the cached layout.
+    //The mapping stays valid until invalidate() or clear(), do not unmap it.
+    uint8_t* map(const SharedPtr<VideoFrame>& frame, VAImage& image)
+    {
+        AutoLock lock(m_lock);
+        VASurfaceID surface = (VASurfaceID)frame->surface;
+        EntryMap::iterator it = m_entries.find(surface);
+        if (it != m_entries.end()) {
+            Entry& e = it->second;
+            if (e.fourcc == frame->fourcc
+                && frame->crop.x + frame->crop.width <= e.image.width
+                && frame->crop.y + frame->crop.height <= e.image.height) {
+                //the mapping is persistent, so we need sync by ourself
+                if (!checkVaapiStatus(vaSyncSurface(m_display, surface), "vaSyncSurface"))
+                    return NULL;
+                m_hits++;
+                image = e.image;
+                return e.ptr;
+            }
+            unmapImage(m_display, e.image);
+            m_entries.erase(it);
+        }
+        m_misses++;
+        Entry e;
+        e.fourcc = frame->fourcc;
+        e.ptr = mapSurfaceToImage(m_display, frame->surface, e.image);
+        if (!e.ptr)
+            return NULL;
+        m_entries[surface] = e;
+        image = e.image;
+        return e.ptr;
+    }
+
+    void invalidate(intptr_t surface)
+    {
+        AutoLock lock(m_lock);
+        EntryMap::iterator it = m_entries.find((VASurfaceID)surface);
+        if (it != m_entries.end()) {
+            unmapImage(m_display, it->second.image);
+            m_entries.erase(it);
+        }
+    }
+
+    void clear()
+    {
+        AutoLock lock(m_lock);
+        for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+            unmapImage(m_display, it->second.image);
+        m_entries.clear();
+    }
+
+    uint64_t hits() const { return m_hits; }
+    uint64_t misses() const { return m_misses; }
+
+private:
+    struct Entry {
+        VAImage image;
+        uint8_t* ptr;
+        uint32_t fourcc;
+    };
+    typedef std::map<VASurfaceID, Entry> EntryMap;
+
+    VADisplay m_display;
+    Lock m_lock;
+    EntryMap m_entries;
+    uint64_t m_hits;
+    uint64_t m_misses;
+    DISALLOW_COPY_AND_ASSIGN(VaapiImageCache);
+};
+};
+
+#endif //VaapiImageCache_h
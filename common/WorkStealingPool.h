@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef WorkStealingPool_h
+#define WorkStealingPool_h
+
+#include "common/condition.h"
+#include "common/lock.h"
+#include "common/log.h"
+#include "common/NonCopyable.h"
+#include <VideoCommonDefs.h>
+#include <deque>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+/**
+ * Fork-join pool for batches of small, uneven items, like the tiles of
+ * one output frame. run() splits items 0..n-1 into one contiguous range
+ * for each worker and returns when all of them are done, so it is also
+ * the frame barrier. A worker that runs out of its own items steals from
+ * the tail of the others, so one slow tile doesn't idle the rest.
+ * Job::run() gets the worker index, for per-thread state.
+ */
+class WorkStealingPool {
+public:
+    class Job {
+    public:
+        virtual void run(uint32_t worker, uint32_t item) = 0;
+        virtual ~Job() {}
+    };
+
+    WorkStealingPool()
+        : m_start(m_lock)
+        , m_done(m_lock)
+        , m_job(NULL)
+        , m_generation(0)
+        , m_busy(0)
+        , m_quit(false)
+        , m_steals(0)
+    {
+    }
+
+    ~WorkStealingPool()
+    {
+        stop();
+    }
+
+    bool start(uint32_t threads)
+    {
+        for (uint32_t i = 0; i < threads; i++)
+            m_queues.push_back(SharedPtr<Queue>(new Queue));
+        for (uint32_t i = 0; i < threads; i++) {
+            pthread_t thread;
+            Arg* arg = new Arg;
+            arg->pool = this;
+            arg->index = i;
+            if (pthread_create(&thread, NULL, entry, arg)) {
+                ERROR("create thread failed");
+                delete arg;
+                stop();
+                return false;
+            }
+            m_threads.push_back(thread);
+        }
+        return true;
+    }
+
+    //blocks until every item is done
+    void run(Job& job, uint32_t items)
+    {
+        uint32_t workers = m_queues.size();
+        if (!workers || workers != m_threads.size()) {
+            for (uint32_t i = 0; i < items; i++)
+                job.run(0, i);
+            return;
+        }
+        //all workers are parked, nobody touches the queues
+        for (uint32_t w = 0; w < workers; w++) {
+            Queue& q = *m_queues[w];
+            for (uint32_t i = w * items / workers; i < (w + 1) * items / workers; i++)
+                q.items.push_back(i);
+        }
+        AutoLock lock(m_lock);
+        m_job = &job;
+        m_busy = workers;
+        m_generation++;
+        m_start.broadcast();
+        while (m_busy)
+            m_done.wait();
+        m_job = NULL;
+    }
+
+    void stop()
+    {
+        {
+            AutoLock lock(m_lock);
+            m_quit = true;
+            m_start.broadcast();
+        }
+        for (size_t i = 0; i < m_threads.size(); i++)
+            pthread_join(m_threads[i], NULL);
+        m_threads.clear();
+    }
+
+    uint32_t size() const { return m_threads.size(); }
+
+    //items a worker took from another one's range
+    uint64_t steals() const { return __atomic_load_n(&m_steals, __ATOMIC_RELAXED); }
+
+private:
+    struct Queue {
+        SpinLock lock;
+        std::deque<uint32_t> items;
+    };
+
+    struct Arg {
+        WorkStealingPool* pool;
+        uint32_t index;
+    };
+
+    static void* entry(void* p)
+    {
+        Arg* arg = (Arg*)p;
+        arg->pool->loop(arg->index);
+        delete arg;
+        return NULL;
+    }
+
+    void loop(uint32_t index)
+    {
+        uint64_t seen = 0;
+        while (1) {
+            Job* job;
+            {
+                AutoLock lock(m_lock);
+                while (m_generation == seen && !m_quit)
+                    m_start.wait();
+                if (m_quit)
+                    return;
+                seen = m_generation;
+                job = m_job;
+            }
+            uint32_t item;
+            while (pop(index, item) || steal(index, item))
+                job->run(index, item);
+
+            AutoLock lock(m_lock);
+            if (!--m_busy)
+                m_done.signal();
+        }
+    }
+
+    bool pop(uint32_t index, uint32_t& item)
+    {
+        Queue& q = *m_queues[index];
+        ScopedLock<SpinLock> lock(q.lock);
+        if (q.items.empty())
+            return false;
+        item = q.items.front();
+        q.items.pop_front();
+        return true;
+    }
+
+    //take the last item of the next busy worker
+    bool steal(uint32_t index, uint32_t& item)
+    {
+        uint32_t workers = m_queues.size();
+        for (uint32_t i = 1; i < workers; i++) {
+            Queue& q = *m_queues[(index + i) % workers];
+            ScopedLock<SpinLock> lock(q.lock);
+            if (q.items.empty())
+                continue;
+            item = q.items.back();
+            q.items.pop_back();
+            __atomic_add_fetch(&m_steals, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+        return false;
+    }
+
+    Lock m_lock;
+    Condition m_start;
+    Condition m_done;
+    Job* m_job;
+    uint64_t m_generation;
+    uint32_t m_busy;
+    bool m_quit;
+    uint64_t m_steals;
+    std::vector<SharedPtr<Queue> > m_queues;
+    std::vector<pthread_t> m_threads;
+    DISALLOW_COPY_AND_ASSIGN(WorkStealingPool);
+};
+};
+
+#endif //WorkStealingPool_h
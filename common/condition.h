@@ -20,6 +20,8 @@
 #include "lock.h"
 
 #include <Yami.h>
+#include <errno.h>
+#include <time.h>
 
 namespace YamiMediaCodec{
 
@@ -41,6 +43,22 @@ public:
         pthread_cond_wait(&m_cond, &m_lock.m_lock);
     }
 
+    //wait at most ms milliseconds, return false on timeout.
+    //Like wait(), it may return early, so check your predicate in a loop
+    bool waitFor(uint32_t ms)
+    {
+        //the cond uses the default clock, CLOCK_REALTIME
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += ms / 1000;
+        t.tv_nsec += (long)(ms % 1000) * 1000000;
+        if (t.tv_nsec >= 1000000000) {
+            t.tv_sec++;
+            t.tv_nsec -= 1000000000;
+        }
+        return pthread_cond_timedwait(&m_cond, &m_lock.m_lock, &t) != ETIMEDOUT;
+    }
+
     void signal()
     {
         pthread_cond_signal(&m_cond);
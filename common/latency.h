@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef latency_h
+#define latency_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+namespace YamiMediaCodec {
+
+inline uint64_t getMonotonicNs()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/**
+ * Log-bucketed latency histogram, in nanoseconds.
+ * Every power of two is split into SUB_BUCKETS linear buckets, so a
+ * reported percentile is at most 1/SUB_BUCKETS above the real value.
+ * record() is a clz and an increment, it's not thread safe,
+ * keep one for each thread and merge() them for a total.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram() { reset(); }
+
+    void reset()
+    {
+        memset(m_buckets, 0, sizeof(m_buckets));
+        m_count = 0;
+        m_max = 0;
+    }
+
+    void record(uint64_t ns)
+    {
+        m_buckets[index(ns)]++;
+        m_count++;
+        if (ns > m_max)
+            m_max = ns;
+    }
+
+    void merge(const LatencyHistogram& other)
+    {
+        for (uint32_t i = 0; i < BUCKETS; i++)
+            m_buckets[i] += other.m_buckets[i];
+        m_count += other.m_count;
+        if (other.m_max > m_max)
+            m_max = other.m_max;
+    }
+
+    //p in [0, 100], return upper bound of the bucket holding it
+    uint64_t percentile(double p) const
+    {
+        if (!m_count)
+            return 0;
+        uint64_t target = (uint64_t)(m_count * p / 100);
+        if (target >= m_count)
+            target = m_count - 1;
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < BUCKETS; i++) {
+            seen += m_buckets[i];
+            if (seen > target) {
+                uint64_t v = upperBound(i);
+                return v < m_max ? v : m_max;
+            }
+        }
+        return m_max;
+    }
+
+    uint64_t count() const { return m_count; }
+    uint64_t max() const { return m_max; }
+
+    //one line summary, in milliseconds
+    void log(const char* name) const
+    {
+        if (!m_count)
+            return;
+        printf("%-8s %8lu samples, p50 %8.3f p95 %8.3f p99 %8.3f max %8.3f ms\n",
+            name, (unsigned long)m_count,
+            percentile(50) / 1e6, percentile(95) / 1e6, percentile(99) / 1e6, m_max / 1e6);
+    }
+
+private:
+    static const uint32_t SUB_BITS = 4;
+    static const uint32_t SUB_BUCKETS = 1 << SUB_BITS;
+    static const uint32_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    static uint32_t index(uint64_t v)
+    {
+        if (v < SUB_BUCKETS)
+            return (uint32_t)v;
+        uint32_t msb = 63 - __builtin_clzll(v);
+        uint32_t shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + (uint32_t)((v >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t upperBound(uint32_t i)
+    {
+        if (i < SUB_BUCKETS)
+            return i;
+        uint32_t shift = i / SUB_BUCKETS - 1;
+        uint64_t sub = i % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+    }
+
+    uint32_t m_buckets[BUCKETS];
+    uint64_t m_count;
+    uint64_t m_max;
+};
+
+/**
+ * Per-frame stage timer. begin() at frame start, mark() after each stage
+ * records the time since last mark, end() records the whole frame.
+ */
+class StageTimer {
+public:
+    enum Stage {
+        STAGE_INPUT,
+        STAGE_DECODE,
+        STAGE_VPP,
+        STAGE_ENCODE,
+        STAGE_WRITE,
+        STAGE_COUNT
+    };
+
+    StageTimer()
+        : m_start(0)
+        , m_last(0)
+    {
+    }
+
+    void begin()
+    {
+        m_start = m_last = getMonotonicNs();
+    }
+
+    void mark(Stage stage)
+    {
+        uint64_t now = getMonotonicNs();
+        m_stages[stage].record(now - m_last);
+        m_last = now;
+    }
+
+    void end()
+    {
+        m_frame.record(getMonotonicNs() - m_start);
+    }
+
+    void merge(const StageTimer& other)
+    {
+        for (int i = 0; i < STAGE_COUNT; i++)
+            m_stages[i].merge(other.m_stages[i]);
+        m_frame.merge(other.m_frame);
+    }
+
+    const LatencyHistogram& stage(Stage stage) const { return m_stages[stage]; }
+    const LatencyHistogram& frame() const { return m_frame; }
+
+    //STAGE_COUNT is the whole frame
+    static const char* name(int stage)
+    {
+        static const char* names[STAGE_COUNT + 1] = { "input", "decode", "vpp", "encode", "write", "frame" };
+        return names[stage];
+    }
+
+    void log(const char* title) const
+    {
+        if (!m_frame.count())
+            return;
+        printf("%s latency:\n", title);
+        for (int i = 0; i < STAGE_COUNT; i++)
+            m_stages[i].log(name(i));
+        m_frame.log(name(STAGE_COUNT));
+    }
+
+private:
+    LatencyHistogram m_stages[STAGE_COUNT];
+    LatencyHistogram m_frame;
+    uint64_t m_start;
+    uint64_t m_last;
+};
+};
+
+#endif //latency_h
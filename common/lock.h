@@ -44,9 +44,10 @@ public:
         pthread_mutex_unlock(&m_lock);
     }
 
-    void tryLock()
+    //true if we got the lock
+    bool tryLock()
     {
-        pthread_mutex_trylock(&m_lock);
+        return !pthread_mutex_trylock(&m_lock);
     }
 
     friend class Condition;
@@ -56,6 +57,60 @@ private:
     DISALLOW_COPY_AND_ASSIGN(Lock);
 };
 
+/**
+ * Adaptive mutex: spins on trylock for a while, then parks on the mutex.
+ * For short critical sections hit by a few threads, like surface pools,
+ * where a sleep/wake pair costs more than the section itself.
+ * Not for classes libyami also builds, like VideoPool, the two
+ * definitions would differ.
+ */
+class SpinLock
+{
+public:
+    SpinLock()
+    {
+        pthread_mutex_init(&m_lock, NULL);
+    }
+
+    ~SpinLock()
+    {
+        pthread_mutex_destroy(&m_lock);
+    }
+
+    void acquire()
+    {
+        for (int i = 0; i < SPIN_COUNT; i++) {
+            if (!pthread_mutex_trylock(&m_lock))
+                return;
+            pause();
+        }
+        pthread_mutex_lock(&m_lock);
+    }
+
+    void release()
+    {
+        pthread_mutex_unlock(&m_lock);
+    }
+
+    bool tryLock()
+    {
+        return !pthread_mutex_trylock(&m_lock);
+    }
+
+private:
+    static const int SPIN_COUNT = 100;
+
+    static void pause()
+    {
+#if defined(__i386__) || defined(__x86_64__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    pthread_mutex_t m_lock;
+    DISALLOW_COPY_AND_ASSIGN(SpinLock);
+};
+
 class AutoLock
 {
 public:
@@ -72,6 +127,24 @@ private:
     DISALLOW_COPY_AND_ASSIGN(AutoLock);
 };
 
+//AutoLock for any lock with acquire() and release()
+template <class LockType>
+class ScopedLock
+{
+public:
+    explicit ScopedLock(LockType& lock) : m_lock(lock)
+    {
+        m_lock.acquire();
+    }
+    ~ScopedLock()
+    {
+        m_lock.release();
+    }
+private:
+    LockType& m_lock;
+    DISALLOW_COPY_AND_ASSIGN(ScopedLock);
+};
+
 };
 
 #endif
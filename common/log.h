@@ -36,12 +36,53 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/syscall.h>
-#define GETTID()    syscall(__NR_gettid)
+#include <pthread.h>
+
+//the tid never changes, so only ask the kernel once per thread.
+//A forked child has a new one, the child's copy of the cache is cleared
+static __thread long yamiCachedTid = 0;
+static inline void yamiClearTid(void)
+{
+    yamiCachedTid = 0;
+}
+static inline void yamiClearTidOnFork(void)
+{
+    pthread_atfork(NULL, NULL, yamiClearTid);
+}
+static inline long yamiGetTid(void)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    if (!yamiCachedTid) {
+        pthread_once(&once, yamiClearTidOnFork);
+        yamiCachedTid = syscall(__NR_gettid);
+    }
+    return yamiCachedTid;
+}
+#define GETTID()    yamiGetTid()
+
+//folded to a constant by the compiler, no strrchr at runtime
+#define YAMI_BASENAME(file) (__builtin_strrchr(file, '/') ? __builtin_strrchr(file, '/') + 1 : (file))
 
 extern int yamiLogFlag;
 extern FILE* yamiLogFn;
 extern int isInit;
 
+#if defined(__cplusplus) && !defined(YAMIMESSAGE)
+//async backend and per module levels, see logasync.h
+#include "common/logasync.h"
+
+//a filtered message costs a load and a compare, keep all levels in release builds
+#define YAMI_LOG_RUNTIME_LEVELS 1
+
+#define YAMI_DEBUG_MESSAGE(LEVEL, prefix, format, ...) \
+    do {\
+        static int yamiLogSite = 0; \
+        if (YamiMediaCodec::LogModules::instance().level(yamiLogSite, YAMI_BASENAME(__FILE__)) >= YAMI_LOG_##LEVEL) \
+            YamiMediaCodec::logWrite(#prefix, GETTID(), YAMI_BASENAME(__FILE__), __LINE__, format "\n", ##__VA_ARGS__); \
+    } while (0)
+
+#else
+
 #ifndef YAMIMESSAGE
 #define yamiMessage(stream, format, ...)  do {\
   fprintf(stream, format, ##__VA_ARGS__); \
@@ -51,17 +92,17 @@ extern int isInit;
 #define YAMI_DEBUG_MESSAGE(LEVEL, prefix, format, ...) \
     do {\
         if (yamiLogFlag >= YAMI_LOG_##LEVEL) { \
-            const char* name = strrchr(__FILE__, '/'); \
-            name = (name ? (name + 1) : __FILE__); \
-            yamiMessage(yamiLogFn, "libyami %s %ld (%s, %d): " format "\n", #prefix, (long int)GETTID(), name, __LINE__, ##__VA_ARGS__); \
+            yamiMessage(yamiLogFn, "libyami %s %ld (%s, %d): " format "\n", #prefix, (long int)GETTID(), YAMI_BASENAME(__FILE__), __LINE__, ##__VA_ARGS__); \
         } \
     } while (0)
 
+#endif
+
 #ifndef ERROR
 #define ERROR(format, ...)  YAMI_DEBUG_MESSAGE(ERROR, error, format, ##__VA_ARGS__)
 #endif
 
-#ifdef __ENABLE_DEBUG__
+#if defined(__ENABLE_DEBUG__) || defined(YAMI_LOG_RUNTIME_LEVELS)
 
 #ifndef WARNING
 #define WARNING(format, ...)   YAMI_DEBUG_MESSAGE(WARNING, warning, format, ##__VA_ARGS__)
@@ -89,7 +130,7 @@ extern int isInit;
 } while(0)
 #endif
 
-#else                           //__ENABLE_DEBUG__
+#else                           //__ENABLE_DEBUG__ || YAMI_LOG_RUNTIME_LEVELS
 #ifndef INFO
 #define INFO(format, ...)
 #endif
@@ -106,7 +147,7 @@ extern int isInit;
 #define DEBUG_FOURCC(promptStr, fourcc)
 #endif
 
-#endif                          //__ENABLE_DEBUG__
+#endif                          //__ENABLE_DEBUG__ || YAMI_LOG_RUNTIME_LEVELS
 #endif                          //__ANDROID
 
 #ifndef ASSERT
@@ -0,0 +1,475 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef logasync_h
+#define logasync_h
+
+//included by log.h for c++ only, do not include it directly
+
+#include "common/lock.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace YamiMediaCodec {
+
+/**
+ * Runtime log level per module, a module is the source file name without
+ * extension. Set from YAMI_LOG_MODULES="decodeoutput:4,vppinputasync:debug"
+ * or by setModuleLevel(). Modules without an entry follow yamiLogFlag.
+ *
+ * Every log call site caches its module's level together with the table
+ * generation, so the check is a load and a compare until the table changes.
+ */
+class LogModules {
+public:
+    static LogModules& instance()
+    {
+        static LogModules modules;
+        return modules;
+    }
+
+    //site is the call site's cache, 0 means not resolved yet
+    int level(int& site, const char* file)
+    {
+        uint32_t gen = __atomic_load_n(&m_generation, __ATOMIC_ACQUIRE);
+        int cached = __atomic_load_n(&site, __ATOMIC_RELAXED);
+        if ((uint32_t)cached >> 8 != gen) {
+            cached = (int)(gen << 8) | (lookup(file) + 1);
+            __atomic_store_n(&site, cached, __ATOMIC_RELAXED);
+        }
+        int level = (cached & 0xff) - 1;
+        return level < 0 ? yamiLogFlag : level;
+    }
+
+    //level < 0 removes the module's entry
+    void setModuleLevel(const char* module, int level)
+    {
+        //the site cache keeps level + 1 in 8 bits
+        if (level > MAX_LEVEL)
+            level = MAX_LEVEL;
+        AutoLock lock(m_lock);
+        uint32_t i;
+        for (i = 0; i < m_count; i++) {
+            if (!strcmp(m_entries[i].name, module))
+                break;
+        }
+        if (i == m_count) {
+            if (level < 0)
+                return;
+            if (m_count == MAX_MODULES) {
+                fprintf(stderr, "libyami: too many log modules, %s ignored\n", module);
+                return;
+            }
+            snprintf(m_entries[i].name, sizeof(m_entries[i].name), "%s", module);
+            m_count++;
+        }
+        if (level < 0)
+            m_entries[i] = m_entries[--m_count];
+        else
+            m_entries[i].level = level;
+        bumpGeneration();
+    }
+
+private:
+    LogModules()
+        : m_count(0)
+        , m_generation(1)
+    {
+        const char* env = getenv("YAMI_LOG_MODULES");
+        if (env)
+            parse(env);
+    }
+
+    //"name:level,name:level"
+    void parse(const char* spec)
+    {
+        char name[32];
+        while (*spec) {
+            const char* end = strchr(spec, ',');
+            size_t len = end ? (size_t)(end - spec) : strlen(spec);
+            const char* colon = (const char*)memchr(spec, ':', len);
+            if (colon && (size_t)(colon - spec) < sizeof(name)) {
+                size_t n = colon - spec;
+                memcpy(name, spec, n);
+                name[n] = '\0';
+                setModuleLevel(name, parseLevel(colon + 1, len - n - 1));
+            }
+            if (!end)
+                break;
+            spec = end + 1;
+        }
+    }
+
+    static int parseLevel(const char* s, size_t len)
+    {
+        static const char* names[] = { "none", "error", "warning", "info", "debug" };
+        for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+            if (strlen(names[i]) == len && !strncasecmp(s, names[i], len))
+                return i;
+        }
+        //strtol saturates, setModuleLevel clamps it
+        long level = strtol(s, NULL, 10);
+        if (level > MAX_LEVEL)
+            return MAX_LEVEL;
+        return level < 0 ? -1 : (int)level;
+    }
+
+    //-1 for no entry
+    int lookup(const char* file)
+    {
+        const char* dot = strchr(file, '.');
+        size_t len = dot ? (size_t)(dot - file) : strlen(file);
+        AutoLock lock(m_lock);
+        for (uint32_t i = 0; i < m_count; i++) {
+            if (strlen(m_entries[i].name) == len && !strncmp(m_entries[i].name, file, len))
+                return m_entries[i].level;
+        }
+        return -1;
+    }
+
+    void bumpGeneration()
+    {
+        //generation lives in the upper bits of the site cache
+        uint32_t gen = m_generation + 1;
+        if (gen >= (1 << 23))
+            gen = 1;
+        __atomic_store_n(&m_generation, gen, __ATOMIC_RELEASE);
+    }
+
+    static const uint32_t MAX_MODULES = 32;
+    static const int MAX_LEVEL = 254;
+    struct Entry {
+        char name[32];
+        int level;
+    };
+    Lock m_lock;
+    Entry m_entries[MAX_MODULES];
+    uint32_t m_count;
+    uint32_t m_generation;
+    DISALLOW_COPY_AND_ASSIGN(LogModules);
+};
+
+/**
+ * Asynchronous log backend. Each thread formats its messages into its own
+ * single producer/single consumer ring, a drain thread merges the rings
+ * in time order and writes them to yamiLogFn. Nothing on the logging
+ * thread blocks: a full ring drops the message and the drop is reported.
+ *
+ * Enabled by YAMI_LOG_ASYNC=1 or start(). Pending messages are flushed by
+ * stop(), which also runs at exit. A forked child logs synchronously, it
+ * has no drain thread.
+ */
+class AsyncLog {
+public:
+    static AsyncLog& instance()
+    {
+        static AsyncLog log;
+        return log;
+    }
+
+    bool isRunning() const { return __atomic_load_n(&m_running, __ATOMIC_ACQUIRE); }
+
+    bool start()
+    {
+        AutoLock lock(m_lock);
+        if (m_running)
+            return true;
+        m_quit = false;
+        if (pthread_create(&m_thread, NULL, drainEntry, this)) {
+            fprintf(stderr, "libyami: create log thread failed\n");
+            return false;
+        }
+        __atomic_store_n(&m_running, true, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    void stop()
+    {
+        {
+            AutoLock lock(m_lock);
+            if (!m_running)
+                return;
+            __atomic_store_n(&m_running, false, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&m_quit, true, __ATOMIC_RELEASE);
+        }
+        pthread_join(m_thread, NULL);
+        //writers that saw m_running before it was cleared, after them no
+        //message goes to a ring until the next start()
+        while (__atomic_load_n(&m_writers, __ATOMIC_SEQ_CST))
+            sched_yield();
+        drain();
+    }
+
+    //false when not running, the caller writes the message itself then
+    bool vwrite(const char* prefix, long tid, const char* file, int line, const char* format, va_list args)
+    {
+        __atomic_add_fetch(&m_writers, 1, __ATOMIC_SEQ_CST);
+        bool running = __atomic_load_n(&m_running, __ATOMIC_SEQ_CST);
+        if (running)
+            push(prefix, tid, file, line, format, args);
+        __atomic_sub_fetch(&m_writers, 1, __ATOMIC_RELEASE);
+        return running;
+    }
+
+private:
+    void push(const char* prefix, long tid, const char* file, int line, const char* format, va_list args)
+    {
+        Ring* ring = threadRing();
+        if (!ring)
+            return;
+        uint32_t head = ring->head;
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head - tail >= RING_SLOTS) {
+            __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        Slot& slot = ring->slots[head % RING_SLOTS];
+        slot.time = now();
+        int n = snprintf(slot.text, sizeof(slot.text), "libyami %s %ld (%s, %d): ", prefix, tid, file, line);
+        if (n > 0 && n < (int)sizeof(slot.text)) {
+            int m = vsnprintf(slot.text + n, sizeof(slot.text) - n, format, args);
+            n = m < 0 ? n : n + m;
+        }
+        //format ends with a newline, put it back if truncated
+        if (n < 0 || n > (int)sizeof(slot.text) - 1) {
+            n = sizeof(slot.text) - 1;
+            slot.text[n - 1] = '\n';
+        }
+        slot.length = n;
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+        //half full, do not wait for the drain thread's next poll
+        if (head + 1 - tail == RING_SLOTS / 2)
+            pthread_cond_signal(&m_wake);
+    }
+
+    static const uint32_t RING_SLOTS = 512;
+    struct Slot {
+        uint64_t time;
+        uint32_t length;
+        char text[244];
+    };
+    struct Ring {
+        Slot slots[RING_SLOTS];
+        uint32_t head; //written by the owner thread
+        uint32_t tail; //written by the drain thread
+        uint32_t dropped;
+        bool dead; //owner thread exited
+        Ring* next;
+    };
+
+    AsyncLog()
+        : m_rings(NULL)
+        , m_running(false)
+        , m_quit(false)
+        , m_writers(0)
+    {
+        pthread_key_create(&m_key, threadExit);
+        pthread_atfork(NULL, NULL, forkChild);
+        pthread_mutex_init(&m_wakeLock, NULL);
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&m_wake, &attr);
+        pthread_condattr_destroy(&attr);
+        const char* env = getenv("YAMI_LOG_ASYNC");
+        if (env && strcmp(env, "0"))
+            start();
+    }
+
+    ~AsyncLog()
+    {
+        stop();
+        //rings of live threads are leaked on purpose, they may still log
+    }
+
+    static uint64_t now()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec * 1000000000ULL + t.tv_nsec;
+    }
+
+    Ring* threadRing()
+    {
+        Ring* ring = (Ring*)pthread_getspecific(m_key);
+        if (ring)
+            return ring;
+        ring = (Ring*)calloc(1, sizeof(Ring));
+        if (!ring)
+            return NULL;
+        AutoLock lock(m_lock);
+        ring->next = m_rings;
+        m_rings = ring;
+        pthread_setspecific(m_key, ring);
+        return ring;
+    }
+
+    //only the forking thread lives on in the child, the drain thread is gone
+    static void forkChild()
+    {
+        AsyncLog& log = instance();
+        __atomic_store_n(&log.m_running, false, __ATOMIC_SEQ_CST);
+        log.m_writers = 0;
+    }
+
+    static void threadExit(void* ring)
+    {
+        __atomic_store_n(&((Ring*)ring)->dead, true, __ATOMIC_RELEASE);
+    }
+
+    static void* drainEntry(void* arg)
+    {
+        AsyncLog* log = (AsyncLog*)arg;
+        while (!__atomic_load_n(&log->m_quit, __ATOMIC_ACQUIRE)) {
+            if (log->drain())
+                continue;
+            //poll every 5ms, or earlier when a ring fills up
+            struct timespec t;
+            clock_gettime(CLOCK_MONOTONIC, &t);
+            t.tv_nsec += 5000000;
+            if (t.tv_nsec >= 1000000000) {
+                t.tv_sec++;
+                t.tv_nsec -= 1000000000;
+            }
+            pthread_mutex_lock(&log->m_wakeLock);
+            pthread_cond_timedwait(&log->m_wake, &log->m_wakeLock, &t);
+            pthread_mutex_unlock(&log->m_wakeLock);
+        }
+        return NULL;
+    }
+
+    //write everything pending, oldest first. Return false if there was nothing.
+    //m_lock is not held while writing, a thread logging for the first time
+    //takes it to add its ring
+    bool drain()
+    {
+        AutoLock drainLock(m_drainLock);
+        //rings are added in front, and only removed by reap() below
+        Ring* rings;
+        {
+            AutoLock lock(m_lock);
+            rings = m_rings;
+        }
+        FILE* fp = yamiLogFn ? yamiLogFn : stderr;
+        bool written = false;
+        for (;;) {
+            Ring* oldest = NULL;
+            uint64_t oldestTime = 0;
+            for (Ring* r = rings; r; r = r->next) {
+                uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+                if (tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+                    continue;
+                uint64_t t = r->slots[tail % RING_SLOTS].time;
+                if (!oldest || t < oldestTime) {
+                    oldest = r;
+                    oldestTime = t;
+                }
+            }
+            if (!oldest)
+                break;
+            uint32_t tail = __atomic_load_n(&oldest->tail, __ATOMIC_RELAXED);
+            const Slot& slot = oldest->slots[tail % RING_SLOTS];
+            fwrite(slot.text, 1, slot.length, fp);
+            __atomic_store_n(&oldest->tail, tail + 1, __ATOMIC_RELEASE);
+            written = true;
+        }
+        uint32_t dropped = reap();
+        if (dropped)
+            fprintf(fp, "libyami: %u log messages dropped\n", dropped);
+        if (written || dropped)
+            fflush(fp);
+        return written;
+    }
+
+    //free rings of exited threads once they are empty, return the drops
+    uint32_t reap()
+    {
+        uint32_t total = 0;
+        AutoLock lock(m_lock);
+        Ring** link = &m_rings;
+        while (*link) {
+            Ring* r = *link;
+            total += __atomic_exchange_n(&r->dropped, 0, __ATOMIC_RELAXED);
+            if (__atomic_load_n(&r->dead, __ATOMIC_ACQUIRE)
+                && __atomic_load_n(&r->tail, __ATOMIC_RELAXED) == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+                *link = r->next;
+                free(r);
+                continue;
+            }
+            link = &r->next;
+        }
+        return total;
+    }
+
+    //guards m_rings and m_running, never held across a write
+    Lock m_lock;
+    //one drain at a time
+    Lock m_drainLock;
+    pthread_key_t m_key;
+    Ring* m_rings;
+    pthread_t m_thread;
+    pthread_mutex_t m_wakeLock;
+    pthread_cond_t m_wake;
+    bool m_running;
+    bool m_quit;
+    //threads in vwrite(), stop() waits for them
+    uint32_t m_writers;
+    DISALLOW_COPY_AND_ASSIGN(AsyncLog);
+};
+
+inline void logWrite(const char* prefix, long tid, const char* file, int line, const char* format, ...)
+    __attribute__((format(printf, 5, 6)));
+
+inline void logWrite(const char* prefix, long tid, const char* file, int line, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    AsyncLog& async = AsyncLog::instance();
+    if (!async.isRunning() || !async.vwrite(prefix, tid, file, line, format, args)) {
+        FILE* fp = yamiLogFn ? yamiLogFn : stderr;
+        flockfile(fp);
+        fprintf(fp, "libyami %s %ld (%s, %d): ", prefix, tid, file, line);
+        vfprintf(fp, format, args);
+        funlockfile(fp);
+    }
+    va_end(args);
+}
+
+inline bool logStartAsync()
+{
+    return AsyncLog::instance().start();
+}
+
+//flush and go back to synchronous logging
+inline void logStopAsync()
+{
+    AsyncLog::instance().stop();
+}
+
+inline void logSetModuleLevel(const char* module, int level)
+{
+    LogModules::instance().setModuleLevel(module, level);
+}
+};
+
+#endif //logasync_h
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef trace_h
+#define trace_h
+
+#include "common/latency.h"
+#include "common/lock.h"
+#include "common/log.h"
+#include "common/NonCopyable.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+/**
+ * Chrome trace-event recorder, open the output in chrome://tracing or
+ * ui.perfetto.dev. Events go to a buffer owned by the recording thread,
+ * the file is written by close(), or at exit if nobody called it.
+ * Names must be string literals, only the pointer is kept.
+ * When no trace is open TRACE_SCOPE costs a load and a branch.
+ */
+class Trace {
+public:
+    static Trace& instance()
+    {
+        static Trace trace;
+        return trace;
+    }
+
+    bool isEnabled() const { return __atomic_load_n(&m_enabled, __ATOMIC_RELAXED); }
+
+    bool open(const char* fileName)
+    {
+        AutoLock lock(m_lock);
+        m_fileName = fileName;
+        FILE* fp = fopen(fileName, "w");
+        if (!fp) {
+            ERROR("can't open trace file %s", fileName);
+            return false;
+        }
+        fclose(fp);
+        __atomic_store_n(&m_enabled, true, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    //stop recording and write the file
+    void close()
+    {
+        if (!isEnabled())
+            return;
+        __atomic_store_n(&m_enabled, false, __ATOMIC_RELAXED);
+        AutoLock lock(m_lock);
+        FILE* fp = fopen(m_fileName.c_str(), "w");
+        if (!fp) {
+            ERROR("can't open trace file %s", m_fileName.c_str());
+            return;
+        }
+        int pid = getpid();
+        bool first = true;
+        uint64_t events = 0, dropped = 0;
+        fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        for (size_t i = 0; i < m_buffers.size(); i++) {
+            Buffer* b = m_buffers[i];
+            AutoLock bufferLock(b->lock);
+            for (size_t j = 0; j < b->events.size(); j++) {
+                const Event& e = b->events[j];
+                fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f",
+                    first ? "" : ",\n", e.name, e.phase, pid, b->tid, (e.time - m_start) / 1e3);
+                if (e.phase == 'X')
+                    fprintf(fp, ",\"dur\":%.3f}", e.value / 1e3);
+                else
+                    fprintf(fp, ",\"args\":{\"value\":%lu}}", (unsigned long)e.value);
+                first = false;
+            }
+            events += b->events.size();
+            dropped += b->dropped;
+            b->events.clear();
+            b->dropped = 0;
+        }
+        fprintf(fp, "\n]}\n");
+        fclose(fp);
+        if (dropped)
+            fprintf(stderr, "trace: %lu events written, %lu dropped\n", (unsigned long)events, (unsigned long)dropped);
+    }
+
+    //a duration event, from start to now
+    void complete(const char* name, uint64_t start)
+    {
+        add(name, 'X', start, getMonotonicNs() - start);
+    }
+
+    void counter(const char* name, uint64_t value)
+    {
+        add(name, 'C', getMonotonicNs(), value);
+    }
+
+private:
+    struct Event {
+        const char* name;
+        char phase;
+        uint64_t time;
+        uint64_t value; //duration for X, counter value for C
+    };
+
+    struct Buffer {
+        Lock lock; //only contended when close() runs
+        long tid;
+        std::vector<Event> events;
+        uint64_t dropped;
+    };
+
+    //events kept for each thread, about 32M
+    static const size_t MAX_EVENTS = 1 << 20;
+
+    Trace()
+        : m_enabled(false)
+        , m_start(getMonotonicNs())
+    {
+        pthread_key_create(&m_key, NULL);
+    }
+
+    ~Trace()
+    {
+        close();
+        //buffers are leaked, a detached thread may still hold one
+    }
+
+    void add(const char* name, char phase, uint64_t time, uint64_t value)
+    {
+        Buffer* b = threadBuffer();
+        if (!b)
+            return;
+        AutoLock lock(b->lock);
+        if (b->events.size() >= MAX_EVENTS) {
+            b->dropped++;
+            return;
+        }
+        Event e;
+        e.name = name;
+        e.phase = phase;
+        e.time = time;
+        e.value = value;
+        b->events.push_back(e);
+    }
+
+    Buffer* threadBuffer()
+    {
+        Buffer* b = (Buffer*)pthread_getspecific(m_key);
+        if (b)
+            return b;
+        b = new Buffer;
+        b->tid = GETTID();
+        b->dropped = 0;
+        AutoLock lock(m_lock);
+        m_buffers.push_back(b);
+        pthread_setspecific(m_key, b);
+        return b;
+    }
+
+    Lock m_lock;
+    bool m_enabled;
+    uint64_t m_start;
+    std::string m_fileName;
+    pthread_key_t m_key;
+    std::vector<Buffer*> m_buffers;
+    DISALLOW_COPY_AND_ASSIGN(Trace);
+};
+
+class TraceScope {
+public:
+    TraceScope(const char* name)
+        : m_name(name)
+        , m_start(Trace::instance().isEnabled() ? getMonotonicNs() : 0)
+    {
+    }
+    ~TraceScope()
+    {
+        if (m_start && Trace::instance().isEnabled())
+            Trace::instance().complete(m_name, m_start);
+    }
+
+private:
+    const char* m_name;
+    uint64_t m_start;
+    DISALLOW_COPY_AND_ASSIGN(TraceScope);
+};
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+//record the enclosing scope as one event
+#define TRACE_SCOPE(name) YamiMediaCodec::TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#define TRACE_COUNTER(name, value)                                  \
+    do {                                                            \
+        if (YamiMediaCodec::Trace::instance().isEnabled())          \
+            YamiMediaCodec::Trace::instance().counter(name, value); \
+    } while (0)
+
+#endif //trace_h
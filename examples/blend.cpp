@@ -19,10 +19,12 @@
 
 #include "bumpbox.h"
 #include "font.h"
+#include "overlay.h"
 #include "vppinputdecode.h"
 #include "common/log.h"
 #include "common/common_def.h"
 #include "common/VaapiUtils.h"
+#include "common/VaapiImageCache.h"
 #include <Yami.h>
 #include <getopt.h>
 #include <stdio.h>
@@ -220,6 +222,7 @@ public:
     {
         SharedPtr<VideoFrame> frame;
         VAStatus status;
+        uint32_t count = 0;
         while (m_input->read(frame)) {
             //copy the decoded surface
             memset(&m_dest->crop, 0, sizeof(VideoRect));
@@ -230,8 +233,11 @@ public:
             }
 
             if (m_bOsd) {
+                for (size_t i = 0; i < m_osdOverlays.size(); i++)
+                    drawOSDText(i, count);
                 process(m_osd, "osd", m_osdSurfaces, m_osdBumpBoxes, m_dest);
             }
+            count++;
 
             if (m_bMosaic) {
                 vector<SharedPtr<VideoFrame> > srcFrame;
@@ -296,6 +302,7 @@ public:
         , m_mosaicSize(32)
         , m_wireframeWidth(4)
         , m_flipRot(0)
+        , m_font(font[0], N_ELEMENTS(font), FONT_BLOCK_SIZE)
     {
     }
     ~Blend()
@@ -373,53 +380,25 @@ private:
         return frame;
     }
 
-    bool drawSurfaceRGBA(SharedPtr<VideoFrame>& frame, bool text = false)
+    bool fillRandom(OverlaySurface& overlay)
     {
-        VASurfaceID surface = (VASurfaceID)frame->surface;
-        VAImage image;
+        uint8_t r = rand() % 256;
+        uint8_t g = rand() % 256;
+        uint8_t b = rand() % 256;
+        uint8_t a = (rand() % 128) + 128; //low alpha value will introduce trasparent block
 
-        VAStatus status = vaDeriveImage(*m_vaDisplay, surface, &image);
-        if (!checkVaapiStatus(status, "vaDeriveImage"))
-            return false;
-        assert(image.num_planes == 1);
-        char* buf;
-        status = vaMapBuffer(*m_vaDisplay, image.buf, (void**)&buf);
-        if (!checkVaapiStatus(status, "vaMapBuffer")) {
-            vaDestroyImage(*m_vaDisplay, image.image_id);
-            return false;
-        }
-
-        if (text) {
-            int n = rand() % (sizeof(font) / sizeof(font[0]));
-            char* ptr = buf + image.offsets[0];
-            for (int i = 0; i < image.height; i++) {
-                uint32_t* dest = (uint32_t*)(ptr + image.pitches[0] * i);
-                for (int j = 0; j < image.width; j++) {
-                    *dest = font[n][i * FONT_BLOCK_SIZE + j % FONT_BLOCK_SIZE];
-                    dest++;
-                }
-            }
-        }
-        else {
-            uint8_t r = rand() % 256;
-            uint8_t g = rand() % 256;
-            uint8_t b = rand() % 256;
-            uint8_t a = (rand() % 128) + 128; //low alpha value will introduce trasparent block
-
-            uint32_t pixel = (a << 24) | (b << 16) | (g << 8) | r;
-            char* ptr = buf + image.offsets[0];
-            for (int i = 0; i < image.height; i++) {
-                uint32_t* dest = (uint32_t*)(ptr + image.pitches[0] * i);
-                for (int j = 0; j < image.width; j++) {
-                    *dest = pixel;
-                    dest++;
-                }
-            }
-        }
+        return overlay.fill((a << 24) | (b << 16) | (g << 8) | r);
+    }
 
-        checkVaapiStatus(vaUnmapBuffer(*m_vaDisplay, image.buf), "vaUnmapBuffer");
-        checkVaapiStatus(vaDestroyImage(*m_vaDisplay, image.image_id), "vaDestroyImage");
-        return true;
+    //OSD line i is its glyph repeated, with a gap that moves one cell per frame.
+    //The overlay keeps what it drew, so a frame only rewrites those two cells
+    bool drawOSDText(size_t i, uint32_t frame)
+    {
+        OverlaySurface& overlay = *m_osdOverlays[i];
+        std::vector<uint32_t> glyphs(overlay.frame()->crop.width / m_font.size(), m_osdGlyphs[i]);
+        if (!glyphs.empty())
+            glyphs[frame % glyphs.size()] = m_font.count(); //no such glyph, a blank cell
+        return overlay.drawText(m_font, glyphs);
     }
 
     bool createBlendSurfaces(uint32_t targetWidth, uint32_t targetHeight)
@@ -434,8 +413,10 @@ private:
             if (!frame)
                 return false;
             frame->fourcc = YAMI_FOURCC_RGBA;
-            drawSurfaceRGBA(frame);
+            SharedPtr<OverlaySurface> overlay(new OverlaySurface(*m_vaDisplay, frame));
+            fillRandom(*overlay);
             m_blendSurfaces.push_back(frame);
+            m_blendOverlays.push_back(overlay);
             SharedPtr<BumpBox> box(new BumpBox(targetWidth, targetHeight, w, h));
             m_blendBumpBoxes.push_back(box);
         }
@@ -452,8 +433,10 @@ private:
             if (!text)
                 return false;
             text->fourcc = YAMI_FOURCC_RGBA;
-            drawSurfaceRGBA(text, true);
             m_osdSurfaces.push_back(text);
+            m_osdOverlays.push_back(SharedPtr<OverlaySurface>(new OverlaySurface(*m_vaDisplay, text)));
+            m_osdGlyphs.push_back(rand() % m_font.count());
+            drawOSDText(i, 0);
             SharedPtr<BumpBox> box(new BumpBox(targetWidth, targetHeight, w, h));
             m_osdBumpBoxes.push_back(box);
         }
@@ -606,10 +589,10 @@ private:
 
     bool write(SharedPtr<VideoFrame>& frame)
     {
-        VASurfaceID surface = (VASurfaceID)frame->surface;
-        VAImage image;
-
-        uint8_t* buf = mapSurfaceToImage(*m_vaDisplay, surface, image);
+        //vpp renders into it again next frame, don't keep it mapped
+        ScopedImageMapping mapping(*m_vaDisplay, frame);
+        const VAImage& image = mapping.image();
+        uint8_t* buf = mapping.data();
         if (buf != NULL) {
             for (int i = 0; i < image.height; i++) {
                 fwrite(buf + i * image.pitches[0], 1, image.width, m_fp);
@@ -618,7 +601,6 @@ private:
             for (int i = 0; i < image.height / 2; i++) {
                 fwrite(buf + i * image.pitches[1], 1, image.width, m_fp);
             }
-            unmapImage(*m_vaDisplay, image);
             return true;
         }
         else {
@@ -646,6 +628,10 @@ private:
     vector<SharedPtr<BumpBox> > m_osdBumpBoxes;
     vector<SharedPtr<BumpBox> > m_mosaicBumpBoxes;
     vector<SharedPtr<BumpBox> > m_wireframeBumpBoxes;
+    //the blend and OSD surfaces are drawn through these
+    vector<SharedPtr<OverlaySurface> > m_blendOverlays;
+    vector<SharedPtr<OverlaySurface> > m_osdOverlays;
+    vector<uint32_t> m_osdGlyphs;
     SharedPtr<VideoFrame> m_dest;
     SharedPtr<VideoFrame> m_displaySurface;
     bool m_bBlend;
@@ -656,6 +642,7 @@ private:
     int m_mosaicSize;
     int m_wireframeWidth;
     uint32_t m_flipRot;
+    GlyphAtlas m_font;
 };
 
 int main(int argc, char** argv)
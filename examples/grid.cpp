@@ -35,6 +35,7 @@ using namespace YamiMediaCodec;
 using namespace std;
 
 #include <errno.h>
+#include <poll.h>
 extern "C" {
 #include <libdrm/drm_fourcc.h>
 #include <libdrm/intel_bufmgr.h>
@@ -44,10 +45,16 @@ extern "C" {
 #include <xf86drmMode.h>
 #include <map>
 #include <sstream>
+#include "common/CountedFrameAllocator.h"
+#include "common/VaapiImageCache.h"
 #include "common/VaapiUtils.h"
 #include "common/common_def.h"
+#include "common/BoundedQueue.h"
 #include "common/condition.h"
 #include "common/lock.h"
+#include "common/latency.h"
+#include "common/StatsServer.h"
+#include "common/WorkStealingPool.h"
 
 using namespace std;
 
@@ -194,14 +201,30 @@ DrmFrame::~DrmFrame()
     }
 }
 
-class DrmRenderer
+//what a grid draws to, see DrmRenderer for the contract
+class Renderer
 {
-    typedef std::deque<SharedPtr<DrmFrame> > FrameQueue;
+public:
+    virtual bool init() = 0;
+    virtual SharedPtr<VideoFrame> dequeue() = 0;
+    virtual bool queue(const SharedPtr<VideoFrame>&) = 0;
+    virtual bool discard(const SharedPtr<VideoFrame>&) = 0;
+    virtual void flush() = 0;
+    virtual uint32_t getWidth() = 0;
+    virtual uint32_t getHeight() = 0;
+    virtual uint32_t getRefresh() = 0;
+    virtual size_t getFreeCount() = 0;
+    virtual ~Renderer() {}
+};
+
+class DrmRenderer : public Renderer
+{
+    typedef BoundedQueue<SharedPtr<DrmFrame> > FrameQueue;
     class Flipper {
     public:
         Flipper(int fd, uint32_t crtcID,
             FrameQueue& fronts, FrameQueue& backs, SharedPtr<DrmFrame>& current,
-            Condition&, Lock&);
+            uint64_t& flipped, Condition&, Lock&);
         ~Flipper();
         bool init();
 
@@ -211,17 +234,18 @@ class DrmRenderer
         void loop();
 
         //flip buffer and wait it done
-        bool flip_l();
+        bool flip(const SharedPtr<DrmFrame>&);
 
         int        m_fd;
         uint32_t   m_crtcID;
 
-        //all protected by m_lock;
         FrameQueue& m_fronts;
         FrameQueue& m_backs;
+        //only touched by the flip thread after init
         SharedPtr<DrmFrame>& m_current;
-        bool       m_quit;
 
+        //protected by m_lock, signal m_cond when changed
+        uint64_t&  m_flipped;
         Condition& m_cond;
         Lock&      m_lock;
 
@@ -248,6 +272,11 @@ public:
 
     uint32_t getWidth();
     uint32_t getHeight();
+    //in Hz
+    uint32_t getRefresh();
+
+    //back buffers ready to dequeue, for stats
+    size_t getFreeCount();
 
 
     DrmRenderer(VADisplay, int fd, int displayIdx);
@@ -271,8 +300,12 @@ private:
     uint32_t m_planeID;
     drmModeModeInfo m_mode;
 
+    //for flush() to wait the flip thread
     Condition m_cond;
     Lock      m_lock;
+    uint64_t  m_queued;
+    uint64_t  m_flipped;
+
     FrameQueue m_backs;
     FrameQueue m_fronts;
     SharedPtr<DrmFrame> m_current;
@@ -280,13 +313,15 @@ private:
     int m_frameCount;
 };
 
+#define DRM_FRAME_COUNT 5
+
 DrmRenderer::Flipper::Flipper(
     int fd, uint32_t crtcID,
     FrameQueue & fronts, FrameQueue & backs, SharedPtr<DrmFrame> & current,
-    Condition &cond, Lock &lock)
+    uint64_t& flipped, Condition &cond, Lock &lock)
     :m_fd(fd), m_crtcID(crtcID),
-     m_fronts(fronts),m_backs(backs), m_current(current), m_quit(false),
-     m_cond(cond), m_lock(lock),
+     m_fronts(fronts),m_backs(backs), m_current(current),
+     m_flipped(flipped), m_cond(cond), m_lock(lock),
      m_thread(-1)
 {
 
@@ -294,11 +329,8 @@ DrmRenderer::Flipper::Flipper(
 
 DrmRenderer::Flipper::~Flipper()
 {
-    {
-        AutoLock lock(m_lock);
-        m_quit = true;
-        m_cond.signal();
-    }
+    //the loop flips what is queued, then quits
+    m_fronts.close();
     if (m_thread != (uint32_t)-1)
         pthread_join(m_thread, NULL);
 }
@@ -312,10 +344,9 @@ bool DrmRenderer::Flipper::init()
     return true;
 }
 
-bool DrmRenderer::Flipper::flip_l()
+bool DrmRenderer::Flipper::flip(const SharedPtr<DrmFrame>& frame)
 {
     //start a flip.
-    SharedPtr<DrmFrame>& frame = m_fronts.front();
     uint32_t handle = frame->getFbHandle();
     int ret = drmModePageFlip(m_fd, m_crtcID, handle, DRM_MODE_PAGE_FLIP_EVENT, NULL);
     checkDrmRet(ret, "drmModePageFlip");
@@ -329,17 +360,16 @@ bool DrmRenderer::Flipper::flip_l()
     FD_ZERO(&fds);
     FD_SET(m_fd, &fds);
 
-    //we hold the lock, release it here to
-    m_lock.release();
     select(m_fd + 1, &fds, NULL, NULL, &timeout);
     drmHandleEvent(m_fd, &evctx);
-    m_lock.acquire();
+    //the old front is off screen now, it never blocks since backs can hold all frames
     if (m_current)
-        m_backs.push_back(m_current);
-    m_current = m_fronts.front();
-    m_fronts.pop_front();
-    m_cond.signal();
+        m_backs.push(m_current);
+    m_current = frame;
 
+    AutoLock lock(m_lock);
+    m_flipped++;
+    m_cond.broadcast();
     return true;
 }
 
@@ -352,20 +382,17 @@ void* DrmRenderer::Flipper::start(void* flipper)
 
 void DrmRenderer::Flipper::loop()
 {
-    while (1) {
-        AutoLock lock(m_lock);
-        if (m_fronts.empty()) {
-            if (m_quit)
-                break;
-            m_cond.wait();
-        } else {
-            flip_l();
-        }
+    SharedPtr<DrmFrame> frame;
+    while (m_fronts.pop(frame)) {
+        flip(frame);
+        frame.reset();
     }
 }
 
 DrmRenderer::DrmRenderer(VADisplay display, int fd, int displayIdx)
-    :m_display(display), m_fd(fd), m_displayIdx(displayIdx), m_cond(m_lock), m_frameCount(0)
+    :m_display(display), m_fd(fd), m_displayIdx(displayIdx), m_cond(m_lock),
+     m_queued(0), m_flipped(0),
+     m_backs(DRM_FRAME_COUNT), m_fronts(DRM_FRAME_COUNT), m_frameCount(0)
 {
 }
 
@@ -375,7 +402,7 @@ bool DrmRenderer::createFrames(uint32_t width, uint32_t height, int size)
         SharedPtr<DrmFrame> frame(new DrmFrame(m_display, m_fd, width, height));
         if (!frame->init())
             return false;
-        m_backs.push_back(frame);
+        m_backs.tryPush(frame);
     }
     m_frameCount = size;
     return true;
@@ -391,6 +418,16 @@ uint32_t DrmRenderer::getHeight()
     return m_mode.vdisplay;
 }
 
+uint32_t DrmRenderer::getRefresh()
+{
+    return m_mode.vrefresh ? m_mode.vrefresh : 60;
+}
+
+size_t DrmRenderer::getFreeCount()
+{
+    return m_backs.size();
+}
+
 bool DrmRenderer::getConnector(drmModeRes *resource)
 {
     drmModeConnectorPtr connector = NULL;
@@ -463,22 +500,24 @@ bool DrmRenderer::getPlane()
 
 bool DrmRenderer::setPlane()
 {
-    AutoLock lock(m_lock);
-    SharedPtr<DrmFrame> frame = m_backs.front();
+    //flip thread is not started yet
+    SharedPtr<DrmFrame> frame;
+    if (!m_backs.tryPop(frame))
+        return false;
     uint32_t handle = frame->getFbHandle();
     int ret;
     ret = drmModeSetCrtc(m_fd, m_crtcID, handle, 0, 0, &m_connectorID, 1, &m_mode);
-    if (!checkDrmRet(ret, "drmModeSetCrtc"))
+    if (!checkDrmRet(ret, "drmModeSetCrtc")) {
+        m_backs.tryPush(frame);
         return false;
-
-    m_backs.pop_front();
+    }
     m_current = frame;
     return true;
 }
 
 bool DrmRenderer::createFlipper()
 {
-    m_flipper.reset(new Flipper(m_fd, m_crtcID, m_fronts, m_backs, m_current, m_cond, m_lock));
+    m_flipper.reset(new Flipper(m_fd, m_crtcID, m_fronts, m_backs, m_current, m_flipped, m_cond, m_lock));
     if (!m_flipper->init())
         return false;
     return true;
@@ -503,7 +542,7 @@ bool DrmRenderer::init()
 {
     if (!initDrm())
         return false;
-    if (!createFrames(m_mode.hdisplay, m_mode.vdisplay, 5) || !setPlane() || !createFlipper())
+    if (!createFrames(m_mode.hdisplay, m_mode.vdisplay, DRM_FRAME_COUNT) || !setPlane() || !createFlipper())
         return false;
     ERROR("%dx%d@%d", m_mode.hdisplay, m_mode.vdisplay, m_mode.vrefresh);
     return true;
@@ -511,13 +550,9 @@ bool DrmRenderer::init()
 
 SharedPtr<VideoFrame> DrmRenderer::dequeue()
 {
-    AutoLock lock(m_lock);
-    SharedPtr<VideoFrame> frame;
-    while (m_backs.empty())
-        m_cond.wait();
-    frame = StaticPointerCast<VideoFrame>(m_backs.front());
-    m_backs.pop_front();
-    return frame;
+    SharedPtr<DrmFrame> frame;
+    m_backs.pop(frame);
+    return StaticPointerCast<VideoFrame>(frame);
 }
 
 bool DrmRenderer::queue(const SharedPtr<VideoFrame>& vframe)
@@ -528,10 +563,18 @@ bool DrmRenderer::queue(const SharedPtr<VideoFrame>& vframe)
         ERROR("invalid frame queued");
         return false;
     }
+    //counted first, the flipper may be done with it before push returns
+    {
+        AutoLock lock(m_lock);
+        m_queued++;
+    }
+    if (m_fronts.push(frame))
+        return true;
+    //the queue is closed and the frame will never flip, flush() must not wait for it
     AutoLock lock(m_lock);
-    m_fronts.push_back(frame);
-    m_cond.signal();
-    return true;
+    m_queued--;
+    m_cond.broadcast();
+    return false;
 }
 
 bool DrmRenderer::discard(const SharedPtr<VideoFrame>& vframe)
@@ -542,16 +585,13 @@ bool DrmRenderer::discard(const SharedPtr<VideoFrame>& vframe)
         ERROR("invalid frame queued");
         return false;
     }
-    AutoLock lock(m_lock);
-    m_backs.push_back(frame);
-    //no need signal
-    return true;
+    return m_backs.push(frame);
 }
 
 void DrmRenderer::flush()
 {
     AutoLock lock(m_lock);
-    while (!m_fronts.empty())
+    while (m_flipped != m_queued)
         m_cond.wait();
 }
 
@@ -566,6 +606,151 @@ DrmRenderer::~DrmRenderer()
     }
 }
 
+//--null-renderer options, shared by all grids
+struct NullRendererConfig {
+    NullRendererConfig()
+        : enabled(false)
+        , width(1920)
+        , height(1080)
+        , refresh(60)
+        , hash(false)
+        , dumpEvery(30)
+    {
+    }
+    bool enabled;
+    uint32_t width;
+    uint32_t height;
+    //the compose pace, there is no vblank to follow
+    uint32_t refresh;
+    //print a hash of every composed frame
+    bool hash;
+    //write every dumpEvery-th frame here, as raw RGBX
+    string dumpFile;
+    uint32_t dumpEvery;
+};
+
+//offscreen frames, a queued frame is hashed or dumped and goes
+//straight back to the pool, so it needs no display or drm master
+class NullRenderer : public Renderer
+{
+public:
+    NullRenderer(VADisplay display, int displayIdx, const NullRendererConfig& config)
+        : m_display(display)
+        , m_displayIdx(displayIdx)
+        , m_config(config)
+        , m_fp(NULL)
+        , m_queued(0)
+        , m_hash(FNV_OFFSET)
+    {
+    }
+    ~NullRenderer()
+    {
+        if (m_config.hash && m_queued)
+            printf("display %d: %lu frames, total hash %016lx\n", m_displayIdx,
+                (unsigned long)m_queued, (unsigned long)m_hash);
+        if (m_fp)
+            fclose(m_fp);
+    }
+    bool init()
+    {
+        //the display is owned by App
+        SharedPtr<VADisplay> display(new VADisplay(m_display));
+        SharedPtr<FrameAllocator> pool(new PooledFrameAllocator(display, DRM_FRAME_COUNT));
+        m_allocator.reset(new CountedFrameAllocator(pool, DRM_FRAME_COUNT));
+        if (!m_allocator->setFormat(YAMI_FOURCC_RGBX, m_config.width, m_config.height)) {
+            ERROR("can't allocate %dx%d offscreen frames", m_config.width, m_config.height);
+            return false;
+        }
+        m_images.reset(new VaapiImageCache(m_display));
+        if (!m_config.dumpFile.empty()) {
+            //one file for each display
+            string name = m_config.dumpFile;
+            if (m_displayIdx != 1) {
+                char suffix[16];
+                snprintf(suffix, sizeof(suffix), ".%d", m_displayIdx);
+                name += suffix;
+            }
+            m_fp = fopen(name.c_str(), "wb");
+            if (!m_fp) {
+                ERROR("can't open %s", name.c_str());
+                return false;
+            }
+        }
+        return true;
+    }
+    SharedPtr<VideoFrame> dequeue()
+    {
+        //frames come back in queue(), the pool never runs dry
+        SharedPtr<VideoFrame> frame = m_allocator->alloc();
+        if (!frame)
+            ERROR("no free offscreen frame");
+        return frame;
+    }
+    bool queue(const SharedPtr<VideoFrame>& frame)
+    {
+        bool dump = m_fp && m_config.dumpEvery && !(m_queued % m_config.dumpEvery);
+        m_queued++;
+        if (!m_config.hash && !dump)
+            return true;
+        return inspect(frame, dump);
+    }
+    bool discard(const SharedPtr<VideoFrame>&) { return true; }
+    void flush() {}
+    uint32_t getWidth() { return m_config.width; }
+    uint32_t getHeight() { return m_config.height; }
+    uint32_t getRefresh() { return m_config.refresh; }
+    size_t getFreeCount() { return m_allocator->freeCount(); }
+
+private:
+    static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+    static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+    bool inspect(const SharedPtr<VideoFrame>& frame, bool dump)
+    {
+        //our own small pool, vpp renders into it and we only read it back,
+        //so every surface stays mapped
+        VAImage image;
+        uint8_t* buf = m_images->map(frame, image);
+        if (!buf)
+            return false;
+        bool ret = true;
+        uint32_t rowBytes = m_config.width * 4;
+        uint64_t hash = FNV_OFFSET;
+        for (uint32_t y = 0; y < m_config.height; y++) {
+            const uint8_t* row = buf + image.offsets[0] + y * image.pitches[0];
+            if (m_config.hash) {
+                //skip X, vpp leaves it undefined
+                for (uint32_t x = 0; x < rowBytes; x++) {
+                    if ((x & 3) != 3)
+                        hash = (hash ^ row[x]) * FNV_PRIME;
+                }
+            }
+            if (dump && fwrite(row, 1, rowBytes, m_fp) != rowBytes) {
+                ERROR("write dump failed");
+                ret = false;
+                break;
+            }
+        }
+        if (m_config.hash) {
+            printf("display %d frame %lu hash %016lx\n", m_displayIdx,
+                (unsigned long)m_queued - 1, (unsigned long)hash);
+            m_hash = (m_hash ^ hash) * FNV_PRIME;
+        }
+        return ret;
+    }
+
+    VADisplay m_display;
+    int m_displayIdx;
+    NullRendererConfig m_config;
+    SharedPtr<CountedFrameAllocator> m_allocator;
+    //after the allocator, it goes first
+    SharedPtr<VaapiImageCache> m_images;
+    FILE* m_fp;
+    uint64_t m_queued;
+    //of all frames
+    uint64_t m_hash;
+};
+
 void usage(const char* app) {
         printf("%s: a tool to display MxN ways decode output in a grid\n", app);
         printf("usage: %s <options> file1 [file2] ...\n", app);
@@ -573,13 +758,96 @@ void usage(const char* app) {
         printf("   -r <row> \n");
         printf("   -d <index>, target display index, start from 1 \n");
         printf("   -s, put vpp and decode in single thread \n");
+        printf("   -j <threads>, compose tiles on <threads> threads, each with its own vpp \n");
+        printf("   -p <fps>, paced: compose at display refresh, each tile shows its newest frame due\n");
+        printf("       for a <fps> stream, late frames are dropped and a slow tile doesn't stall others\n");
+        printf("   -e <freeze|loop>, at the end of a file, hold its last frame or play it again\n");
+        printf("       default is freeze, the display ends when all tiles are frozen\n");
         printf("   -g, <grid command line> create other grid instance  \n");
         printf("       example: grid a.mp4 -g \"b.mp4 -d 2\"\n");
         printf("       it will render a.mp4 in first display and b.mp4 in second\n");
+        printf("   --stats-socket <path>, serve live counters on a unix socket, in Prometheus text or json\n");
+        printf("       example: curl --unix-socket <path> http://localhost/metrics\n");
+        printf("   --null-renderer, compose to offscreen frames, no display needed\n");
+        printf("   --null-size <width>x<height>, size of offscreen frames, default 1920x1080\n");
+        printf("   --null-refresh <hz>, how often frames are composed, default 60\n");
+        printf("   --null-hash, print a hash of each composed frame\n");
+        printf("   --null-dump <file>, write composed frames as raw RGBX, display N > 1 appends .N\n");
+        printf("   --null-dump-every <n>, dump one of every n frames, default 30\n");
+        printf("   --control, read commands from stdin, one per line, tiles count from 0 row by row:\n");
+        printf("       replace <display> <tile> <file>\n");
+        printf("       loop <display> <tile> on|off\n");
+        printf("       freeze <display> <tile>\n");
+        printf("       blank <display> <tile>\n");
+        printf("       quit\n");
+        printf("       displays stay up until quit, or until stdin is closed and all tiles are frozen\n");
 }
 
 class Grid
 {
+    //only touched by the thread composing the tile, or by the pacer and
+    //control commands between frames
+    struct Tile {
+        Tile()
+            : start(0)
+            , frames(0)
+            , eos(false)
+            , loop(false)
+            , blank(false)
+        {
+        }
+        //for stats probes, input pointers change on replace.
+        //The count itself is atomic, the decode thread doesn't take the lock
+        uint64_t getBytesRead()
+        {
+            AutoLock l(lock);
+            return decode ? decode->getBytesRead() : 0;
+        }
+        size_t getQueueSize()
+        {
+            AutoLock l(lock);
+            return async ? async->getQueueSize() : 0;
+        }
+
+        //inputs are destroyed after the frames below
+        Lock lock;
+        SharedPtr<VppInputDecode> decode; //kept for the life of the tile
+        SharedPtr<VppInput> input; //decode, or async on it
+        SharedPtr<VppInputAsync> async;
+        //rewinds the file at eof on the decode thread while loop is set
+        SharedPtr<InputLoop> looper;
+        string file;
+
+        LatencyHistogram read;
+        LatencyHistogram vpp;
+
+        SharedPtr<VideoFrame> current; //on screen
+        //for paced mode
+        SharedPtr<VideoFrame> pending; //decoded, not due yet
+        uint64_t start; //due time of the first frame
+        uint64_t frames; //frames taken from the input
+        bool eos; //nothing more to read, current is frozen
+        bool loop; //play the file again at eos
+        bool blank;
+        StatsCounter drops; //replaced by a newer frame before shown
+        StatsCounter stutters; //a frame was due but not decoded yet
+    };
+
+    class ComposeJob : public WorkStealingPool::Job {
+    public:
+        ComposeJob(Grid* grid)
+            : m_grid(grid)
+        {
+        }
+        void run(uint32_t worker, uint32_t tile)
+        {
+            m_grid->composeTile(worker, tile);
+        }
+
+    private:
+        Grid* m_grid;
+    };
+
     class Arg
     {
     public:
@@ -620,11 +888,65 @@ class Grid
         vector<char*> m_argv;
     };
 public:
+    //a control request for one tile
+    struct Command {
+        enum Type {
+            REPLACE,
+            LOOP,
+            NO_LOOP,
+            FREEZE,
+            BLANK
+        };
+        Type type;
+        int tile;
+        string file;
+    };
+
     bool init(const string& args)
     {
          m_arg.init(args);
          return init(m_arg.getArgc(), m_arg.getArgv());
     }
+    int getDisplayIdx() { return m_displayIdx; }
+    //keep the display up when all tiles are at eos, commands may come
+    void setControl(bool control) { __atomic_store_n(&m_control, control, __ATOMIC_RELAXED); }
+    //applied by the compose thread before the next frame
+    bool post(const Command& cmd)
+    {
+        if (!m_commands.tryPush(cmd)) {
+            fprintf(stderr, "display %d is busy, command dropped\n", m_displayIdx);
+            return false;
+        }
+        return true;
+    }
+    void quit() { __atomic_store_n(&m_quit, true, __ATOMIC_RELAXED); }
+    void wait()
+    {
+        if (m_vppThread != (unsigned long)-1)
+            pthread_join(m_vppThread, NULL);
+        m_vppThread = -1;
+    }
+    //call it after init, stats must be stopped before we are destroyed
+    void addStats(StatsServer& stats)
+    {
+        char labels[64];
+        snprintf(labels, sizeof(labels), "display=%d", m_displayIdx);
+        string display(labels);
+        const char* frames = "frames through each stage";
+        stats.add("yami_frames_total", frames, m_decoded, display + ",stage=decode");
+        stats.add("yami_frames_total", frames, m_processed, display + ",stage=vpp");
+        stats.add("yami_frames_total", frames, m_rendered, display + ",stage=render");
+        stats.add("yami_free_surfaces", "free surfaces in the pool", m_renderer.get(), &Renderer::getFreeCount, display + (m_null.enabled ? ",pool=null" : ",pool=drm"));
+        for (size_t i = 0; i < m_tiles.size(); i++) {
+            snprintf(labels, sizeof(labels), "display=%d,tile=%lu", m_displayIdx, (unsigned long)i);
+            Tile* tile = m_tiles[i].get();
+            stats.add("yami_bytes_read_total", "compressed bytes read", tile, &Tile::getBytesRead, labels, StatsServer::COUNTER);
+            if (!m_singleThread)
+                stats.add("yami_queue_depth", "decoded frames waiting in the async input", tile, &Tile::getQueueSize, labels);
+            stats.add("yami_dropped_frames_total", "late frames dropped by the pacer", m_tiles[i]->drops, labels);
+            stats.add("yami_stutters_total", "refreshes where a due frame was not decoded", m_tiles[i]->stutters, labels);
+        }
+    }
     bool run()
     {
         if (pthread_create(&m_vppThread, NULL, start, this)) {
@@ -633,18 +955,22 @@ public:
         }
         return true;
     }
-    Grid(int fd, const SharedPtr<NativeDisplay>& nativeDisplay):m_fd(fd), m_nativeDisplay(nativeDisplay),
+    Grid(int fd, const SharedPtr<NativeDisplay>& nativeDisplay, const NullRendererConfig& null)
+        :m_fd(fd), m_nativeDisplay(nativeDisplay), m_null(null),
         m_vaDisplay((VADisplay)nativeDisplay->handle),
         m_width(0), m_height(0), m_col(0), m_row(0),
-        m_displayIdx(1), m_singleThread(false), m_vppThread(-1){}
+        m_displayIdx(1), m_singleThread(false), m_threads(0), m_fps(0), m_eofLoop(false), m_control(false), m_quit(false),
+        m_commands(16), m_vppThread(-1){}
 
     ~Grid()
     {
-        if (m_vppThread != (unsigned long)-1)
-            pthread_join(m_vppThread, NULL);
+        wait();
+        m_pool.stop();
         m_renderer.reset();
+        m_vpps.clear();
         m_vpp.reset();
-        m_inputs.clear();
+        m_black.reset();
+        m_tiles.clear();
     }
 private:
     bool init(int argc, char** argv)
@@ -656,42 +982,41 @@ private:
 
         int len = m_col * m_row;
         for (int i = 0; i < len; i++) {
-            SharedPtr<VppInputDecode> decodeInput(new VppInputDecode);
-            char* file = m_files[i % m_files.size()];
-            if (!decodeInput->init(file)) {
-                fprintf(stderr, "failed to open %s\n", file);
+            SharedPtr<Tile> tile(new Tile);
+            tile->loop = m_eofLoop;
+            if (!openTile(*tile, m_files[i % m_files.size()]))
                 return false;
-            }
-            //set native display
-            if (!decodeInput->config(*m_nativeDisplay)) {
-                return false;
-            }
-            SharedPtr<VppInput> input;
-            if (m_singleThread) {
-                input = decodeInput;
-            } else {
-                input = VppInputAsync::create(decodeInput, 3);
-                if (!input) {
-                    ERROR("can't create async input");
-                    return false;
-                }
-            }
-            m_inputs.push_back(input);
+            m_tiles.push_back(tile);
         }
-
-        m_vpp.reset(createVideoPostProcess(YAMI_VPP_SCALER), releaseVideoPostProcess);
-        if (!m_vpp) {
-            ERROR("can't create vpp");
+        if (m_fps && m_singleThread) {
+            ERROR("-p needs async inputs, it can't be used with -s");
             return false;
         }
-        if (m_vpp->setNativeDisplay(*m_nativeDisplay) != YAMI_SUCCESS) {
-            ERROR("set display for vpp failed");
+
+        m_vpp = createVpp();
+        if (!m_vpp)
             return false;
+        //worker 0 reuses m_vpp, it is also the serial path
+        m_vpps.push_back(m_vpp);
+        for (int i = 1; i < m_threads; i++) {
+            SharedPtr<IVideoPostProcess> vpp = createVpp();
+            if (!vpp)
+                return false;
+            m_vpps.push_back(vpp);
         }
+        m_workerTiles.resize(m_vpps.size());
+        for (int i = 0; i < len; i++)
+            m_tileDests.push_back(SharedPtr<VideoFrame>(new VideoFrame));
+        if (m_threads > 1 && !m_pool.start(m_threads))
+            return false;
 
-        SharedPtr<DrmRenderer> tmp(new DrmRenderer(m_vaDisplay, m_fd, m_displayIdx));
+        SharedPtr<Renderer> tmp;
+        if (m_null.enabled)
+            tmp.reset(new NullRenderer(m_vaDisplay, m_displayIdx, m_null));
+        else
+            tmp.reset(new DrmRenderer(m_vaDisplay, m_fd, m_displayIdx));
         if (!tmp->init()) {
-            ERROR("init drm renderer failed");
+            ERROR("init renderer failed");
             return false;
         }
         m_renderer = tmp;
@@ -700,51 +1025,343 @@ private:
         return true;
     }
 
+    SharedPtr<IVideoPostProcess> createVpp()
+    {
+        SharedPtr<IVideoPostProcess> vpp(createVideoPostProcess(YAMI_VPP_SCALER), releaseVideoPostProcess);
+        if (!vpp) {
+            ERROR("can't create vpp");
+            return vpp;
+        }
+        if (vpp->setNativeDisplay(*m_nativeDisplay) != YAMI_SUCCESS) {
+            ERROR("set display for vpp failed");
+            vpp.reset();
+        }
+        return vpp;
+    }
+
     static void* start(void* grid)
     {
         Grid* g = (Grid*)grid;
         g->renderOutputs();
         return NULL;
     }
-    void renderOutputs()
+
+    //runs on a pool worker, tiles only share the dest surface
+    void composeTile(uint32_t worker, uint32_t index)
+    {
+        Tile& tile = *m_tiles[index];
+        uint64_t start = getMonotonicNs();
+        //paced frames are picked by pickFrames()
+        if (!m_fps && !tile.eos)
+            readTile(tile);
+        SharedPtr<VideoFrame> frame = tile.blank ? m_black : tile.current;
+        //nothing decoded yet
+        if (!frame)
+            return;
+        uint64_t read = getMonotonicNs();
+        tile.read.record(read - start);
+        m_vpps[worker]->process(frame, m_tileDests[index]);
+        tile.vpp.record(getMonotonicNs() - read);
+        m_processed.add();
+        m_workerTiles[worker]++;
+    }
+
+    //blocking read for the unpaced mode, the tile loops or freezes at eos
+    void readTile(Tile& tile)
     {
         SharedPtr<VideoFrame> frame;
-        FpsCalc fps;
+        //a looping tile is rewound inside read()
+        if (!tile.input->read(frame)) {
+            tile.eos = true;
+            return;
+        }
+        tile.current = frame;
+        m_decoded.add();
+    }
+
+    //stop the decode thread of a tile, current frame stays on screen
+    void closeTile(Tile& tile)
+    {
+        SharedPtr<VppInputAsync> async;
+        {
+            AutoLock lock(tile.lock);
+            async = tile.async;
+            tile.async.reset();
+            tile.input.reset();
+        }
+        //joins the thread, out of the lock so stats don't wait on it
+        async.reset();
+        tile.pending.reset();
+        tile.eos = true;
+    }
+
+    //start or replace the input of a tile,
+    //the decoder and its surfaces are reused for the same codec
+    bool openTile(Tile& tile, const string& file)
+    {
+        closeTile(tile);
+        bool opened;
+        if (tile.decode) {
+            opened = tile.decode->reopen(file.c_str());
+        } else {
+            SharedPtr<VppInputDecode> decode(new VppInputDecode);
+            //the decoder sees one long stream, no reopen at eof
+            tile.looper.reset(new InputLoop(0));
+            tile.looper->setRepeat(tile.loop);
+            decode->setLoop(tile.looper);
+            opened = decode->init(file.c_str()) && decode->config(*m_nativeDisplay);
+            if (opened) {
+                AutoLock lock(tile.lock);
+                tile.decode = decode;
+            }
+        }
+        if (!opened) {
+            fprintf(stderr, "failed to open %s\n", file.c_str());
+            return false;
+        }
+        SharedPtr<VppInput> input = tile.decode;
+        SharedPtr<VppInputAsync> async;
+        if (!m_singleThread) {
+            input = VppInputAsync::create(tile.decode, 3);
+            if (!input) {
+                ERROR("can't create async input");
+                return false;
+            }
+            async = DynamicPointerCast<VppInputAsync>(input);
+        }
+        {
+            AutoLock lock(tile.lock);
+            tile.input = input;
+            tile.async = async;
+        }
+        tile.file = file;
+        tile.frames = 0;
+        tile.eos = false;
+        tile.blank = false;
+        return true;
+    }
+
+    //a small black frame, vpp scales it over blank tiles
+    bool createBlackFrame()
+    {
+        if (m_black)
+            return true;
+        SharedPtr<VADisplay> display(new VADisplay(m_vaDisplay));
+        m_blackAllocator.reset(new PooledFrameAllocator(display, 1));
+        if (!m_blackAllocator->setFormat(YAMI_FOURCC_NV12, 16, 16))
+            return false;
+        SharedPtr<VideoFrame> frame = m_blackAllocator->alloc();
+        if (!frame)
+            return false;
+        VAImage image;
+        uint8_t* buf = mapSurfaceToImage(m_vaDisplay, frame->surface, image);
+        if (!buf)
+            return false;
+        for (uint32_t y = 0; y < image.height; y++) {
+            memset(buf + image.offsets[0] + y * image.pitches[0], 16, image.width);
+            if (y < image.height / 2U)
+                memset(buf + image.offsets[1] + y * image.pitches[1], 128, image.width);
+        }
+        unmapImage(m_vaDisplay, image);
+        frame->crop.x = 0;
+        frame->crop.y = 0;
+        frame->crop.width = 16;
+        frame->crop.height = 16;
+        m_black = frame;
+        return true;
+    }
+
+    //between frames, no worker is touching the tiles
+    void applyCommands()
+    {
+        Command cmd;
+        while (m_commands.tryPop(cmd)) {
+            if (cmd.tile < 0 || cmd.tile >= (int)m_tiles.size()) {
+                fprintf(stderr, "display %d has no tile %d\n", m_displayIdx, cmd.tile);
+                continue;
+            }
+            Tile& tile = *m_tiles[cmd.tile];
+            switch (cmd.type) {
+            case Command::REPLACE:
+                openTile(tile, cmd.file);
+                break;
+            case Command::LOOP:
+                tile.loop = true;
+                if (tile.looper)
+                    tile.looper->setRepeat(true);
+                //a frozen tile starts again
+                if (tile.eos && !tile.blank)
+                    openTile(tile, tile.file);
+                break;
+            case Command::NO_LOOP:
+                tile.loop = false;
+                if (tile.looper)
+                    tile.looper->setRepeat(false);
+                break;
+            case Command::FREEZE:
+                closeTile(tile);
+                break;
+            case Command::BLANK:
+                closeTile(tile);
+                tile.current.reset();
+                tile.blank = createBlackFrame();
+                break;
+            }
+        }
+    }
+
+    bool isPlaying()
+    {
+        for (size_t i = 0; i < m_tiles.size(); i++) {
+            if (!m_tiles[i]->eos)
+                return true;
+        }
+        return false;
+    }
+
+    //frame n of a tile is due n frame durations after its first frame came
+    uint64_t dueTime(const Tile& tile, uint64_t n)
+    {
+        return tile.start + n * (1000000000ULL / m_fps);
+    }
+
+    //take the newest due frame of each tile without waiting
+    void pickFrames(uint64_t now)
+    {
+        for (size_t i = 0; i < m_tiles.size(); i++) {
+            Tile& tile = *m_tiles[i];
+            if (tile.eos)
+                continue;
+            bool took = false;
+            while (1) {
+                if (!tile.pending) {
+                    if (!tile.async->tryRead(tile.pending)) {
+                        //a looping tile never gets here, its decode thread rewinds
+                        if (tile.async->isEos())
+                            tile.eos = true;
+                        else if (tile.frames && dueTime(tile, tile.frames) <= now)
+                            tile.stutters.add();
+                        break;
+                    }
+                    if (!tile.frames)
+                        tile.start = now;
+                    tile.frames++;
+                    m_decoded.add();
+                }
+                if (dueTime(tile, tile.frames - 1) > now)
+                    break;
+                //the one we took is late, it will never be shown
+                if (took)
+                    tile.drops.add();
+                tile.current = tile.pending;
+                tile.pending.reset();
+                took = true;
+            }
+        }
+    }
+
+    //sleep to the given refresh tick, return the next one
+    uint64_t waitTick(uint64_t tick)
+    {
+        uint64_t period = 1000000000ULL / m_renderer->getRefresh();
+        uint64_t now = getMonotonicNs();
+        //too late for this one, don't try to catch up
+        if (tick + period < now)
+            tick = now;
+        struct timespec ts;
+        ts.tv_sec = tick / 1000000000ULL;
+        ts.tv_nsec = tick % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
+        return tick + period;
+    }
+
+    //each tile gets its own copy of dest, so the crops don't race
+    void setTileDests(const SharedPtr<VideoFrame>& dest)
+    {
         int width = m_width / m_col;
         int height = m_height / m_row;
+        for (int i = 0; i < m_row; i++) {
+            for (int j = 0; j < m_col; j++) {
+                VideoFrame& tile = *m_tileDests[i * m_col + j];
+                tile = *dest;
+                tile.crop.x = j * width;
+                tile.crop.y = i * height;
+                tile.crop.width = width;
+                tile.crop.height = height;
+            }
+        }
+    }
+
+    void logTiles()
+    {
+        printf("tile times on display %d, %d threads, %lu steals (ms):\n",
+            m_displayIdx, (int)m_vpps.size(), (unsigned long)m_pool.steals());
+        printf("%-9s %9s %9s %9s %9s\n", "tile", "read p50", "read p99", "vpp p50", "vpp p99");
+        for (size_t i = 0; i < m_tiles.size(); i++) {
+            Tile& t = *m_tiles[i];
+            char name[16];
+            snprintf(name, sizeof(name), "%d,%d", (int)i / m_col, (int)i % m_col);
+            printf("%-9s %9.3f %9.3f %9.3f %9.3f", name,
+                t.read.percentile(50) / 1e6, t.read.percentile(99) / 1e6,
+                t.vpp.percentile(50) / 1e6, t.vpp.percentile(99) / 1e6);
+            if (m_fps)
+                printf(", %lu dropped, %lu stutters", (unsigned long)t.drops.get(), (unsigned long)t.stutters.get());
+            printf("\n");
+        }
+        for (size_t i = 0; i < m_workerTiles.size(); i++)
+            printf("worker %lu: %lu tiles\n", (unsigned long)i, (unsigned long)m_workerTiles[i]);
+    }
+
+    void renderOutputs()
+    {
+        FpsCalc fps;
+        StageTimer timer;
+        ComposeJob job(this);
+        uint64_t tick = getMonotonicNs();
         do {
+            if (__atomic_load_n(&m_quit, __ATOMIC_RELAXED))
+                goto DONE;
+            applyCommands();
+            bool playing = isPlaying();
+            //all tiles frozen or blank, a control command may change that
+            if (!playing && !__atomic_load_n(&m_control, __ATOMIC_RELAXED))
+                goto DONE;
+            //with nothing to read, only the refresh paces us
+            if (m_fps || !playing)
+                tick = waitTick(tick);
+            timer.begin();
             SharedPtr<VideoFrame> dest = m_renderer->dequeue();
-            for (int i = 0; i < m_row; i++) {
-                for (int j = 0; j < m_col; j++) {
-                    SharedPtr<VppInput>& input = m_inputs[i * m_col + j];
-                    if (!input->read(frame)) {
-                        m_renderer->discard(dest);
-                        m_renderer->flush();
-                        goto DONE;
-                    }
-                    dest->crop.x = j * width;
-                    dest->crop.y = i * height;
-                    dest->crop.width = width;
-                    dest->crop.height = height;
-                    m_vpp->process(frame, dest);
-                }
-            }
+            if (!dest)
+                goto DONE;
+            if (m_fps)
+                pickFrames(getMonotonicNs());
+            setTileDests(dest);
+            //returns after the last tile, it's our frame barrier
+            m_pool.run(job, m_tileDests.size());
+            timer.mark(StageTimer::STAGE_VPP);
             if (!m_renderer->queue(dest)) {
                 ERROR("queue to drm failed");
                 goto DONE;
             }
+            timer.mark(StageTimer::STAGE_WRITE);
+            timer.end();
+            m_rendered.add();
 
             fps.addFrame();
         } while (1);
 DONE:
+        m_renderer->flush();
         printf("playback on display %d done\n", m_displayIdx);
         fps.log();
+        timer.log("grid");
+        logTiles();
     }
     bool processCmdline(int argc, char** argv)
     {
         char opt;
         optind = 0;
-        while ((opt = getopt(argc, argv, "c:r:d:s")) != -1)
+        while ((opt = getopt(argc, argv, "c:r:d:sj:p:e:")) != -1)
         {
             switch (opt) {
                 case 'c':
@@ -759,6 +1376,18 @@ DONE:
                 case 's':
                     m_singleThread = true;
                     break;
+                case 'j':
+                    m_threads = atoi(optarg);
+                    break;
+                case 'p':
+                    m_fps = atoi(optarg);
+                    break;
+                case 'e':
+                    if (!strcmp(optarg, "loop"))
+                        m_eofLoop = true;
+                    else if (strcmp(optarg, "freeze"))
+                        return false;
+                    break;
                 default:
                     return false;
             }
@@ -780,19 +1409,42 @@ DONE:
 
     int m_fd;
     SharedPtr<NativeDisplay> m_nativeDisplay;
+    NullRendererConfig m_null;
     VADisplay m_vaDisplay;
 
-    vector< SharedPtr<VppInput> > m_inputs;
     SharedPtr<IVideoPostProcess> m_vpp;
-    SharedPtr<DrmRenderer> m_renderer;
+    SharedPtr<Renderer> m_renderer;
     uint32_t m_width, m_height;
     int m_col, m_row;
     int m_displayIdx;
     //put decode and vpp in single thread
     bool m_singleThread;
+
+    //parallel composition, one vpp for each worker
+    int m_threads;
+    vector<SharedPtr<IVideoPostProcess> > m_vpps;
+    WorkStealingPool m_pool;
+    vector<SharedPtr<VideoFrame> > m_tileDests;
+    vector<SharedPtr<Tile> > m_tiles;
+    //only written by the worker itself
+    vector<uint64_t> m_workerTiles;
+    //stream frame rate for paced mode, 0 to compose as fast as inputs decode
+    int m_fps;
+
+    //runtime control, see applyCommands()
+    bool m_eofLoop; //default for new tiles
+    bool m_control;
+    bool m_quit;
+    BoundedQueue<Command> m_commands;
+    SharedPtr<PooledFrameAllocator> m_blackAllocator;
+    SharedPtr<VideoFrame> m_black;
+
     vector<char*> m_files;
     pthread_t m_vppThread;
     Arg m_arg;
+    StatsCounter m_decoded;
+    StatsCounter m_processed;
+    StatsCounter m_rendered;
 };
 
 class App
@@ -810,12 +1462,22 @@ public:
         }
         for (size_t i = 0; i < m_args.size(); i++) {
             string& arg = m_args[i];
-            SharedPtr<Grid> grid(new Grid(m_fd, m_nativeDisplay));
+            SharedPtr<Grid> grid(new Grid(m_fd, m_nativeDisplay, m_null));
             if (!grid->init(arg)) {
                 return false;
             }
             m_grids.push_back(grid);
         }
+        if (!m_statsSocket.empty()) {
+            for (size_t i = 0; i < m_grids.size(); i++)
+                m_grids[i]->addStats(m_stats);
+            if (!m_stats.start(m_statsSocket.c_str()))
+                return false;
+        }
+        if (m_control) {
+            for (size_t i = 0; i < m_grids.size(); i++)
+                m_grids[i]->setControl(true);
+        }
         return true;
     }
     bool run()
@@ -827,25 +1489,142 @@ public:
                 return false;
             }
         }
+        if (m_control) {
+            if (pipe(m_wake)) {
+                ERROR("create pipe failed");
+                return false;
+            }
+            if (pthread_create(&m_controlThread, NULL, startControl, this)) {
+                ERROR("create thread failed");
+                return false;
+            }
+            m_controlStarted = true;
+        }
         return true;
     }
+    App():m_fd(-1), m_vaDisplay(NULL), m_control(false), m_controlStarted(false)
+    {
+        m_wake[0] = m_wake[1] = -1;
+    }
     ~App()
     {
+        //play to the end, or to a quit command
+        for (size_t i = 0; i < m_grids.size(); i++)
+            m_grids[i]->wait();
+        stopControl();
+        //stats server reads the grids
+        m_stats.stop();
         //make sure we destory all grid instance before we destory va
         m_grids.clear();
 
         if (m_nativeDisplay) {
             vaTerminate(m_vaDisplay);
         }
-        if (m_fd != 0) {
+        if (m_fd != -1) {
             close(m_fd);
         }
     }
 private:
+    static void* startControl(void* app)
+    {
+        ((App*)app)->controlLoop();
+        return NULL;
+    }
+
+    void stopControl()
+    {
+        if (m_controlStarted) {
+            char c = 0;
+            if (write(m_wake[1], &c, 1) != 1)
+                ERROR("wake control thread failed");
+            pthread_join(m_controlThread, NULL);
+            m_controlStarted = false;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (m_wake[i] != -1)
+                close(m_wake[i]);
+            m_wake[i] = -1;
+        }
+    }
+
+    void controlLoop()
+    {
+        struct pollfd fds[2];
+        fds[0].fd = STDIN_FILENO;
+        fds[0].events = POLLIN;
+        fds[1].fd = m_wake[0];
+        fds[1].events = POLLIN;
+        string line;
+        while (1) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                ERROR("control poll failed: %s", strerror(errno));
+                break;
+            }
+            if (fds[1].revents)
+                return;
+            char buf[256];
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n <= 0)
+                break;
+            line.append(buf, n);
+            size_t end;
+            while ((end = line.find('\n')) != string::npos) {
+                command(line.substr(0, end));
+                line.erase(0, end + 1);
+            }
+        }
+        //no more commands, let the displays end with their inputs
+        for (size_t i = 0; i < m_grids.size(); i++)
+            m_grids[i]->setControl(false);
+    }
+
+    void command(const string& line)
+    {
+        istringstream is(line);
+        string name, arg;
+        int display = -1;
+        Grid::Command cmd;
+        cmd.tile = -1;
+        is >> name;
+        if (name.empty())
+            return;
+        if (name == "quit") {
+            for (size_t i = 0; i < m_grids.size(); i++)
+                m_grids[i]->quit();
+            return;
+        }
+        is >> display >> cmd.tile >> arg;
+        if (name == "replace" && !arg.empty()) {
+            cmd.type = Grid::Command::REPLACE;
+            cmd.file = arg;
+        } else if (name == "loop" && (arg == "on" || arg == "off")) {
+            cmd.type = arg == "on" ? Grid::Command::LOOP : Grid::Command::NO_LOOP;
+        } else if (name == "freeze") {
+            cmd.type = Grid::Command::FREEZE;
+        } else if (name == "blank") {
+            cmd.type = Grid::Command::BLANK;
+        } else {
+            fprintf(stderr, "bad command: %s\n", line.c_str());
+            return;
+        }
+        for (size_t i = 0; i < m_grids.size(); i++) {
+            if (m_grids[i]->getDisplayIdx() == display) {
+                m_grids[i]->post(cmd);
+                return;
+            }
+        }
+        fprintf(stderr, "no display %d\n", display);
+    }
 
     bool initDisplay()
     {
-        m_fd = open("/dev/dri/card0", O_RDWR);
+        //offscreen composition works on a render node
+        if (m_null.enabled)
+            m_fd = open("/dev/dri/renderD128", O_RDWR);
+        if (m_fd == -1)
+            m_fd = open("/dev/dri/card0", O_RDWR);
         if (m_fd == -1) {
             fprintf(stderr, "Failed to open card0 \n");
             return false;
@@ -882,6 +1661,36 @@ private:
                     return false;
                 string tmp = argv[i];
                 m_args.push_back(tmp);
+            } else if (strcmp(argv[i], "--stats-socket") == 0) {
+                i++;
+                if (i == argc)
+                    return false;
+                m_statsSocket = argv[i];
+            } else if (strcmp(argv[i], "--control") == 0) {
+                m_control = true;
+            } else if (strcmp(argv[i], "--null-renderer") == 0) {
+                m_null.enabled = true;
+            } else if (strcmp(argv[i], "--null-hash") == 0) {
+                m_null.hash = true;
+            } else if (strcmp(argv[i], "--null-size") == 0) {
+                i++;
+                if (i == argc || sscanf(argv[i], "%ux%u", &m_null.width, &m_null.height) != 2)
+                    return false;
+            } else if (strcmp(argv[i], "--null-refresh") == 0) {
+                i++;
+                if (i == argc || atoi(argv[i]) <= 0)
+                    return false;
+                m_null.refresh = atoi(argv[i]);
+            } else if (strcmp(argv[i], "--null-dump") == 0) {
+                i++;
+                if (i == argc)
+                    return false;
+                m_null.dumpFile = argv[i];
+            } else if (strcmp(argv[i], "--null-dump-every") == 0) {
+                i++;
+                if (i == argc)
+                    return false;
+                m_null.dumpEvery = atoi(argv[i]);
             } else {
                 append(cmd, argv[i]);
             }
@@ -898,6 +1707,15 @@ private:
 
     vector<string> m_args;
     vector< SharedPtr<Grid> > m_grids;
+    string m_statsSocket;
+    NullRendererConfig m_null;
+    StatsServer m_stats;
+
+    //--control, commands from stdin
+    bool m_control;
+    bool m_controlStarted;
+    pthread_t m_controlThread;
+    int m_wake[2];
 };
 
 int main(int argc, char** argv)
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef overlay_h
+#define overlay_h
+
+#include "common/log.h"
+#include "common/VaapiImageCache.h"
+#include <VideoCommonDefs.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+namespace YamiMediaCodec {
+
+/// square RGBA glyphs, one after another, like font.h has them
+class GlyphAtlas
+{
+public:
+    GlyphAtlas(const uint32_t* glyphs, uint32_t count, uint32_t size)
+        : m_glyphs(glyphs)
+        , m_count(count)
+        , m_size(size)
+    {
+    }
+    uint32_t count() const { return m_count; }
+    uint32_t size() const { return m_size; }
+    //row y of glyph n
+    const uint32_t* row(uint32_t n, uint32_t y) const
+    {
+        return m_glyphs + ((size_t)n * m_size + y) * m_size;
+    }
+
+private:
+    const uint32_t* m_glyphs;
+    uint32_t m_count;
+    uint32_t m_size;
+};
+
+/// an RGBA surface for the blender and OSD filters, drawn by the cpu.
+/// It is mapped for each draw only, the gpu reads it next. It remembers
+/// what it holds, so a draw only writes the rectangle that changed since
+/// the last one: nothing for the same fill, the changed cells for a line
+/// of text.
+class OverlaySurface
+{
+public:
+    OverlaySurface(VADisplay display, const SharedPtr<VideoFrame>& frame)
+        : m_display(display)
+        , m_frame(frame)
+        , m_content(CONTENT_UNKNOWN)
+        , m_pixel(0)
+        , m_atlas(NULL)
+    {
+    }
+
+    const SharedPtr<VideoFrame>& frame() const { return m_frame; }
+
+    //all of it in one pixel, a << 24 | b << 16 | g << 8 | r
+    bool fill(uint32_t pixel)
+    {
+        if (m_content == CONTENT_FILL && m_pixel == pixel)
+            return true;
+        ScopedImageMapping mapping(m_display, m_frame);
+        Canvas canvas;
+        if (!map(mapping, canvas))
+            return false;
+        fillRect(canvas, 0, 0, canvas.width, canvas.height, pixel);
+        m_content = CONTENT_FILL;
+        m_pixel = pixel;
+        m_text.clear();
+        return true;
+    }
+
+    //a line of glyphs from the top left corner, cells past the text are cleared.
+    //Keep the atlas alive while the surface is drawn with it
+    bool drawText(const GlyphAtlas& atlas, const std::vector<uint32_t>& text)
+    {
+        ScopedImageMapping mapping(m_display, m_frame);
+        Canvas canvas;
+        if (!map(mapping, canvas))
+            return false;
+        uint32_t size = atlas.size();
+        uint32_t cells = canvas.width / size;
+        uint32_t rows = std::min(canvas.height, size);
+        std::vector<uint32_t> line(cells, (uint32_t)kBlank);
+        for (uint32_t i = 0; i < cells && i < text.size(); i++) {
+            if (text[i] < atlas.count())
+                line[i] = text[i];
+        }
+
+        uint32_t first = 0, last = cells;
+        if (m_content == CONTENT_TEXT && m_atlas == &atlas) {
+            while (first < cells && line[first] == m_text[first])
+                first++;
+            while (last > first && line[last - 1] == m_text[last - 1])
+                last--;
+        }
+        else {
+            //the margins right of and below the cells are never drawn again
+            fillRect(canvas, cells * size, 0, canvas.width - cells * size, canvas.height, 0);
+            fillRect(canvas, 0, rows, cells * size, canvas.height - rows, 0);
+        }
+        for (uint32_t y = 0; y < rows; y++) {
+            uint32_t* dest = canvas.row(y) + first * size;
+            for (uint32_t i = first; i < last; i++, dest += size) {
+                if (line[i] == kBlank)
+                    memset(dest, 0, size * sizeof(uint32_t));
+                else
+                    memcpy(dest, atlas.row(line[i], y), size * sizeof(uint32_t));
+            }
+        }
+        m_content = CONTENT_TEXT;
+        m_atlas = &atlas;
+        m_text.swap(line);
+        return true;
+    }
+
+    //the surface was written by someone else, the next draw writes all of it
+    void invalidate()
+    {
+        m_content = CONTENT_UNKNOWN;
+        m_text.clear();
+    }
+
+private:
+    enum Content {
+        CONTENT_UNKNOWN,
+        CONTENT_FILL,
+        CONTENT_TEXT,
+    };
+    static const uint32_t kBlank = 0xffffffff;
+
+    struct Canvas {
+        uint8_t* data;
+        uint32_t pitch;
+        uint32_t width;
+        uint32_t height;
+        uint32_t* row(uint32_t y) const { return (uint32_t*)(data + (size_t)pitch * y); }
+    };
+
+    bool map(const ScopedImageMapping& mapping, Canvas& canvas)
+    {
+        const VAImage& image = mapping.image();
+        uint8_t* buf = mapping.data();
+        if (!buf)
+            return false;
+        if (image.num_planes != 1) {
+            ERROR("overlay surface has %d planes, want packed rgba", image.num_planes);
+            return false;
+        }
+        canvas.data = buf + image.offsets[0];
+        canvas.pitch = image.pitches[0];
+        canvas.width = std::min<uint32_t>(image.width, m_frame->crop.width);
+        canvas.height = std::min<uint32_t>(image.height, m_frame->crop.height);
+        return true;
+    }
+
+    //one row is filled, the compiler makes vector stores of the loop,
+    //and the others are copies of it
+    static void fillRect(const Canvas& canvas, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t pixel)
+    {
+        if (!width || !height)
+            return;
+        uint32_t* first = canvas.row(y) + x;
+        for (uint32_t i = 0; i < width; i++)
+            first[i] = pixel;
+        for (uint32_t j = 1; j < height; j++)
+            memcpy(canvas.row(y + j) + x, first, width * sizeof(uint32_t));
+    }
+
+    VADisplay m_display;
+    SharedPtr<VideoFrame> m_frame;
+    Content m_content;
+    uint32_t m_pixel;
+    //what the cells hold when m_content is CONTENT_TEXT
+    const GlyphAtlas* m_atlas;
+    std::vector<uint32_t> m_text;
+};
+};
+
+#endif //overlay_h
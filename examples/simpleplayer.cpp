@@ -18,10 +18,12 @@
 #endif
 
 #include "tests/decodeinput.h"
+#include "common/latency.h"
 #include "common/log.h"
 #include <Yami.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -35,10 +37,13 @@ class SimplePlayer
 public:
     bool init(int argc, char** argv)
     {
-        if (argc != 2) {
-            printf("usage: simpleplayer xxx.264\n");
+        if (argc != 2 && argc != 3) {
+            printf("usage: simpleplayer xxx.264 [fps]\n");
+            printf("    with fps, frames are shown on time and late ones are dropped\n");
             return false;
         }
+        if (argc == 3)
+            m_fps = atoi(argv[2]);
         m_input.reset(DecodeInput::create(argv[1]));
         if (!m_input) {
             fprintf(stderr, "failed to open %s", argv[1]);
@@ -94,9 +99,11 @@ public:
             }
         }
         m_decoder->stop();
+        if (m_fps)
+            printf("%lu frames shown, %lu late frames dropped\n", (unsigned long)(m_frames - m_dropped), (unsigned long)m_dropped);
         return true;
     }
-    SimplePlayer():m_window(0), m_width(0), m_height(0) {}
+    SimplePlayer():m_window(0), m_width(0), m_height(0), m_fps(0), m_start(0), m_frames(0), m_dropped(0) {}
     ~SimplePlayer()
     {
         if (m_nativeDisplay) {
@@ -114,6 +121,8 @@ private:
             SharedPtr<VideoFrame> frame = m_decoder->getOutput();
             if (!frame)
                 break;
+            if (m_fps && !waitDue())
+                continue;
             status = vaPutSurface(m_vaDisplay, (VASurfaceID)frame->surface,
                 m_window, 0, 0, m_width, m_height, 0, 0, m_width, m_height,
                 NULL, 0, 0);
@@ -123,6 +132,28 @@ private:
             }
         } while (1);
     }
+    //sleep until the next frame is due, false if it's a frame period late
+    bool waitDue()
+    {
+        uint64_t period = 1000000000ULL / m_fps;
+        uint64_t now = getMonotonicNs();
+        if (!m_frames)
+            m_start = now;
+        uint64_t due = m_start + m_frames * period;
+        m_frames++;
+        if (now > due + period) {
+            m_dropped++;
+            return false;
+        }
+        if (due > now) {
+            struct timespec ts;
+            ts.tv_sec = due / 1000000000ULL;
+            ts.tv_nsec = due % 1000000000ULL;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                ;
+        }
+        return true;
+    }
     bool initDisplay()
     {
         Display* display = XOpenDisplay(NULL);
@@ -175,6 +206,12 @@ private:
     SharedPtr<IVideoDecoder> m_decoder;
     SharedPtr<DecodeInput> m_input;
     int m_width, m_height;
+
+    //pacing, off when m_fps is 0
+    int m_fps;
+    uint64_t m_start;
+    uint64_t m_frames;
+    uint64_t m_dropped;
 };
 
 int main(int argc, char** argv)
@@ -0,0 +1,553 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "V4L2DecodeSession.h"
+
+#include "common/condition.h"
+#include "common/latency.h"
+#include "common/lock.h"
+#include "common/log.h"
+#include "common/StatsSink.h"
+#include "decodeinput.h"
+#include "V4L2Device.h"
+#include "V4L2InputQueue.h"
+#include "V4L2Renderer.h"
+#include <errno.h>
+#include <linux/videodev2.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef V4L2_EVENT_RESOLUTION_CHANGE
+    #define V4L2_EVENT_RESOLUTION_CHANGE 5
+#endif
+#ifndef V4L2_EVENT_SOURCE_CHANGE
+    #define V4L2_EVENT_SOURCE_CHANGE 5
+#endif
+
+using namespace YamiMediaCodec;
+
+extern uint32_t v4l2PixelFormatFromMime(const char* mime);
+
+static const uint32_t k_maxInputBufferSize = 1024 * 1024;
+static const uint32_t k_inputBufferCount = 8;
+//how long the device may stay quiet while we wait for the output format
+static const uint32_t k_formatTimeoutMs = 1000;
+//and for more frames after the input is used up
+static const uint32_t k_drainTimeoutMs = 100;
+
+//V4L2Device::poll() has no timeout, this interrupts it when nothing woke
+//it for a while. Call restart() after each wake up that made progress
+class PollTimeout {
+public:
+    PollTimeout(const SharedPtr<V4L2Device>& device, uint32_t ms)
+        : m_device(device)
+        , m_ms(ms)
+        , m_cond(m_lock)
+        , m_expired(false)
+        , m_stop(false)
+    {
+        m_started = !pthread_create(&m_thread, NULL, start, this);
+        if (!m_started) {
+            ERROR("create poll timeout thread failed");
+            expire();
+        }
+    }
+
+    ~PollTimeout()
+    {
+        {
+            AutoLock lock(m_lock);
+            m_stop = true;
+            m_cond.signal();
+        }
+        if (m_started)
+            pthread_join(m_thread, NULL);
+        if (m_expired)
+            m_device->clearDevicePollInterrupt();
+    }
+
+    void restart()
+    {
+        AutoLock lock(m_lock);
+        m_cond.signal();
+    }
+
+    bool expired()
+    {
+        AutoLock lock(m_lock);
+        return m_expired;
+    }
+
+private:
+    static void* start(void* timeout)
+    {
+        static_cast<PollTimeout*>(timeout)->loop();
+        return NULL;
+    }
+
+    void loop()
+    {
+        AutoLock lock(m_lock);
+        //a signal means restart, or stop
+        while (!m_stop) {
+            if (!m_cond.waitFor(m_ms) && !m_stop) {
+                expire();
+                return;
+            }
+        }
+    }
+
+    void expire()
+    {
+        m_expired = true;
+        m_device->setDevicePollInterrupt();
+    }
+
+    SharedPtr<V4L2Device> m_device;
+    uint32_t m_ms;
+    Lock m_lock;
+    Condition m_cond;
+    pthread_t m_thread;
+    bool m_started;
+    bool m_expired;
+    bool m_stop;
+    DISALLOW_COPY_AND_ASSIGN(PollTimeout);
+};
+
+static bool memoryTypeFromRenderMode(short renderMode, VideoDataMemoryType& memoryType)
+{
+    switch (renderMode) {
+    case -1:
+        //no rendering
+        memoryType = VIDEO_DATA_MEMORY_TYPE_RAW_COPY;
+        break;
+    case 3:
+        memoryType = VIDEO_DATA_MEMORY_TYPE_DRM_NAME;
+        break;
+    case 4:
+        memoryType = VIDEO_DATA_MEMORY_TYPE_DMA_BUF;
+        break;
+    case 6:
+        memoryType = VIDEO_DATA_MEMORY_TYPE_EXTERNAL_DMA_BUF;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+V4L2DecodeSession::V4L2DecodeSession(const DecodeParameter& params, char* inputFile)
+    : m_params(params)
+    , m_stats(NULL)
+    , m_memoryType(VIDEO_DATA_MEMORY_TYPE_DRM_NAME)
+    , m_width(0)
+    , m_height(0)
+    , m_inputBufferSize(k_maxInputBufferSize)
+    , m_sourceChange(false)
+    , m_dequeuedAfterEOS(0)
+    , m_frames(0)
+    , m_wakeups(0)
+    , m_start(0)
+    , m_end(0)
+    , m_opened(false)
+    , m_quit(false)
+    , m_ok(false)
+{
+    m_params.inputFile = inputFile;
+}
+
+V4L2DecodeSession::~V4L2DecodeSession()
+{
+    close();
+}
+
+bool V4L2DecodeSession::init(StatsSink* stats)
+{
+    m_stats = stats;
+    if (!memoryTypeFromRenderMode(m_params.renderMode, m_memoryType)) {
+        ERROR("unsupported render mode %d, -m [-1,3,4, 6] are supported", m_params.renderMode);
+        return false;
+    }
+    m_input.reset(DecodeInput::create(m_params.inputFile));
+    if (!m_input) {
+        ERROR("fail to init input stream %s", m_params.inputFile);
+        return false;
+    }
+
+    enum v4l2_memory inputMemory;
+    if (!V4L2InputQueue::memoryFromName(m_params.inputMemory, inputMemory)) {
+        fprintf(stderr, "invalid input memory: %s\n", m_params.inputMemory.c_str());
+        return false;
+    }
+    m_device = V4L2Device::Create();
+    if (!m_device) {
+        ERROR("failed to create v4l2 device");
+        return false;
+    }
+    m_inputQueue.reset(new V4L2InputQueue(m_device, inputMemory));
+    m_loop.reset(new InputLoop(m_params.loopCount, m_params.loopSeconds));
+    m_inputQueue->setLoop(m_loop);
+    m_renderer = V4L2Renderer::create(m_device, m_memoryType);
+    if (!m_renderer) {
+        ERROR("unsupported render mode %d, please check your build configuration", m_memoryType);
+        return false;
+    }
+
+    if (!m_device->open("decoder", 0)) {
+        ERROR("open decode failed");
+        return false;
+    }
+    m_opened = true;
+    m_device->setFrameMemoryType(m_memoryType);
+
+    if (!m_renderer->setDisplay()) {
+        ERROR("set display failed");
+        return false;
+    }
+
+    // query hw capability
+    struct v4l2_capability caps;
+    memset(&caps, 0, sizeof(caps));
+    caps.capabilities = V4L2_CAP_VIDEO_CAPTURE_MPLANE | V4L2_CAP_VIDEO_OUTPUT_MPLANE | V4L2_CAP_STREAMING;
+    if (m_device->ioctl(VIDIOC_QUERYCAP, &caps) == -1) {
+        ERROR("query capability failed");
+        return false;
+    }
+
+    if (!setFormats())
+        return false;
+
+    //the first source change says the output format is known
+    struct v4l2_event_subscription sub;
+    memset(&sub, 0, sizeof(sub));
+    sub.type = V4L2_EVENT_SOURCE_CHANGE;
+    m_sourceChange = m_device->ioctl(VIDIOC_SUBSCRIBE_EVENT, &sub) == 0;
+    if (!m_sourceChange)
+        WARNING("subscribe source change failed, check the format after each wake up");
+
+    // input port starts as early as possible to decide output frame format
+    __u32 type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    if (m_device->ioctl(VIDIOC_STREAMON, &type) == -1) {
+        ERROR("stream on input failed");
+        return false;
+    }
+
+    if (!m_inputQueue->setup(k_inputBufferCount, m_inputBufferSize))
+        return false;
+    // feed input frames first
+    for (uint32_t i = 0; i < m_inputQueue->getCount(); i++) {
+        if (!m_inputQueue->feed(m_input, i))
+            break;
+    }
+
+    if (!waitForFormat())
+        return false;
+    if (!m_renderer->setupOutputBuffers(m_width, m_height)) {
+        ERROR("setupOutputBuffers failed");
+        return false;
+    }
+
+    // output port starts as late as possible to adopt user provide output buffer
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (m_device->ioctl(VIDIOC_STREAMON, &type) == -1) {
+        ERROR("stream on output failed");
+        return false;
+    }
+    return true;
+}
+
+bool V4L2DecodeSession::setFormats()
+{
+    uint32_t codecFormat = v4l2PixelFormatFromMime(m_input->getMimeType());
+    if (!codecFormat) {
+        ERROR("unsupported mimetype, %s", m_input->getMimeType());
+        return false;
+    }
+
+    struct v4l2_format format;
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    format.fmt.pix_mp.pixelformat = codecFormat;
+    format.fmt.pix_mp.width = m_input->getWidth();
+    format.fmt.pix_mp.height = m_input->getHeight();
+    format.fmt.pix_mp.num_planes = 1;
+    format.fmt.pix_mp.plane_fmt[0].sizeimage = k_maxInputBufferSize;
+    if (m_device->ioctl(VIDIOC_S_FMT, &format) == -1) {
+        ERROR("set input format failed");
+        return false;
+    }
+    if (format.fmt.pix_mp.plane_fmt[0].sizeimage)
+        m_inputBufferSize = format.fmt.pix_mp.plane_fmt[0].sizeimage;
+
+    // set preferred output format
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    uint8_t* data = (uint8_t*)m_input->getCodecData().data();
+    uint32_t size = m_input->getCodecData().size();
+    //save codecdata, size+data, the type of format.fmt.raw_data is __u8[200]
+    //we must make sure enough space (>=sizeof(uint32_t) + size) to store codecdata
+    if (sizeof(format.fmt.raw_data) < size + sizeof(uint32_t)) {
+        ERROR("No enough space to store codec data");
+        return false;
+    }
+    memcpy(format.fmt.raw_data, &size, sizeof(uint32_t));
+    memcpy(format.fmt.raw_data + sizeof(uint32_t), data, size);
+    if (m_device->ioctl(VIDIOC_S_FMT, &format) == -1) {
+        ERROR("set output format failed");
+        return false;
+    }
+    return true;
+}
+
+bool V4L2DecodeSession::isFormatReady()
+{
+    if (!m_sourceChange) {
+        struct v4l2_format format;
+        memset(&format, 0, sizeof(format));
+        format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        return m_device->ioctl(VIDIOC_G_FMT, &format) == 0;
+    }
+    struct v4l2_event ev;
+    memset(&ev, 0, sizeof(ev));
+    while (m_device->ioctl(VIDIOC_DQEVENT, &ev) == 0) {
+        if (ev.type == V4L2_EVENT_SOURCE_CHANGE)
+            return true;
+    }
+    return false;
+}
+
+bool V4L2DecodeSession::waitForFormat()
+{
+    //the decoder may need more input for the first frame, so feed it
+    //till the format is known, or till the device stays quiet
+    PollTimeout timeout(m_device, k_formatTimeoutMs);
+    while (!isFormatReady()) {
+        if (__atomic_load_n(&m_quit, __ATOMIC_RELAXED))
+            return false;
+        if (feedReady())
+            timeout.restart();
+        if (m_device->poll(true, NULL) != 0) {
+            ERROR("poll device failed");
+            return false;
+        }
+        m_wakeups++;
+        if (timeout.expired() && !isFormatReady()) {
+            ERROR(isInputDrained() ? "no video resolution after the whole input" : "no video resolution, the device is stuck");
+            return false;
+        }
+    }
+
+    struct v4l2_format format;
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (m_device->ioctl(VIDIOC_G_FMT, &format) != 0) {
+        ERROR("no video resolution after the source change");
+        return false;
+    }
+    if (format.fmt.pix_mp.num_planes != 2) {
+        ERROR("unsupported output plane count %d", format.fmt.pix_mp.num_planes);
+        return false;
+    }
+    m_width = format.fmt.pix_mp.width;
+    m_height = format.fmt.pix_mp.height;
+    if (!m_width || !m_height) {
+        ERROR("invalid video resolution %dx%d", m_width, m_height);
+        return false;
+    }
+    return true;
+}
+
+bool V4L2DecodeSession::handleResolutionChange()
+{
+    DEBUG("+handle resolution change");
+    bool resolutionChanged = false;
+    // check resolution change
+    struct v4l2_event ev;
+    memset(&ev, 0, sizeof(ev));
+
+    while (m_device->ioctl(VIDIOC_DQEVENT, &ev) == 0) {
+        if (ev.type == V4L2_EVENT_RESOLUTION_CHANGE) {
+            resolutionChanged = true;
+            break;
+        }
+    }
+    if (!resolutionChanged) {
+        WARNING("no resolution change");
+        return false;
+    }
+
+    bool ret = m_renderer->onFormatChanged();
+    DEBUG("-handle resolution change");
+    return ret;
+}
+
+void V4L2DecodeSession::renderReady()
+{
+    while (m_renderer->renderOneFrame()) {
+        m_frames++;
+        updateStats();
+    }
+}
+
+//refill every input buffer the device gave back
+uint32_t V4L2DecodeSession::feedReady()
+{
+    uint32_t index;
+    uint32_t count = 0;
+    while (m_inputQueue->dequeue(index)) {
+        if (!m_inputQueue->feed(m_input, index))
+            m_dequeuedAfterEOS++;
+        count++;
+    }
+    return count;
+}
+
+bool V4L2DecodeSession::isInputDrained()
+{
+    if (!m_inputQueue->isEOS())
+        return false;
+    return !m_inputQueue->getQueued() || m_dequeuedAfterEOS >= m_inputQueue->getCount();
+}
+
+void V4L2DecodeSession::updateStats()
+{
+    if (!m_stats || !m_stats->isOpen())
+        return;
+    //output is nv12
+    m_stats->addFrames();
+    m_stats->setBytesIn(m_inputQueue->getBytes());
+    m_stats->setBytesOut((uint64_t)m_frames * m_width * m_height * 3 / 2);
+    m_stats->setPool(m_inputQueue->getQueued(), m_inputQueue->getCount());
+    m_stats->tick();
+}
+
+bool V4L2DecodeSession::run()
+{
+    m_start = getMonotonicNs();
+    m_loop->start();
+    m_ok = true;
+    //waitForFormat() took the first source change
+    bool eventPending = false;
+    while (!__atomic_load_n(&m_quit, __ATOMIC_RELAXED)) {
+        //frames of the old size go out first, so they are counted
+        renderReady();
+        if (eventPending) {
+            handleResolutionChange();
+            renderReady();
+        }
+        feedReady();
+        if (isInputDrained())
+            break;
+        //sleeps until a buffer is done, an event comes, or stop()
+        if (m_device->poll(true, &eventPending) != 0) {
+            ERROR("poll device failed");
+            m_ok = false;
+            break;
+        }
+        m_wakeups++;
+    }
+    m_end = getMonotonicNs();
+    drainOutput();
+    return m_ok;
+}
+
+void V4L2DecodeSession::stop()
+{
+    __atomic_store_n(&m_quit, true, __ATOMIC_RELAXED);
+    if (m_opened)
+        m_device->setDevicePollInterrupt();
+}
+
+void V4L2DecodeSession::drainOutput()
+{
+    //the last frames come out after the input is drained, there is no
+    //end of stream mark on them, so take them till the device is quiet
+    PollTimeout timeout(m_device, k_drainTimeoutMs);
+    while (!__atomic_load_n(&m_quit, __ATOMIC_RELAXED)) {
+        uint32_t frames = m_frames;
+        renderReady();
+        feedReady();
+        if (m_frames != frames) {
+            //the quiet time isn't decode time
+            m_end = getMonotonicNs();
+            timeout.restart();
+        }
+        bool eventPending = false;
+        if (m_device->poll(true, &eventPending) != 0) {
+            ERROR("poll device failed");
+            m_ok = false;
+            break;
+        }
+        if (timeout.expired())
+            break;
+        m_wakeups++;
+        if (eventPending)
+            handleResolutionChange();
+    }
+}
+
+void V4L2DecodeSession::report()
+{
+    double seconds = (m_end - m_start) / 1e9;
+    printf("%s: %d frames, %.2f fps, %lu wakeups, %s input",
+        m_params.inputFile, m_frames, seconds > 0 ? m_frames / seconds : 0,
+        (unsigned long)m_wakeups, m_inputQueue->getMemoryName());
+    if (m_inputQueue->getMemory() == V4L2_MEMORY_USERPTR)
+        printf(" (%lu zero copy, %lu copied)",
+            (unsigned long)m_inputQueue->getZeroCopyCount(), (unsigned long)m_inputQueue->getCopyCount());
+    printf("%s\n", m_ok ? "" : ", failed");
+    m_loop->log(m_params.inputFile);
+}
+
+void V4L2DecodeSession::close()
+{
+    if (!m_opened)
+        return;
+    m_opened = false;
+    if (m_stats) {
+        m_stats->setBytesIn(m_inputQueue->getBytes());
+        m_stats->setBytesOut((uint64_t)m_frames * m_width * m_height * 3 / 2);
+        m_stats->setPool(m_inputQueue->getQueued(), m_inputQueue->getCount());
+        m_stats->close();
+    }
+    possibleWait(m_input->getMimeType(), &m_params);
+
+    // release queued input/output buffer
+    m_inputQueue->release();
+
+    struct v4l2_requestbuffers reqbufs;
+    memset(&reqbufs, 0, sizeof(reqbufs));
+    reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    reqbufs.memory = V4L2_MEMORY_MMAP;
+    reqbufs.count = 0;
+    if (m_device->ioctl(VIDIOC_REQBUFS, &reqbufs) == -1)
+        ERROR("release output buffers failed");
+
+    __u32 type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    if (m_device->ioctl(VIDIOC_STREAMOFF, &type) == -1)
+        ERROR("stream off input failed");
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (m_device->ioctl(VIDIOC_STREAMOFF, &type) == -1)
+        ERROR("stream off output failed");
+
+    if (m_device->close() == -1)
+        ERROR("close device failed");
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef V4L2DecodeSession_h
+#define V4L2DecodeSession_h
+
+#include "common/NonCopyable.h"
+#include "decodehelp.h"
+#include <stdint.h>
+#include <Yami.h>
+
+class DecodeInput;
+class V4L2Device;
+class V4L2InputQueue;
+class V4L2Renderer;
+namespace YamiMediaCodec {
+class InputLoop;
+class StatsSink;
+}
+
+/**
+ * One v4l2 decode, from the input file to the renderer. All state lives
+ * here, so a process can run many of them, each on its own thread.
+ * run() sleeps in V4L2Device::poll() and handles whatever woke it:
+ * resolution change, finished output frames, and used input buffers.
+ * stop() can be called from another thread to end run() early.
+ */
+class V4L2DecodeSession {
+public:
+    V4L2DecodeSession(const DecodeParameter& params, char* inputFile);
+    ~V4L2DecodeSession();
+
+    //open the device and start decoding, stats is optional
+    bool init(YamiMediaCodec::StatsSink* stats = NULL);
+    //until the stream is decoded and rendered
+    bool run();
+    void stop();
+
+    const char* inputFile() const { return m_params.inputFile; }
+    uint32_t frames() const { return m_frames; }
+    void report();
+
+private:
+    bool setFormats();
+    //feed input until the decoder knows the output size
+    bool waitForFormat();
+    //the source change event came, or G_FMT works if we have no events
+    bool isFormatReady();
+    bool handleResolutionChange();
+    void renderReady();
+    //buffers taken back
+    uint32_t feedReady();
+    bool isInputDrained();
+    void drainOutput();
+    void close();
+    void updateStats();
+
+    DecodeParameter m_params;
+    YamiMediaCodec::StatsSink* m_stats;
+    SharedPtr<DecodeInput> m_input;
+    SharedPtr<V4L2Device> m_device;
+    SharedPtr<V4L2Renderer> m_renderer;
+    SharedPtr<V4L2InputQueue> m_inputQueue;
+    SharedPtr<YamiMediaCodec::InputLoop> m_loop;
+    VideoDataMemoryType m_memoryType;
+    uint32_t m_width;
+    uint32_t m_height;
+    //sizeimage of the input port, as the driver set it
+    uint32_t m_inputBufferSize;
+    //V4L2_EVENT_SOURCE_CHANGE is subscribed
+    bool m_sourceChange;
+    //input buffers dequeued after eos
+    uint32_t m_dequeuedAfterEOS;
+    uint32_t m_frames;
+    //poll() returns, idle cost of the session
+    uint64_t m_wakeups;
+    uint64_t m_start;
+    uint64_t m_end;
+    bool m_opened;
+    bool m_quit;
+    bool m_ok;
+    DISALLOW_COPY_AND_ASSIGN(V4L2DecodeSession);
+};
+
+#endif //V4L2DecodeSession_h
@@ -18,10 +18,12 @@
 #endif
 
 #include "V4L2Device.h"
+#include "V4L2DeviceFake.h"
 
 #include "common/log.h"
 #include "common/common_def.h"
 #include <string.h>
+#include <stdlib.h>
 #include <inttypes.h>
 
 #ifdef __ENABLE_V4L2_OPS__
@@ -291,11 +293,20 @@ protected:
 SharedPtr<V4L2Device> V4L2Device::Create()
 {
     SharedPtr<V4L2Device> device;
+    //headless runs without a codec, see V4L2DeviceFake.h
+    const char* fake = getenv("YAMI_V4L2_FAKE");
+    if (fake) {
+        V4L2FakeConfig config;
+        if (!config.parse(fake))
+            return device;
+        device.reset(new V4L2DeviceFake(config));
+    } else {
 #ifdef __ENABLE_V4L2_OPS__
-    device.reset(new V4L2DeviceOps);
+        device.reset(new V4L2DeviceOps);
 #else
-    device.reset(new V4L2DeviceYami);
+        device.reset(new V4L2DeviceYami);
 #endif
+    }
     if (!device->init())
         device.reset();
     return device;
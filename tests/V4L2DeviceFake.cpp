@@ -0,0 +1,756 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "V4L2DeviceFake.h"
+
+#include "common/log.h"
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef V4L2_EVENT_SOURCE_CHANGE
+    #define V4L2_EVENT_SOURCE_CHANGE 5
+#endif
+
+using namespace YamiMediaCodec;
+
+static const uint32_t k_defaultWidth = 1280;
+static const uint32_t k_defaultHeight = 720;
+static const uint32_t k_defaultInputSize = 1024 * 1024;
+static const uint64_t k_fnvOffset = 0xcbf29ce484222325ULL;
+static const uint64_t k_fnvPrime = 0x100000001b3ULL;
+
+//mmap offset: port, buffer index, plane
+#define FAKE_MMAP_OFFSET(port, index, plane) (((port) << 24) | ((index) << 8) | (plane))
+
+V4L2FakeConfig::V4L2FakeConfig()
+    : latencyUs(0)
+    , resizeEvery(0)
+    , width(0)
+    , height(0)
+    , dpbSize(4)
+    , maxBuffers(32)
+    , dmabuf(true)
+    , inputSize(0)
+{
+}
+
+bool V4L2FakeConfig::parse(const char* spec)
+{
+    std::string s(spec);
+    size_t pos = 0;
+    while (pos < s.size()) {
+        size_t end = s.find(',', pos);
+        if (end == std::string::npos)
+            end = s.size();
+        std::string item = s.substr(pos, end - pos);
+        pos = end + 1;
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            ERROR("fake device: %s has no value", item.c_str());
+            return false;
+        }
+        std::string key = item.substr(0, eq);
+        const char* value = item.c_str() + eq + 1;
+        if (key == "latency") {
+            latencyUs = atoi(value);
+        }
+        else if (key == "resize") {
+            resizeEvery = atoi(value);
+        }
+        else if (key == "size") {
+            if (sscanf(value, "%ux%u", &width, &height) != 2 || !width || !height) {
+                ERROR("fake device: bad size %s", value);
+                return false;
+            }
+        }
+        else if (key == "dpb") {
+            dpbSize = atoi(value);
+        }
+        else if (key == "buffers") {
+            maxBuffers = atoi(value);
+            if (!maxBuffers || maxBuffers > VIDEO_MAX_FRAME) {
+                ERROR("fake device: bad buffer count %s", value);
+                return false;
+            }
+        }
+        else if (key == "dmabuf") {
+            dmabuf = atoi(value);
+        }
+        else if (key == "insize") {
+            inputSize = atoi(value);
+        }
+        else {
+            ERROR("fake device: unknown option %s", key.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+V4L2DeviceFake::Port::Port()
+    : memory(V4L2_MEMORY_MMAP)
+    , streaming(false)
+{
+    memset(&format, 0, sizeof(format));
+}
+
+V4L2DeviceFake::V4L2DeviceFake(const V4L2FakeConfig& config)
+    : m_config(config)
+    , m_encoder(false)
+    , m_opened(false)
+    , m_work(m_lock)
+    , m_ready(m_lock)
+    , m_formatKnown(false)
+    , m_sourceChange(false)
+    , m_resizePending(false)
+    , m_interrupt(false)
+    , m_quit(false)
+    , m_frames(0)
+    , m_resizes(0)
+    , m_bytes(0)
+    , m_checksum(k_fnvOffset)
+{
+    m_fd = -1;
+}
+
+V4L2DeviceFake::~V4L2DeviceFake()
+{
+    close();
+    for (int i = 0; i < PORT_COUNT; i++) {
+        //a mapping outlives the device, as it does for a driver
+        if (isMapped(m_ports[i]))
+            ERROR("fake device: buffers of port %d are still mapped, leaking them", i);
+        else
+            freeBuffers(m_ports[i]);
+    }
+}
+
+bool V4L2DeviceFake::init()
+{
+    return true;
+}
+
+bool V4L2DeviceFake::open(const char* name, int32_t flags)
+{
+    if (m_opened)
+        return false;
+    if (!strcmp(name, "encoder"))
+        m_encoder = true;
+    else if (strcmp(name, "decoder"))
+        return false;
+    m_quit = false;
+    if (pthread_create(&m_thread, NULL, start, this)) {
+        ERROR("create thread failed");
+        return false;
+    }
+    m_opened = true;
+    //any value but -1
+    m_fd = 0;
+    return true;
+}
+
+int32_t V4L2DeviceFake::close()
+{
+    if (!m_opened)
+        return 0;
+    {
+        AutoLock lock(m_lock);
+        m_quit = true;
+        m_work.broadcast();
+    }
+    pthread_join(m_thread, NULL);
+    m_opened = false;
+    m_fd = -1;
+    fprintf(stderr, "fake v4l2 %s: %d frames, %lu bytes, %d resolution changes, checksum %016lx\n",
+        m_encoder ? "encoder" : "decoder", m_frames, (unsigned long)m_bytes, m_resizes, (unsigned long)m_checksum);
+    for (int i = 0; i < PORT_COUNT; i++) {
+        //a client leak, and its REQBUFS(0) failed with EBUSY
+        if (isMapped(m_ports[i]))
+            fprintf(stderr, "fake v4l2 %s: %s buffers are still mapped at close\n",
+                m_encoder ? "encoder" : "decoder", i == INPUT ? "input" : "output");
+    }
+    return 0;
+}
+
+int32_t V4L2DeviceFake::fail(int err)
+{
+    errno = err;
+    return -1;
+}
+
+bool V4L2DeviceFake::getPort(uint32_t type, int& port)
+{
+    if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+        port = INPUT;
+    else if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+        port = OUTPUT;
+    else
+        return false;
+    return true;
+}
+
+int32_t V4L2DeviceFake::ioctl(int32_t cmd, void* arg)
+{
+    AutoLock lock(m_lock);
+    switch ((uint32_t)cmd) {
+    case VIDIOC_QUERYCAP: {
+        struct v4l2_capability* caps = (struct v4l2_capability*)arg;
+        memset(caps, 0, sizeof(*caps));
+        strcpy((char*)caps->driver, "fake");
+        caps->capabilities = V4L2_CAP_VIDEO_CAPTURE_MPLANE | V4L2_CAP_VIDEO_OUTPUT_MPLANE | V4L2_CAP_STREAMING;
+        caps->device_caps = caps->capabilities;
+        return 0;
+    }
+    case VIDIOC_S_FMT:
+        return setFormat((struct v4l2_format*)arg);
+    case VIDIOC_G_FMT:
+        return getFormat((struct v4l2_format*)arg);
+    case VIDIOC_REQBUFS:
+        return reqbufs((struct v4l2_requestbuffers*)arg);
+    case VIDIOC_QUERYBUF:
+        return querybuf((struct v4l2_buffer*)arg);
+    case VIDIOC_QBUF:
+        return qbuf((struct v4l2_buffer*)arg);
+    case VIDIOC_DQBUF:
+        return dqbuf((struct v4l2_buffer*)arg);
+    case VIDIOC_STREAMON:
+        return stream(*(uint32_t*)arg, true);
+    case VIDIOC_STREAMOFF:
+        return stream(*(uint32_t*)arg, false);
+    case VIDIOC_DQEVENT: {
+        if (m_events.empty())
+            return fail(ENOENT);
+        struct v4l2_event* ev = (struct v4l2_event*)arg;
+        memset(ev, 0, sizeof(*ev));
+        ev->type = m_events.front();
+        m_events.pop_front();
+        ev->pending = m_events.size();
+        return 0;
+    }
+    case VIDIOC_G_CTRL: {
+        struct v4l2_control* ctrl = (struct v4l2_control*)arg;
+        if (ctrl->id != V4L2_CID_MIN_BUFFERS_FOR_CAPTURE)
+            return fail(EINVAL);
+        ctrl->value = m_config.dpbSize;
+        return 0;
+    }
+    case VIDIOC_SUBSCRIBE_EVENT:
+    case VIDIOC_UNSUBSCRIBE_EVENT: {
+        struct v4l2_event_subscription* sub = (struct v4l2_event_subscription*)arg;
+        if (m_encoder || sub->type != V4L2_EVENT_SOURCE_CHANGE)
+            return fail(EINVAL);
+        m_sourceChange = cmd == VIDIOC_SUBSCRIBE_EVENT;
+        return 0;
+    }
+    case VIDIOC_S_PARM:
+    case VIDIOC_S_EXT_CTRLS:
+        //accepted and ignored
+        return 0;
+    default:
+        DEBUG("fake device: unsupported ioctl 0x%x", cmd);
+        return fail(ENOTTY);
+    }
+}
+
+void V4L2DeviceFake::setOutputFormat(uint32_t width, uint32_t height)
+{
+    struct v4l2_pix_format_mplane& format = m_ports[OUTPUT].format;
+    format.width = width;
+    format.height = height;
+    if (m_encoder) {
+        format.num_planes = 1;
+        format.plane_fmt[0].sizeimage = std::max<uint32_t>(width * height / 2, sizeof(FakeFrameHeader));
+        return;
+    }
+    //nv12 in two planes
+    format.pixelformat = V4L2_PIX_FMT_NV12M;
+    format.num_planes = 2;
+    format.plane_fmt[0].bytesperline = width;
+    format.plane_fmt[0].sizeimage = width * height;
+    format.plane_fmt[1].bytesperline = width;
+    format.plane_fmt[1].sizeimage = width * height / 2;
+}
+
+int32_t V4L2DeviceFake::setFormat(struct v4l2_format* format)
+{
+    int port;
+    if (!getPort(format->type, port))
+        return fail(EINVAL);
+    if (port == OUTPUT && !m_encoder) {
+        //codec data for the decoder, nothing to keep
+        return 0;
+    }
+    struct v4l2_pix_format_mplane& f = m_ports[port].format;
+    f = format->fmt.pix_mp;
+    if (port == INPUT) {
+        if (m_encoder) {
+            //raw frames, in as many planes as the client sends
+            if (!f.num_planes)
+                f.num_planes = f.pixelformat == V4L2_PIX_FMT_YUV420M ? 3 : f.pixelformat == V4L2_PIX_FMT_NV12 ? 2 : 1;
+            setOutputFormat(f.width, f.height);
+        } else {
+            f.num_planes = 1;
+            if (m_config.inputSize)
+                f.plane_fmt[0].sizeimage = m_config.inputSize;
+            else if (!f.plane_fmt[0].sizeimage)
+                f.plane_fmt[0].sizeimage = k_defaultInputSize;
+        }
+    }
+    format->fmt.pix_mp = f;
+    return 0;
+}
+
+int32_t V4L2DeviceFake::getFormat(struct v4l2_format* format)
+{
+    int port;
+    if (!getPort(format->type, port))
+        return fail(EINVAL);
+    //the decoder doesn't know its output before the first input
+    if (port == OUTPUT && !m_encoder && !m_formatKnown)
+        return fail(EINVAL);
+    format->fmt.pix_mp = m_ports[port].format;
+    return 0;
+}
+
+int32_t V4L2DeviceFake::reqbufs(struct v4l2_requestbuffers* req)
+{
+    int port;
+    if (!getPort(req->type, port))
+        return fail(EINVAL);
+    bool dmabuf = req->memory == V4L2_MEMORY_DMABUF && port == INPUT && m_config.dmabuf;
+    if (req->memory != V4L2_MEMORY_MMAP && req->memory != V4L2_MEMORY_USERPTR && !dmabuf)
+        return fail(EINVAL);
+    Port& p = m_ports[port];
+    if (isMapped(p))
+        return fail(EBUSY);
+    p.queued.clear();
+    p.done.clear();
+    freeBuffers(p);
+    p.memory = (enum v4l2_memory)req->memory;
+    uint32_t count = std::min(req->count, m_config.maxBuffers);
+    p.buffers.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        Buffer& b = p.buffers[i];
+        memset(b.memory, 0, sizeof(b.memory));
+        memset(b.length, 0, sizeof(b.length));
+        memset(b.mapped, 0, sizeof(b.mapped));
+        memset(b.userptr, 0, sizeof(b.userptr));
+        memset(b.fd, -1, sizeof(b.fd));
+        memset(b.bytesused, 0, sizeof(b.bytesused));
+        b.flags = 0;
+        if (p.memory != V4L2_MEMORY_MMAP)
+            continue;
+        for (uint32_t j = 0; j < p.format.num_planes && j < VIDEO_MAX_PLANES; j++) {
+            uint32_t length = p.format.plane_fmt[j].sizeimage;
+            if (!length)
+                continue;
+            void* memory = ::mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) {
+                freeBuffers(p);
+                return fail(ENOMEM);
+            }
+            b.memory[j] = (uint8_t*)memory;
+            b.length[j] = length;
+        }
+    }
+    req->count = count;
+    return 0;
+}
+
+bool V4L2DeviceFake::isMapped(const Port& port)
+{
+    for (size_t i = 0; i < port.buffers.size(); i++) {
+        for (uint32_t j = 0; j < VIDEO_MAX_PLANES; j++) {
+            if (port.buffers[i].mapped[j])
+                return true;
+        }
+    }
+    return false;
+}
+
+void V4L2DeviceFake::freeBuffers(Port& port)
+{
+    for (size_t i = 0; i < port.buffers.size(); i++) {
+        Buffer& b = port.buffers[i];
+        for (uint32_t j = 0; j < VIDEO_MAX_PLANES; j++) {
+            if (b.memory[j])
+                ::munmap(b.memory[j], b.length[j]);
+        }
+    }
+    port.buffers.clear();
+}
+
+int32_t V4L2DeviceFake::querybuf(struct v4l2_buffer* buf)
+{
+    int port;
+    if (!getPort(buf->type, port))
+        return fail(EINVAL);
+    Port& p = m_ports[port];
+    if (buf->index >= p.buffers.size() || !buf->m.planes)
+        return fail(EINVAL);
+    uint32_t planes = std::min<uint32_t>(buf->length, p.format.num_planes);
+    for (uint32_t i = 0; i < planes; i++) {
+        buf->m.planes[i].length = p.format.plane_fmt[i].sizeimage;
+        buf->m.planes[i].m.mem_offset = FAKE_MMAP_OFFSET(port, buf->index, i);
+    }
+    buf->length = planes;
+    buf->memory = p.memory;
+    return 0;
+}
+
+int32_t V4L2DeviceFake::qbuf(struct v4l2_buffer* buf)
+{
+    int port;
+    if (!getPort(buf->type, port))
+        return fail(EINVAL);
+    Port& p = m_ports[port];
+    if (buf->index >= p.buffers.size() || buf->memory != p.memory)
+        return fail(EINVAL);
+    for (size_t i = 0; i < p.queued.size(); i++) {
+        if (p.queued[i] == buf->index)
+            return fail(EINVAL);
+    }
+    Buffer& b = p.buffers[buf->index];
+    //empty decoder output comes back without planes, V4L2Renderer reuses m for a userptr
+    bool empty = port == OUTPUT && !m_encoder && p.memory == V4L2_MEMORY_MMAP;
+    if (!empty && !buf->m.planes)
+        return fail(EINVAL);
+    uint32_t planes = empty ? 0 : std::min<uint32_t>(buf->length, VIDEO_MAX_PLANES);
+    for (uint32_t i = 0; i < planes; i++) {
+        b.bytesused[i] = buf->m.planes[i].bytesused;
+        b.userptr[i] = p.memory == V4L2_MEMORY_USERPTR ? buf->m.planes[i].m.userptr : 0;
+        if (b.bytesused[i] && p.memory == V4L2_MEMORY_USERPTR && !b.userptr[i])
+            return fail(EFAULT);
+        //vb2 wants a userptr plane to cover sizeimage
+        if (port == INPUT && !m_encoder && p.memory == V4L2_MEMORY_USERPTR
+            && buf->m.planes[i].length < p.format.plane_fmt[i].sizeimage)
+            return fail(EINVAL);
+        b.fd[i] = p.memory == V4L2_MEMORY_DMABUF ? buf->m.planes[i].m.fd : -1;
+        if (b.bytesused[i] && p.memory == V4L2_MEMORY_DMABUF && b.fd[i] < 0)
+            return fail(EBADF);
+        if (p.memory == V4L2_MEMORY_MMAP && b.bytesused[i] > b.length[i])
+            return fail(EINVAL);
+    }
+    for (uint32_t i = planes; i < VIDEO_MAX_PLANES; i++)
+        b.bytesused[i] = 0;
+    b.flags = buf->flags;
+    p.queued.push_back(buf->index);
+    m_work.signal();
+    return 0;
+}
+
+int32_t V4L2DeviceFake::dqbuf(struct v4l2_buffer* buf)
+{
+    int port;
+    if (!getPort(buf->type, port))
+        return fail(EINVAL);
+    Port& p = m_ports[port];
+    if (p.done.empty())
+        return fail(EAGAIN);
+    uint32_t index = p.done.front();
+    p.done.pop_front();
+    const Buffer& b = p.buffers[index];
+    buf->index = index;
+    buf->flags = b.flags;
+    buf->bytesused = b.bytesused[0];
+    if (buf->m.planes) {
+        uint32_t planes = std::min<uint32_t>(buf->length, VIDEO_MAX_PLANES);
+        for (uint32_t i = 0; i < planes; i++)
+            buf->m.planes[i].bytesused = b.bytesused[i];
+    }
+    return 0;
+}
+
+int32_t V4L2DeviceFake::stream(uint32_t type, bool on)
+{
+    int port;
+    if (!getPort(type, port))
+        return fail(EINVAL);
+    Port& p = m_ports[port];
+    p.streaming = on;
+    if (!on) {
+        //all buffers go back to the client
+        p.queued.clear();
+        p.done.clear();
+    }
+    else if (port == OUTPUT) {
+        //the client has set up buffers for the new size
+        m_resizePending = false;
+    }
+    m_work.broadcast();
+    return 0;
+}
+
+int32_t V4L2DeviceFake::poll(bool pollDevice, bool* eventPending)
+{
+    AutoLock lock(m_lock);
+    while (!m_interrupt
+        && !(pollDevice && (!m_ports[INPUT].done.empty() || !m_ports[OUTPUT].done.empty() || !m_events.empty())))
+        m_ready.wait();
+    if (eventPending)
+        *eventPending = !m_events.empty();
+    return 0;
+}
+
+int32_t V4L2DeviceFake::setDevicePollInterrupt()
+{
+    AutoLock lock(m_lock);
+    m_interrupt = true;
+    m_ready.broadcast();
+    return 0;
+}
+
+int32_t V4L2DeviceFake::clearDevicePollInterrupt()
+{
+    AutoLock lock(m_lock);
+    m_interrupt = false;
+    return 0;
+}
+
+void* V4L2DeviceFake::mmap(void* addr, size_t length, int32_t prot,
+    int32_t flags, unsigned int offset)
+{
+    AutoLock lock(m_lock);
+    uint32_t port = offset >> 24;
+    uint32_t index = (offset >> 8) & 0xffff;
+    uint32_t plane = offset & 0xff;
+    if (port >= PORT_COUNT || index >= m_ports[port].buffers.size() || plane >= VIDEO_MAX_PLANES) {
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+    Buffer& b = m_ports[port].buffers[index];
+    if (!b.memory[plane] || length > b.length[plane]) {
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+    //every mapping of a buffer is the same memory, counted until munmap
+    b.mapped[plane]++;
+    return b.memory[plane];
+}
+
+int32_t V4L2DeviceFake::munmap(void* addr, size_t length)
+{
+    AutoLock lock(m_lock);
+    for (int i = 0; i < PORT_COUNT; i++) {
+        std::vector<Buffer>& buffers = m_ports[i].buffers;
+        for (size_t j = 0; j < buffers.size(); j++) {
+            Buffer& b = buffers[j];
+            for (uint32_t k = 0; k < VIDEO_MAX_PLANES; k++) {
+                if (b.memory[k] == addr && b.mapped[k]) {
+                    b.mapped[k]--;
+                    return 0;
+                }
+            }
+        }
+    }
+    return fail(EINVAL);
+}
+
+int32_t V4L2DeviceFake::setFrameMemoryType(VideoDataMemoryType memory_type)
+{
+    return 0;
+}
+
+#if __ENABLE_EGL__
+int32_t V4L2DeviceFake::useEglImage(/*EGLDisplay*/ void* eglDisplay, /*EGLContext*/ void* eglContext,
+    uint32_t bufferIndex, void* eglImage)
+{
+    return -1;
+}
+
+int32_t V4L2DeviceFake::setDrmFd(int drmFd)
+{
+    return 0;
+}
+#endif
+
+#if __ENABLE_WAYLAND__
+int32_t V4L2DeviceFake::setWaylandDisplay(struct wl_display* wlDisplay)
+{
+    return 0;
+}
+#endif
+
+#if __ENABLE_X11__
+int32_t V4L2DeviceFake::setXDisplay(Display* x11Display)
+{
+    return 0;
+}
+#endif
+
+void* V4L2DeviceFake::start(void* device)
+{
+    ((V4L2DeviceFake*)device)->loop();
+    return NULL;
+}
+
+//the next input can be handled: it is eos, or there is an output buffer for it
+bool V4L2DeviceFake::canProcess()
+{
+    Port& in = m_ports[INPUT];
+    Port& out = m_ports[OUTPUT];
+    if (!in.streaming || in.queued.empty())
+        return false;
+    const Buffer& b = in.buffers[in.queued.front()];
+    if (!b.bytesused[0])
+        return true;
+    if (!m_encoder && !m_formatKnown)
+        return true;
+    return out.streaming && !out.queued.empty() && !m_resizePending;
+}
+
+void V4L2DeviceFake::loop()
+{
+    AutoLock lock(m_lock);
+    while (1) {
+        while (!m_quit && !canProcess())
+            m_work.wait();
+        if (m_quit)
+            return;
+
+        Port& in = m_ports[INPUT];
+        Port& out = m_ports[OUTPUT];
+        uint32_t index = in.queued.front();
+        if (!in.buffers[index].bytesused[0]) {
+            //eos, nothing to output
+            in.queued.pop_front();
+            in.done.push_back(index);
+            m_ready.broadcast();
+            continue;
+        }
+        if (!m_encoder && !m_formatKnown) {
+            uint32_t width = m_config.width ? m_config.width : in.format.width;
+            uint32_t height = m_config.height ? m_config.height : in.format.height;
+            if (!width || !height) {
+                width = k_defaultWidth;
+                height = k_defaultHeight;
+            }
+            setOutputFormat(width, height);
+            m_formatKnown = true;
+            if (m_sourceChange)
+                m_events.push_back(V4L2_EVENT_SOURCE_CHANGE);
+            m_ready.broadcast();
+            //wait for the client's output buffers
+            continue;
+        }
+
+        uint32_t outIndex = out.queued.front();
+        if (m_config.latencyUs) {
+            //the client may queue and dequeue while we work
+            m_lock.release();
+            usleep(m_config.latencyUs);
+            m_lock.acquire();
+            if (m_quit)
+                return;
+            //streamed off meanwhile
+            if (in.queued.empty() || in.queued.front() != index
+                || out.queued.empty() || out.queued.front() != outIndex)
+                continue;
+        }
+        in.queued.pop_front();
+        out.queued.pop_front();
+        process(index, outIndex);
+        in.done.push_back(index);
+        out.done.push_back(outIndex);
+
+        if (!m_encoder && m_config.resizeEvery && !(m_frames % m_config.resizeEvery)) {
+            //toggle between the full size and a half
+            const struct v4l2_pix_format_mplane& f = out.format;
+            uint32_t width = m_config.width ? m_config.width : in.format.width;
+            if (!width)
+                width = k_defaultWidth;
+            if (f.width == width)
+                setOutputFormat(f.width / 2, f.height / 2);
+            else
+                setOutputFormat(f.width * 2, f.height * 2);
+            m_resizePending = true;
+            m_resizes++;
+            if (m_sourceChange)
+                m_events.push_back(V4L2_EVENT_SOURCE_CHANGE);
+        }
+        m_ready.broadcast();
+    }
+}
+
+uint64_t V4L2DeviceFake::checksum(const Buffer& buffer, uint32_t planes)
+{
+    uint64_t hash = k_fnvOffset;
+    for (uint32_t i = 0; i < planes; i++) {
+        uint32_t size = buffer.bytesused[i];
+        void* mapped = MAP_FAILED;
+        const uint8_t* data = buffer.userptr[i] ? (const uint8_t*)buffer.userptr[i] : buffer.memory[i];
+        if (buffer.fd[i] >= 0 && size) {
+            //a real device reads it by dma, we have to map it
+            mapped = ::mmap(NULL, size, PROT_READ, MAP_SHARED, buffer.fd[i], 0);
+            if (mapped == MAP_FAILED)
+                ERROR("fake device: can't map dma-buf %d", buffer.fd[i]);
+            else
+                data = (const uint8_t*)mapped;
+        }
+        if (!data)
+            continue;
+        for (uint32_t j = 0; j < size; j++) {
+            hash ^= data[j];
+            hash *= k_fnvPrime;
+        }
+        if (mapped != MAP_FAILED)
+            ::munmap(mapped, size);
+    }
+    return hash;
+}
+
+//pass-through "codec": the output is a header about the input
+void V4L2DeviceFake::process(uint32_t in, int32_t out)
+{
+    Buffer& input = m_ports[INPUT].buffers[in];
+    Buffer& output = m_ports[OUTPUT].buffers[out];
+    uint32_t planes = m_ports[INPUT].format.num_planes;
+    if (!planes)
+        planes = 1;
+
+    FakeFrameHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = YAMI_FOURCC('F', 'A', 'K', 'E');
+    header.frame = m_frames++;
+    for (uint32_t i = 0; i < planes; i++)
+        header.size += input.bytesused[i];
+    header.checksum = checksum(input, planes);
+    m_bytes += header.size;
+    m_checksum = (m_checksum ^ header.checksum) * k_fnvPrime;
+
+    const struct v4l2_pix_format_mplane& f = m_ports[OUTPUT].format;
+    uint8_t* dest = output.userptr[0] ? (uint8_t*)output.userptr[0] : (output.length[0] >= sizeof(header) ? output.memory[0] : NULL);
+    if (dest)
+        memcpy(dest, &header, sizeof(header));
+    if (m_encoder) {
+        output.bytesused[0] = sizeof(header);
+    } else {
+        for (uint32_t i = 0; i < f.num_planes; i++)
+            output.bytesused[i] = f.plane_fmt[i].sizeimage;
+    }
+    output.flags = input.flags;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef V4L2DeviceFake_h
+#define V4L2DeviceFake_h
+
+#include "V4L2Device.h"
+#include "common/condition.h"
+#include "common/lock.h"
+#include "common/NonCopyable.h"
+#include <linux/videodev2.h>
+#include <deque>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+struct V4L2FakeConfig {
+    V4L2FakeConfig();
+    //"latency=<us>,resize=<frames>,size=<w>x<h>,dpb=<n>,buffers=<n>,dmabuf=<0|1>,insize=<bytes>"
+    bool parse(const char* spec);
+
+    //time spent on each buffer
+    uint32_t latencyUs;
+    //a resolution change event every N frames, 0 for never
+    uint32_t resizeEvery;
+    //decoded size, 0 to take it from the input format
+    uint32_t width;
+    uint32_t height;
+    //V4L2_CID_MIN_BUFFERS_FOR_CAPTURE
+    uint32_t dpbSize;
+    //REQBUFS gives at most this many
+    uint32_t maxBuffers;
+    //take dma-bufs for input, or refuse them
+    bool dmabuf;
+    //decoder input sizeimage, 0 to take the one asked for
+    uint32_t inputSize;
+};
+
+/**
+ * Software V4L2Device for headless runs, chosen by V4L2Device::Create()
+ * when YAMI_V4L2_FAKE is set, its value is the V4L2FakeConfig spec.
+ * "Decoding" turns each input buffer into one output buffer that starts
+ * with a FakeFrameHeader: a frame number and a checksum of the payload.
+ * Output pixels are left alone. The encoder mode does the same, and the
+ * header is the whole bitstream. mmap and userptr buffers are supported,
+ * and dmabuf for input, the fd is mapped to read it. dmabuf=0 refuses
+ * dmabuf, so clients can test their fallback. Like a driver, REQBUFS
+ * fails with EBUSY while mmap buffers of the port are still mapped, and
+ * decoder input userptr planes shorter than sizeimage are refused.
+ * A subscribed V4L2_EVENT_SOURCE_CHANGE comes when the first input gives
+ * the output format, and on each resize.
+ */
+class V4L2DeviceFake : public V4L2Device {
+public:
+    struct FakeFrameHeader {
+        uint32_t magic; //FAKE
+        uint32_t frame;
+        uint32_t size; //payload bytes
+        uint32_t reserved;
+        uint64_t checksum; //fnv-1a of the payload
+    };
+
+    explicit V4L2DeviceFake(const V4L2FakeConfig& config);
+    ~V4L2DeviceFake();
+
+    bool open(const char* name, int32_t flags);
+    int32_t close();
+    int32_t ioctl(int32_t cmd, void* arg);
+    int32_t poll(bool pollDevice, bool* eventPending);
+    int32_t setDevicePollInterrupt();
+    int32_t clearDevicePollInterrupt();
+    void* mmap(void* addr, size_t length, int32_t prot,
+        int32_t flags, unsigned int offset);
+    int32_t munmap(void* addr, size_t length);
+    int32_t setFrameMemoryType(VideoDataMemoryType memory_type);
+
+#if __ENABLE_EGL__
+    int32_t useEglImage(/*EGLDisplay*/ void* eglDisplay, /*EGLContext*/ void* eglContext,
+        uint32_t bufferIndex, void* eglImage);
+    int32_t setDrmFd(int drmFd);
+#endif
+
+#if __ENABLE_WAYLAND__
+    int32_t setWaylandDisplay(struct wl_display* wlDisplay);
+#endif
+
+#if __ENABLE_X11__
+    int32_t setXDisplay(Display* x11Display);
+#endif
+
+protected:
+    bool init();
+
+private:
+    enum {
+        INPUT, //OUTPUT_MPLANE, compressed data for a decoder
+        OUTPUT, //CAPTURE_MPLANE
+        PORT_COUNT
+    };
+
+    struct Buffer {
+        //mmap buffers, allocated by REQBUFS with ::mmap so they don't move
+        uint8_t* memory[VIDEO_MAX_PLANES];
+        uint32_t length[VIDEO_MAX_PLANES];
+        //live client mappings of memory
+        uint32_t mapped[VIDEO_MAX_PLANES];
+        unsigned long userptr[VIDEO_MAX_PLANES];
+        //the client's dma-buf, it keeps the fd open while queued
+        int fd[VIDEO_MAX_PLANES];
+        uint32_t bytesused[VIDEO_MAX_PLANES];
+        uint32_t flags;
+    };
+
+    struct Port {
+        Port();
+        enum v4l2_memory memory;
+        struct v4l2_pix_format_mplane format;
+        std::vector<Buffer> buffers;
+        //owned by the device, and ready for DQBUF
+        std::deque<uint32_t> queued;
+        std::deque<uint32_t> done;
+        bool streaming;
+    };
+
+    int32_t fail(int err);
+    bool getPort(uint32_t type, int& port);
+    void setOutputFormat(uint32_t width, uint32_t height);
+    int32_t reqbufs(struct v4l2_requestbuffers* req);
+    static bool isMapped(const Port& port);
+    static void freeBuffers(Port& port);
+    int32_t querybuf(struct v4l2_buffer* buf);
+    int32_t qbuf(struct v4l2_buffer* buf);
+    int32_t dqbuf(struct v4l2_buffer* buf);
+    int32_t stream(uint32_t type, bool on);
+    int32_t getFormat(struct v4l2_format* format);
+    int32_t setFormat(struct v4l2_format* format);
+
+    static void* start(void* device);
+    void loop();
+    bool canProcess();
+    void process(uint32_t in, int32_t out);
+    uint64_t checksum(const Buffer& buffer, uint32_t planes);
+
+    V4L2FakeConfig m_config;
+    bool m_encoder;
+    bool m_opened;
+
+    YamiMediaCodec::Lock m_lock;
+    YamiMediaCodec::Condition m_work; //for the worker
+    YamiMediaCodec::Condition m_ready; //for poll()
+    Port m_ports[PORT_COUNT];
+    std::deque<uint32_t> m_events;
+    bool m_formatKnown;
+    //V4L2_EVENT_SOURCE_CHANGE is subscribed, nothing is queued before
+    bool m_sourceChange;
+    //output waits for the client to take the new size
+    bool m_resizePending;
+    bool m_interrupt;
+    bool m_quit;
+    pthread_t m_thread;
+
+    uint32_t m_frames;
+    uint32_t m_resizes;
+    uint64_t m_bytes;
+    uint64_t m_checksum;
+    DISALLOW_COPY_AND_ASSIGN(V4L2DeviceFake);
+};
+
+#endif //V4L2DeviceFake_h
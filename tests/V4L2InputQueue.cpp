@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "V4L2InputQueue.h"
+
+#include "common/common_def.h"
+#include "common/log.h"
+#include "decodeinput.h"
+#include "V4L2Device.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(HAVE_LINUX_UDMABUF_H) && defined(HAVE_MEMFD_CREATE)
+#include <linux/udmabuf.h>
+#define HAVE_UDMABUF 1
+#endif
+
+static const int k_inputPlaneCount = 1;
+
+static const char* memoryName(enum v4l2_memory memory)
+{
+    switch (memory) {
+    case V4L2_MEMORY_MMAP:
+        return "mmap";
+    case V4L2_MEMORY_USERPTR:
+        return "userptr";
+    case V4L2_MEMORY_DMABUF:
+        return "dmabuf";
+    default:
+        return "unknown";
+    }
+}
+
+V4L2InputQueue::Slot::Slot()
+    : mapped(NULL)
+    , length(0)
+    , fd(-1)
+{
+}
+
+V4L2InputQueue::V4L2InputQueue(const SharedPtr<V4L2Device>& device, enum v4l2_memory memory)
+    : m_device(device)
+    , m_memory(memory)
+    , m_bufferSize(0)
+    , m_queued(0)
+    , m_eos(false)
+    , m_bytes(0)
+    , m_zeroCopy(0)
+    , m_copied(0)
+{
+}
+
+V4L2InputQueue::~V4L2InputQueue()
+{
+    release();
+}
+
+const char* V4L2InputQueue::getMemoryName() const
+{
+    return memoryName(m_memory);
+}
+
+bool V4L2InputQueue::memoryFromName(const std::string& name, enum v4l2_memory& memory)
+{
+    static const enum v4l2_memory memories[] = { V4L2_MEMORY_MMAP, V4L2_MEMORY_USERPTR, V4L2_MEMORY_DMABUF };
+    if (name.empty()) {
+        memory = V4L2_MEMORY_MMAP;
+        return true;
+    }
+    for (size_t i = 0; i < N_ELEMENTS(memories); i++) {
+        if (name == memoryName(memories[i])) {
+            memory = memories[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool V4L2InputQueue::requestBuffers(uint32_t count)
+{
+    struct v4l2_requestbuffers reqbufs;
+    memset(&reqbufs, 0, sizeof(reqbufs));
+    reqbufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    reqbufs.memory = m_memory;
+    reqbufs.count = count;
+    if (m_device->ioctl(VIDIOC_REQBUFS, &reqbufs) == -1 || (count && !reqbufs.count))
+        return false;
+    m_slots.resize(reqbufs.count);
+    return true;
+}
+
+bool V4L2InputQueue::setup(uint32_t count, uint32_t bufferSize)
+{
+    m_bufferSize = bufferSize;
+#ifndef HAVE_UDMABUF
+    if (m_memory == V4L2_MEMORY_DMABUF) {
+        WARNING("built without udmabuf, fall back to mmap input");
+        m_memory = V4L2_MEMORY_MMAP;
+    }
+#endif
+    if (!requestBuffers(count)) {
+        if (m_memory == V4L2_MEMORY_MMAP) {
+            ERROR("request %d input buffers failed", count);
+            return false;
+        }
+        WARNING("device refused %s input, fall back to mmap", memoryName(m_memory));
+        m_memory = V4L2_MEMORY_MMAP;
+        if (!requestBuffers(count)) {
+            ERROR("request %d input buffers failed", count);
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < m_slots.size(); i++) {
+        if (m_memory == V4L2_MEMORY_MMAP && !mapBuffer(i))
+            return false;
+        if (m_memory == V4L2_MEMORY_DMABUF && !createDmaBuf(m_slots[i], bufferSize)) {
+            WARNING("can't create dma-buf for input, fall back to mmap");
+            release();
+            m_memory = V4L2_MEMORY_MMAP;
+            return setup(count, bufferSize);
+        }
+    }
+    DEBUG("%zu %s input buffers", m_slots.size(), memoryName(m_memory));
+    return true;
+}
+
+bool V4L2InputQueue::mapBuffer(uint32_t index)
+{
+    struct v4l2_plane planes[k_inputPlaneCount];
+    struct v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    memset(planes, 0, sizeof(planes));
+    buffer.index = index;
+    buffer.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.m.planes = planes;
+    buffer.length = k_inputPlaneCount;
+    if (m_device->ioctl(VIDIOC_QUERYBUF, &buffer) == -1) {
+        ERROR("query input buffer %d failed", index);
+        return false;
+    }
+
+    // length and mem_offset should be filled by VIDIOC_QUERYBUF above
+    void* address = m_device->mmap(NULL,
+        buffer.m.planes[0].length,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED,
+        buffer.m.planes[0].m.mem_offset);
+    if (!address || address == MAP_FAILED) {
+        ERROR("map input buffer %d failed", index);
+        return false;
+    }
+    Slot& slot = m_slots[index];
+    slot.mapped = static_cast<uint8_t*>(address);
+    slot.length = buffer.m.planes[0].length;
+    DEBUG("input buffer %d = %p", index, slot.mapped);
+    return true;
+}
+
+#ifdef HAVE_UDMABUF
+bool V4L2InputQueue::createDmaBuf(Slot& slot, size_t size)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    size = (size + page - 1) / page * page;
+
+    int dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (dev == -1)
+        return false;
+    int memfd = memfd_create("v4l2input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd == -1) {
+        close(dev);
+        return false;
+    }
+    bool ret = false;
+    //udmabuf wants the size sealed
+    if (!ftruncate(memfd, size) && fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) != -1) {
+        struct udmabuf_create create;
+        memset(&create, 0, sizeof(create));
+        create.memfd = memfd;
+        create.flags = UDMABUF_FLAGS_CLOEXEC;
+        create.size = size;
+        int fd = ioctl(dev, UDMABUF_CREATE, &create);
+        void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        if (fd >= 0 && p != MAP_FAILED) {
+            slot.fd = fd;
+            slot.mapped = static_cast<uint8_t*>(p);
+            slot.length = size;
+            ret = true;
+        } else {
+            if (fd >= 0)
+                close(fd);
+            if (p != MAP_FAILED)
+                munmap(p, size);
+        }
+    }
+    close(memfd);
+    close(dev);
+    return ret;
+}
+#else
+bool V4L2InputQueue::createDmaBuf(Slot&, size_t)
+{
+    return false;
+}
+#endif
+
+bool V4L2InputQueue::fill(uint32_t index, const VideoDecodeBuffer& unit, size_t stable, struct v4l2_plane& plane)
+{
+    Slot& slot = m_slots[index];
+    plane.bytesused = unit.size;
+
+    if (m_memory == V4L2_MEMORY_USERPTR) {
+        //the parser's storage is used as it is, till this slot is dequeued.
+        //the plane can't be shorter than sizeimage, so it may run past the unit
+        if (stable >= unit.size && stable >= m_bufferSize) {
+            plane.m.userptr = (unsigned long)unit.data;
+            plane.length = std::max<size_t>(unit.size, m_bufferSize);
+            m_zeroCopy++;
+            return true;
+        }
+        if (slot.copy.size() < unit.size || slot.copy.size() < m_bufferSize)
+            slot.copy.resize(std::max<size_t>(unit.size, m_bufferSize));
+        memcpy(&slot.copy[0], unit.data, unit.size);
+        plane.m.userptr = (unsigned long)&slot.copy[0];
+        plane.length = slot.copy.size();
+        m_copied++;
+        return true;
+    }
+
+    //mmap and dmabuf buffers have a fixed size
+    if (unit.size > slot.length) {
+        ERROR("decode unit of %zu bytes doesn't fit %s input buffer of %zu, use userptr input",
+            unit.size, memoryName(m_memory), slot.length);
+        return false;
+    }
+    memcpy(slot.mapped, unit.data, unit.size);
+    if (m_memory == V4L2_MEMORY_DMABUF) {
+        plane.m.fd = slot.fd;
+        plane.length = slot.length;
+    } else {
+        plane.m.mem_offset = 0;
+    }
+    m_copied++;
+    return true;
+}
+
+bool V4L2InputQueue::feed(const SharedPtr<DecodeInput>& input, int index)
+{
+    VideoDecodeBuffer inputBuffer;
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[k_inputPlaneCount];
+
+    memset(&inputBuffer, 0, sizeof(inputBuffer));
+    memset(&buf, 0, sizeof(buf));
+    memset(&planes, 0, sizeof(planes));
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE; // it indicates input buffer(raw frame) type
+    buf.memory = m_memory;
+    buf.m.planes = planes;
+    buf.length = k_inputPlaneCount;
+
+    if (index == -1) {
+        if (!dequeue(buf.index))
+            return true;
+    } else {
+        buf.index = index;
+    }
+
+    if (m_eos)
+        return false;
+    if (buf.index >= m_slots.size()) {
+        ERROR("invalid input buffer index %d", buf.index);
+        return false;
+    }
+
+    if (!input->getLoopedDecodeUnit(inputBuffer, m_loop.get())) {
+        // send empty buffer for EOS
+        m_eos = true;
+        memset(&inputBuffer, 0, sizeof(inputBuffer));
+        if (m_memory == V4L2_MEMORY_USERPTR) {
+            Slot& slot = m_slots[buf.index];
+            if (slot.copy.size() < m_bufferSize)
+                slot.copy.resize(std::max<size_t>(m_bufferSize, 1));
+            planes[0].m.userptr = (unsigned long)&slot.copy[0];
+            planes[0].length = slot.copy.size();
+        } else if (m_memory == V4L2_MEMORY_DMABUF) {
+            planes[0].m.fd = m_slots[buf.index].fd;
+            planes[0].length = m_slots[buf.index].length;
+        }
+        planes[0].bytesused = 0;
+    } else {
+        if (!fill(buf.index, inputBuffer, input->getStableSize(inputBuffer.data), planes[0])) {
+            m_eos = true;
+            return false;
+        }
+        m_bytes += inputBuffer.size;
+        buf.flags = inputBuffer.flag;
+    }
+
+    if (m_device->ioctl(VIDIOC_QBUF, &buf) == -1) {
+        ERROR("queue input buffer %d failed, %s", buf.index, strerror(errno));
+        m_eos = true;
+        return false;
+    }
+    m_queued++;
+    return true;
+}
+
+bool V4L2InputQueue::dequeue(uint32_t& index)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[k_inputPlaneCount];
+    memset(&buf, 0, sizeof(buf));
+    memset(&planes, 0, sizeof(planes));
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    buf.memory = m_memory;
+    buf.m.planes = planes;
+    buf.length = k_inputPlaneCount;
+    if (m_device->ioctl(VIDIOC_DQBUF, &buf) == -1)
+        return false;
+    //the device is done with what the slot pointed to
+    m_queued--;
+    index = buf.index;
+    return true;
+}
+
+void V4L2InputQueue::reset()
+{
+    m_queued = 0;
+    m_eos = false;
+}
+
+void V4L2InputQueue::release()
+{
+    if (m_slots.empty())
+        return;
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        Slot& slot = m_slots[i];
+        if (m_memory == V4L2_MEMORY_MMAP && slot.mapped)
+            m_device->munmap(slot.mapped, slot.length);
+        if (m_memory == V4L2_MEMORY_DMABUF) {
+            if (slot.mapped)
+                munmap(slot.mapped, slot.length);
+            if (slot.fd != -1)
+                close(slot.fd);
+        }
+    }
+    requestBuffers(0);
+    m_slots.clear();
+    m_queued = 0;
+}
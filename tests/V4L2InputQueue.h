@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef V4L2InputQueue_h
+#define V4L2InputQueue_h
+
+#include "common/InputLoop.h"
+#include <linux/videodev2.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <Yami.h>
+
+class DecodeInput;
+class V4L2Device;
+
+/**
+ * Compressed side (OUTPUT_MPLANE) of a v4l2 decoder, it only talks to
+ * V4L2Device, so any implementation of it can stand in for the driver.
+ *
+ *  MMAP:    every unit is copied to a driver buffer.
+ *  USERPTR: units of a DecodeInput with stable data are queued as they are,
+ *           if a whole buffer size of it can be read from the unit on, the
+ *           device wants a plane of at least sizeimage. Others are copied
+ *           to memory owned by the slot.
+ *  DMABUF:  slots are udmabuf dma-bufs over a memfd, units are copied in,
+ *           a file mapping can't be exported as dma-buf.
+ * If the device refuses USERPTR or DMABUF we fall back to MMAP.
+ * What a slot points to stays valid until the slot is dequeued.
+ */
+class V4L2InputQueue {
+public:
+    V4L2InputQueue(const SharedPtr<V4L2Device>& device, enum v4l2_memory memory);
+    ~V4L2InputQueue();
+
+    //request buffers, bufferSize is the size we gave in S_FMT
+    bool setup(uint32_t count, uint32_t bufferSize);
+    //index -1: dequeue a used buffer first, true if none is ready
+    //index >= 0: fill the free buffer at index
+    //false at eos or on error
+    bool feed(const SharedPtr<DecodeInput>& input, int index = -1);
+    //take back a buffer the device is done with, false if none is ready
+    bool dequeue(uint32_t& index);
+    //rewind the input at eos while the loop says so
+    void setLoop(const SharedPtr<YamiMediaCodec::InputLoop>& loop) { m_loop = loop; }
+    //unmap and free all buffers
+    void release();
+    //forget about queued buffers after STREAMOFF
+    void reset();
+
+    enum v4l2_memory getMemory() const { return m_memory; }
+    const char* getMemoryName() const;
+    //"mmap", "userptr" or "dmabuf", an empty name is mmap
+    static bool memoryFromName(const std::string& name, enum v4l2_memory& memory);
+    uint32_t getCount() const { return m_slots.size(); }
+    //buffers in the device
+    int32_t getQueued() const { return m_queued; }
+    bool isEOS() const { return m_eos; }
+    uint64_t getBytes() const { return m_bytes; }
+    //units queued without a copy, and copied
+    uint64_t getZeroCopyCount() const { return m_zeroCopy; }
+    uint64_t getCopyCount() const { return m_copied; }
+
+private:
+    struct Slot {
+        Slot();
+        //MMAP and DMABUF, where the device reads from
+        uint8_t* mapped;
+        size_t length;
+        int fd;
+        //USERPTR copy fallback
+        std::vector<uint8_t> copy;
+    };
+
+    bool requestBuffers(uint32_t count);
+    bool mapBuffer(uint32_t index);
+    bool createDmaBuf(Slot& slot, size_t size);
+    //put the unit somewhere the device can read it
+    //stable: DecodeInput::getStableSize() of the unit
+    bool fill(uint32_t index, const VideoDecodeBuffer& unit, size_t stable, struct v4l2_plane& plane);
+
+    SharedPtr<V4L2Device> m_device;
+    enum v4l2_memory m_memory;
+    uint32_t m_bufferSize;
+    std::vector<Slot> m_slots;
+    int32_t m_queued;
+    bool m_eos;
+    uint64_t m_bytes;
+    uint64_t m_zeroCopy;
+    uint64_t m_copied;
+    SharedPtr<YamiMediaCodec::InputLoop> m_loop;
+};
+
+#endif //V4L2InputQueue_h
@@ -191,6 +191,66 @@ bool V4L2Renderer::onFormatChanged()
     return true;
 }
 
+//no display, frames go back to the decoder as they come, for headless runs
+class NullRenderer : public V4L2Renderer {
+public:
+    NullRenderer(const SharedPtr<V4L2Device>& device, VideoDataMemoryType memoryType)
+        : V4L2Renderer(device, memoryType)
+        , m_count(0)
+    {
+    }
+    bool setDisplay()
+    {
+        return true;
+    }
+    bool setupOutputBuffers(uint32_t width, uint32_t height, uint32_t dpbSize)
+    {
+        if (!dpbSize) {
+            if (!getDpbSize(dpbSize)) {
+                ERROR("get dpb size failed");
+                return false;
+            }
+        }
+        m_dpbSize = dpbSize;
+        m_count = dpbSize + kExtraOutputFrameCount;
+        if (!requestBuffers(m_count)) {
+            ERROR("requestBuffers failed");
+            return false;
+        }
+        m_width = width;
+        m_height = height;
+        return queueOutputBuffersAtStart(m_count);
+    }
+    bool queueOutputBuffers()
+    {
+        return queueOutputBuffersAtStart(m_count);
+    }
+
+private:
+    bool render(uint32_t& index)
+    {
+        return true;
+    }
+    bool queueOutputBuffersAtStart(uint32_t count)
+    {
+        for (uint32_t i = 0; i < count; i++) {
+            if (!queueBuffer(i))
+                return false;
+        }
+        return true;
+    }
+    bool resizeWindow(uint32_t width, uint32_t height)
+    {
+        return true;
+    }
+    void destroyOutputBuffers()
+    {
+        m_count = 0;
+    }
+
+    uint32_t m_count;
+};
+
 #ifdef __ENABLE_X11__
 #include <X11/Xlib.h>
 class X11Renderer : public V4L2Renderer {
@@ -563,6 +623,10 @@ private:
 SharedPtr<V4L2Renderer> V4L2Renderer::create(const SharedPtr<V4L2Device>& device, VideoDataMemoryType memoryType)
 {
     SharedPtr<V4L2Renderer> renderer;
+    if (memoryType == VIDEO_DATA_MEMORY_TYPE_RAW_COPY) {
+        renderer.reset(new NullRenderer(device, memoryType));
+        return renderer;
+    }
 #ifdef __ENABLE_X11__
     if (memoryType == VIDEO_DATA_MEMORY_TYPE_EXTERNAL_DMA_BUF)
         renderer.reset(new ExternalDmaBufRenderer(device, memoryType));
@@ -22,19 +22,30 @@
 #include "decodeoutput.h"
 #include "decodehelp.h"
 
+#include "common/InputLoop.h"
+#include "common/lock.h"
+#include "common/latency.h"
+#include "common/StatsSink.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
 
-SharedPtr<VppInput> createInput(DecodeParameter& para, SharedPtr<NativeDisplay>& display)
+SharedPtr<VppInput> createInput(DecodeParameter& para, SharedPtr<NativeDisplay>& display, const SharedPtr<InputLoop>& loop)
 {
     SharedPtr<VppInput> input(VppInput::create(para.inputFile, para.renderFourcc, para.width, para.height, para.useCAPI));
     if (!input) {
         fprintf(stderr, "VppInput create failed.\n");
         return input;
     }
+    //before config, it reads the first frame
+    input->setLoop(loop);
     if(para.useCAPI){
         SharedPtr<VppInputDecodeCapi> inputDecode = DynamicPointerCast<VppInputDecodeCapi>(input);
         if (inputDecode && inputDecode->config(*display))
@@ -55,19 +66,18 @@ SharedPtr<VppInput> createInput(DecodeParameter& para, SharedPtr<NativeDisplay>&
 
 class DecodeTest {
 public:
-    bool init(int argc, char** argv)
+    bool init(const DecodeParameter& params)
     {
-        if (!processCmdLine(argc, argv, &m_params)) {
-            fprintf(stderr, "process arguments failed.\n");
-            return false;
-        }
-        m_output.reset(DecodeOutput::create(m_params.renderMode, m_params.renderFourcc, m_params.inputFile, m_params.outputFile.c_str()));
+        m_params = params;
+        m_output.reset(DecodeOutput::create(m_params.renderMode, m_params.renderFourcc, m_params.inputFile, m_params.outputFile.c_str(),
+            m_params.segmentFrames, m_params.segmentBytes, m_params.segmentPattern.empty() ? NULL : m_params.segmentPattern.c_str()));
         if (!m_output) {
             fprintf(stderr, "DecodeOutput::create failed.\n");
             return false;
         }
         m_nativeDisplay = m_output->nativeDisplay();
-        m_vppInput = createInput(m_params, m_nativeDisplay);
+        m_loop.reset(new InputLoop(m_params.loopCount, m_params.loopSeconds));
+        m_vppInput = createInput(m_params, m_nativeDisplay, m_loop);
 
         if (!m_nativeDisplay || !m_vppInput) {
             fprintf(stderr, "DecodeTest init failed.\n");
@@ -78,35 +88,337 @@ public:
     bool run()
     {
         FpsCalc fps;
+        StageTimer timer;
+        StatsSink stats("yamidecode");
+        if (!m_params.statsTarget.empty()
+            && !stats.open(m_params.statsTarget.c_str(), m_params.statsFormat.empty() ? NULL : m_params.statsFormat.c_str(), m_params.statsInterval))
+            return false;
+        stats.setStageTimer(&timer);
+        uint64_t bytesOut = 0;
         SharedPtr<VideoFrame> src;
         uint32_t count = 0;
+        m_loop->start();
+        timer.begin();
+        bool ok = true;
         while (m_vppInput->read(src)) {
-            if (!m_output->output(src))
+            timer.mark(StageTimer::STAGE_DECODE);
+            if (!m_output->output(src)) {
+                ok = false;
                 break;
+            }
+            timer.mark(StageTimer::STAGE_WRITE);
+            timer.end();
             count++;
             fps.addFrame();
+            if (stats.isOpen()) {
+                //decoded bytes. No pool stats, the surfaces are the decoder's
+                uint32_t planes, width[3], height[3];
+                if (getPlaneResolution(src->fourcc, src->crop.width, src->crop.height, width, height, planes)) {
+                    for (uint32_t i = 0; i < planes; i++)
+                        bytesOut += width[i] * height[i];
+                }
+                stats.addFrames();
+                stats.setBytesIn(m_vppInput->getBytesRead());
+                stats.setBytesOut(bytesOut);
+                stats.tick();
+            }
             if (count == m_params.renderFrames)
                 break;
+            timer.begin();
         }
         fps.log();
+        m_loop->log("yamidecode");
+        timer.log("yamidecode");
+        stats.close();
 
         possibleWait(m_vppInput->getMimeType(), &m_params);
 
-        return true;
+        return ok;
     }
 
 private:
     SharedPtr<DecodeOutput> m_output;
     SharedPtr<NativeDisplay> m_nativeDisplay;
     SharedPtr<VppInput> m_vppInput;
+    SharedPtr<InputLoop> m_loop;
+    DecodeParameter m_params;
+};
+
+//counts the decoder's frames that are not released yet, and the peak of it
+class HeldFrames {
+public:
+    HeldFrames()
+        : m_count(new Count)
+    {
+    }
+    //the frame to hand on, released frames are counted
+    SharedPtr<VideoFrame> hold(const SharedPtr<VideoFrame>& frame)
+    {
+        Count& count = *m_count;
+        uint32_t held = __atomic_add_fetch(&count.held, 1, __ATOMIC_RELAXED);
+        uint32_t peak = __atomic_load_n(&count.peak, __ATOMIC_RELAXED);
+        while (held > peak && !__atomic_compare_exchange_n(&count.peak, &peak, held, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+        return SharedPtr<VideoFrame>(frame.get(), Release(m_count, frame));
+    }
+    uint32_t peak() const { return __atomic_load_n(&m_count->peak, __ATOMIC_RELAXED); }
+
+private:
+    struct Count {
+        Count()
+            : held(0)
+            , peak(0)
+        {
+        }
+        uint32_t held;
+        uint32_t peak;
+    };
+    class Release {
+    public:
+        Release(const SharedPtr<Count>& count, const SharedPtr<VideoFrame>& frame)
+            : m_count(count)
+            , m_frame(frame)
+        {
+        }
+        void operator()(VideoFrame*)
+        {
+            m_frame.reset();
+            __atomic_sub_fetch(&m_count->held, 1, __ATOMIC_RELAXED);
+        }
+
+    private:
+        SharedPtr<Count> m_count;
+        SharedPtr<VideoFrame> m_frame;
+    };
+    SharedPtr<Count> m_count;
+};
+
+//one input of the multi stream mode, decoded by a single thread
+class DecodeStream {
+public:
+    //index: output files in the -o directory start with it, inputs may share a name
+    DecodeStream(const DecodeParameter& params, char* inputFile, size_t index)
+        : m_params(params)
+        , m_frames(0)
+        , m_start(0)
+        , m_end(0)
+        , m_ok(false)
+    {
+        m_params.inputFile = inputFile;
+        const char* base = strrchr(inputFile, '/');
+        char name[PATH_MAX];
+        snprintf(name, sizeof(name), "%u_%s", (unsigned)index, base ? base + 1 : inputFile);
+        m_outputName = name;
+        int width, height;
+        if (guessResolution(inputFile, width, height)) {
+            m_params.width = width;
+            m_params.height = height;
+        }
+    }
+    bool init(const SharedPtr<VADisplay>& display)
+    {
+        //the output only takes its file name from the input name
+        m_output.reset(DecodeOutput::create(m_params.renderMode, m_params.renderFourcc, m_outputName.c_str(), m_params.outputFile.c_str(),
+            m_params.segmentFrames, m_params.segmentBytes, m_params.segmentPattern.empty() ? NULL : m_params.segmentPattern.c_str(),
+            display));
+        if (!m_output) {
+            fprintf(stderr, "%s: DecodeOutput::create failed.\n", m_params.inputFile);
+            return false;
+        }
+        m_nativeDisplay = m_output->nativeDisplay();
+        if (!m_nativeDisplay) {
+            fprintf(stderr, "%s: no native display.\n", m_params.inputFile);
+            return false;
+        }
+        m_loop.reset(new InputLoop(m_params.loopCount, m_params.loopSeconds));
+        m_vppInput = createInput(m_params, m_nativeDisplay, m_loop);
+        return bool(m_vppInput);
+    }
+    //false if the output failed
+    bool run()
+    {
+        SharedPtr<VideoFrame> src;
+        m_start = getMonotonicNs();
+        //streams waiting for a thread don't use up their duration
+        m_loop->start();
+        m_ok = true;
+        m_timer.begin();
+        while (m_vppInput->read(src)) {
+            m_timer.mark(StageTimer::STAGE_DECODE);
+            src = m_held.hold(src);
+            if (!m_output->output(src)) {
+                m_ok = false;
+                break;
+            }
+            src.reset();
+            m_timer.mark(StageTimer::STAGE_WRITE);
+            m_timer.end();
+            m_frames++;
+            if (m_frames == m_params.renderFrames)
+                break;
+            m_timer.begin();
+        }
+        m_end = getMonotonicNs();
+        //release decoder and output in this thread, they may be big
+        m_vppInput.reset();
+        m_output.reset();
+        return m_ok;
+    }
+    uint32_t frames() const { return m_frames; }
+    const char* inputFile() const { return m_params.inputFile; }
+    void report()
+    {
+        double seconds = (m_end - m_start) / 1e9;
+        //a frame is timed from the read of it to the end of its output,
+        //and the next read starts right away, so this is the frame interval,
+        //not the time a bitstream buffer spends in the decoder
+        const LatencyHistogram& interval = m_timer.frame();
+        //surfaces held by us and the output, the decoder's own use is not seen
+        printf("%s: %d frames, %.2f fps, frame interval(ms) p50 %.2f p95 %.2f p99 %.2f max %.2f, at most %d surfaces held%s\n",
+            m_params.inputFile, m_frames, seconds > 0 ? m_frames / seconds : 0,
+            interval.percentile(50) / 1e6, interval.percentile(95) / 1e6, interval.percentile(99) / 1e6,
+            interval.max() / 1e6, m_held.peak(), m_ok ? "" : ", output failed");
+        m_loop->log(m_params.inputFile);
+    }
+    const StageTimer& timer() const { return m_timer; }
+
+private:
     DecodeParameter m_params;
+    std::string m_outputName;
+    SharedPtr<DecodeOutput> m_output;
+    SharedPtr<NativeDisplay> m_nativeDisplay;
+    SharedPtr<VppInput> m_vppInput;
+    SharedPtr<InputLoop> m_loop;
+    StageTimer m_timer;
+    HeldFrames m_held;
+    uint32_t m_frames;
+    uint64_t m_start;
+    uint64_t m_end;
+    bool m_ok;
+};
+
+//decode many streams in one process, with a thread for each running stream
+class MultiDecodeTest {
+public:
+    MultiDecodeTest()
+        : m_next(0)
+        , m_frames(0)
+        , m_failed(0)
+    {
+    }
+    bool init(const DecodeParameter& params)
+    {
+        if (params.renderMode > 0) {
+            fprintf(stderr, "multiple inputs only support render mode -2, -1 and 0\n");
+            return false;
+        }
+        if (params.renderMode != -1) {
+            struct stat buf;
+            if (stat(params.outputFile.c_str(), &buf) || !S_ISDIR(buf.st_mode)) {
+                fprintf(stderr, "multiple inputs need a directory for -o\n");
+                return false;
+            }
+        }
+        if (!params.separateDisplay) {
+            m_display = createVADisplay();
+            if (!m_display)
+                return false;
+        }
+        //a stream is opened by the thread that runs it, so only m_threads
+        //decoders and outputs exist at a time
+        for (size_t i = 0; i < params.inputFiles.size(); i++)
+            m_streams.push_back(SharedPtr<DecodeStream>(new DecodeStream(params, params.inputFiles[i], i)));
+        m_threads = params.threads;
+        if (!m_threads || m_threads > m_streams.size())
+            m_threads = m_streams.size();
+        printf("decode %d streams with %d threads on %s\n", (int)m_streams.size(), m_threads,
+            params.separateDisplay ? "separate displays" : "a shared display");
+        return true;
+    }
+    //false if any stream failed
+    bool run()
+    {
+        std::vector<pthread_t> threads(m_threads);
+        uint64_t begin = getMonotonicNs();
+        for (uint32_t i = 0; i < m_threads; i++) {
+            if (pthread_create(&threads[i], NULL, start, this)) {
+                ERROR("create thread failed");
+                m_threads = i;
+                break;
+            }
+        }
+        //no thread at all, nothing ran
+        if (!m_threads)
+            return false;
+        for (uint32_t i = 0; i < m_threads; i++)
+            pthread_join(threads[i], NULL);
+        double seconds = (getMonotonicNs() - begin) / 1e9;
+
+        printf("total: %d streams, %d frames, %.2f fps", (int)m_streams.size(), m_frames, seconds > 0 ? m_frames / seconds : 0);
+        if (m_failed)
+            printf(", %d failed", m_failed);
+        printf("\n");
+        m_total.log("all streams");
+        return !m_failed;
+    }
+
+private:
+    static void* start(void* test)
+    {
+        ((MultiDecodeTest*)test)->loop();
+        return NULL;
+    }
+    void loop()
+    {
+        while (1) {
+            SharedPtr<DecodeStream> stream;
+            {
+                AutoLock lock(m_lock);
+                if (m_next >= m_streams.size())
+                    return;
+                stream.swap(m_streams[m_next++]);
+            }
+            if (!stream->init(m_display)) {
+                AutoLock lock(m_lock);
+                fprintf(stderr, "%s: init failed\n", stream->inputFile());
+                m_failed++;
+                continue;
+            }
+            bool ok = stream->run();
+            AutoLock lock(m_lock);
+            stream->report();
+            m_frames += stream->frames();
+            m_total.merge(stream->timer());
+            if (!ok)
+                m_failed++;
+        }
+    }
+
+    SharedPtr<VADisplay> m_display;
+    std::vector<SharedPtr<DecodeStream> > m_streams;
+    uint32_t m_threads;
+    Lock m_lock;
+    size_t m_next;
+    uint32_t m_frames;
+    uint32_t m_failed;
+    StageTimer m_total;
 };
 
 int main(int argc, char* argv[])
 {
+    DecodeParameter params;
+    if (!processCmdLine(argc, argv, &params)) {
+        fprintf(stderr, "process arguments failed.\n");
+        return 1;
+    }
+    if (params.inputFiles.size() > 1) {
+        MultiDecodeTest decode;
+        if (!decode.init(params))
+            return 1;
+        return decode.run() ? 0 : 1;
+    }
     DecodeTest decode;
-    if (!decode.init(argc, argv))
+    if (!decode.init(params))
         return 1;
-    decode.run();
-    return 0;
+    return decode.run() ? 0 : 1;
 }
@@ -20,6 +20,7 @@
 #include "decodehelp.h"
 
 #include "common/utils.h"
+#include "common/trace.h"
 
 #include <ctype.h>
 #include <limits.h>
@@ -35,14 +36,14 @@ using namespace YamiMediaCodec;
 static void printHelp(const char* app)
 {
     printf("%s <options>\n", app);
-    printf("   -i media file to decode\n");
+    printf("   -i media file to decode, repeat it to decode multiple streams concurrently\n");
     printf("   -w wait before quit: 0:no-wait, 1:auto(jpeg wait), 2:wait\n");
     printf("   -f dumped fourcc [*]\n");
     printf("   -o dumped output dir\n");
     printf("   -n specify how many frames to be decoded\n");
     printf("   -m <render mode>\n");
     printf("     -2: print MD5 by per frame and the whole decoded file MD5\n");
-    printf("     -1: skip video rendering [*]\n");
+    printf("     -1: skip video rendering\n");
     printf("      0: dump video frame to file [*]\n");
     printf("      1: render to X window [*]\n");
     printf("      2: texture: render to Pixmap + texture from Pixmap [*]\n");
@@ -56,6 +57,65 @@ static void printHelp(const char* app)
     printf("      0: decode all layers\n");
     printf("    N>0: decode the first N layers\n");
     printf("  --lowlatency: if set this flag to true, AVC decoder will output the ready frames ASAP\n");
+    printf("  --segment-frames <N>: dump mode only, start a new output file every N frames, 1 for one file per frame\n");
+    printf("  --segment-bytes <K>: dump mode only, start a new output file before it exceeds K bytes, k/m/g suffix allowed\n");
+    printf("  --segment-pattern <pattern>: printf style name for segments, like out_%%05d.yuv\n");
+    printf("      default: index is inserted before the extension of the dumped file name\n");
+    printf("  --threads <N>: with multiple -i, how many streams are decoded at the same time, default: all of them\n");
+    printf("  --separate-display: with multiple -i, create a VADisplay for each stream instead of sharing one\n");
+    printf("  --stats <file|fd:N>: write periodic stats (frames, fps, bytes, stage latency) to file or fd, single input only\n");
+    printf("  --stats-format <json|csv>: default: csv for .csv file, else json lines\n");
+    printf("  --stats-interval <ms>: how often stats are written, default 1000\n");
+    printf("  --trace <file.json>: record pipeline stages, write a chrome trace (chrome://tracing, ui.perfetto.dev) on exit\n");
+    printf("  --input-memory <mmap|userptr|dmabuf>: v4l2decode only, how compressed data goes to the device, default mmap\n");
+    printf("      userptr: queue the parsed data without a copy when the input can keep it\n");
+    printf("  --loop <N>: decode the input N times without restarting the decoder, 0 for no limit\n");
+    printf("  --duration <S>: stop after S seconds, the input is looped until then unless --loop is given\n");
+    printf(" YAMI_V4L2_FAKE=<spec> in the environment runs v4l2decode on a software device, no codec needed\n");
+    printf("      spec: latency=<us>,resize=<frames>,size=<w>x<h>,dpb=<n>,buffers=<n>, may be empty\n");
+}
+
+static bool parseBytes(const char* str, uint64_t& bytes)
+{
+    char* end;
+    //strtoull takes "-1" as a huge number
+    if (*str == '-')
+        return false;
+    bytes = strtoull(str, &end, 10);
+    if (end == str)
+        return false;
+    switch (tolower(*end)) {
+    case 'g':
+        bytes <<= 10;
+    case 'm':
+        bytes <<= 10;
+    case 'k':
+        bytes <<= 10;
+        end++;
+        break;
+    default:
+        break;
+    }
+    return *end == '\0';
+}
+
+//only one integer conversion is allowed in the pattern
+static bool isValidSegmentPattern(const char* pattern)
+{
+    int conversions = 0;
+    for (const char* p = pattern; *p; p++) {
+        if (*p != '%')
+            continue;
+        p++;
+        if (*p == '%')
+            continue;
+        while (*p == '0' || *p == '-' || isdigit(*p))
+            p++;
+        if (*p != 'd' && *p != 'u')
+            return false;
+        conversions++;
+    }
+    return conversions == 1;
 }
 
 bool processCmdLine(int argc, char** argv, DecodeParameter* parameters)
@@ -67,17 +127,37 @@ bool processCmdLine(int argc, char** argv, DecodeParameter* parameters)
     parameters->waitBeforeQuit = 1;
     parameters->renderMode = 1;
     parameters->inputFile = NULL;
+    parameters->inputFiles.clear();
     parameters->useCAPI = false;
     parameters->temporalLayer = 0;
     parameters->spacialLayer = 0;
     parameters->qualityLayer = 0;
     parameters->enableLowLatency = false;
+    parameters->segmentFrames = 0;
+    parameters->segmentBytes = 0;
+    parameters->threads = 0;
+    parameters->separateDisplay = false;
+    parameters->statsInterval = 1000;
+    parameters->loopCount = -1;
+    parameters->loopSeconds = 0;
 
     const struct option long_opts[] = {
         { "help", no_argument, NULL, 'h' },
         { "capi", no_argument, NULL, 0 },
         { "temporal-layer", required_argument, NULL, 0 },
         { "lowlatency", no_argument, 0, 0 },
+        { "segment-frames", required_argument, NULL, 0 },
+        { "segment-bytes", required_argument, NULL, 0 },
+        { "segment-pattern", required_argument, NULL, 0 },
+        { "threads", required_argument, NULL, 0 },
+        { "separate-display", no_argument, NULL, 0 },
+        { "stats", required_argument, NULL, 0 },
+        { "stats-format", required_argument, NULL, 0 },
+        { "stats-interval", required_argument, NULL, 0 },
+        { "trace", required_argument, NULL, 0 },
+        { "input-memory", required_argument, NULL, 0 },
+        { "loop", required_argument, NULL, 0 },
+        { "duration", required_argument, NULL, 0 },
         { NULL, no_argument, NULL, 0 }
     };
 
@@ -89,7 +169,9 @@ bool processCmdLine(int argc, char** argv, DecodeParameter* parameters)
             printHelp(argv[0]);
             return false;
         case 'i':
-            parameters->inputFile = optarg;
+            if (!parameters->inputFile)
+                parameters->inputFile = optarg;
+            parameters->inputFiles.push_back(optarg);
             break;
         case 'w':
             parameters->waitBeforeQuit = atoi(optarg);
@@ -124,6 +206,63 @@ bool processCmdLine(int argc, char** argv, DecodeParameter* parameters)
             case 3:
                 parameters->enableLowLatency = true;
                 break;
+            case 4:
+                if (atoi(optarg) < 1) {
+                    fprintf(stderr, "invalid segment frames: %s\n", optarg);
+                    return false;
+                }
+                parameters->segmentFrames = atoi(optarg);
+                break;
+            case 5:
+                if (!parseBytes(optarg, parameters->segmentBytes) || !parameters->segmentBytes) {
+                    fprintf(stderr, "invalid segment size: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 6:
+                if (!isValidSegmentPattern(optarg)) {
+                    fprintf(stderr, "segment pattern needs exactly one %%d: %s\n", optarg);
+                    return false;
+                }
+                parameters->segmentPattern = optarg;
+                break;
+            case 7:
+                parameters->threads = atoi(optarg);
+                break;
+            case 8:
+                parameters->separateDisplay = true;
+                break;
+            case 9:
+                parameters->statsTarget = optarg;
+                break;
+            case 10:
+                parameters->statsFormat = optarg;
+                break;
+            case 11:
+                parameters->statsInterval = atoi(optarg);
+                break;
+            case 12:
+                if (!Trace::instance().open(optarg))
+                    return false;
+                break;
+            case 13:
+                //checked by V4L2InputQueue, which knows the names
+                parameters->inputMemory = optarg;
+                break;
+            case 14:
+                parameters->loopCount = atoi(optarg);
+                if (parameters->loopCount < 0) {
+                    fprintf(stderr, "invalid loop count: %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 15:
+                if (atoi(optarg) < 0) {
+                    fprintf(stderr, "invalid duration: %s\n", optarg);
+                    return false;
+                }
+                parameters->loopSeconds = atoi(optarg);
+                break;
             default:
                 printHelp(argv[0]);
                 break;
@@ -148,6 +287,20 @@ bool processCmdLine(int argc, char** argv, DecodeParameter* parameters)
         fprintf(stderr, "no input media file specified.\n");
         return false;
     }
+    bool segmented = parameters->segmentFrames || parameters->segmentBytes;
+    if (!parameters->segmentPattern.empty() && !segmented) {
+        fprintf(stderr, "--segment-pattern needs --segment-frames or --segment-bytes\n");
+        return false;
+    }
+    if (segmented && parameters->renderMode != 0) {
+        fprintf(stderr, "--segment-frames and --segment-bytes only work with -m 0\n");
+        return false;
+    }
+    //the streams run on their own threads, and there is one sink
+    if (parameters->inputFiles.size() > 1 && !parameters->statsTarget.empty()) {
+        fprintf(stderr, "--stats works with a single input only\n");
+        return false;
+    }
     if (outputFile.empty())
         outputFile = "./";
     parameters->outputFile = outputFile;
@@ -18,9 +18,15 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 typedef struct DecodeParameter {
     char* inputFile;
+    //all -i given, more than one means multi stream mode
+    std::vector<char*> inputFiles;
+    //multi stream mode: concurrent decode loops, and display sharing
+    uint32_t threads;
+    bool separateDisplay;
     int width;
     int height;
     short renderMode;
@@ -35,6 +41,24 @@ typedef struct DecodeParameter {
 
     //if set this flag to true, AVC decoder will output the ready frames ASAP.
     bool enableLowLatency;
+
+    //split dumped output, a new file every N frames or K bytes. 0 means no limit
+    uint32_t segmentFrames;
+    uint64_t segmentBytes;
+    std::string segmentPattern;
+
+    //machine readable stats, a file or fd:N. Empty means off
+    std::string statsTarget;
+    std::string statsFormat;
+    uint32_t statsInterval;
+
+    //v4l2decode input buffers: mmap, userptr or dmabuf. Empty means mmap
+    std::string inputMemory;
+
+    //play the input this many times, 0 for no limit, -1 if not given.
+    //stop feeding after loopSeconds, 0 for no limit
+    int loopCount;
+    uint32_t loopSeconds;
 } StreamParameter;
 
 bool processCmdLine(int argc, char** argv, DecodeParameter* parameters);
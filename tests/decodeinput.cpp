@@ -20,6 +20,10 @@
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "decodeinput.h"
 #include "common/NonCopyable.h"
 #include "common/log.h"
@@ -40,6 +44,7 @@ public:
     virtual bool isEOS() {return m_parseToEOS;}
     virtual bool init() = 0;
     virtual const string& getCodecData();
+    virtual bool rewind();
 protected:
     std::ifstream m_ifs;
     uint8_t *m_buffer;
@@ -68,7 +73,15 @@ class DecodeInputRaw:public MyDecodeInput
 public:
     DecodeInputRaw();
     ~DecodeInputRaw();
+    bool initInput(const char* fileName);
     bool init();
+    size_t getStableSize(const uint8_t* data)
+    {
+        if (!m_mapped || data < m_mapped || data >= m_mapped + m_mappedSize)
+            return 0;
+        return m_mapped + m_mappedSize - data;
+    }
+    bool rewind();
     bool ensureBufferData();
     int32_t scanForStartCode(const uint8_t * data, uint32_t offset, uint32_t size);
     bool getNextDecodeUnit(VideoDecodeBuffer &inputBuffer);
@@ -78,6 +91,11 @@ public:
     uint32_t m_lastReadOffset; // data has been consumed by decoder already
     uint32_t m_availableData;  // available data in m_buffer
     uint32_t StartCodeSize;
+
+private:
+    //whole file mapped, units point into it
+    uint8_t* m_mapped;
+    size_t m_mappedSize;
 };
 
 class DecodeInputH26x:public DecodeInputRaw
@@ -97,6 +115,7 @@ public:
     ~DecodeInputJPEG();
     const char * getMimeType();
     bool isSyncWord(const uint8_t* buf);
+    bool rewind();
 private:
     int m_countSOI;
     int m_skipBytes;
@@ -154,6 +173,25 @@ DecodeInput* DecodeInput::create(const char* fileName)
     return input;
 }
 
+bool DecodeInput::getLoopedDecodeUnit(VideoDecodeBuffer& inputBuffer, InputLoop* loop)
+{
+    if (!loop)
+        return getNextDecodeUnit(inputBuffer);
+    if (loop->expired())
+        return false;
+    if (getNextDecodeUnit(inputBuffer))
+        return true;
+    //the decoder just sees a longer stream
+    if (!loop->again())
+        return false;
+    if (!rewind()) {
+        WARNING("the input can't be rewound, no more loops");
+        return false;
+    }
+    loop->addPass();
+    return getNextDecodeUnit(inputBuffer);
+}
+
 void DecodeInput::setResolution(const uint16_t width, const uint16_t height)
 {
   m_width = width;
@@ -185,6 +223,16 @@ bool MyDecodeInput::initInput(const char* fileName)
     return init();
 }
 
+bool MyDecodeInput::rewind()
+{
+    m_ifs.clear();
+    if (!m_ifs.seekg(0, std::ios::beg))
+        return false;
+    m_readToEOS = false;
+    m_parseToEOS = false;
+    return init();
+}
+
 const string& MyDecodeInput::getCodecData()
 {
     //no codec data;
@@ -267,11 +315,58 @@ bool DecodeInputVPX::getNextDecodeUnit(VideoDecodeBuffer &inputBuffer)
 DecodeInputRaw::DecodeInputRaw()
     : m_lastReadOffset(0)
     , m_availableData(0)
+    , m_mapped(NULL)
+    , m_mappedSize(0)
 {
 }
 
 DecodeInputRaw::~DecodeInputRaw()
 {
+    if (m_mapped) {
+        munmap(m_mapped, m_mappedSize);
+        m_buffer = NULL;
+    }
+}
+
+//map a regular file instead of reading it to the cache buffer,
+//no refill copies, and units stay valid for the input's lifetime
+bool DecodeInputRaw::initInput(const char* fileName)
+{
+    struct stat st;
+    //don't open pipes here, that would eat the writer. Offsets are 32 bits
+    int fd = -1;
+    if (!stat(fileName, &st) && S_ISREG(st.st_mode))
+        fd = open(fileName, O_RDONLY);
+    if (fd != -1) {
+        if (!fstat(fd, &st) && st.st_size > 0 && (uint64_t)st.st_size < UINT32_MAX) {
+            void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                m_mapped = static_cast<uint8_t*>(p);
+                m_mappedSize = st.st_size;
+                madvise(p, m_mappedSize, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+    }
+    if (!m_mapped)
+        return MyDecodeInput::initInput(fileName);
+
+    m_buffer = m_mapped;
+    m_availableData = m_mappedSize;
+    m_readToEOS = true;
+    return init();
+}
+
+bool DecodeInputRaw::rewind()
+{
+    m_lastReadOffset = 0;
+    if (!m_mapped) {
+        m_availableData = 0;
+        return MyDecodeInput::rewind();
+    }
+    //the whole file is still there
+    m_parseToEOS = false;
+    return init();
 }
 
 bool DecodeInputRaw::init()
@@ -400,6 +495,14 @@ const char *DecodeInputJPEG::getMimeType()
     return YAMI_MIME_JPEG;
 }
 
+bool DecodeInputJPEG::rewind()
+{
+    m_countSOI = 0;
+    m_skipBytes = 0;
+    m_needPayloadLength = false;
+    return DecodeInputRaw::rewind();
+}
+
 bool DecodeInputJPEG::isSyncWord(const uint8_t* buf)
 {
     if (m_skipBytes > 0) {
@@ -16,6 +16,7 @@
 #ifndef decodeinput_h
 #define decodeinput_h
 
+#include "common/InputLoop.h"
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -33,6 +34,14 @@ public:
     virtual const string& getCodecData() = 0;
     virtual uint16_t getWidth() {return m_width;}
     virtual uint16_t getHeight() {return m_height;}
+    //bytes from data on, data from getNextDecodeUnit, that stay valid and readable
+    //until the input is destroyed, so a device can take them without a copy. 0 if none
+    virtual size_t getStableSize(const uint8_t* /*data*/) { return 0; }
+    //start again from the first unit, false if the input can't seek, a pipe for example
+    virtual bool rewind() { return false; }
+    //getNextDecodeUnit(), but rewinds at EOF while the loop says so.
+    //loop may be NULL, false at the last EOS or when the duration is up
+    bool getLoopedDecodeUnit(VideoDecodeBuffer& inputBuffer, YamiMediaCodec::InputLoop* loop);
 
 protected:
     virtual bool initInput(const char* fileName) = 0;
@@ -151,6 +151,19 @@ bool DecodeInputAvFormat::getNextDecodeUnit(VideoDecodeBuffer &inputBuffer)
     return false;
 }
 
+bool DecodeInputAvFormat::rewind()
+{
+    if (!m_format)
+        return false;
+    int64_t start = m_format->start_time == (int64_t)AV_NOPTS_VALUE ? 0 : m_format->start_time;
+    if (av_seek_frame(m_format, -1, start, AVSEEK_FLAG_BACKWARD) < 0) {
+        ERROR("seek to the start failed");
+        return false;
+    }
+    m_isEos = false;
+    return true;
+}
+
 const string& DecodeInputAvFormat::getCodecData()
 {
     return m_codecData;
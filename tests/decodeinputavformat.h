@@ -40,6 +40,7 @@ public:
     virtual const char * getMimeType();
     virtual bool getNextDecodeUnit(VideoDecodeBuffer &inputBuffer);
     virtual const string& getCodecData();
+    virtual bool rewind();
 
 protected:
     virtual bool initInput(const char* fileName);
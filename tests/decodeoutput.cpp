@@ -21,6 +21,10 @@
 #include "decodeoutput.h"
 #include "common/log.h"
 #include "common/VaapiUtils.h"
+#include "common/VaapiImageCache.h"
+#include "common/condition.h"
+#include "common/lock.h"
+#include "common/trace.h"
 
 extern "C" {
 #include "md5.h"
@@ -43,7 +47,10 @@ extern "C" {
 #include <va/va.h>
 #include <va/va_drmcommon.h>
 #include <vector>
+#include <deque>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <pthread.h>
 #include <sstream>
 #include <assert.h>
 #include <fstream>
@@ -95,7 +102,8 @@ public:
 
 bool DecodeOutputNull::init()
 {
-    m_vaDisplay = createVADisplay();
+    if (!m_vaDisplay)
+        m_vaDisplay = createVADisplay();
     if (!m_vaDisplay)
         return false;
     return DecodeOutput::init();
@@ -109,21 +117,32 @@ bool DecodeOutputNull::output(const SharedPtr<VideoFrame>& frame)
 
 class ColorConvert {
 public:
-    ColorConvert(const SharedPtr<VADisplay>& display, uint32_t fourcc)
+    ColorConvert(const SharedPtr<VADisplay>& display, uint32_t fourcc, int poolSize = 3)
         : m_width(0)
         , m_height(0)
         , m_destFourcc(fourcc)
         , m_display(display)
-
+        , m_images(*display)
     {
-        m_allocator.reset(new PooledFrameAllocator(m_display, 3));
+        m_allocator.reset(new PooledFrameAllocator(m_display, poolSize));
     }
     SharedPtr<VideoFrame> convert(const SharedPtr<VideoFrame>& src)
     {
 
-        if (src->fourcc == m_destFourcc)
+        if (!needConvert(src))
             return src;
-
+        return copy(src);
+    }
+    //copy() keeps the size, only the fourcc may change
+    bool needConvert(const SharedPtr<VideoFrame>& src) const
+    {
+        return src->fourcc != m_destFourcc;
+    }
+    //always return a frame from our own pool, even if the fourcc is same.
+    //So the caller can hold it without starving the decoder.
+    SharedPtr<VideoFrame> copy(const SharedPtr<VideoFrame>& src)
+    {
+        TRACE_SCOPE("ColorConvert::copy");
         SharedPtr<VideoFrame> dest;
         uint32_t width = src->crop.width;
         uint32_t height = src->crop.height;
@@ -132,6 +151,10 @@ public:
             return dest;
         }
         dest = m_allocator->alloc();
+        if (!dest) {
+            ERROR("no free surface in convert pool");
+            return dest;
+        }
         YamiStatus status = m_vpp->process(src, dest);
         if (status != YAMI_SUCCESS) {
             ERROR("vpp process return %d", status);
@@ -139,20 +162,20 @@ public:
         }
         return dest;
     }
-    //collect all bytes to dest
-    bool convert(vector<uint8_t>& dest, const SharedPtr<VideoFrame>& frame)
+    //receives the visible bytes of each row, straight from the mapped image
+    class RowConsumer {
+    public:
+        virtual void consume(const uint8_t* data, uint32_t size) = 0;
+        virtual ~RowConsumer() {}
+    };
+
+    //stream all visible rows to consumer, no intermediate copy
+    bool convert(RowConsumer& consumer, const SharedPtr<VideoFrame>& frame)
     {
+        TRACE_SCOPE("ColorConvert::convert");
         SharedPtr<VideoFrame> src = convert(frame);
         if (!src)
             return false;
-        dest.clear();
-        VAImage image;
-        uint8_t* p = mapSurfaceToImage(*m_display, src->surface, image);
-        if (!p) {
-            ERROR("failed to map VAImage");
-            return false;
-        }
-
         uint32_t planes, width[3], height[3];
         uint32_t xByte[3], yByte[3];
         if (!getPlaneResolution(src->fourcc, src->crop.width, src->crop.height, width, height, planes)) {
@@ -163,20 +186,74 @@ public:
             ERROR("get left-top coordinate failed");
             return false;
         }
+        //only surfaces of our own pool stay mapped. The decoder renders
+        //into its own again, and reallocates them on format changes
+        VAImage image;
+        uint8_t* p;
+        SharedPtr<ScopedImageMapping> mapping;
+        if (src != frame) {
+            p = m_images.map(src, image);
+        }
+        else {
+            mapping.reset(new ScopedImageMapping(*m_display, src));
+            p = mapping->data();
+            image = mapping->image();
+        }
+        if (!p) {
+            ERROR("failed to map VAImage");
+            return false;
+        }
         for (uint32_t i = 0; i < planes; i++) {
-            copyPlane(dest, p, image.offsets[i] + yByte[i] * image.pitches[i], width[i], height[i], image.pitches[i], xByte[i]);
+            copyPlane(consumer, p, image.offsets[i] + yByte[i] * image.pitches[i], width[i], height[i], image.pitches[i], xByte[i]);
         }
-        unmapImage(*m_display, image);
+        return true;
+    }
+
+    //copy() of this frame reallocates the pool, frames from it must be released first
+    bool willReset(const SharedPtr<VideoFrame>& src) const
+    {
+        return src->crop.width != m_width || src->crop.height != m_height;
+    }
+
+    //collect all bytes to dest, dest is sized once and reused across frames
+    bool convert(vector<uint8_t>& dest, const SharedPtr<VideoFrame>& frame)
+    {
+        BufferConsumer consumer(dest);
+        if (!convert(consumer, frame))
+            return false;
+        dest.resize(consumer.size());
         return true;
     }
 
 private:
-    static void copyPlane(std::vector<uint8_t>& v, uint8_t* data, uint32_t offset, uint32_t width,
+    class BufferConsumer : public RowConsumer {
+    public:
+        BufferConsumer(vector<uint8_t>& buffer)
+            : m_buffer(buffer)
+            , m_size(0)
+        {
+        }
+        void consume(const uint8_t* data, uint32_t size)
+        {
+            //only grows on the first frame or a resolution change
+            if (m_buffer.size() < m_size + size)
+                m_buffer.resize(m_size + size);
+            memcpy(&m_buffer[m_size], data, size);
+            m_size += size;
+        }
+        size_t size() const { return m_size; }
+
+    private:
+        vector<uint8_t>& m_buffer;
+        size_t m_size;
+    };
+
+    static void copyPlane(RowConsumer& consumer, uint8_t* data, uint32_t offset, uint32_t width,
         uint32_t height, uint32_t pitch, uint32_t widthOffset)
     {
-        data += offset;
+        data += offset + widthOffset;
         for (uint32_t h = 0; h < height; h++) {
-            v.insert(v.end(), data + widthOffset, data + width + widthOffset);
+            consumer.consume(data, width);
             data += pitch;
         }
     }
@@ -186,6 +263,8 @@ private:
         if (m_width != width || m_height != height) {
             m_width = width;
             m_height = height;
+            //pool is reallocated, old surface ids are not valid any more
+            m_images.clear();
             if (!m_allocator->setFormat(m_destFourcc, width, height)) {
                 fprintf(stderr, "m_allocator setFormat failed\n");
                 return false;
@@ -207,12 +286,15 @@ private:
     SharedPtr<VADisplay> m_display;
     SharedPtr<FrameAllocator> m_allocator;
     SharedPtr<IVideoPostProcess> m_vpp;
+    //must be destroyed before the pool
+    VaapiImageCache m_images;
 };
 
 class DecodeOutputFile : public DecodeOutput {
 public:
     DecodeOutputFile(const char* outputFile, const char* inputFile, uint32_t fourcc)
         : m_destFourcc(fourcc)
+        , m_convertPoolSize(3)
         , m_inputFile(inputFile)
         , m_outputFile(outputFile)
     {
@@ -222,6 +304,7 @@ public:
 
 protected:
     uint32_t m_destFourcc;
+    int m_convertPoolSize;
     const char* m_inputFile;
     const char* m_outputFile;
     SharedPtr<ColorConvert> m_convert;
@@ -229,18 +312,41 @@ protected:
 
 bool DecodeOutputFile::init()
 {
-    m_vaDisplay = createVADisplay();
+    if (!m_vaDisplay)
+        m_vaDisplay = createVADisplay();
     if (!m_vaDisplay)
         return false;
-    m_convert.reset(new ColorConvert(m_vaDisplay, m_destFourcc));
+    m_convert.reset(new ColorConvert(m_vaDisplay, m_destFourcc, m_convertPoolSize));
     return DecodeOutput::init();
 }
 
+//frames waiting for the writer thread, each of them holds a convert surface
+#define DUMP_QUEUE_SIZE 4
+
 class DecodeOutputDump : public DecodeOutputFile {
 public:
-    DecodeOutputDump(const char* outputFile, const char* inputFile, uint32_t fourcc)
+    DecodeOutputDump(const char* outputFile, const char* inputFile, uint32_t fourcc,
+        uint32_t segmentFrames, uint64_t segmentBytes, const char* segmentPattern)
         : DecodeOutputFile(outputFile, inputFile, fourcc)
+        , m_outputWidth(0)
+        , m_outputHeight(0)
+        , m_segmentFrames(segmentFrames)
+        , m_segmentBytes(segmentBytes)
+        , m_segmentPattern(segmentPattern ? segmentPattern : "")
+        , m_segmentIndex(0)
+        , m_segmentFrameCount(0)
+        , m_segmentByteCount(0)
+        , m_notFull(m_lock)
+        , m_notEmpty(m_lock)
+        , m_threadStarted(false)
+        , m_eos(false)
+        , m_error(false)
+        , m_frames(0)
+        , m_waits(0)
+        , m_waitTime(0)
     {
+        //one is converting, one is writing, the rest are queued
+        m_convertPoolSize = DUMP_QUEUE_SIZE + 2;
     }
     ~DecodeOutputDump();
 
@@ -251,11 +357,122 @@ private:
     void resetConvert(uint32_t fourcc);
     bool isI420Dest();
     std::string getOutputFileName(uint32_t width, uint32_t height, uint32_t fourcc);
+    bool writeDirect(const SharedPtr<VideoFrame>& frame);
     SharedPtr<VppOutput> m_output;
+    SharedPtr<VaapiFrameWriter> m_writer;
+    std::string m_outputName;
+    uint32_t m_outputWidth;
+    uint32_t m_outputHeight;
+
+    //segmented output, a new file every m_segmentFrames frames or m_segmentBytes bytes
+    bool isSegmented();
+    std::string getSegmentFileName(uint32_t index);
+    bool openOutput();
+    bool rotateOutput(const SharedPtr<VideoFrame>& frame);
+    uint32_t m_segmentFrames;
+    uint64_t m_segmentBytes;
+    std::string m_segmentPattern;
+    uint32_t m_segmentIndex;
+    uint32_t m_segmentFrameCount;
+    uint64_t m_segmentByteCount;
+
+    //writer thread, overlaps readback and disk write with decoding
+    bool startWriter();
+    void stopWriter();
+    static void* writerEntry(void* dump);
+    void writerLoop();
+    //wait until all queued frames are written, false on write errors
+    bool drainWriter();
+
+    Lock m_lock;
+    Condition m_notFull;
+    Condition m_notEmpty;
+    std::deque<SharedPtr<VideoFrame> > m_queue;
+    pthread_t m_thread;
+    bool m_threadStarted;
+    bool m_eos;
+    bool m_error;
+
+    //how often the decoder waited on the writer
+    uint32_t m_frames;
+    uint32_t m_waits;
+    uint64_t m_waitTime;
 };
 
 DecodeOutputDump::~DecodeOutputDump()
 {
+    stopWriter();
+    if (m_frames) {
+        fprintf(stderr, "dump: %d frames, decoder waited on writer %d times, %.2f ms total\n",
+            m_frames, m_waits, m_waitTime / 1000.0);
+    }
+}
+
+bool DecodeOutputDump::startWriter()
+{
+    if (pthread_create(&m_thread, NULL, writerEntry, this)) {
+        ERROR("create writer thread failed");
+        return false;
+    }
+    m_threadStarted = true;
+    return true;
+}
+
+void DecodeOutputDump::stopWriter()
+{
+    if (!m_threadStarted)
+        return;
+    {
+        AutoLock lock(m_lock);
+        m_eos = true;
+        m_notEmpty.signal();
+    }
+    pthread_join(m_thread, NULL);
+    m_threadStarted = false;
+}
+
+bool DecodeOutputDump::drainWriter()
+{
+    AutoLock lock(m_lock);
+    //the writer pops a frame after it released it
+    while (!m_queue.empty() && !m_error)
+        m_notFull.wait();
+    return !m_error;
+}
+
+void* DecodeOutputDump::writerEntry(void* dump)
+{
+    ((DecodeOutputDump*)dump)->writerLoop();
+    return NULL;
+}
+
+void DecodeOutputDump::writerLoop()
+{
+    while (1) {
+        SharedPtr<VideoFrame> frame;
+        {
+            AutoLock lock(m_lock);
+            while (m_queue.empty()) {
+                //drain all queued frames before quit
+                if (m_eos)
+                    return;
+                m_notEmpty.wait();
+            }
+            frame = m_queue.front();
+        }
+        bool ret = rotateOutput(frame) && m_output->output(frame);
+        frame.reset();
+        AutoLock lock(m_lock);
+        //pop after write, so the surface is not reused by convert before we finish it
+        m_queue.pop_front();
+        m_notFull.signal();
+        if (!ret) {
+            ERROR("write frame failed");
+            m_error = true;
+            m_queue.clear();
+            return;
+        }
+    }
 }
 
 std::string DecodeOutputDump::getOutputFileName(uint32_t width, uint32_t height, uint32_t fourcc)
@@ -263,7 +480,7 @@ std::string DecodeOutputDump::getOutputFileName(uint32_t width, uint32_t height,
     std::ostringstream name;
     struct stat buf;
     int r = stat(m_outputFile, &buf);
-    if (r == 0 && buf.st_mode & S_IFDIR) {
+    if (r == 0 && S_ISDIR(buf.st_mode)) {
         //If user only assign a directory, we should choose fourcc base on first frame.
         resetConvert(fourcc);
         const char* baseFileName = m_inputFile;
@@ -289,26 +506,92 @@ void DecodeOutputDump::resetConvert(uint32_t fourcc)
     else {
         m_destFourcc = fourcc;
     }
-    m_convert.reset(new ColorConvert(m_vaDisplay, m_destFourcc));
+    m_convert.reset(new ColorConvert(m_vaDisplay, m_destFourcc, m_convertPoolSize));
+}
+
+bool DecodeOutputDump::isSegmented()
+{
+    return m_segmentFrames || m_segmentBytes;
+}
+
+std::string DecodeOutputDump::getSegmentFileName(uint32_t index)
+{
+    char name[PATH_MAX];
+    if (!m_segmentPattern.empty()) {
+        snprintf(name, sizeof(name), m_segmentPattern.c_str(), index);
+        return name;
+    }
+    //insert the index before extension, so the fourcc can still be guessed from it
+    std::string base = m_outputName;
+    std::string ext;
+    size_t dot = base.rfind('.');
+    size_t slash = base.rfind('/');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        ext = base.substr(dot);
+        base = base.substr(0, dot);
+    }
+    snprintf(name, sizeof(name), "%s_%05u%s", base.c_str(), index, ext.c_str());
+    return name;
+}
+
+bool DecodeOutputDump::openOutput()
+{
+    std::string name = isSegmented() ? getSegmentFileName(m_segmentIndex) : m_outputName;
+    //close the old one first, so the finished segment is complete on disk
+    m_output.reset();
+    m_output = VppOutput::create(name.c_str(), m_destFourcc, m_outputWidth, m_outputHeight);
+    SharedPtr<VppOutputFile> outputFile = DynamicPointerCast<VppOutputFile>(m_output);
+    if (!outputFile) {
+        ERROR("maybe you set a wrong extension");
+        return false;
+    }
+    if (!m_writer)
+        m_writer.reset(new VaapiFrameWriter(m_vaDisplay));
+    if (!outputFile->config(m_writer)) {
+        ERROR("config writer failed");
+        return false;
+    }
+    DEBUG("dump to %s", name.c_str());
+    return true;
+}
+
+//called from writer thread, or from writeDirect() while it is idle
+bool DecodeOutputDump::rotateOutput(const SharedPtr<VideoFrame>& frame)
+{
+    if (!isSegmented())
+        return true;
+    uint32_t planes, width[3], height[3];
+    if (!getPlaneResolution(frame->fourcc, frame->crop.width, frame->crop.height, width, height, planes))
+        return false;
+    uint64_t frameBytes = 0;
+    for (uint32_t i = 0; i < planes; i++)
+        frameBytes += width[i] * height[i];
+
+    bool full = (m_segmentFrames && m_segmentFrameCount >= m_segmentFrames)
+        || (m_segmentBytes && m_segmentFrameCount && m_segmentByteCount + frameBytes > m_segmentBytes);
+    if (full) {
+        m_segmentIndex++;
+        m_segmentFrameCount = 0;
+        m_segmentByteCount = 0;
+        if (!openOutput())
+            return false;
+    }
+    m_segmentFrameCount++;
+    m_segmentByteCount += frameBytes;
+    return true;
 }
 
 bool DecodeOutputDump::initOutput(const SharedPtr<VideoFrame>& frame)
 {
     uint32_t width = frame->crop.width;
     uint32_t height = frame->crop.height;
-    if (!m_output) {
-        std::string name = getOutputFileName(width, height, frame->fourcc);
-        m_output = VppOutput::create(name.c_str(), m_destFourcc, width, height);
-        SharedPtr<VppOutputFile> outputFile = DynamicPointerCast<VppOutputFile>(m_output);
-        if (!outputFile) {
-            ERROR("maybe you set a wrong extension");
+    //after the writer started, only the writer touches m_output
+    if (m_outputName.empty()) {
+        m_outputName = getOutputFileName(width, height, frame->fourcc);
+        m_outputWidth = width;
+        m_outputHeight = height;
+        if (!openOutput())
             return false;
-        }
-        SharedPtr<FrameWriter> writer(new VaapiFrameWriter(m_vaDisplay));
-        if (!outputFile->config(writer)) {
-            ERROR("config writer failed");
-            return false;
-        }
     }
     return DecodeOutputFile::setVideoSize(width, height);
 }
@@ -322,8 +605,60 @@ bool DecodeOutputDump::output(const SharedPtr<VideoFrame>& frame)
 {
     if (!initOutput(frame))
         return false;
-    SharedPtr<VideoFrame> dest = m_convert->convert(frame);
-    return m_output->output(dest);
+    if (!m_threadStarted && !startWriter())
+        return false;
+
+    if (!m_convert->needConvert(frame))
+        return writeDirect(frame);
+
+    //the old surfaces are gone after this, so are their mappings.
+    //The writer must be done with every queued frame before that
+    if (m_convert->willReset(frame)) {
+        if (!drainWriter())
+            return false;
+        m_writer->resetCache();
+    }
+    //the writer may hold the frame for a while, do not keep decoder's surface
+    SharedPtr<VideoFrame> dest = m_convert->copy(frame);
+    if (!dest)
+        return false;
+
+    AutoLock lock(m_lock);
+    if (m_queue.size() >= DUMP_QUEUE_SIZE && !m_error) {
+        struct timeval start, end;
+        gettimeofday(&start, NULL);
+        m_waits++;
+        while (m_queue.size() >= DUMP_QUEUE_SIZE && !m_error)
+            m_notFull.wait();
+        gettimeofday(&end, NULL);
+        m_waitTime += (end.tv_sec - start.tv_sec) * 1000000ULL + end.tv_usec - start.tv_usec;
+    }
+    if (m_error)
+        return false;
+    m_queue.push_back(dest);
+    m_notEmpty.signal();
+    m_frames++;
+    return true;
+}
+
+//no conversion, so no gpu copy either. The decoder's surface is written on
+//this thread, queued it would be held away from the decoder
+bool DecodeOutputDump::writeDirect(const SharedPtr<VideoFrame>& frame)
+{
+    //the writer thread is idle once its queue is empty
+    if (!drainWriter())
+        return false;
+    m_writer->setKeepMapped(false);
+    bool ret = rotateOutput(frame) && m_output->output(frame);
+    m_writer->setKeepMapped(true);
+    if (!ret) {
+        ERROR("write frame failed");
+        AutoLock lock(m_lock);
+        m_error = true;
+        return false;
+    }
+    m_frames++;
+    return true;
 }
 
 class DecodeOutputMD5 : public DecodeOutputFile {
@@ -332,6 +667,7 @@ public:
         : DecodeOutputFile(outputFile, inputFile, fourcc)
         , m_file()
     {
+        memset(&m_fileMD5, 0, sizeof(m_fileMD5));
     }
     virtual ~DecodeOutputMD5();
 
@@ -343,13 +679,30 @@ private:
     std::string getOutputFileName(uint32_t width, uint32_t height);
     std::string writeToFile(MD5_CTX&);
 
+    //feeds rows to the per-frame and the whole-file MD5 at once
+    class MD5Consumer : public ColorConvert::RowConsumer {
+    public:
+        MD5Consumer(MD5_CTX& frame, MD5_CTX& file)
+            : m_frame(frame)
+            , m_file(file)
+        {
+        }
+        void consume(const uint8_t* data, uint32_t size)
+        {
+            MD5_Update(&m_frame, data, size);
+            MD5_Update(&m_file, data, size);
+        }
+
+    private:
+        MD5_CTX& m_frame;
+        MD5_CTX& m_file;
+    };
+
     std::ofstream m_file;
-    static MD5_CTX m_fileMD5;
-    vector<uint8_t> m_data;
+    //per output, so concurrent streams do not mix their hashes
+    MD5_CTX m_fileMD5;
 };
 
-MD5_CTX DecodeOutputMD5::m_fileMD5 = { 0 };
-
 std::string DecodeOutputMD5::getOutputFileName(uint32_t width, uint32_t height)
 {
     std::ostringstream name;
@@ -357,7 +710,7 @@ std::string DecodeOutputMD5::getOutputFileName(uint32_t width, uint32_t height)
     name << m_outputFile;
     struct stat buf;
     int r = stat(m_outputFile, &buf);
-    if (r == 0 && buf.st_mode & S_IFDIR) {
+    if (r == 0 && S_ISDIR(buf.st_mode)) {
         const char* fileName = m_inputFile;
         const char* s = strrchr(m_inputFile, '/');
         if (s)
@@ -415,16 +768,13 @@ bool DecodeOutputMD5::output(const SharedPtr<VideoFrame>& frame)
     if (frame->fourcc == YAMI_FOURCC_P010)
         m_convert.reset(new ColorConvert(m_vaDisplay, YAMI_FOURCC_P010));
 
-    if (!m_convert->convert(m_data, frame))
-        return false;
-
     MD5_CTX frameMD5;
     MD5_Init(&frameMD5);
-    MD5_Update(&frameMD5, &m_data[0], m_data.size());
+    MD5Consumer consumer(frameMD5, m_fileMD5);
+    if (!m_convert->convert(consumer, frame))
+        return false;
     writeToFile(frameMD5);
 
-    MD5_Update(&m_fileMD5, &m_data[0], m_data.size());
-
     return true;
 }
 
@@ -901,7 +1251,9 @@ DecodeOutputWayland::~DecodeOutputWayland()
 }
 #endif
 
-DecodeOutput* DecodeOutput::create(int renderMode, uint32_t fourcc, const char* inputFile, const char* outputFile)
+DecodeOutput* DecodeOutput::create(int renderMode, uint32_t fourcc, const char* inputFile, const char* outputFile,
+    uint32_t segmentFrames, uint64_t segmentBytes, const char* segmentPattern,
+    const SharedPtr<VADisplay>& display)
 {
     DecodeOutput* output;
     switch (renderMode) {
@@ -912,7 +1264,7 @@ DecodeOutput* DecodeOutput::create(int renderMode, uint32_t fourcc, const char*
         output = new DecodeOutputNull();
         break;
     case 0:
-        output = new DecodeOutputDump(outputFile, inputFile, fourcc);
+        output = new DecodeOutputDump(outputFile, inputFile, fourcc, segmentFrames, segmentBytes, segmentPattern);
         break;
 #ifdef __ENABLE_X11__
     case 1:
@@ -940,6 +1292,8 @@ DecodeOutput* DecodeOutput::create(int renderMode, uint32_t fourcc, const char*
         fprintf(stderr, "renderMode:%d, do not support this render mode\n", renderMode);
         return NULL;
     }
+    //only file and null outputs can share the display, others create from their window system
+    output->m_vaDisplay = display;
     if (!output->init())
         fprintf(stderr, "DecodeOutput init failed\n");
     return output;
@@ -26,7 +26,11 @@
 class DecodeOutput
 {
 public:
-    static DecodeOutput* create(int renderMode, uint32_t fourcc, const char* inputFile, const char* outputFile);
+    //segmentFrames/segmentBytes split the dumped file, only render mode 0 uses them
+    //display: reuse an existing display for render mode -2, -1, 0. Create a new one if it's null
+    static DecodeOutput* create(int renderMode, uint32_t fourcc, const char* inputFile, const char* outputFile,
+        uint32_t segmentFrames = 0, uint64_t segmentBytes = 0, const char* segmentPattern = NULL,
+        const SharedPtr<VADisplay>& display = SharedPtr<VADisplay>());
     virtual bool output(const SharedPtr<VideoFrame>& frame) = 0;
     SharedPtr<NativeDisplay> nativeDisplay();
     virtual ~DecodeOutput() {}
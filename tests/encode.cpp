@@ -27,53 +27,37 @@
 #if __ENABLE_X11__
 #include <X11/Xlib.h>
 #endif
+#ifndef ANDROID
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#endif
+#include "common/InputLoop.h"
 #include "common/log.h"
+#include "common/StatsSink.h"
+#include "common/utils.h"
+#ifndef ANDROID
+#include "common/latency.h"
+#include "common/lock.h"
+#include "common/ThreadPool.h"
+#endif
 #include <Yami.h>
 #include "encodeinput.h"
 #include "encodehelp.h"
 
 using namespace YamiMediaCodec;
 
-int main(int argc, char** argv)
+//creates and starts an encoder with the command line parameters
+static IVideoEncoder* createEncoder(const char* mimeType, NativeDisplay& nativeDisplay,
+    uint32_t width, uint32_t height)
 {
-    IVideoEncoder *encoder = NULL;
-    uint32_t maxOutSize = 0;
-    EncodeInput* input;
-    EncodeOutput* output;
-    Encode_Status status;
-    VideoFrameRawData inputBuffer;
-    VideoEncOutputBuffer outputBuffer;
-    int encodeFrameCount = 0;
-
-    memset(&outputBuffer, 0, sizeof(VideoEncOutputBuffer));
-    if (!process_cmdline(argc, argv))
-        return -1;
-
-    DEBUG("inputFourcc: %.4s codec is %s", (char*)(&(inputFourcc)), codec);
-    input = EncodeInput::create(inputFileName, inputFourcc, videoWidth, videoHeight);
-    if (!input) {
-        fprintf (stderr, "fail to init input stream\n");
-        return -1;
-    }
-
-    videoWidth = input->getWidth();
-    videoHeight = input->getHeight();
-    if (YAMI_FOURCC_P010 == input->getFourcc())
-        bitDepth = 10;
-
-    output = EncodeOutput::create(outputFileName, videoWidth, videoHeight, fps, codec);
-    if (!output) {
-        fprintf (stderr, "fail to init output stream\n");
-        delete input;
-        return -1;
-    }
-
-    encoder = createVideoEncoder(output->getMimeType());
-    assert(encoder != NULL);
-
-    NativeDisplay nativeDisplay;
-    nativeDisplay.type = NATIVE_DISPLAY_DRM;
-    nativeDisplay.handle = -1;
+    IVideoEncoder* encoder = createVideoEncoder(mimeType);
+    if (!encoder)
+        return NULL;
     encoder->setNativeDisplay(&nativeDisplay);
 
     //configure encoding parameters
@@ -81,6 +65,8 @@ int main(int argc, char** argv)
     encVideoParams.size = sizeof(VideoParamsCommon);
     encoder->getParameters(VideoParamsTypeCommon, &encVideoParams);
     setEncoderParameters(&encVideoParams);
+    encVideoParams.resolution.width = width;
+    encVideoParams.resolution.height = height;
     encVideoParams.size = sizeof(VideoParamsCommon);
     encoder->setParameters(VideoParamsTypeCommon, &encVideoParams);
 
@@ -102,7 +88,7 @@ int main(int argc, char** argv)
 
     // configure AVC encoding parameters
     VideoParamsAVC encVideoParamsAVC;
-    if (!strcmp(output->getMimeType(), YAMI_MIME_H264)) {
+    if (!strcmp(mimeType, YAMI_MIME_H264)) {
         encVideoParamsAVC.size = sizeof(VideoParamsAVC);
         encoder->getParameters(VideoParamsTypeAVC, &encVideoParamsAVC);
         encVideoParamsAVC.idrInterval = idrInterval;
@@ -112,7 +98,7 @@ int main(int argc, char** argv)
 
     // configure VP9 encoding parameters
     VideoParamsVP9 encVideoParamsVP9;
-    if (!strcmp(output->getMimeType(), YAMI_MIME_VP9)) {
+    if (!strcmp(mimeType, YAMI_MIME_VP9)) {
         encoder->getParameters(VideoParamsTypeVP9, &encVideoParamsVP9);
         encVideoParamsVP9.referenceMode = referenceMode;
         encoder->setParameters(VideoParamsTypeVP9, &encVideoParamsVP9);
@@ -123,8 +109,553 @@ int main(int argc, char** argv)
     streamFormat.streamFormat = AVC_STREAM_FORMAT_ANNEXB;
     encoder->setParameters(VideoConfigTypeAVCStreamFormat, &streamFormat);
 
-    status = encoder->start();
-    assert(status == ENCODE_SUCCESS);
+    if (encoder->start() != ENCODE_SUCCESS) {
+        releaseVideoEncoder(encoder);
+        return NULL;
+    }
+    return encoder;
+}
+
+#ifndef ANDROID
+//a missed slot is filled with the next frame, longer stalls restart the pacing
+static const uint32_t kMaxDuplicates = 4;
+//frames waiting for one encoder, the camera's newer frames are dropped past this
+static const uint32_t kMaxQueuedFrames = 3;
+//a camera with nothing to give for this long is given up
+static const int kPollTimeoutMs = 2000;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void onInterrupt(int)
+{
+    interrupted = 1;
+}
+
+//test.264 and /dev/video2 give test_video2.264
+static std::string cameraOutputName(const char* output, const char* device)
+{
+    const char* node = strrchr(device, '/');
+    node = node ? node + 1 : device;
+    std::string name(output);
+    size_t dot = name.rfind('.');
+    size_t slash = name.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = name.size();
+    name.insert(dot, std::string("_") + node);
+    return name;
+}
+
+//one dequeued camera buffer, it's queued back when the last encode of it is done
+struct CapturedFrame {
+    CapturedFrame(EncodeInputCamera* camera, const VideoFrameRawData& raw,
+        const SharedPtr<VideoFrame>& surface, uint64_t time)
+        : camera(camera)
+        , raw(raw)
+        , surface(surface)
+        , time(time)
+    {
+    }
+    ~CapturedFrame()
+    {
+        //the surface gives its buffer back by itself
+        if (!surface)
+            camera->recycleOneFrameInput(raw);
+    }
+    EncodeInputCamera* camera;
+    VideoFrameRawData raw;
+    SharedPtr<VideoFrame> surface;
+    uint64_t time;
+    DISALLOW_COPY_AND_ASSIGN(CapturedFrame);
+};
+
+//each encode of a surface gets its own VideoFrame, they share the captured frame
+struct CapturedFrameHolder {
+    explicit CapturedFrameHolder(const SharedPtr<CapturedFrame>& frame)
+        : m_frame(frame)
+    {
+    }
+    void operator()(VideoFrame* frame)
+    {
+        delete frame;
+    }
+
+private:
+    SharedPtr<CapturedFrame> m_frame;
+};
+
+/**
+ * One camera and its encoder. capture() runs on the poll thread, it paces
+ * frames to the -f rate and queues them. The queue is encoded on a pool
+ * thread, one task per camera at a time, so the encoder is never shared.
+ */
+class CameraStream {
+public:
+    explicit CameraStream(const char* device)
+        : m_device(device)
+        , m_encoder(NULL)
+        , m_maxOutSize(0)
+        , m_zeroCopy(false)
+        , m_scheduled(false)
+        , m_nextSlot(-1)
+        , m_captured(0)
+        , m_submitted(0)
+        , m_dropped(0)
+        , m_duplicated(0)
+        , m_skipped(0)
+        , m_encoded(0)
+        , m_ok(true)
+    {
+        memset(&m_outputBuffer, 0, sizeof(m_outputBuffer));
+    }
+
+    ~CameraStream()
+    {
+        //frames go back to the camera before it's closed
+        m_jobs.clear();
+        if (m_encoder) {
+            m_encoder->stop();
+            releaseVideoEncoder(m_encoder);
+        }
+        free(m_outputBuffer.data);
+        m_camera.reset();
+    }
+
+    bool init(EncodeInputCamera::CameraDataMode mode)
+    {
+        m_camera.reset(new EncodeInputCamera);
+        m_camera->setDataMode(mode);
+        if (!m_camera->init(m_device, inputFourcc, videoWidth, videoHeight)) {
+            fprintf(stderr, "fail to init camera %s\n", m_device);
+            return false;
+        }
+        m_camera->setBlocking(false);
+        int width = m_camera->getWidth();
+        int height = m_camera->getHeight();
+
+        std::string name = cameraOutputName(outputFileName, m_device);
+        m_output.reset(EncodeOutput::create(name.c_str(), width, height, fps, codec));
+        if (!m_output) {
+            fprintf(stderr, "fail to init output stream %s\n", name.c_str());
+            return false;
+        }
+
+        NativeDisplay nativeDisplay;
+        m_zeroCopy = m_camera->getNativeDisplay(nativeDisplay);
+        if (!m_zeroCopy) {
+            nativeDisplay.type = NATIVE_DISPLAY_DRM;
+            nativeDisplay.handle = -1;
+        }
+        m_encoder = createEncoder(m_output->getMimeType(), nativeDisplay, width, height);
+        if (!m_encoder) {
+            fprintf(stderr, "fail to create encoder for %s\n", m_device);
+            return false;
+        }
+        m_encoder->getMaxOutSize(&m_maxOutSize);
+        if (!createOutputBuffer(&m_outputBuffer, m_maxOutSize)) {
+            fprintf(stderr, "fail to create output\n");
+            return false;
+        }
+        printf("%s: %dx%d to %s%s\n", m_device, width, height, name.c_str(), m_zeroCopy ? ", zero copy" : "");
+        return true;
+    }
+
+    int getFd() const { return m_camera->getFd(); }
+    bool done() const { return frameCount && m_submitted >= (uint32_t)frameCount; }
+
+    //takes every ready frame, slot n of the output is at start + n * interval
+    bool capture(uint64_t start, uint64_t interval, ThreadPool& pool)
+    {
+        bool got = false;
+        while (!done()) {
+            VideoFrameRawData raw;
+            SharedPtr<VideoFrame> surface;
+            memset(&raw, 0, sizeof(raw));
+            if (m_zeroCopy ? !m_camera->getOneFrame(surface) : !m_camera->getOneFrameInput(raw))
+                break;
+            uint64_t now = getMonotonicNs();
+            SharedPtr<CapturedFrame> frame(new CapturedFrame(m_camera.get(), raw, surface, now));
+            got = true;
+            m_captured++;
+
+            int64_t slot = (now - start) / interval;
+            if (m_nextSlot < 0)
+                m_nextSlot = slot;
+            if (slot < m_nextSlot) {
+                //the camera is faster than the target rate
+                m_dropped++;
+                continue;
+            }
+            uint32_t repeat = 1;
+            if (slot - m_nextSlot > kMaxDuplicates) {
+                m_skipped += slot - m_nextSlot;
+                m_nextSlot = slot;
+            } else {
+                repeat += slot - m_nextSlot;
+            }
+
+            bool schedule = false;
+            {
+                AutoLock lock(m_lock);
+                if (m_jobs.size() >= kMaxQueuedFrames) {
+                    //the encoder can't keep up, the slot is lost
+                    m_dropped++;
+                    m_skipped += slot + 1 - m_nextSlot;
+                    m_nextSlot = slot + 1;
+                    continue;
+                }
+                for (uint32_t i = 0; i < repeat && !done(); i++) {
+                    Job job = { frame, (uint64_t)m_nextSlot++ };
+                    m_jobs.push_back(job);
+                    m_submitted++;
+                    if (i)
+                        m_duplicated++;
+                }
+                if (!m_scheduled)
+                    schedule = m_scheduled = true;
+            }
+            if (schedule)
+                pool.post(SharedPtr<ThreadPool::Task>(new EncodeTask(this)));
+        }
+        return got;
+    }
+
+    bool finish()
+    {
+        m_encoder->flush();
+        writeOutput(true);
+        return m_ok;
+    }
+
+    void report(double seconds)
+    {
+        printf("%s: %d captured, %d encoded, %d dropped, %d duplicated, %d slots skipped, %.2f fps%s\n",
+            m_device, m_captured, m_encoded, m_dropped, m_duplicated, m_skipped,
+            seconds > 0 ? m_encoded / seconds : 0, m_ok ? "" : ", encode failed");
+        m_latency.log("latency");
+    }
+
+    uint32_t encoded() const { return m_encoded; }
+    const LatencyHistogram& latency() const { return m_latency; }
+
+private:
+    struct Job {
+        SharedPtr<CapturedFrame> frame;
+        uint64_t pts;
+    };
+
+    class EncodeTask : public ThreadPool::Task {
+    public:
+        explicit EncodeTask(CameraStream* stream)
+            : m_stream(stream)
+        {
+        }
+        void run() { m_stream->encodeQueued(); }
+
+    private:
+        CameraStream* m_stream;
+    };
+
+    void encodeQueued()
+    {
+        while (1) {
+            Job job;
+            {
+                AutoLock lock(m_lock);
+                if (m_jobs.empty()) {
+                    m_scheduled = false;
+                    return;
+                }
+                job = m_jobs.front();
+                m_jobs.pop_front();
+            }
+            encode(job);
+        }
+    }
+
+    void encode(const Job& job)
+    {
+        Encode_Status status;
+        m_captureTimes[job.pts] = job.frame->time;
+        if (m_zeroCopy) {
+            SharedPtr<VideoFrame> frame(new VideoFrame(*job.frame->surface), CapturedFrameHolder(job.frame));
+            frame->timeStamp = job.pts;
+            status = m_encoder->encode(frame);
+        } else {
+            VideoFrameRawData raw = job.frame->raw;
+            raw.timeStamp = job.pts;
+            status = m_encoder->encode(&raw);
+        }
+        if (status != ENCODE_SUCCESS) {
+            ERROR("%s: encode frame %" PRIu64 " failed, %d", m_device, job.pts, status);
+            m_captureTimes.erase(job.pts);
+            m_ok = false;
+            return;
+        }
+        writeOutput(false);
+    }
+
+    void writeOutput(bool drain)
+    {
+        Encode_Status status;
+        do {
+            status = m_encoder->getOutput(&m_outputBuffer, drain);
+            if (status == ENCODE_SUCCESS) {
+                if (!m_output->write(m_outputBuffer.data, m_outputBuffer.dataSize))
+                    m_ok = false;
+                //capture to bitstream
+                std::map<uint64_t, uint64_t>::iterator it = m_captureTimes.find(m_outputBuffer.timeStamp);
+                if (it != m_captureTimes.end()) {
+                    m_latency.record(getMonotonicNs() - it->second);
+                    m_captureTimes.erase(it);
+                    m_encoded++;
+                }
+            } else if (status == ENCODE_BUFFER_TOO_SMALL) {
+                m_maxOutSize = (m_maxOutSize * 3) / 2;
+                if (!createOutputBuffer(&m_outputBuffer, m_maxOutSize)) {
+                    fprintf(stderr, "fail to create output\n");
+                    m_ok = false;
+                    return;
+                }
+            }
+        } while (status == ENCODE_SUCCESS || status == ENCODE_BUFFER_TOO_SMALL);
+    }
+
+    const char* m_device;
+    SharedPtr<EncodeInputCamera> m_camera;
+    SharedPtr<EncodeOutput> m_output;
+    IVideoEncoder* m_encoder;
+    VideoEncOutputBuffer m_outputBuffer;
+    uint32_t m_maxOutSize;
+    bool m_zeroCopy;
+
+    Lock m_lock;
+    std::deque<Job> m_jobs;
+    //an EncodeTask is posted or running
+    bool m_scheduled;
+
+    //poll thread only
+    int64_t m_nextSlot;
+    uint32_t m_captured;
+    uint32_t m_submitted;
+    uint32_t m_dropped;
+    uint32_t m_duplicated;
+    uint32_t m_skipped;
+
+    //encode task only
+    std::map<uint64_t, uint64_t> m_captureTimes;
+    LatencyHistogram m_latency;
+    uint32_t m_encoded;
+    bool m_ok;
+    DISALLOW_COPY_AND_ASSIGN(CameraStream);
+};
+
+/**
+ * Several cameras captured from one epoll loop, each encoded to its own file.
+ */
+class MultiCameraEncode {
+public:
+    MultiCameraEncode()
+        : m_epoll(-1)
+    {
+    }
+
+    ~MultiCameraEncode()
+    {
+        if (m_epoll != -1)
+            close(m_epoll);
+    }
+
+    bool init()
+    {
+        EncodeInputCamera::CameraDataMode mode = EncodeInputCamera::CAMERA_DATA_MODE_MMAP;
+        if (cameraMode && !EncodeInputCamera::parseDataMode(cameraMode, mode)) {
+            fprintf(stderr, "unknown camera mode %s\n", cameraMode);
+            return false;
+        }
+        ensureInputParameters();
+        m_epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (m_epoll == -1) {
+            ERROR("epoll_create1 failed, %s", strerror(errno));
+            return false;
+        }
+        for (int i = 0; i < inputFileCount; i++) {
+            const char* device = inputFileNames[i];
+            if (strncmp(device, "/dev/video", strlen("/dev/video"))) {
+                fprintf(stderr, "multiple inputs must be cameras, %s is not one\n", device);
+                return false;
+            }
+            SharedPtr<CameraStream> stream(new CameraStream(device));
+            if (!stream->init(mode))
+                return false;
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.u32 = i;
+            if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, stream->getFd(), &event) == -1) {
+                ERROR("can't poll %s, %s", device, strerror(errno));
+                return false;
+            }
+            m_streams.push_back(stream);
+            m_errorSince.push_back(0);
+        }
+        uint32_t threads = threadCount;
+        if (!threads || threads > m_streams.size())
+            threads = m_streams.size();
+        if (!m_pool.start(threads))
+            return false;
+        printf("encode %d cameras at %d fps with %d threads\n", (int)m_streams.size(), fps, threads);
+        return true;
+    }
+
+    bool run()
+    {
+        std::vector<struct epoll_event> events(m_streams.size());
+        uint64_t interval = 1000000000ULL / fps;
+        uint64_t start = getMonotonicNs();
+        uint32_t active = m_streams.size();
+
+        signal(SIGINT, onInterrupt);
+        while (active && !interrupted) {
+            int n = epoll_wait(m_epoll, &events[0], events.size(), kPollTimeoutMs);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                ERROR("epoll_wait failed, %s", strerror(errno));
+                break;
+            }
+            if (!n) {
+                fprintf(stderr, "no frame from any camera in %d ms\n", kPollTimeoutMs);
+                break;
+            }
+            bool idle = true;
+            for (int i = 0; i < n; i++) {
+                uint32_t index = events[i].data.u32;
+                CameraStream& stream = *m_streams[index];
+                if (stream.capture(start, interval, m_pool)) {
+                    idle = false;
+                    m_errorSince[index] = 0;
+                } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    //also when the encoder holds every buffer, so give it some time
+                    uint64_t now = getMonotonicNs();
+                    if (!m_errorSince[index])
+                        m_errorSince[index] = now;
+                    if (now - m_errorSince[index] < kPollTimeoutMs * 1000000ULL)
+                        continue;
+                    fprintf(stderr, "%s stopped giving frames\n", inputFileNames[index]);
+                    remove(stream, active);
+                    continue;
+                }
+                if (stream.done())
+                    remove(stream, active);
+            }
+            //only errors, don't spin on them
+            if (idle)
+                usleep(1000);
+        }
+        signal(SIGINT, SIG_DFL);
+        m_pool.waitIdle();
+
+        bool ret = true;
+        for (size_t i = 0; i < m_streams.size(); i++) {
+            if (!m_streams[i]->finish())
+                ret = false;
+        }
+        double seconds = (getMonotonicNs() - start) / 1e9;
+
+        uint32_t frames = 0;
+        LatencyHistogram latency;
+        for (size_t i = 0; i < m_streams.size(); i++) {
+            m_streams[i]->report(seconds);
+            frames += m_streams[i]->encoded();
+            latency.merge(m_streams[i]->latency());
+        }
+        printf("total: %d cameras, %d frames, %.2f fps\n", (int)m_streams.size(), frames, seconds > 0 ? frames / seconds : 0);
+        latency.log("latency");
+        return ret;
+    }
+
+private:
+    void remove(CameraStream& stream, uint32_t& active)
+    {
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, stream.getFd(), NULL);
+        active--;
+    }
+
+    std::vector<SharedPtr<CameraStream> > m_streams;
+    //when a camera started to poll with an error and no frame, 0 for never
+    std::vector<uint64_t> m_errorSince;
+    int m_epoll;
+    //declared last, so the workers are joined before the streams go
+    ThreadPool m_pool;
+    DISALLOW_COPY_AND_ASSIGN(MultiCameraEncode);
+};
+#endif
+
+int main(int argc, char** argv)
+{
+    IVideoEncoder *encoder = NULL;
+    uint32_t maxOutSize = 0;
+    EncodeInput* input;
+    EncodeOutput* output;
+    Encode_Status status;
+    VideoFrameRawData inputBuffer;
+    VideoEncOutputBuffer outputBuffer;
+    int encodeFrameCount = 0;
+    StatsSink stats("yamiencode");
+    uint64_t frameBytes = 0, bytesIn = 0, bytesOut = 0;
+
+    memset(&outputBuffer, 0, sizeof(VideoEncOutputBuffer));
+    if (!process_cmdline(argc, argv))
+        return -1;
+
+#ifndef ANDROID
+    if (inputFileCount > 1) {
+        MultiCameraEncode multi;
+        if (!multi.init())
+            return -1;
+        return multi.run() ? 0 : -1;
+    }
+#endif
+
+    DEBUG("inputFourcc: %.4s codec is %s", (char*)(&(inputFourcc)), codec);
+    input = EncodeInput::create(inputFileName, inputFourcc, videoWidth, videoHeight, cameraMode);
+    if (!input) {
+        fprintf (stderr, "fail to init input stream\n");
+        return -1;
+    }
+    input->setReadAhead(readAheadFrames, directIo);
+    if (mappedInput)
+        input->setMapped(true);
+    if (startFrame && !input->seekFrame(startFrame)) {
+        fprintf(stderr, "can't start from frame %d\n", startFrame);
+        delete input;
+        return -1;
+    }
+    SharedPtr<InputLoop> loop(new InputLoop(loopCount, loopSeconds));
+    if (!input->setLoop(loop) && (loopCount >= 0 || loopSeconds))
+        fprintf(stderr, "--loop and --duration need a yuv file, ignored\n");
+
+    videoWidth = input->getWidth();
+    videoHeight = input->getHeight();
+    if (YAMI_FOURCC_P010 == input->getFourcc())
+        bitDepth = 10;
+
+    output = EncodeOutput::create(outputFileName, videoWidth, videoHeight, fps, codec);
+    if (!output) {
+        fprintf (stderr, "fail to init output stream\n");
+        delete input;
+        return -1;
+    }
+
+    NativeDisplay nativeDisplay;
+    //inputs with VA surfaces of their own share the display, and skip the upload
+    bool zeroCopy = input->getNativeDisplay(nativeDisplay);
+    if (!zeroCopy) {
+        nativeDisplay.type = NATIVE_DISPLAY_DRM;
+        nativeDisplay.handle = -1;
+    }
+    encoder = createEncoder(output->getMimeType(), nativeDisplay, videoWidth, videoHeight);
+    assert(encoder != NULL);
 
     //init output buffer
     encoder->getMaxOutSize(&maxOutSize);
@@ -145,11 +676,32 @@ int main(int argc, char** argv)
         delete output;
         return -1;
     }
+    if (statsTarget) {
+        if (!stats.open(statsTarget, statsFormat, statsInterval)) {
+            delete input;
+            delete output;
+            return -1;
+        }
+        uint32_t planes, width[3], height[3];
+        if (getPlaneResolution(input->getFourcc(), videoWidth, videoHeight, width, height, planes)) {
+            for (uint32_t p = 0; p < planes; p++)
+                frameBytes += width[p] * height[p];
+        }
+    }
     uint64_t i = 0;
+    loop->start();
     while (!input->isEOS())
     {
         memset(&inputBuffer, 0, sizeof(inputBuffer));
-        if (input->getOneFrameInput(inputBuffer)) {
+        if (zeroCopy) {
+            SharedPtr<VideoFrame> frame;
+            if (!input->getOneFrame(frame))
+                break;
+            frame->timeStamp = i++;
+            status = encoder->encode(frame);
+            ASSERT(status == ENCODE_SUCCESS);
+        }
+        else if (input->getOneFrameInput(inputBuffer)) {
             inputBuffer.timeStamp = i++;
             status = encoder->encode(&inputBuffer);
             ASSERT(status == ENCODE_SUCCESS);
@@ -171,6 +723,7 @@ int main(int argc, char** argv)
                       "%" PRIu64,
                       outputBuffer.timeStamp);
                 DEBUG("output data size %d", outputBuffer.dataSize);
+                bytesOut += outputBuffer.dataSize;
             }
 #ifdef __BUILD_GET_MV__
             if (status == ENCODE_SUCCESS) {
@@ -187,6 +740,11 @@ int main(int argc, char** argv)
         } while (status != ENCODE_BUFFER_NO_MORE);
 
         encodeFrameCount++;
+        bytesIn += frameBytes;
+        stats.addFrames();
+        stats.setBytesIn(bytesIn);
+        stats.setBytesOut(bytesOut);
+        stats.tick();
 
         if (frameCount && encodeFrameCount >= frameCount)
             break;
@@ -203,6 +761,7 @@ int main(int argc, char** argv)
        if (status == ENCODE_SUCCESS
            && output->write(outputBuffer.data, outputBuffer.dataSize)) {
            DEBUG("timeStamp(PTS) : " "%" PRIu64 "\n", outputBuffer.timeStamp);
+           bytesOut += outputBuffer.dataSize;
        }
 #ifdef __BUILD_GET_MV__
         if (status == ENCODE_SUCCESS) {
@@ -219,6 +778,9 @@ int main(int argc, char** argv)
     } while (status != ENCODE_BUFFER_NO_MORE);
 
 error1:
+    loop->log("yamiencode");
+    stats.setBytesOut(bytesOut);
+    stats.close();
     encoder->stop();
     releaseVideoEncoder(encoder);
     free(outputBuffer.data);
@@ -22,13 +22,21 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/select.h>
 #include <linux/videodev2.h>
+#include <va/va_drm.h>
+#include <va/va_drmcommon.h>
+#include <algorithm>
+#include "common/common_def.h"
+#include "common/lock.h"
 #include "common/log.h"
 #include "common/utils.h"
+#include "common/VaapiUtils.h"
 #include "encodeinput.h"
 
 
@@ -44,10 +52,125 @@
         }                                                       \
     }while(0)
 
+// the encoder holds frames it reorders, so more buffers are out in dmabuf mode
+static const uint32_t kDmaBufFrameBufferCount = 8;
+
+static uint32_t toV4l2PixelFormat(uint32_t fourcc)
+{
+    switch (fourcc) {
+    case VA_FOURCC_NV12:
+        return V4L2_PIX_FMT_NV12;
+    case VA_FOURCC('I', '4', '2', '0'):
+        return V4L2_PIX_FMT_YUV420;
+    default:
+        return V4L2_PIX_FMT_YUYV;
+    }
+}
+
+static uint32_t fromV4l2PixelFormat(uint32_t pixelFormat)
+{
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV12M:
+        return VA_FOURCC_NV12;
+    case V4L2_PIX_FMT_YUV420:
+    case V4L2_PIX_FMT_YUV420M:
+        return VA_FOURCC('I', '4', '2', '0');
+    case V4L2_PIX_FMT_YUYV:
+        return VA_FOURCC_YUY2;
+    default:
+        return 0;
+    }
+}
+
+// planes of the frame itself, not of the v4l2 buffer
+static uint32_t framePlaneCount(uint32_t fourcc)
+{
+    switch (fourcc) {
+    case VA_FOURCC_YUY2:
+        return 1;
+    case VA_FOURCC_NV12:
+        return 2;
+    default:
+        return 3;
+    }
+}
+
+// the camera for FrameRecycler, NULL once ~EncodeInputCamera has started
+struct EncodeInputCamera::RecycleState {
+    RecycleState(EncodeInputCamera* c)
+        : camera(c)
+    {
+    }
+    Lock lock;
+    EncodeInputCamera* camera;
+};
+
+// gives the v4l2 buffer back when the encoder is done with the surface,
+// unless the camera is closed by then
+struct EncodeInputCamera::FrameRecycler {
+    FrameRecycler(const SharedPtr<RecycleState>& state, int32_t index)
+        : m_state(state)
+        , m_index(index)
+    {
+    }
+    void operator()(VideoFrame* frame)
+    {
+        {
+            AutoLock lock(m_state->lock);
+            if (m_state->camera)
+                m_state->camera->enqueFrame(m_index);
+        }
+        delete frame;
+    }
+
+private:
+    SharedPtr<RecycleState> m_state;
+    int32_t m_index;
+};
+
+EncodeInputCamera::FrameBuffer::FrameBuffer()
+    : dmabuf(-1)
+    , surface(VA_INVALID_SURFACE)
+{
+    memset(planes, 0, sizeof(planes));
+    memset(lengths, 0, sizeof(lengths));
+}
+
+EncodeInputCamera::EncodeInputCamera()
+    : m_fd(-1)
+    , m_frameBufferCount(5)
+    , m_frameBufferSize(0)
+    , m_dataMode(CAMERA_DATA_MODE_MMAP)
+    , m_blocking(true)
+    , m_bufferType(V4L2_BUF_TYPE_VIDEO_CAPTURE)
+    , m_planeCount(1)
+    , m_vaDisplay(NULL)
+    , m_drmFd(-1)
+    , m_recycleState(new RecycleState(this))
+{
+    memset(m_planeSizes, 0, sizeof(m_planeSizes));
+    memset(m_bytesPerLine, 0, sizeof(m_bytesPerLine));
+    memset(m_pitches, 0, sizeof(m_pitches));
+    memset(m_offsets, 0, sizeof(m_offsets));
+}
+
+bool EncodeInputCamera::parseDataMode(const char* name, CameraDataMode& mode)
+{
+    if (!strcasecmp(name, "mmap"))
+        mode = CAMERA_DATA_MODE_MMAP;
+    else if (!strcasecmp(name, "dmabuf"))
+        mode = CAMERA_DATA_MODE_DMABUF_MMAP;
+    else if (!strcasecmp(name, "userptr"))
+        mode = CAMERA_DATA_MODE_USRPTR;
+    else
+        return false;
+    return true;
+}
+
 bool EncodeInputCamera::initDevice(const char *cameraDevicePath)
 {
     struct v4l2_capability cap;
-    struct v4l2_format fmt;
     bool ret = true;
 
     INFO();
@@ -61,52 +184,181 @@ bool EncodeInputCamera::initDevice(const char *cameraDevicePath)
 
     IOCTL_CHECK_RET(m_fd, VIDIOC_QUERYCAP, "VIDIOC_QUERYCAP", cap, false);
 
-    if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE)) {
+    uint32_t capabilities = cap.capabilities;
+    if (capabilities & V4L2_CAP_DEVICE_CAPS)
+        capabilities = cap.device_caps;
+    if (!(capabilities & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE))) {
         ERROR("the device doesn't support video capture!!");
         return false;
     }
+    if (!(capabilities & V4L2_CAP_STREAMING)) {
+        ERROR("camera device does not support video streaming\n");
+        return false;
+    }
+
+    if (!setFormat(capabilities))
+        return false;
+
+    if (m_dataMode == CAMERA_DATA_MODE_DMABUF_MMAP && m_planeCount > 1) {
+        WARNING("%d plane camera frames can't be one VA surface, use userptr instead of dmabuf", m_planeCount);
+        m_dataMode = CAMERA_DATA_MODE_USRPTR;
+    }
 
     switch (m_dataMode) {
     case CAMERA_DATA_MODE_MMAP:
-        if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
-            ERROR("camera device does not support video streaming\n");
-            return false;
+        ret = initMmap();
+        break;
+    case CAMERA_DATA_MODE_DMABUF_MMAP:
+        m_frameBufferCount = kDmaBufFrameBufferCount;
+        ret = initMmap();
+        if (ret && !(exportDmaBuf() && createSurfaces())) {
+            // the frames are still mapped, so we can hand out copies
+            WARNING("can't import camera frames to VA, fall back to mmap");
+            destroySurfaces();
+            m_dataMode = CAMERA_DATA_MODE_MMAP;
         }
-    break;
-    default:
-        ERROR("unsupported camera data mode");
-    break;
+        break;
+    case CAMERA_DATA_MODE_USRPTR:
+        ret = initUserPtr();
+        break;
     }
 
+    return ret;
+}
+
+bool EncodeInputCamera::setFormat(uint32_t capabilities)
+{
+    struct v4l2_format fmt;
+    uint32_t pixelFormat = toV4l2PixelFormat(m_fourcc);
+    uint32_t width, height;
+
     // set video format and resolution, XXX get supported formats/resolutions first
     memset(&fmt, 0, sizeof fmt);
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width       = m_width;
-    fmt.fmt.pix.height      = m_height;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+    if (capabilities & V4L2_CAP_VIDEO_CAPTURE) {
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        fmt.fmt.pix.width       = m_width;
+        fmt.fmt.pix.height      = m_height;
+        fmt.fmt.pix.pixelformat = pixelFormat;
+        fmt.fmt.pix.field       = V4L2_FIELD_ANY;
+    } else {
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        fmt.fmt.pix_mp.width       = m_width;
+        fmt.fmt.pix_mp.height      = m_height;
+        fmt.fmt.pix_mp.pixelformat = pixelFormat;
+        fmt.fmt.pix_mp.field       = V4L2_FIELD_ANY;
+    }
+    m_bufferType = fmt.type;
     IOCTL_CHECK_RET(m_fd, VIDIOC_S_FMT, "VIDIOC_S_FMT", fmt, false);
-    DEBUG("video resolution: %dx%d = %dx%d", m_width, m_height, fmt.fmt.pix.width, fmt.fmt.pix.height);
     IOCTL_CHECK_RET(m_fd, VIDIOC_G_FMT, "VIDIOC_G_FMT", fmt, false);
-    if (m_width != fmt.fmt.pix.width || m_height != fmt.fmt.pix.height) {
-        ERROR("not supported resolution(%dx%d), use %dx%d from camera\n", m_width, m_height, fmt.fmt.pix.width, fmt.fmt.pix.height);
-        m_width = fmt.fmt.pix.width;
-        m_height = fmt.fmt.pix.height;
+
+    if (m_bufferType == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        width = fmt.fmt.pix.width;
+        height = fmt.fmt.pix.height;
+        pixelFormat = fmt.fmt.pix.pixelformat;
+        m_planeCount = 1;
+        m_planeSizes[0] = fmt.fmt.pix.sizeimage;
+        m_bytesPerLine[0] = fmt.fmt.pix.bytesperline;
+    } else {
+        const struct v4l2_pix_format_mplane& format = fmt.fmt.pix_mp;
+        width = format.width;
+        height = format.height;
+        pixelFormat = format.pixelformat;
+        m_planeCount = format.num_planes;
+        if (!m_planeCount || m_planeCount > kMaxPlanes) {
+            ERROR("unsupported camera buffer of %d planes", m_planeCount);
+            return false;
+        }
+        for (uint32_t i = 0; i < m_planeCount; i++) {
+            m_planeSizes[i] = format.plane_fmt[i].sizeimage;
+            m_bytesPerLine[i] = format.plane_fmt[i].bytesperline;
+        }
+    }
+    DEBUG("video resolution: %dx%d = %dx%d, %d planes", m_width, m_height, width, height, m_planeCount);
+    if (m_width != width || m_height != height) {
+        ERROR("not supported resolution(%dx%d), use %dx%d from camera\n", m_width, m_height, width, height);
+        m_width = width;
+        m_height = height;
     }
 
+    uint32_t fourcc = fromV4l2PixelFormat(pixelFormat);
+    if (!fourcc) {
+        ERROR("unsupported camera format %.4s", (char*)&pixelFormat);
+        return false;
+    }
+    if (fourcc != m_fourcc) {
+        WARNING("camera can't capture %.4s, use %.4s", (char*)&m_fourcc, (char*)&fourcc);
+        m_fourcc = fourcc;
+    }
+    return setLayout();
+}
 
-    switch (m_dataMode) {
-    case CAMERA_DATA_MODE_MMAP:
-        ret = initMmap();
-        ASSERT(ret);
-        break;
-    default:
-        ERROR("unsupported yet");
-        break;
+// where each plane of the frame is, once it is in one piece of memory
+bool EncodeInputCamera::setLayout()
+{
+    uint32_t planes = framePlaneCount(m_fourcc);
+
+    if (m_planeCount > 1) {
+        if (m_planeCount != planes) {
+            ERROR("%.4s in %d buffer planes is not supported", (char*)&m_fourcc, m_planeCount);
+            return false;
+        }
+        // one buffer plane for each, back to back
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < planes; i++) {
+            m_pitches[i] = m_bytesPerLine[i];
+            m_offsets[i] = offset;
+            offset += m_planeSizes[i];
+        }
+        m_frameBufferSize = offset;
+        return true;
     }
 
+    uint32_t pitch = m_bytesPerLine[0];
+    if (!pitch)
+        pitch = m_fourcc == VA_FOURCC_YUY2 ? m_width * 2 : m_width;
+    m_pitches[0] = pitch;
+    m_offsets[0] = 0;
+    if (planes == 2) {
+        m_pitches[1] = pitch;
+        m_offsets[1] = pitch * m_height;
+    } else if (planes == 3) {
+        m_pitches[1] = m_pitches[2] = pitch / 2;
+        m_offsets[1] = pitch * m_height;
+        m_offsets[2] = m_offsets[1] + pitch / 2 * m_height / 2;
+    }
+    m_frameBufferSize = m_planeSizes[0];
     return true;
 }
 
+void EncodeInputCamera::initBuffer(struct v4l2_buffer& buf, struct v4l2_plane* planes, int32_t index)
+{
+    memset(&buf, 0, sizeof(buf));
+    buf.type = m_bufferType;
+    buf.memory = m_dataMode == CAMERA_DATA_MODE_USRPTR ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+    if (m_bufferType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        memset(planes, 0, sizeof(*planes) * kMaxPlanes);
+        buf.m.planes = planes;
+        buf.length = m_planeCount;
+    }
+    if (index < 0)
+        return;
+    buf.index = index;
+
+    if (m_dataMode != CAMERA_DATA_MODE_USRPTR || (uint32_t)index >= m_frameBuffers.size())
+        return;
+    // tell the driver where to capture to
+    const FrameBuffer& frame = m_frameBuffers[index];
+    if (m_bufferType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        for (uint32_t i = 0; i < m_planeCount; i++) {
+            planes[i].m.userptr = (unsigned long)frame.planes[i];
+            planes[i].length = frame.lengths[i];
+        }
+    } else {
+        buf.m.userptr = (unsigned long)frame.planes[0];
+        buf.length = frame.lengths[0];
+    }
+}
+
 bool EncodeInputCamera::initMmap(void)
 {
     struct v4l2_requestbuffers rqbufs;
@@ -116,7 +368,7 @@ bool EncodeInputCamera::initMmap(void)
     memset(&rqbufs, 0, sizeof(rqbufs));
     rqbufs.count = m_frameBufferCount;
     rqbufs.memory = V4L2_MEMORY_MMAP;
-    rqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    rqbufs.type = m_bufferType;
 
     IOCTL_CHECK_RET(m_fd, VIDIOC_REQBUFS, "VIDIOC_REQBUFS", rqbufs, false);
     INFO("rqbufs.count: %d\n", rqbufs.count);
@@ -127,141 +379,263 @@ bool EncodeInputCamera::initMmap(void)
     DEBUG("map video frames: ");
     for (index = 0; index < rqbufs.count; ++index) {
         struct v4l2_buffer buf;
-        memset(&buf, 0, sizeof(buf));
-        buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory      = V4L2_MEMORY_MMAP;
-        buf.index       = index;
+        struct v4l2_plane planes[kMaxPlanes];
+        initBuffer(buf, planes, index);
 
         IOCTL_CHECK_RET(m_fd, VIDIOC_QUERYBUF, "VIDIOC_QUERYBUF", buf, false);
-        if (m_frameBufferSize)
-            ASSERT(m_frameBufferSize == buf.length);
-        m_frameBufferSize = buf.length;
 
-        m_frameBuffers[index]= (uint8_t*)mmap(NULL, buf.length,
-                  PROT_READ | PROT_WRITE, MAP_SHARED,
-                  m_fd, buf.m.offset);
+        FrameBuffer& frame = m_frameBuffers[index];
+        for (uint32_t i = 0; i < m_planeCount; i++) {
+            bool multiPlanar = m_bufferType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+            uint32_t length = multiPlanar ? planes[i].length : buf.length;
+            uint32_t offset = multiPlanar ? planes[i].m.mem_offset : buf.m.offset;
+            void* address = mmap(NULL, length,
+                PROT_READ | PROT_WRITE, MAP_SHARED,
+                m_fd, offset);
+
+            if (MAP_FAILED == address) {
+                ERROR("mmap failed");
+                return false;
+            }
+            frame.planes[i] = static_cast<uint8_t*>(address);
+            frame.lengths[i] = length;
+            DEBUG("index: %d, plane: %d, length: %d, addr: %p", buf.index, i, length, address);
+        }
+    }
+
+    if (m_planeCount > 1) {
+        for (index = 0; index < m_frameBufferCount; ++index)
+            m_frameBuffers[index].staging.resize(m_frameBufferSize);
+    }
+    return true;
+}
+
+bool EncodeInputCamera::initUserPtr(void)
+{
+    struct v4l2_requestbuffers rqbufs;
+    long pageSize = sysconf(_SC_PAGESIZE);
+
+    INFO();
+    memset(&rqbufs, 0, sizeof(rqbufs));
+    rqbufs.count = m_frameBufferCount;
+    rqbufs.memory = V4L2_MEMORY_USERPTR;
+    rqbufs.type = m_bufferType;
+
+    IOCTL_CHECK_RET(m_fd, VIDIOC_REQBUFS, "VIDIOC_REQBUFS", rqbufs, false);
+    INFO("rqbufs.count: %d\n", rqbufs.count);
+
+    m_frameBuffers.resize(rqbufs.count);
+    m_frameBufferCount = rqbufs.count;
 
-        if (MAP_FAILED == m_frameBuffers[index]) {
-            ERROR("mmap failed");
+    // one piece of memory per frame, buffer planes are at the frame's plane offsets
+    size_t size = (m_frameBufferSize + pageSize - 1) / pageSize * pageSize;
+    for (uint32_t index = 0; index < rqbufs.count; ++index) {
+        void* memory = NULL;
+        if (posix_memalign(&memory, pageSize, size)) {
+            ERROR("allocate %zu bytes for frame %d failed", size, index);
             return false;
         }
+        FrameBuffer& frame = m_frameBuffers[index];
+        if (m_planeCount == 1) {
+            frame.planes[0] = static_cast<uint8_t*>(memory);
+            frame.lengths[0] = size;
+        } else {
+            for (uint32_t i = 0; i < m_planeCount; i++) {
+                frame.planes[i] = static_cast<uint8_t*>(memory) + m_offsets[i];
+                frame.lengths[i] = m_planeSizes[i];
+            }
+        }
+        DEBUG("index: %d, size: %zu, addr: %p", index, size, memory);
+    }
+    return true;
+}
 
-        DEBUG("index: %d, buf.length: %d, addr: %p", buf.index, buf.length, m_frameBuffers[index]);
+bool EncodeInputCamera::exportDmaBuf()
+{
+    for (uint32_t index = 0; index < m_frameBufferCount; ++index) {
+        struct v4l2_exportbuffer expbuf;
+        memset(&expbuf, 0, sizeof(expbuf));
+        expbuf.type = m_bufferType;
+        expbuf.index = index;
+        expbuf.plane = 0;
+        expbuf.flags = O_CLOEXEC | O_RDWR;
+
+        IOCTL_CHECK_RET(m_fd, VIDIOC_EXPBUF, "VIDIOC_EXPBUF", expbuf, false);
+        m_frameBuffers[index].dmabuf = expbuf.fd;
     }
+    return true;
+}
 
+// one VA surface per camera buffer, made once and reused for every frame
+bool EncodeInputCamera::createSurfaces()
+{
+    m_drmFd = open("/dev/dri/renderD128", O_RDWR);
+    if (m_drmFd < 0) {
+        ERROR("can't open /dev/dri/renderD128, try to /dev/dri/card0");
+        m_drmFd = open("/dev/dri/card0", O_RDWR);
+    }
+    if (m_drmFd < 0) {
+        ERROR("can't open drm device");
+        return false;
+    }
+    VADisplay display = vaGetDisplayDRM(m_drmFd);
+    int majorVersion, minorVersion;
+    if (!checkVaapiStatus(vaInitialize(display, &majorVersion, &minorVersion), "vaInitialize"))
+        return false;
+    m_vaDisplay = display;
+
+    uint32_t planes = framePlaneCount(m_fourcc);
+    for (uint32_t index = 0; index < m_frameBufferCount; ++index) {
+        FrameBuffer& frame = m_frameBuffers[index];
+        VASurfaceAttribExternalBuffers external;
+        unsigned long handle = (unsigned long)frame.dmabuf;
+        memset(&external, 0, sizeof(external));
+        external.pixel_format = m_fourcc;
+        external.width = m_width;
+        external.height = m_height;
+        external.data_size = m_frameBufferSize;
+        external.num_planes = planes;
+        for (uint32_t i = 0; i < planes; i++) {
+            external.pitches[i] = m_pitches[i];
+            external.offsets[i] = m_offsets[i];
+        }
+        external.buffers = &handle;
+        external.num_buffers = 1;
+
+        VASurfaceAttrib attribs[2];
+        attribs[0].flags = VA_SURFACE_ATTRIB_SETTABLE;
+        attribs[0].type = VASurfaceAttribMemoryType;
+        attribs[0].value.type = VAGenericValueTypeInteger;
+        attribs[0].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME;
+
+        attribs[1].flags = VA_SURFACE_ATTRIB_SETTABLE;
+        attribs[1].type = VASurfaceAttribExternalBufferDescriptor;
+        attribs[1].value.type = VAGenericValueTypePointer;
+        attribs[1].value.value.p = &external;
+
+        VASurfaceID id;
+        VAStatus status = vaCreateSurfaces(m_vaDisplay, getRtFormat(m_fourcc), m_width, m_height,
+            &id, 1, attribs, N_ELEMENTS(attribs));
+        if (!checkVaapiStatus(status, "vaCreateSurfaces"))
+            return false;
+        frame.surface = id;
+    }
     return true;
 }
 
+void EncodeInputCamera::destroySurfaces()
+{
+    for (size_t i = 0; i < m_frameBuffers.size(); i++) {
+        FrameBuffer& frame = m_frameBuffers[i];
+        if (frame.surface != VA_INVALID_SURFACE) {
+            vaDestroySurfaces(m_vaDisplay, &frame.surface, 1);
+            frame.surface = VA_INVALID_SURFACE;
+        }
+        if (frame.dmabuf != -1) {
+            close(frame.dmabuf);
+            frame.dmabuf = -1;
+        }
+    }
+    if (m_vaDisplay) {
+        vaTerminate(m_vaDisplay);
+        m_vaDisplay = NULL;
+    }
+    if (m_drmFd != -1) {
+        close(m_drmFd);
+        m_drmFd = -1;
+    }
+}
+
 bool EncodeInputCamera::startCapture(void)
 {
     unsigned int i;
     enum v4l2_buf_type type;
 
     INFO();
-    switch (m_dataMode) {
-    case CAMERA_DATA_MODE_MMAP:
-        for (i = 0; i < m_frameBufferCount; ++i) {
-            struct v4l2_buffer buf;
-            memset(&buf, 0, sizeof(buf));
-            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            buf.memory = V4L2_MEMORY_MMAP;
-            buf.index = i;
-
-            IOCTL_CHECK_RET(m_fd, VIDIOC_QBUF, "VIDIOC_QBUF", buf, false);
-        }
-
-        type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        IOCTL_CHECK_RET(m_fd, VIDIOC_STREAMON, "VIDIOC_STREAMON", type, false);
-        INFO("STREAMON ok\n");
-        break;
-    default:
-        ASSERT(0);
-        break;
+    for (i = 0; i < m_frameBufferCount; ++i) {
+        if (!enqueFrame(i))
+            return false;
     }
 
+    type = (enum v4l2_buf_type)m_bufferType;
+    IOCTL_CHECK_RET(m_fd, VIDIOC_STREAMON, "VIDIOC_STREAMON", type, false);
+    INFO("STREAMON ok\n");
+
     return true;
 }
 
 
 bool EncodeInputCamera::init(const char* cameraPath, uint32_t fourcc, int width, int height)
 {
-    bool ret = true;
     if (!width || !height) {
         return false;
     }
     m_width = width;
     m_height = height;
     m_fourcc = fourcc;
-    if (!m_fourcc)
-        m_fourcc = VA_FOURCC_YUY2;
-
-    ret = initDevice(cameraPath);
-    ASSERT(ret);
-    ret = startCapture();
-    ASSERT(ret);
-    m_dataMode = CAMERA_DATA_MODE_MMAP;
+    if (!m_fourcc) {
+        // the encoder takes nv12 surfaces as they are
+        m_fourcc = m_dataMode == CAMERA_DATA_MODE_DMABUF_MMAP ? VA_FOURCC_NV12 : VA_FOURCC_YUY2;
+    }
 
-    return true;
+    if (!initDevice(cameraPath))
+        return false;
+    return startCapture();
 }
 
 int32_t EncodeInputCamera::dequeFrame(void)
 {
     struct v4l2_buffer buf;
+    struct v4l2_plane planes[kMaxPlanes];
     int ret = 0;
 
     INFO();
-    memset(&buf, 0, sizeof(buf));
-
-    switch (m_dataMode) {
-    case CAMERA_DATA_MODE_MMAP: {
-        // poll until there is available frames
-        while(1) {
-            fd_set fds;
-            struct timeval tv;
 
-            FD_ZERO(&fds);
-            FD_SET(m_fd, &fds);
+    // poll until there is available frames
+    while (m_blocking) {
+        fd_set fds;
+        struct timeval tv;
+
+        FD_ZERO(&fds);
+        FD_SET(m_fd, &fds);
+
+        /* Timeout. */
+        tv.tv_sec = 2;
+        tv.tv_usec = 0;
+
+        ret= select(m_fd + 1, &fds, NULL, NULL, &tv);
+
+        if (-1 == ret) {
+            if (EINTR == errno)
+                continue;
+            ERROR("select failed");
+            return -1;
+        } else if (0 == ret) {
+            ERROR("select timeout\n");
+            return -1;
+        } else
+            break;
+    }
 
-            /* Timeout. */
-            tv.tv_sec = 2;
-            tv.tv_usec = 0;
 
-            ret= select(m_fd + 1, &fds, NULL, NULL, &tv);
+    DEBUG("get one frame");
+    initBuffer(buf, planes, -1);
 
-            if (-1 == ret) {
-                if (EINTR == errno)
-                    continue;
-                ERROR("select failed");
-                return -1;
-            } else if (0 == ret) {
-                ERROR("select timeout\n");
+    do {
+        ret = ioctl(m_fd, VIDIOC_DQBUF, &buf);
+        if (-1 == ret) {
+            if (!m_blocking && errno == EAGAIN)
                 return -1;
-            } else
-                break;
-        }
-
-
-        DEBUG("get one frame");
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.length = m_frameBufferSize;
-
-        do {
-            ret = ioctl(m_fd, VIDIOC_DQBUF, &buf);
-            if (-1 == ret) {
-                usleep(5000);
-            } else
-                break;
-        } while (errno == EAGAIN || EINTR == errno);
-
-        ASSERT(ret != -1);
-        ASSERT(buf.index < m_frameBufferCount);
-    }
-    break;
-    default:
-        ASSERT(0);
-        break;
+            usleep(5000);
+        } else
+            break;
+    } while (errno == EAGAIN || EINTR == errno);
+
+    if (-1 == ret) {
+        ERROR("VIDIOC_DQBUF failed, %s", strerror(errno));
+        return -1;
     }
+    ASSERT(buf.index < m_frameBufferCount);
 
     return buf.index;
 }
@@ -270,36 +644,47 @@ bool EncodeInputCamera::enqueFrame(int32_t index)
 {
     assert(index >=0 && (uint32_t)index < m_frameBufferCount);
     struct v4l2_buffer buf;
-    memset(&buf, 0, sizeof(buf));
+    struct v4l2_plane planes[kMaxPlanes];
 
-    switch (m_dataMode) {
-    case CAMERA_DATA_MODE_MMAP:
-        DEBUG("recycle one frame (index: %d)\n", index);
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = index;
-        buf.length = m_frameBufferSize;
+    DEBUG("recycle one frame (index: %d)\n", index);
+    initBuffer(buf, planes, index);
 
-        IOCTL_CHECK_RET(m_fd, VIDIOC_QBUF, "VIDIOC_QBUF", buf, false);
-        break;
-    default:
-        ASSERT(0);
-        break;
-    }
+    IOCTL_CHECK_RET(m_fd, VIDIOC_QBUF, "VIDIOC_QBUF", buf, false);
     return true;
 }
 
+uint8_t* EncodeInputCamera::getFrameData(uint32_t index)
+{
+    FrameBuffer& frame = m_frameBuffers[index];
+    if (m_planeCount == 1 || m_dataMode == CAMERA_DATA_MODE_USRPTR)
+        return frame.planes[0];
+
+    // each plane has its own mapping, gather them
+    for (uint32_t i = 0; i < m_planeCount; i++)
+        memcpy(&frame.staging[m_offsets[i]], frame.planes[i], std::min(frame.lengths[i], m_planeSizes[i]));
+    return &frame.staging[0];
+}
+
 bool EncodeInputCamera::getOneFrameInput(VideoFrameRawData &inputBuffer)
 {
     int frameIndex = dequeFrame();
-    ASSERT((frameIndex >= 0) && ((uint32_t)frameIndex < m_frameBufferCount));
+    if (frameIndex < 0)
+        return false;
 
     memset(&inputBuffer, 0, sizeof(inputBuffer));
-    bool ret = fillFrameRawData(&inputBuffer, m_fourcc, m_width, m_height, m_frameBuffers[frameIndex]);
-    if(ret)
-        inputBuffer.internalID = frameIndex;
+    inputBuffer.memoryType = VIDEO_DATA_MEMORY_TYPE_RAW_POINTER;
+    inputBuffer.width = m_width;
+    inputBuffer.height = m_height;
+    inputBuffer.fourcc = m_fourcc;
+    inputBuffer.handle = reinterpret_cast<intptr_t>(getFrameData(frameIndex));
+    inputBuffer.size = m_frameBufferSize;
+    for (uint32_t i = 0; i < kMaxPlanes; i++) {
+        inputBuffer.pitch[i] = m_pitches[i];
+        inputBuffer.offset[i] = m_offsets[i];
+    }
+    inputBuffer.internalID = frameIndex;
 
-    return ret;
+    return true;
 }
 
 bool EncodeInputCamera::recycleOneFrameInput(VideoFrameRawData &inputBuffer)
@@ -312,41 +697,61 @@ bool EncodeInputCamera::recycleOneFrameInput(VideoFrameRawData &inputBuffer)
     return ret;
 }
 
+bool EncodeInputCamera::getNativeDisplay(NativeDisplay& display)
+{
+    if (!m_vaDisplay)
+        return false;
+    display.type = NATIVE_DISPLAY_VA;
+    display.handle = (intptr_t)m_vaDisplay;
+    return true;
+}
+
+bool EncodeInputCamera::getOneFrame(SharedPtr<VideoFrame>& frame)
+{
+    if (!m_vaDisplay)
+        return false;
+    int32_t frameIndex = dequeFrame();
+    if (frameIndex < 0)
+        return false;
+
+    frame.reset(new VideoFrame, FrameRecycler(m_recycleState, frameIndex));
+    memset(frame.get(), 0, sizeof(VideoFrame));
+    frame->surface = static_cast<intptr_t>(m_frameBuffers[frameIndex].surface);
+    frame->crop.width = m_width;
+    frame->crop.height = m_height;
+    frame->fourcc = m_fourcc;
+    return true;
+}
+
 bool EncodeInputCamera::stopCapture(void)
 {
     enum v4l2_buf_type type;
 
     INFO();
-    switch (m_dataMode) {
-    case CAMERA_DATA_MODE_MMAP:
-        type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        IOCTL_CHECK_RET(m_fd, VIDIOC_STREAMOFF, "VIDIOC_STREAMOFF", type, false);
-    break;
-    default:
-        ASSERT(0);
-    break;
-    }
+    type = (enum v4l2_buf_type)m_bufferType;
+    IOCTL_CHECK_RET(m_fd, VIDIOC_STREAMOFF, "VIDIOC_STREAMOFF", type, false);
 
     return true;
 }
 
 bool EncodeInputCamera::uninitDevice()
 {
-    unsigned int i;
-
     INFO();
-    switch (m_dataMode) {
-    case CAMERA_DATA_MODE_MMAP:
-        for (i = 0; i < m_frameBufferCount; ++i)
-            if (-1 == munmap(m_frameBuffers[i], m_frameBufferSize)) {
+    destroySurfaces();
+    for (size_t i = 0; i < m_frameBuffers.size(); ++i) {
+        FrameBuffer& frame = m_frameBuffers[i];
+        if (m_dataMode == CAMERA_DATA_MODE_USRPTR) {
+            free(frame.planes[0]);
+            continue;
+        }
+        for (uint32_t j = 0; j < m_planeCount; j++) {
+            if (frame.planes[j] && -1 == munmap(frame.planes[j], frame.lengths[j])) {
                 ERROR("munmap failed\n");
                 return false;
             }
-        break;
-    default:
-        ASSERT(0);
-        break;
+        }
     }
+    m_frameBuffers.clear();
 
     if (-1 == close(m_fd)) {
         ERROR("close device failed\n");
@@ -361,10 +766,15 @@ EncodeInputCamera::~EncodeInputCamera()
 {
     bool ret = true;
 
+    {
+        //waits for a re-queue in flight, later ones are skipped
+        AutoLock lock(m_recycleState->lock);
+        m_recycleState->camera = NULL;
+    }
+    if (m_fd == -1)
+        return;
     ret = stopCapture();
     ASSERT(ret);
     ret = uninitDevice();
     ASSERT(ret);
 }
-
-
@@ -20,7 +20,7 @@
 
 #include "encodeInputDecoder.h"
 #include "common/log.h"
-#include "common/VaapiUtils.h"
+#include "common/VaapiImageCache.h"
 #include "assert.h"
 
 EncodeInputDecoder::EncodeInputDecoder(DecodeInput* input)
@@ -32,6 +32,7 @@ EncodeInputDecoder::EncodeInputDecoder(DecodeInput* input)
 }
 EncodeInputDecoder::~EncodeInputDecoder()
 {
+    m_images.clear();
     if (m_decoder) {
         m_decoder->stop();
         releaseVideoDecoder(m_decoder);
@@ -90,6 +91,8 @@ bool EncodeInputDecoder::decodeOneFrame()
     return true;
 }
 
+//holds the frame and its mapping until encoder recycles it,
+//the decoder surface is unmapped before it goes back to the decoder
 class MyRawImage {
 public:
     static SharedPtr<MyRawImage> create(VADisplay display, const SharedPtr<VideoFrame>& frame, VideoFrameRawData& inputBuffer)
@@ -103,36 +106,29 @@ public:
         }
         return image;
     }
-    ~MyRawImage()
-    {
-        if (m_frame) {
-            unmapImage(m_display, m_image);
-        }
-    }
 
 private:
     MyRawImage(VADisplay display, const SharedPtr<VideoFrame>& frame)
-        : m_display(display)
-        , m_frame(frame)
+        : m_frame(frame)
+        , m_mapping(display, frame)
     {
     }
 
-    VAImage m_image;
-    VADisplay m_display;
     SharedPtr<VideoFrame> m_frame;
+    //goes before the frame
+    ScopedImageMapping m_mapping;
     bool init(VideoFrameRawData& inputBuffer)
     {
-        uint8_t* p = mapSurfaceToImage(m_display, m_frame->surface, m_image);
-        if (!p) {
-            m_frame.reset();
+        const VAImage& image = m_mapping.image();
+        uint8_t* p = m_mapping.data();
+        if (!p)
             return false;
-        }
         memset(&inputBuffer, 0, sizeof(inputBuffer));
         inputBuffer.memoryType = VIDEO_DATA_MEMORY_TYPE_RAW_POINTER;
         inputBuffer.fourcc = m_frame->fourcc;
         inputBuffer.handle = (intptr_t)p;
-        memcpy(inputBuffer.pitch, m_image.pitches, sizeof(inputBuffer.pitch));
-        memcpy(inputBuffer.offset, m_image.offsets, sizeof(inputBuffer.offset));
+        memcpy(inputBuffer.pitch, image.pitches, sizeof(inputBuffer.pitch));
+        memcpy(inputBuffer.offset, image.offsets, sizeof(inputBuffer.offset));
         inputBuffer.timeStamp = m_frame->timeStamp;
         inputBuffer.flags = m_frame->flags;
         inputBuffer.width = m_frame->crop.width;
@@ -18,6 +18,7 @@
 #define __ENCODE_HELP__
 #include <getopt.h>
 #include <Yami.h>
+#include "common/trace.h"
 
 static int referenceMode = 0;
 static int idrInterval = 0;
@@ -25,6 +26,9 @@ static int intraPeriod = 30;
 static int ipPeriod = 1;
 static int bitDepth = 8;
 static char *inputFileName = NULL;
+#define MAX_INPUT_FILES 16
+static char* inputFileNames[MAX_INPUT_FILES];
+static int inputFileCount = 0;
 static char defaultOutputFile[] = "test.264";
 static char *outputFileName = defaultOutputFile;
 static char *codec = NULL;
@@ -40,6 +44,18 @@ static uint32_t initBufferFullness = 0;
 static uint32_t windowSize = 1000;
 static uint32_t targetPercentage = 95;
 static uint32_t qualityLevel = VIDEO_PARAMS_QUALITYLEVEL_NONE;
+static char* statsTarget = NULL;
+static char* statsFormat = NULL;
+static uint32_t statsInterval = 1000;
+static char* cameraMode = NULL;
+static int threadCount = 0;
+static int readAheadFrames = 4;
+static bool directIo = false;
+static bool mappedInput = false;
+static int startFrame = 0;
+//-1: once, or till loopSeconds is up. 0: no limit
+static int loopCount = -1;
+static int loopSeconds = 0;
 
 #ifdef __BUILD_GET_MV__
 static FILE *MVFp;
@@ -63,6 +79,10 @@ static void print_help(const char* app)
 {
     printf("%s <options>\n", app);
     printf("   -i <source yuv filename> load YUV from a file\n");
+    printf("      give -i /dev/videoN more than once to capture and encode several cameras,\n");
+    printf("      -o test.264 is written as test_videoN.264, -f is the rate each camera is held to\n");
+    printf("      or -i synthetic:<w>x<h>:<nv12|i420|yv12>:<pattern>[:<frames>[:<seed>]] for generated frames,\n");
+    printf("      pattern is gradient, noise, moving-boxes, moving-bars or scene-cuts, 300 frames by default\n");
     printf("   -W <width> -H <height>\n");
     printf("   -o <coded file> optional\n");
     printf("   -b <bitrate: kbps> optional\n");
@@ -88,6 +108,19 @@ static void print_help(const char* app)
            "JPEG valid range[1, 100], HEVC|AVC|VP8|VP9 valid range[%d, %d], "
            "a value of 0 means CODEC will use its own internal default value> "
            "optional\n", VIDEO_PARAMS_QUALITYLEVEL_NONE, VIDEO_PARAMS_QUALITYLEVEL_MAX);
+    printf("   --stats <file|fd:N> write periodic stats (frames, fps, bytes) to file or fd, optional\n");
+    printf("   --stats-format <json|csv> default: csv for .csv file, else json lines\n");
+    printf("   --stats-interval <ms> how often stats are written, default 1000\n");
+    printf("   --camera-mode <mmap|dmabuf|userptr> how /dev/video* frames are captured, default mmap\n");
+    printf("                 dmabuf: frames go to the encoder as VA surfaces, without a copy\n");
+    printf("   --threads <encode threads for several cameras, default one for each camera>\n");
+    printf("   --read-ahead <frames of a yuv file read ahead on a thread, default 4, 0 to read in the encode loop>\n");
+    printf("   --direct-io read the yuv file with O_DIRECT, bypassing the page cache\n");
+    printf("   --mmap give the encoder frames straight from a mapping of the yuv file, no reads or copies\n");
+    printf("   --start-frame <n> start from frame n of the yuv file\n");
+    printf("   --loop <n> encode the yuv file n times without restarting the encoder, 0 for no limit\n");
+    printf("   --duration <s> stop after s seconds, the yuv file is looped until then unless --loop is given\n");
+    printf("   --trace <file.json> record pipeline stages, write a chrome trace (chrome://tracing, ui.perfetto.dev) on exit, optional\n");
 }
 
 static VideoRateControl string_to_rc_mode(char *str)
@@ -125,6 +158,18 @@ static bool process_cmdline(int argc, char *argv[])
         { "vbv-buffer-fullness", required_argument, NULL, 0 },
         { "vbv-buffer-size", required_argument, NULL, 0 },
         { "quality-level", required_argument, NULL, 0 },
+        { "stats", required_argument, NULL, 0 },
+        { "stats-format", required_argument, NULL, 0 },
+        { "stats-interval", required_argument, NULL, 0 },
+        { "camera-mode", required_argument, NULL, 0 },
+        { "threads", required_argument, NULL, 0 },
+        { "read-ahead", required_argument, NULL, 0 },
+        { "direct-io", no_argument, NULL, 0 },
+        { "mmap", no_argument, NULL, 0 },
+        { "start-frame", required_argument, NULL, 0 },
+        { "loop", required_argument, NULL, 0 },
+        { "duration", required_argument, NULL, 0 },
+        { "trace", required_argument, NULL, 0 },
         { NULL, no_argument, NULL, 0 }
     };
     int option_index;
@@ -143,6 +188,10 @@ static bool process_cmdline(int argc, char *argv[])
             return false;
         case 'i':
             inputFileName = optarg;
+            if (inputFileCount < MAX_INPUT_FILES)
+                inputFileNames[inputFileCount++] = optarg;
+            else
+                fprintf(stderr, "only %d inputs are supported, ignore %s\n", MAX_INPUT_FILES, optarg);
             break;
         case 'o':
             outputFileName = optarg;
@@ -210,6 +259,47 @@ static bool process_cmdline(int argc, char *argv[])
                 case 13:
                     qualityLevel = atoi(optarg);
                     break;
+                case 14:
+                    statsTarget = optarg;
+                    break;
+                case 15:
+                    statsFormat = optarg;
+                    break;
+                case 16:
+                    statsInterval = atoi(optarg);
+                    break;
+                case 17:
+                    cameraMode = optarg;
+                    break;
+                case 18:
+                    threadCount = atoi(optarg);
+                    break;
+                case 19:
+                    readAheadFrames = atoi(optarg);
+                    break;
+                case 20:
+                    directIo = true;
+                    break;
+                case 21:
+                    mappedInput = true;
+                    break;
+                case 22:
+                    startFrame = atoi(optarg);
+                    break;
+                case 23:
+                    loopCount = atoi(optarg);
+                    if (loopCount < 0) {
+                        fprintf(stderr, "invalid loop count: %s\n", optarg);
+                        return false;
+                    }
+                    break;
+                case 24:
+                    loopSeconds = atoi(optarg);
+                    break;
+                case 25:
+                    if (!YamiMediaCodec::Trace::instance().open(optarg))
+                        return false;
+                    break;
             }
         }
     }
@@ -221,6 +311,11 @@ static bool process_cmdline(int argc, char *argv[])
     }
 #endif
 
+    if (readAheadFrames < 0 || startFrame < 0 || loopSeconds < 0) {
+        fprintf(stderr, "read ahead, start frame and duration can't be negative\n");
+        return false;
+    }
+
     if ((rcMode == RATE_CONTROL_CBR || rcMode == RATE_CONTROL_VBR) && (bitRate <= 0)) {
         fprintf(stderr, "please make sure bitrate is positive when CBR/VBR mode\n");
         return false;
@@ -17,13 +17,20 @@
 #include "config.h"
 #endif
 
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <algorithm>
 #include "common/log.h"
 #include "common/utils.h"
+#include "common/trace.h"
 
 #include "encodeinput.h"
 #include "encodeInputDecoder.h"
@@ -32,7 +39,7 @@ using namespace YamiMediaCodec;
 
 #define MAX_WIDTH  8192
 #define MAX_HEIGHT 4320
-EncodeInput * EncodeInput::create(const char* inputFileName, uint32_t fourcc, int width, int height)
+EncodeInput * EncodeInput::create(const char* inputFileName, uint32_t fourcc, int width, int height, const char* cameraMode)
 {
     EncodeInput *input = NULL;
     if (!inputFileName) {
@@ -42,6 +49,9 @@ EncodeInput * EncodeInput::create(const char* inputFileName, uint32_t fourcc, in
         return NULL;
 #endif
     }
+    else if (SyntheticFrame::isSpec(inputFileName)) {
+        input = new EncodeInputSynthetic;
+    }
     else {
 #ifndef ANDROID // temp disable transcoding and camera support on android
         DecodeInput* decodeInput = DecodeInput::create(inputFileName);
@@ -49,7 +59,15 @@ EncodeInput * EncodeInput::create(const char* inputFileName, uint32_t fourcc, in
             input = new EncodeInputDecoder(decodeInput);
         }
         else if (!strncmp(inputFileName, "/dev/video", strlen("/dev/video"))) {
-            input = new EncodeInputCamera;
+            EncodeInputCamera* camera = new EncodeInputCamera;
+            EncodeInputCamera::CameraDataMode mode = EncodeInputCamera::CAMERA_DATA_MODE_MMAP;
+            if (cameraMode && !EncodeInputCamera::parseDataMode(cameraMode, mode)) {
+                fprintf(stderr, "unknown camera mode %s\n", cameraMode);
+                delete camera;
+                return NULL;
+            }
+            camera->setDataMode(mode);
+            input = camera;
         }
         else
 #endif
@@ -69,10 +87,21 @@ EncodeInput * EncodeInput::create(const char* inputFileName, uint32_t fourcc, in
     return input;
 }
 
+// O_DIRECT wants the offset, size and memory of a read aligned to the logical block size
+static const uint32_t kIoAlign = 4096;
+
 EncodeInputFile::EncodeInputFile()
-    : m_ifs()
-    , m_buffer(NULL)
+    : m_fd(-1)
+    , m_seekable(true)
+    , m_readAhead(kDefaultReadAhead)
+    , m_directIo(false)
+    , m_mapped(false)
+    , m_prepared(false)
     , m_readToEOS(false)
+    , m_reading(false)
+    , m_outCount(0)
+    , m_nextFrame(0)
+    , m_lastRead(0)
 {
 }
 
@@ -116,43 +145,392 @@ bool EncodeInputFile::init(const char* inputFileName, uint32_t fourcc, int width
     break;
     }
 
-    m_ifs.open(inputFileName);
-    if (!m_ifs) {
+    m_fd = open(inputFileName, O_RDONLY);
+    if (m_fd == -1) {
         fprintf(stderr, "fail to open input file: %s", inputFileName);
         return false;
     }
+    m_fileName = inputFileName;
+    struct stat st;
+    if (!fstat(m_fd, &st) && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)))
+        m_seekable = false;
+    return true;
+}
+
+bool EncodeInputFile::setReadAhead(uint32_t frames, bool directIo)
+{
+    if (m_prepared)
+        return false;
+    m_readAhead = frames;
+    m_directIo = directIo;
+    return true;
+}
 
-    m_buffer = static_cast<uint8_t*>(malloc(m_frameSize));
+bool EncodeInputFile::setMapped(bool mapped)
+{
+    if (m_prepared)
+        return false;
+    m_mapped = mapped;
     return true;
 }
 
+bool EncodeInputFile::seekFrame(uint64_t frame)
+{
+    struct stat st;
+    if (!m_seekable || fstat(m_fd, &st)) {
+        ERROR("%s can't seek", m_fileName.c_str());
+        return false;
+    }
+    if ((frame + 1) * m_frameSize > (uint64_t)st.st_size) {
+        ERROR("%s has no frame %" PRIu64, m_fileName.c_str(), frame);
+        return false;
+    }
+    if (m_mapped && m_prepared) {
+        m_map.seek(frame);
+    } else {
+        //frames read ahead are dropped, frames held by the caller stay out
+        stopReading();
+        m_nextFrame = frame;
+    }
+    m_readToEOS = false;
+    return true;
+}
+
+bool EncodeInputFile::prepare()
+{
+    m_prepared = true;
+    if (m_mapped) {
+        if (m_seekable && m_map.open(m_fileName.c_str(), m_frameSize)) {
+            m_map.seek(m_nextFrame);
+            return true;
+        }
+        WARNING("can't map %s, read it instead", m_fileName.c_str());
+        m_mapped = false;
+    }
+    if (!m_seekable)
+        m_directIo = false;
+    if (m_directIo) {
+        int flags = fcntl(m_fd, F_GETFL);
+        if (flags == -1 || fcntl(m_fd, F_SETFL, flags | O_DIRECT) == -1) {
+            WARNING("%s can't be read with O_DIRECT, read it through the page cache", m_fileName.c_str());
+            m_directIo = false;
+        }
+    }
+    if (!m_directIo)
+        posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    m_slots.resize(std::max(m_readAhead, 1u));
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        void* memory;
+        //room for the aligned blocks around an unaligned frame
+        if (posix_memalign(&memory, kIoAlign, m_frameSize + 2 * kIoAlign)) {
+            ERROR("fail to allocate %zu bytes for a frame", m_frameSize);
+            return false;
+        }
+        m_slots[i].memory = m_slots[i].data = static_cast<uint8_t*>(memory);
+    }
+    return true;
+}
+
+bool EncodeInputFile::startReading()
+{
+    m_free.reset(new SlotQueue(m_slots.size()));
+    m_filled.reset(new SlotQueue(m_slots.size()));
+    for (uint32_t i = 0; i < m_slots.size(); i++) {
+        if (!m_slots[i].out)
+            m_free->push(i);
+    }
+    if (pthread_create(&m_reader, NULL, readerEntry, this)) {
+        ERROR("create reader thread failed");
+        return false;
+    }
+    m_reading = true;
+    return true;
+}
+
+void EncodeInputFile::stopReading()
+{
+    if (!m_reading)
+        return;
+    m_filled->close();
+    m_free->close();
+    pthread_join(m_reader, NULL);
+    m_reading = false;
+}
+
+ssize_t EncodeInputFile::readFrame(Slot& slot, uint64_t frame)
+{
+    uint64_t offset = frame * m_frameSize;
+    uint64_t start = offset;
+    uint64_t end = offset + m_frameSize;
+    if (m_directIo) {
+        start &= ~(uint64_t)(kIoAlign - 1);
+        end = (end + kIoAlign - 1) & ~(uint64_t)(kIoAlign - 1);
+    }
+    size_t skip = offset - start;
+    size_t length = end - start;
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n;
+        if (m_seekable)
+            n = pread(m_fd, slot.memory + done, length - done, start + done);
+        else
+            n = read(m_fd, slot.memory + done, length - done);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EINVAL && m_directIo) {
+                int flags = fcntl(m_fd, F_GETFL);
+                if (flags != -1 && fcntl(m_fd, F_SETFL, flags & ~O_DIRECT) != -1) {
+                    WARNING("%s refused O_DIRECT reads, read it through the page cache", m_fileName.c_str());
+                    m_directIo = false;
+                    return readFrame(slot, frame);
+                }
+            }
+            ERROR("read %s failed, %s", m_fileName.c_str(), strerror(errno));
+            return -1;
+        }
+        if (!n)
+            break;
+        done += n;
+    }
+    slot.data = slot.memory + skip;
+    if (done <= skip)
+        return 0;
+    return std::min(done - skip, m_frameSize);
+}
+
+void* EncodeInputFile::readerEntry(void* input)
+{
+    ((EncodeInputFile*)input)->readerLoop();
+    return NULL;
+}
+
+void EncodeInputFile::readerLoop()
+{
+    uint32_t index;
+    while (m_free->pop(index)) {
+        m_lastRead = readFrame(m_slots[index], m_nextFrame);
+        //the ring keeps going over the rewind, a short tail is dropped
+        if (m_lastRead >= 0 && m_lastRead < (ssize_t)m_frameSize && m_nextFrame && startNextPass()) {
+            m_nextFrame = 0;
+            m_lastRead = readFrame(m_slots[index], m_nextFrame);
+        }
+        if (m_lastRead < (ssize_t)m_frameSize)
+            break;
+        m_nextFrame++;
+        if (!m_filled->push(index))
+            break;
+    }
+    //end of file, or stopped
+    m_filled->close();
+}
+
+bool EncodeInputFile::setLoop(const SharedPtr<InputLoop>& loop)
+{
+    m_loop = loop;
+    return true;
+}
+
+bool EncodeInputFile::startNextPass()
+{
+    if (!m_loop || !m_loop->again())
+        return false;
+    if (!m_seekable) {
+        WARNING("%s can't be rewound, no more loops", m_fileName.c_str());
+        return false;
+    }
+    m_loop->addPass();
+    return true;
+}
+
+bool EncodeInputFile::isSlot(intptr_t handle)
+{
+    uint8_t* p = reinterpret_cast<uint8_t*>(handle);
+    if (m_map.contains(p))
+        return true;
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        if (p >= m_slots[i].memory && p < m_slots[i].memory + m_frameSize + 2 * kIoAlign)
+            return true;
+    }
+    return false;
+}
+
 bool EncodeInputFile::getOneFrameInput(VideoFrameRawData &inputBuffer)
 {
     if (m_readToEOS)
         return false;
+    if (m_loop && m_loop->expired()) {
+        m_readToEOS = true;
+        return false;
+    }
+    if (!m_prepared && !prepare()) {
+        m_readToEOS = true;
+        return false;
+    }
+    if (m_mapped)
+        return getMappedFrame(inputBuffer);
+    if (m_readAhead && !m_reading && !startReading()) {
+        m_readToEOS = true;
+        return false;
+    }
 
-    uint8_t *buffer = m_buffer;
-    if (inputBuffer.handle)
-        buffer = reinterpret_cast<uint8_t*>(inputBuffer.handle);
-
-    size_t ret = m_ifs.read(reinterpret_cast<char*>(buffer), m_frameSize).gcount();
+    uint32_t index = 0;
+    ssize_t ret;
+    if (m_reading) {
+        if (m_outCount == m_slots.size()) {
+            ERROR("all %zu frames read ahead are held, recycle one first", m_slots.size());
+            return false;
+        }
+        ret = m_filled->pop(index) ? (ssize_t)m_frameSize : m_lastRead;
+    } else {
+        ret = readFrame(m_slots[0], m_nextFrame++);
+        if (ret >= 0 && ret < (ssize_t)m_frameSize && m_nextFrame > 1 && startNextPass()) {
+            m_nextFrame = 0;
+            ret = readFrame(m_slots[0], m_nextFrame++);
+        }
+    }
 
     if (ret <= 0) {
         m_readToEOS = true;
         return false;
     }
 
-    if (ret < m_frameSize) {
-        fprintf (stderr, "data is not enough to read(read size: %zu, m_frameSize: %zu), maybe resolution is wrong\n", ret, m_frameSize);
+    if (ret < (ssize_t)m_frameSize) {
+        fprintf (stderr, "data is not enough to read(read size: %zd, m_frameSize: %zu), maybe resolution is wrong\n", ret, m_frameSize);
+        m_readToEOS = true;
         return false;
     }
 
-    return fillFrameRawData(&inputBuffer, m_fourcc, m_width, m_height, buffer);
+    Slot& slot = m_slots[index];
+    if (inputBuffer.handle && !isSlot(inputBuffer.handle)) {
+        //the caller brought its own memory, the slot can be read again at once
+        uint8_t* buffer = reinterpret_cast<uint8_t*>(inputBuffer.handle);
+        memcpy(buffer, slot.data, m_frameSize);
+        if (m_reading)
+            m_free->push(index);
+        return fillFrameRawData(&inputBuffer, m_fourcc, m_width, m_height, buffer);
+    }
+
+    if (!fillFrameRawData(&inputBuffer, m_fourcc, m_width, m_height, slot.data)) {
+        if (m_reading)
+            m_free->push(index);
+        return false;
+    }
+    inputBuffer.internalID = index;
+    if (m_reading) {
+        slot.out = true;
+        m_outCount++;
+    }
+    return true;
+}
+
+bool EncodeInputFile::getMappedFrame(VideoFrameRawData& inputBuffer)
+{
+    uint8_t* frame = m_map.next();
+    if (!frame && m_map.tell() && startNextPass()) {
+        m_map.seek(0);
+        frame = m_map.next();
+    }
+    if (!frame) {
+        if (m_map.getTailSize())
+            fprintf(stderr, "data is not enough to read(read size: %zu, m_frameSize: %zu), maybe resolution is wrong\n", m_map.getTailSize(), m_frameSize);
+        m_readToEOS = true;
+        return false;
+    }
+    if (inputBuffer.handle && !isSlot(inputBuffer.handle)) {
+        uint8_t* buffer = reinterpret_cast<uint8_t*>(inputBuffer.handle);
+        memcpy(buffer, frame, m_frameSize);
+        frame = buffer;
+    }
+    //the mapping lives as long as we do, nothing to recycle
+    return fillFrameRawData(&inputBuffer, m_fourcc, m_width, m_height, frame);
+}
+
+bool EncodeInputFile::recycleOneFrameInput(VideoFrameRawData &inputBuffer)
+{
+    uint32_t index = inputBuffer.internalID;
+    //frames copied to the caller's memory have nothing to give back
+    if (index >= m_slots.size() || !m_slots[index].out
+        || inputBuffer.handle != reinterpret_cast<intptr_t>(m_slots[index].data))
+        return true;
+    m_slots[index].out = false;
+    m_outCount--;
+    //a stopped reader takes it when it starts again
+    if (m_reading)
+        m_free->push(index);
+    return true;
 }
 
 EncodeInputFile::~EncodeInputFile()
 {
-    free(m_buffer);
+    stopReading();
+    for (size_t i = 0; i < m_slots.size(); i++)
+        free(m_slots[i].memory);
+    if (m_fd != -1)
+        close(m_fd);
+}
+
+EncodeInputSynthetic::EncodeInputSynthetic()
+    : m_nextFrame(0)
+    , m_readToEOS(false)
+{
+}
+
+bool EncodeInputSynthetic::init(const char* inputFileName, uint32_t /*fourcc*/, int /*width*/, int /*height*/)
+{
+    if (!m_generator.parse(inputFileName))
+        return false;
+    m_fourcc = m_generator.getFourcc();
+    m_width = m_generator.getWidth();
+    m_height = m_generator.getHeight();
+    m_frameSize = m_generator.getFrameSize();
+    return true;
+}
+
+bool EncodeInputSynthetic::seekFrame(uint64_t frame)
+{
+    uint64_t frames = m_generator.getFrameCount();
+    if (frames && frame >= frames) {
+        ERROR("synthetic input has no frame %d", (int)frame);
+        return false;
+    }
+    m_nextFrame = frame;
+    m_readToEOS = false;
+    return true;
+}
+
+bool EncodeInputSynthetic::setLoop(const SharedPtr<InputLoop>& loop)
+{
+    m_loop = loop;
+    return true;
+}
+
+bool EncodeInputSynthetic::getOneFrameInput(VideoFrameRawData& inputBuffer)
+{
+    if (m_readToEOS)
+        return false;
+    if (m_loop && m_loop->expired()) {
+        m_readToEOS = true;
+        return false;
+    }
+    uint64_t frames = m_generator.getFrameCount();
+    if (frames && m_nextFrame >= frames) {
+        if (!m_loop || !m_loop->again()) {
+            m_readToEOS = true;
+            return false;
+        }
+        m_loop->addPass();
+        m_nextFrame = 0;
+    }
+
+    uint8_t* buffer = reinterpret_cast<uint8_t*>(inputBuffer.handle);
+    if (!buffer) {
+        m_buffer.resize(m_frameSize);
+        buffer = &m_buffer[0];
+    }
+    m_generator.fill(m_nextFrame++, buffer);
+    return fillFrameRawData(&inputBuffer, m_fourcc, m_width, m_height, buffer);
 }
 
 EncodeOutput::EncodeOutput():m_ofs()
@@ -224,6 +602,7 @@ bool EncodeOutput::init(const char* outputFileName, int width, int height, int f
 
 bool EncodeOutput::write(void* data, int size)
 {
+    TRACE_SCOPE("EncodeOutput::write");
     return m_ofs.write(reinterpret_cast<const char*>(data), size).good();
 }
 
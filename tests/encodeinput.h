@@ -21,7 +21,13 @@
 #endif
 
 #include <Yami.h>
+#include "common/BoundedQueue.h"
+#include "common/InputLoop.h"
+#include "common/MappedFrameFile.h"
 #include "common/NonCopyable.h"
+#include "common/SyntheticFrame.h"
+#include <va/va.h>
+#include <pthread.h>
 #include <vector>
 #include <fstream>
 #include <iostream>
@@ -41,14 +47,31 @@ using namespace YamiMediaCodec;
 class EncodeInput;
 class EncodeInputFile;
 class EncodeInputCamera;
+class EncodeInputSynthetic;
+struct v4l2_buffer;
+struct v4l2_plane;
 class EncodeInput {
 public:
-    static EncodeInput* create(const char* inputFileName, uint32_t fourcc, int width, int height);
+    //cameraMode is one of EncodeInputCamera::parseDataMode()'s names, NULL for mmap
+    static EncodeInput* create(const char* inputFileName, uint32_t fourcc, int width, int height, const char* cameraMode = NULL);
     EncodeInput() : m_width(0), m_height(0), m_frameSize(0) {};
     virtual ~EncodeInput() {};
     virtual bool init(const char* inputFileName, uint32_t fourcc, int width, int height) = 0;
     virtual bool getOneFrameInput(VideoFrameRawData &inputBuffer) = 0;
     virtual bool recycleOneFrameInput(VideoFrameRawData &inputBuffer) {return true;};
+    //inputs that hand out VA surfaces instead of raw data, the encoder must use this display
+    virtual bool getNativeDisplay(NativeDisplay& display) { return false; }
+    //the input gets the frame's memory back when the last reference goes away
+    virtual bool getOneFrame(SharedPtr<VideoFrame>& frame) { return false; }
+    //raw file inputs read up to frames ahead on a thread, call it before the first frame
+    virtual bool setReadAhead(uint32_t frames, bool directIo) { return false; }
+    //raw file inputs give frames straight from a mapping of the file, call it before the first frame
+    virtual bool setMapped(bool mapped) { return false; }
+    //raw file inputs go on from frame n, and are not at EOS any more
+    virtual bool seekFrame(uint64_t frame) { return false; }
+    //raw file inputs start over at EOF while the loop says so, and are at EOS
+    //once its duration is up. Call it before the first frame
+    virtual bool setLoop(const SharedPtr<InputLoop>& loop) { return false; }
     virtual bool isEOS() = 0;
     int getWidth() { return m_width;}
     int getHeight() { return m_height;}
@@ -61,55 +84,180 @@ protected:
     size_t m_frameSize;
 };
 
+/**
+ * Raw frames from a file. A reader thread keeps a ring of aligned frame
+ * buffers filled, a frame handed out goes back to the ring in
+ * recycleOneFrameInput(), so the caller may hold some of them at a time.
+ * With a read ahead of 0, frames are read in getOneFrameInput().
+ * A mapped file needs neither, frames point into the mapping.
+ */
 class EncodeInputFile : public EncodeInput {
 public:
+    enum { kDefaultReadAhead = 4 };
     EncodeInputFile();
     ~EncodeInputFile();
     virtual bool init(const char* inputFileName, uint32_t fourcc, int width, int height);
     virtual bool getOneFrameInput(VideoFrameRawData &inputBuffer);
+    virtual bool recycleOneFrameInput(VideoFrameRawData &inputBuffer);
+    //directIo opens the file with O_DIRECT, so the page cache is not polluted
+    virtual bool setReadAhead(uint32_t frames, bool directIo);
+    virtual bool setMapped(bool mapped);
+    virtual bool seekFrame(uint64_t frame);
+    virtual bool setLoop(const SharedPtr<InputLoop>& loop);
     virtual bool isEOS() {return m_readToEOS;}
 
 protected:
-    std::ifstream m_ifs;
-    uint8_t *m_buffer;
+    struct Slot {
+        uint8_t* memory;
+        //the frame, inside memory
+        uint8_t* data;
+        //handed out, and not recycled yet
+        bool out;
+    };
+    typedef BoundedQueue<uint32_t> SlotQueue;
+
+    //called on the first frame, maps the file or allocates the slots
+    bool prepare();
+    bool getMappedFrame(VideoFrameRawData& inputBuffer);
+    bool startReading();
+    void stopReading();
+    //bytes of the frame read to slot.data, -1 on errors
+    ssize_t readFrame(Slot& slot, uint64_t frame);
+    bool isSlot(intptr_t handle);
+    //at the end of the file, true if another pass starts from frame 0
+    bool startNextPass();
+    static void* readerEntry(void* input);
+    void readerLoop();
+
+    std::string m_fileName;
+    int m_fd;
+    //pipes are read in order, there is no seeking or pread()
+    bool m_seekable;
+    uint32_t m_readAhead;
+    bool m_directIo;
+    bool m_mapped;
+    bool m_prepared;
     bool m_readToEOS;
+    MappedFrameFile m_map;
+    SharedPtr<InputLoop> m_loop;
+
+    std::vector<Slot> m_slots;
+    //slots the reader may fill, and slots ready for getOneFrameInput()
+    SharedPtr<SlotQueue> m_free;
+    SharedPtr<SlotQueue> m_filled;
+    bool m_reading;
+    uint32_t m_outCount;
+    pthread_t m_reader;
+    //reader only, while it runs
+    uint64_t m_nextFrame;
+    ssize_t m_lastRead;
 private:
     DISALLOW_COPY_AND_ASSIGN(EncodeInputFile);
 };
 
+/**
+ * Generated frames, see SyntheticFrame for the "synthetic:..." names.
+ * No file I/O, so the encoder alone is measured. Frames are made in the
+ * caller's memory when it brings some, else in a buffer of our own.
+ */
+class EncodeInputSynthetic : public EncodeInput {
+public:
+    EncodeInputSynthetic();
+    //fourcc, width and height come from the name
+    virtual bool init(const char* inputFileName, uint32_t fourcc, int width, int height);
+    virtual bool getOneFrameInput(VideoFrameRawData& inputBuffer);
+    virtual bool seekFrame(uint64_t frame);
+    virtual bool setLoop(const SharedPtr<InputLoop>& loop);
+    virtual bool isEOS() { return m_readToEOS; }
+
+private:
+    SyntheticFrame m_generator;
+    uint64_t m_nextFrame;
+    bool m_readToEOS;
+    SharedPtr<InputLoop> m_loop;
+    std::vector<uint8_t> m_buffer;
+    DISALLOW_COPY_AND_ASSIGN(EncodeInputSynthetic);
+};
+
 class EncodeInputCamera : public EncodeInput {
 public:
     enum CameraDataMode{
         CAMERA_DATA_MODE_MMAP,
-        // CAMERA_DATA_MODE_DMABUF_MMAP,
-        // CAMERA_DATA_MODE_USRPTR,
-        // CAMERA_DATA_MODE_DMABUF_USRPTR,
+        //mmap buffers exported with VIDIOC_EXPBUF and imported as VA surfaces
+        CAMERA_DATA_MODE_DMABUF_MMAP,
+        //page aligned buffers of our own, one per v4l2 buffer
+        CAMERA_DATA_MODE_USRPTR,
     };
-    EncodeInputCamera() :m_frameBufferCount(5), m_frameBufferSize(0), m_dataMode(CAMERA_DATA_MODE_MMAP) {};
+    //"mmap", "dmabuf" or "userptr"
+    static bool parseDataMode(const char* name, CameraDataMode& mode);
+
+    EncodeInputCamera();
     ~EncodeInputCamera();
     virtual bool init(const char* cameraPath, uint32_t fourcc, int width, int height);
     bool setDataMode(CameraDataMode mode = CAMERA_DATA_MODE_MMAP) {m_dataMode = mode; return true;};
 
     virtual bool getOneFrameInput(VideoFrameRawData &inputBuffer);
     virtual bool recycleOneFrameInput(VideoFrameRawData &inputBuffer);
+    virtual bool getNativeDisplay(NativeDisplay& display);
+    virtual bool getOneFrame(SharedPtr<VideoFrame>& frame);
     virtual bool isEOS() { return false; }
+    //for callers polling many cameras, frames are taken only when ready
+    int getFd() const { return m_fd; }
+    void setBlocking(bool blocking) { m_blocking = blocking; }
     // void getSupportedResolution();
 private:
+    enum { kMaxPlanes = 3 };
+    struct FrameBuffer {
+        FrameBuffer();
+        //mapped or allocated memory of each v4l2 plane
+        uint8_t* planes[kMaxPlanes];
+        uint32_t lengths[kMaxPlanes];
+        int dmabuf;
+        VASurfaceID surface;
+        //multi-plane mmap frames are gathered here
+        std::vector<uint8_t> staging;
+    };
+    struct FrameRecycler;
+    struct RecycleState;
+
     int m_fd;
-    std::vector<uint8_t*> m_frameBuffers;
+    std::vector<FrameBuffer> m_frameBuffers;
     uint32_t m_frameBufferCount;
     uint32_t m_frameBufferSize;
     CameraDataMode m_dataMode;
+    bool m_blocking;
+
+    //capture format, one or more v4l2 planes
+    uint32_t m_bufferType;
+    uint32_t m_planeCount;
+    uint32_t m_planeSizes[kMaxPlanes];
+    uint32_t m_bytesPerLine[kMaxPlanes];
+    //layout of the frame in one piece of memory
+    uint32_t m_pitches[kMaxPlanes];
+    uint32_t m_offsets[kMaxPlanes];
+
+    VADisplay m_vaDisplay;
+    int m_drmFd;
+    //shared with the frames handed out, they may outlive us
+    SharedPtr<RecycleState> m_recycleState;
 
     bool openDevice();
     bool initDevice(const char *cameraDevicePath);
+    bool setFormat(uint32_t capabilities);
+    bool setLayout();
     bool initMmap();
+    bool initUserPtr();
+    bool exportDmaBuf();
+    bool createSurfaces();
+    void destroySurfaces();
+    void initBuffer(struct v4l2_buffer& buf, struct v4l2_plane* planes, int32_t index);
     bool startCapture();
     int32_t dequeFrame();
     bool enqueFrame(int32_t index);
+    uint8_t* getFrameData(uint32_t index);
     bool stopCapture();
     bool uninitDevice();
-
+    DISALLOW_COPY_AND_ASSIGN(EncodeInputCamera);
 };
 
 #if 0
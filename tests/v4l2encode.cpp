@@ -25,12 +25,13 @@
 #include <unistd.h>
 #include <linux/videodev2.h>
 #include  <sys/mman.h>
-#include <v4l2_wrapper.h>
 
+#include "common/InputLoop.h"
 #include "common/log.h"
 #include "common/utils.h"
 #include "encodehelp.h"
 #include "encodeinput.h"
+#include "V4L2Device.h"
 
 static enum v4l2_memory inputMemoryType = V4L2_MEMORY_USERPTR;
 const static enum v4l2_memory outputMemoryType = V4L2_MEMORY_MMAP;
@@ -43,11 +44,13 @@ uint32_t inputQueueCapacity = 0;
 uint32_t outputQueueCapacity = 0;
 VideoFrameRawData inputFrames[kMaxFrameQueueLength];
 uint8_t *outputFrames[kMaxFrameQueueLength];
+uint32_t outputFrameLengths[kMaxFrameQueueLength];
 bool isReadEOS = false;
 bool isEncodeEOS = false;
 bool isOutputEOS = false;
 
 static EncodeInput* streamInput;
+static SharedPtr<V4L2Device> device;
 
 bool readOneFrameData(uint32_t index)
 {
@@ -97,7 +100,7 @@ void fillV4L2InputBuffer(struct v4l2_buffer& buf, const VideoFrameRawData& frame
         ASSERT(0 && "unknown memory type");
 }
 
-bool feedOneInputFrame(int fd, int index = -1 /* if index is not -1, simple enque it*/)
+bool feedOneInputFrame(int index = -1 /* if index is not -1, simple enque it*/)
 {
     struct v4l2_buffer buf;
     struct v4l2_plane planes[VIDEO_MAX_PLANES];
@@ -112,7 +115,7 @@ bool feedOneInputFrame(int fd, int index = -1 /* if index is not -1, simple enqu
     buf.length = inputFramePlaneCount;
 
     if (index == -1) {
-        ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_DQBUF, &buf);
+        ioctlRet = device->ioctl(VIDIOC_DQBUF, &buf);
         if (ioctlRet == -1)
             return false;
         // recycle camera buffer
@@ -140,7 +143,7 @@ bool feedOneInputFrame(int fd, int index = -1 /* if index is not -1, simple enqu
         fillV4L2InputBuffer(buf, inputFrames[buf.index]);
     }
 
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_QBUF, &buf);
+    ioctlRet = device->ioctl(VIDIOC_QBUF, &buf);
     ASSERT(ioctlRet != -1);
 
     return true;
@@ -170,7 +173,7 @@ bool writeOneOutputFrame(uint8_t* data, uint32_t dataSize)
 
 }
 
-bool takeOneOutputFrame(int fd, int index = -1/* if index is not -1, simple enque it*/)
+bool takeOneOutputFrame(int index = -1/* if index is not -1, simple enque it*/)
 {
     struct v4l2_buffer buf;
     struct v4l2_plane planes[1];
@@ -184,12 +187,12 @@ bool takeOneOutputFrame(int fd, int index = -1/* if index is not -1, simple enqu
     buf.length = 1;
 
     if (index == -1) {
-        ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_DQBUF, &buf);
+        ioctlRet = device->ioctl(VIDIOC_DQBUF, &buf);
 
         if (isEncodeEOS) {
             if (ioctlRet == -1) {
                 isOutputEOS = true;
-                YamiV4L2_SetDevicePollInterrupt(fd);
+                device->setDevicePollInterrupt();
                 return true;
             }
         }
@@ -204,7 +207,7 @@ bool takeOneOutputFrame(int fd, int index = -1/* if index is not -1, simple enqu
         buf.index = index;
     }
 
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_QBUF, &buf);
+    ioctlRet = device->ioctl(VIDIOC_QBUF, &buf);
     ASSERT(ioctlRet != -1);
 
     return true;
@@ -212,13 +215,17 @@ bool takeOneOutputFrame(int fd, int index = -1/* if index is not -1, simple enqu
 
 int main(int argc, char** argv)
 {
-    int32_t fd = -1;
     uint32_t i = 0;
     int32_t ioctlRet = -1;
 
     // parse command line parameters
     if (!process_cmdline(argc, argv))
         return -1;
+    //encodehelp.h is shared with yamiencode, these are only done there
+    if (statsTarget || threadCount || inputFileCount > 1) {
+        fprintf(stderr, "--stats, --threads and several -i inputs are not supported by v4l2encode\n");
+        return -1;
+    }
 
 #if ANDROID
     if (!inputFileName) {
@@ -226,18 +233,38 @@ int main(int argc, char** argv)
         inputFourcc = VA_FOURCC_NV12;
     }
 #endif
-    streamInput = EncodeInput::create(inputFileName, inputFourcc, videoWidth, videoHeight);
+    streamInput = EncodeInput::create(inputFileName, inputFourcc, videoWidth, videoHeight, cameraMode);
     ASSERT(streamInput);
+    if (SyntheticFrame::isSpec(inputFileName)) {
+        //the format is in the name, not on the command line
+        videoWidth = streamInput->getWidth();
+        videoHeight = streamInput->getHeight();
+        inputFourcc = streamInput->getFourcc();
+    }
+    streamInput->setReadAhead(readAheadFrames, directIo);
+    if (mappedInput)
+        streamInput->setMapped(true);
+    if (startFrame && !streamInput->seekFrame(startFrame)) {
+        fprintf(stderr, "can't start from frame %d\n", startFrame);
+        return -1;
+    }
+    SharedPtr<InputLoop> loop(new InputLoop(loopCount, loopSeconds));
+    if (!streamInput->setLoop(loop) && (loopCount >= 0 || loopSeconds))
+        fprintf(stderr, "--loop and --duration need a yuv file, ignored\n");
 
     // open device
-    fd = YamiV4L2_Open("encoder", 0);
-    ASSERT(fd!=-1);
+    device = V4L2Device::Create();
+    ASSERT(device);
+    if (!device->open("encoder", 0)) {
+        ERROR("open encoder failed");
+        return -1;
+    }
 
     // query hw capability
     struct v4l2_capability caps;
     memset(&caps, 0, sizeof(caps));
     caps.capabilities = V4L2_CAP_VIDEO_CAPTURE_MPLANE | V4L2_CAP_VIDEO_OUTPUT_MPLANE | V4L2_CAP_STREAMING;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_QUERYCAP, &caps);
+    ioctlRet = device->ioctl(VIDIOC_QUERYCAP, &caps);
     ASSERT(ioctlRet != -1);
 
     // set input/output data format
@@ -245,7 +272,7 @@ int main(int argc, char** argv)
     memset(&format, 0, sizeof(format));
     format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
     format.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_H264;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_S_FMT, &format);
+    ioctlRet = device->ioctl(VIDIOC_S_FMT, &format);
     ASSERT(ioctlRet != -1);
 
     memset(&format, 0, sizeof(format));
@@ -274,7 +301,7 @@ int main(int argc, char** argv)
     }
     format.fmt.pix_mp.width = videoWidth;
     format.fmt.pix_mp.height = videoHeight;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_S_FMT, &format);
+    ioctlRet = device->ioctl(VIDIOC_S_FMT, &format);
     ASSERT(ioctlRet != -1);
 
     // set input buffer type
@@ -284,7 +311,7 @@ int main(int argc, char** argv)
     if (inputMemoryType == V4L2_MEMORY_ANDROID_BUFFER_HANDLE)
         memoryType = VIDEO_DATA_MEMORY_TYPE_ANDROID_BUFFER_HANDLE;
 #endif
-    YamiV4L2_FrameMemoryType(fd, memoryType);
+    device->setFrameMemoryType(memoryType);
     }
 
     // set framerate
@@ -293,7 +320,7 @@ int main(int argc, char** argv)
     parms.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
     parms.parm.output.timeperframe.denominator = 1;
     parms.parm.output.timeperframe.numerator = fps;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_S_PARM, &parms);
+    ioctlRet = device->ioctl(VIDIOC_S_PARM, &parms);
     ASSERT(ioctlRet != -1);
 
     // set bitrate
@@ -306,7 +333,7 @@ int main(int argc, char** argv)
     control.ctrl_class = V4L2_CTRL_CLASS_MPEG;
     control.count = 1;
     control.controls = ctrls;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_S_EXT_CTRLS, &control);
+    ioctlRet = device->ioctl(VIDIOC_S_EXT_CTRLS, &control);
     ASSERT(ioctlRet != -1);
 
     // other controls
@@ -318,15 +345,15 @@ int main(int argc, char** argv)
     control.ctrl_class = V4L2_CTRL_CLASS_MPEG;
     control.count = 1;
     control.controls = ctrls;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_S_EXT_CTRLS, &control);
+    ioctlRet = device->ioctl(VIDIOC_S_EXT_CTRLS, &control);
     ASSERT(ioctlRet != -1);
 
     // start
     __u32 type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_STREAMON, &type);
+    ioctlRet = device->ioctl(VIDIOC_STREAMON, &type);
     ASSERT(ioctlRet != -1);
     type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_STREAMON, &type);
+    ioctlRet = device->ioctl(VIDIOC_STREAMON, &type);
     ASSERT(ioctlRet != -1);
 
     // setup input buffers
@@ -335,7 +362,7 @@ int main(int argc, char** argv)
     reqbufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
     reqbufs.memory = inputMemoryType;
     reqbufs.count = 2;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_REQBUFS, &reqbufs);
+    ioctlRet = device->ioctl(VIDIOC_REQBUFS, &reqbufs);
     ASSERT(ioctlRet != -1);
     ASSERT(reqbufs.count>0 && reqbufs.count <= kMaxFrameQueueLength);
     inputQueueCapacity = reqbufs.count;
@@ -354,7 +381,7 @@ int main(int argc, char** argv)
     reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
     reqbufs.memory = outputMemoryType;
     reqbufs.count = 2;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_REQBUFS, &reqbufs);
+    ioctlRet = device->ioctl(VIDIOC_REQBUFS, &reqbufs);
     ASSERT(ioctlRet != -1);
     ASSERT(reqbufs.count>0 && reqbufs.count <= kMaxFrameQueueLength);
     outputQueueCapacity = reqbufs.count;
@@ -369,88 +396,96 @@ int main(int argc, char** argv)
         buffer.memory = outputMemoryType;
         buffer.m.planes = planes;
         buffer.length = 1;
-        ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_QUERYBUF, &buffer);
+        ioctlRet = device->ioctl(VIDIOC_QUERYBUF, &buffer);
         ASSERT(ioctlRet != -1);
-        void* address = YamiV4L2_Mmap(NULL,
-                                      buffer.m.planes[0].length,
-                                      PROT_READ | PROT_WRITE,
-                                      MAP_SHARED, fd,
-                                      buffer.m.planes[0].m.mem_offset);
-        ASSERT(address);
+        void* address = device->mmap(NULL,
+                                     buffer.m.planes[0].length,
+                                     PROT_READ | PROT_WRITE,
+                                     MAP_SHARED,
+                                     buffer.m.planes[0].m.mem_offset);
+        ASSERT(address && address != MAP_FAILED);
         outputFrames[i] = static_cast<uint8_t*>(address);
-        // ignore lenght here
+        outputFrameLengths[i] = buffer.m.planes[0].length;
     }
     for (i=outputQueueCapacity; i<kMaxFrameQueueLength; i++) {
         outputFrames[i] = NULL;
+        outputFrameLengths[i] = 0;
     }
 
     // feed input/output frames first
     for (i=0; i<inputQueueCapacity; i++) {
-        if (!feedOneInputFrame(fd, i)) {
+        if (!feedOneInputFrame(i)) {
             ASSERT(0);
         }
     }
 
     for (i=0; i<outputQueueCapacity; i++) {
-        if (!takeOneOutputFrame(fd, i)) {
+        if (!takeOneOutputFrame(i)) {
             ASSERT(0);
         }
     }
 
     bool event_pending=true;
+    loop->start();
     do {
-        takeOneOutputFrame(fd);
-        feedOneInputFrame(fd);
+        takeOneOutputFrame();
+        feedOneInputFrame();
         if (isReadEOS)
             break;
-    } while (YamiV4L2_Poll(fd, true, &event_pending) == 0);
+    } while (device->poll(true, &event_pending) == 0);
 
     // drain input buffer
     ASSERT(isReadEOS);
     while (!isEncodeEOS) {
-        takeOneOutputFrame(fd);
-        feedOneInputFrame(fd);
+        takeOneOutputFrame();
+        feedOneInputFrame();
         usleep(10000);
     }
 
     // drain output buffer
     // stop input port to indicate EOS
     type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_STREAMOFF, &type);
+    ioctlRet = device->ioctl(VIDIOC_STREAMOFF, &type);
     ASSERT(ioctlRet != -1);
     ASSERT(isEncodeEOS);
     while (!isOutputEOS) {
         usleep(10000);
-        takeOneOutputFrame(fd);
+        takeOneOutputFrame();
     }
 
     ASSERT(isOutputEOS);
-    // YamiV4L2_Munmap(void* addr, size_t length)
+    // the device keeps mapped buffers, unmap them before REQBUFS frees them
+    for (i=0; i<outputQueueCapacity; i++) {
+        ioctlRet = device->munmap(outputFrames[i], outputFrameLengths[i]);
+        ASSERT(ioctlRet != -1);
+        outputFrames[i] = NULL;
+    }
 
     // release queued input/output buffer
     memset(&reqbufs, 0, sizeof(reqbufs));
     reqbufs.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
     reqbufs.memory = inputMemoryType;
     reqbufs.count = 0;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_REQBUFS, &reqbufs);
+    ioctlRet = device->ioctl(VIDIOC_REQBUFS, &reqbufs);
     ASSERT(ioctlRet != -1);
 
     memset(&reqbufs, 0, sizeof(reqbufs));
     reqbufs.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
     reqbufs.memory = outputMemoryType;
     reqbufs.count = 0;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_REQBUFS, &reqbufs);
+    ioctlRet = device->ioctl(VIDIOC_REQBUFS, &reqbufs);
     ASSERT(ioctlRet != -1);
 
     // stop output prot
     type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    ioctlRet = YamiV4L2_Ioctl(fd, VIDIOC_STREAMOFF, &type);
+    ioctlRet = device->ioctl(VIDIOC_STREAMOFF, &type);
     ASSERT(ioctlRet != -1);
 
     // close device
-    ioctlRet = YamiV4L2_Close(fd);
+    ioctlRet = device->close();
     ASSERT(ioctlRet != -1);
 
+    loop->log("v4l2encode");
     fprintf(stderr, "encode done\n");
     return 0;
 }
@@ -20,7 +20,11 @@
 #include "vppinputoutput.h"
 #include "vppoutputencode.h"
 #include "encodeinput.h"
+#include "common/CountedFrameAllocator.h"
 #include "common/log.h"
+#include "common/latency.h"
+#include "common/StatsSink.h"
+#include "common/trace.h"
 #include <Yami.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,6 +42,14 @@ SharedPtr<VppInput> createInput(const char* filename, const SharedPtr<VADisplay>
         ERROR("creat input failed");
         return input;
     }
+    SharedPtr<VppInputSynthetic> inputSynthetic = DynamicPointerCast<VppInputSynthetic>(input);
+    if (inputSynthetic) {
+        SharedPtr<FrameReader> reader(new VaapiFrameReader(display));
+        SharedPtr<FrameAllocator> alloctor(new PooledFrameAllocator(display, 5));
+        if (!inputSynthetic->config(alloctor, reader))
+            inputSynthetic.reset();
+        return inputSynthetic;
+    }
     SharedPtr<VppInputFile> inputFile = DynamicPointerCast<VppInputFile>(input);
     if (inputFile) {
         SharedPtr<FrameReader> reader(new VaapiFrameReader(display));
@@ -78,7 +90,7 @@ SharedPtr<FrameAllocator> createAllocator(const SharedPtr<VppOutput>& output, co
 {
     uint32_t fourcc;
     int width, height;
-    SharedPtr<FrameAllocator> allocator(new PooledFrameAllocator(display, 5));
+    SharedPtr<FrameAllocator> allocator(new CountedFrameAllocator(SharedPtr<FrameAllocator>(new PooledFrameAllocator(display, 5)), 5));
     if (!output->getFormat(fourcc, width, height)
         || !allocator->setFormat(fourcc, width,height)) {
         allocator.reset();
@@ -91,8 +103,15 @@ class VppTest
 {
 public:
     VppTest()
+        : m_statsTarget(NULL)
+        , m_statsFormat(NULL)
+        , m_statsInterval(1000)
+        , m_mapped(false)
+        , m_startFrame(0)
+        , m_loopCount(-1)
+        , m_loopSeconds(0)
 #if YAMI_CHECK_API_VERSION(0, 2, 1)
-        : m_sharpening(SHARPENING_LEVEL_NONE)
+        , m_sharpening(SHARPENING_LEVEL_NONE)
         , m_denoise(DENOISE_LEVEL_NONE)
         , m_deinterlaceMode(NULL)
         , m_hue(COLORBALANCE_LEVEL_NONE)
@@ -121,6 +140,17 @@ public:
             printf("create input or output failed");
             return false;
         }
+        SharedPtr<VppInputFile> inputFile = DynamicPointerCast<VppInputFile>(m_input);
+        if (inputFile) {
+            //falls back to the stream when the file can't be mapped
+            if (m_mapped)
+                inputFile->setMapped(true);
+            if (m_startFrame && !inputFile->seekFrame(m_startFrame))
+                return false;
+        }
+        m_loop.reset(new InputLoop(m_loopCount, m_loopSeconds));
+        if (!m_input->setLoop(m_loop) && (m_loopCount >= 0 || m_loopSeconds))
+            printf("--loop and --duration are not supported by this input, ignored\n");
         m_allocator = createAllocator(m_output, m_display);
         return bool(m_allocator);
     }
@@ -131,21 +161,48 @@ public:
         SharedPtr<VideoFrame> src, dest;
         YamiStatus  status;
         int count = 0;
+        StageTimer timer;
+        StageTimer::Stage outputStage = DynamicPointerCast<VppOutputEncode>(m_output) ? StageTimer::STAGE_ENCODE : StageTimer::STAGE_WRITE;
+        StatsSink stats("yamivpp");
+        if (m_statsTarget && !stats.open(m_statsTarget, m_statsFormat, m_statsInterval))
+            return false;
+        stats.setStageTimer(&timer);
+        SharedPtr<CountedFrameAllocator> pool = DynamicPointerCast<CountedFrameAllocator>(m_allocator);
+        m_loop->start();
+        timer.begin();
         while (m_input->read(src)) {
+            timer.mark(StageTimer::STAGE_INPUT);
             dest = m_allocator->alloc();
-            status = m_vpp->process(src, dest);
+            {
+                TRACE_SCOPE("IVideoPostProcess::process");
+                status = m_vpp->process(src, dest);
+            }
             if (status != YAMI_SUCCESS) {
                 ERROR("vpp process failed, status = %d", status);
                 return true;
             }
+            timer.mark(StageTimer::STAGE_VPP);
             m_output->output(dest);
+            timer.mark(outputStage);
+            timer.end();
             count++;
+            stats.addFrames();
+            stats.setBytesIn(m_input->getBytesRead());
+            stats.setBytesOut(m_output->getBytesWritten());
+            if (pool)
+                stats.setPool(pool->used(), pool->size());
+            stats.tick();
+            timer.begin();
         }
         //flush output
         dest.reset();
         m_output->output(dest);
+        stats.setBytesOut(m_output->getBytesWritten());
+        stats.close();
 
         printf("%d frame processed\n", count);
+        m_loop->log("yamivpp");
+        timer.log("yamivpp");
         return true;
     }
 private:
@@ -161,6 +218,14 @@ private:
             { "sat", required_argument, NULL, 0 },
             { "br", required_argument, NULL, 0 },
             { "con", required_argument, NULL, 0 },
+            { "stats", required_argument, NULL, 0 },
+            { "stats-format", required_argument, NULL, 0 },
+            { "stats-interval", required_argument, NULL, 0 },
+            { "trace", required_argument, NULL, 0 },
+            { "mmap", no_argument, NULL, 0 },
+            { "start-frame", required_argument, NULL, 0 },
+            { "loop", required_argument, NULL, 0 },
+            { "duration", required_argument, NULL, 0 },
             { NULL, no_argument, NULL, 0 }
         };
         int option_index;
@@ -199,6 +264,39 @@ private:
                 case 7:
                     m_contrast = atoi(optarg);
                     break;
+                case 8:
+                    m_statsTarget = optarg;
+                    break;
+                case 9:
+                    m_statsFormat = optarg;
+                    break;
+                case 10:
+                    m_statsInterval = atoi(optarg);
+                    break;
+                case 11:
+                    if (!Trace::instance().open(optarg))
+                        return false;
+                    break;
+                case 12:
+                    m_mapped = true;
+                    break;
+                case 13:
+                    m_startFrame = atoi(optarg);
+                    break;
+                case 14:
+                    m_loopCount = atoi(optarg);
+                    if (m_loopCount < 0) {
+                        usage();
+                        return false;
+                    }
+                    break;
+                case 15:
+                    if (atoi(optarg) < 0) {
+                        usage();
+                        return false;
+                    }
+                    m_loopSeconds = atoi(optarg);
+                    break;
                 default:
                     usage();
                     return false;
@@ -307,6 +405,14 @@ private:
     SharedPtr<VppOutput> m_output;
     SharedPtr<FrameAllocator> m_allocator;
     SharedPtr<IVideoPostProcess> m_vpp;
+    const char* m_statsTarget;
+    const char* m_statsFormat;
+    uint32_t m_statsInterval;
+    bool m_mapped;
+    uint32_t m_startFrame;
+    int m_loopCount;
+    uint32_t m_loopSeconds;
+    SharedPtr<InputLoop> m_loop;
     int32_t m_sharpening;
     int32_t m_denoise;
     char* m_deinterlaceMode;
@@ -324,6 +430,8 @@ void usage()
     printf("we can guess size and color format from your file name\n");
     printf("current supported format are i420, yv12, nv12\n");
     printf("usage: yamivpp <option> input_1920x1080.i420 output_320x240.yv12\n");
+    printf("       the input can be synthetic:<w>x<h>:<nv12|i420|yv12>:<pattern>[:<frames>[:<seed>]] for generated frames,\n");
+    printf("       pattern is gradient, noise, moving-boxes, moving-bars or scene-cuts, 300 frames by default\n");
     printf("       -s <level> optional, sharpening level\n");
     printf("       --dn <level> optional, denoise level\n");
     printf("       --di <mode>, optional, deinterlace mode, support bob, motion_adaptive and motion_compensated\n");
@@ -331,6 +439,14 @@ void usage()
     printf("       --sat <level>, optional, saturation level, range [0, 100] or -1, -1: delete this filter\n");
     printf("       --br <level>, optional, brightness level, range [0, 100] or -1, -1: delete this filter\n");
     printf("       --con <level>, optional, constrast level, range [0, 100] or -1, -1: delete this filter\n");
+    printf("       --stats <file|fd:N>, optional, write periodic stats (frames, fps, bytes, pool, stage latency) to file or fd\n");
+    printf("       --stats-format <json|csv>, optional, default: csv for .csv file, else json lines\n");
+    printf("       --stats-interval <ms>, optional, how often stats are written, default 1000\n");
+    printf("       --trace <file.json>, optional, record pipeline stages, write a chrome trace on exit\n");
+    printf("       --mmap, optional, read a raw input file through a memory mapping\n");
+    printf("       --start-frame <n>, optional, start from frame n of a raw input file\n");
+    printf("       --loop <n>, optional, process the input n times, 0 for no limit\n");
+    printf("       --duration <s>, optional, stop after s seconds, the input is looped until then unless --loop is given\n");
 }
 
 int main(int argc, char** argv)
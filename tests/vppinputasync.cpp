@@ -14,10 +14,10 @@
  * limitations under the License.
  */
 #include "vppinputasync.h"
+#include "common/trace.h"
 
 VppInputAsync::VppInputAsync()
-    :m_cond(m_lock), m_eos(false),
-     m_queueSize(0),m_quit(false)
+    : m_threadStarted(false)
 {
 }
 
@@ -48,61 +48,60 @@ void* VppInputAsync::start(void* async)
 void VppInputAsync::loop()
 {
     while (1) {
+        SharedPtr<VideoFrame> frame;
+        bool ret;
         {
-            AutoLock lock(m_lock);
-            while (m_queue.size() >= m_queueSize) {
-                m_cond.wait();
-                if (m_quit)
-                    return;
-            }
-
+            TRACE_SCOPE("VppInputAsync::produce");
+            ret = m_input->read(frame);
         }
-        SharedPtr<VideoFrame> frame;
-        bool ret = m_input->read(frame);
-        AutoLock lock(m_lock);
         if (!ret) {
-           m_eos = true;
-           return;
+            m_queue->close();
+            return;
         }
-        m_queue.push_back(frame);
-        m_cond.signal();
-   }
+        //fails when we are destroyed
+        if (!m_queue->push(frame))
+            return;
+        TRACE_COUNTER("VppInputAsync queue", m_queue->size());
+    }
 }
 
 bool VppInputAsync::init(const SharedPtr<VppInput>& input, uint32_t queueSize)
 {
     m_input = input;
-    m_queueSize = queueSize;
+    m_queue.reset(new FrameQueue(queueSize));
     if (pthread_create(&m_thread, NULL, start, this)) {
         ERROR("create thread failed");
         return false;
     }
+    m_threadStarted = true;
     return true;
 
 }
 
 bool VppInputAsync::read(SharedPtr<VideoFrame>& frame)
 {
-    AutoLock lock(m_lock);
-    while (m_queue.empty()) {
-        if (m_eos)
-            return false;
-        m_cond.wait();
-    }
-    frame = m_queue.front();
-    m_queue.pop_front();
-    m_cond.signal();
+    //includes the wait, a long one means the decode thread is behind
+    TRACE_SCOPE("VppInputAsync::read");
+    if (!m_queue->pop(frame))
+        return false;
+    TRACE_COUNTER("VppInputAsync queue", m_queue->size());
+    return true;
+}
+
+bool VppInputAsync::tryRead(SharedPtr<VideoFrame>& frame)
+{
+    if (!m_queue->tryPop(frame))
+        return false;
+    TRACE_COUNTER("VppInputAsync queue", m_queue->size());
     return true;
 }
 
 VppInputAsync::~VppInputAsync()
 {
-    {
-        AutoLock lock(m_lock);
-        m_quit = true;
-        m_cond.signal();
+    if (m_threadStarted) {
+        m_queue->close();
+        pthread_join(m_thread, NULL);
     }
-    pthread_join(m_thread, NULL);
 }
 
 bool VppInputAsync::init(const char* inputFileName, uint32_t fourcc, int width, int height)
@@ -15,9 +15,7 @@
  */
 #ifndef vppinputasync_h
 #define vppinputasync_h
-#include "common/condition.h"
-#include "common/lock.h"
-#include <deque>
+#include "common/BoundedQueue.h"
 
 #include "vppinputoutput.h"
 
@@ -27,6 +25,10 @@ class VppInputAsync : public VppInput
 public:
 
     bool read(SharedPtr<VideoFrame>& frame);
+    //never waits, false if nothing is decoded yet or at eos
+    bool tryRead(SharedPtr<VideoFrame>& frame);
+    //decode thread is done and every frame is read
+    bool isEos() { return m_queue->isClosed() && !m_queue->size(); }
 
     static SharedPtr<VppInput>
     create(const SharedPtr<VppInput>& input, uint32_t queueSize);
@@ -38,6 +40,10 @@ public:
     virtual uint32_t getFourcc() { return m_input->getFourcc(); }
 
     const char *getMimeType() const { return m_input->getMimeType(); }
+    //counted by the decode thread, the input keeps it atomic
+    uint64_t getBytesRead() { return m_input->getBytesRead(); }
+    //decoded frames waiting for read()
+    size_t getQueueSize() { return m_queue ? m_queue->size() : 0; }
 
     //do not use this
     bool init(const char* inputFileName, uint32_t fourcc, int width, int height);
@@ -46,17 +52,14 @@ private:
     static void* start(void* async);
     void loop();
 
-    Condition  m_cond;
-    Lock       m_lock;
     SharedPtr<VppInput> m_input;
-    bool       m_eos;
 
-    typedef std::deque<SharedPtr<VideoFrame> > FrameQueue;
-    FrameQueue m_queue;
-    uint32_t   m_queueSize;
+    //closed by the decode thread on eos, or by us to stop it
+    typedef BoundedQueue<SharedPtr<VideoFrame> > FrameQueue;
+    SharedPtr<FrameQueue> m_queue;
 
     pthread_t  m_thread;
-    bool       m_quit;
+    bool       m_threadStarted;
 
 };
 #endif //vppinputasync_h
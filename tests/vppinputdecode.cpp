@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 #include "tests/vppinputdecode.h"
+#include "common/trace.h"
 
 bool VppInputDecode::init(const char* inputFileName, uint32_t /*fourcc*/, int /*width*/, int /*height*/)
 {
@@ -30,7 +31,8 @@ bool VppInputDecode::init(const char* inputFileName, uint32_t /*fourcc*/, int /*
 
 bool VppInputDecode::config(NativeDisplay& nativeDisplay)
 {
-    m_decoder->setNativeDisplay(&nativeDisplay);
+    m_nativeDisplay = nativeDisplay;
+    m_decoder->setNativeDisplay(&m_nativeDisplay);
 
     VideoConfigBuffer configBuffer;
     memset(&configBuffer, 0, sizeof(configBuffer));
@@ -53,8 +55,39 @@ bool VppInputDecode::config(NativeDisplay& nativeDisplay)
     return status == DECODE_SUCCESS;
 }
 
+bool VppInputDecode::reopen(const char* inputFileName)
+{
+    SharedPtr<DecodeInput> input(DecodeInput::create(inputFileName));
+    if (!input)
+        return false;
+    bool sameCodec = m_input && m_decoder && !strcmp(input->getMimeType(), m_input->getMimeType());
+    m_input = input;
+    m_first.reset();
+    m_eos = false;
+    m_error = false;
+    bool opened;
+    if (sameCodec) {
+        //drop what is left of the old stream, surfaces are reused
+        m_decoder->flush();
+        opened = read(m_first);
+    } else {
+        m_decoder.reset(createVideoDecoder(m_input->getMimeType()), releaseVideoDecoder);
+        if (!m_decoder)
+            ERROR("failed create decoder for %s", m_input->getMimeType());
+        opened = m_decoder && config(m_nativeDisplay);
+    }
+    if (!opened) {
+        //nothing half opened is kept, the next reopen() starts over
+        m_first.reset();
+        m_decoder.reset();
+        m_input.reset();
+    }
+    return opened;
+}
+
 bool VppInputDecode::read(SharedPtr<VideoFrame>& frame)
 {
+    TRACE_SCOPE("VppInputDecode::read");
     if (m_first) {
         frame = m_first;
         m_first.reset();
@@ -72,7 +105,9 @@ bool VppInputDecode::read(SharedPtr<VideoFrame>& frame)
         memset(&inputBuffer, 0, sizeof(inputBuffer));
 
         Decode_Status status = DECODE_FAIL;
-        if (m_input->getNextDecodeUnit(inputBuffer)) {
+        if (m_input->getLoopedDecodeUnit(inputBuffer, m_loop.get())) {
+            __atomic_store_n(&m_bytesRead, m_bytesRead + inputBuffer.size, __ATOMIC_RELAXED);
+            TRACE_SCOPE("IVideoDecoder::decode");
             status = m_decoder->decode(&inputBuffer);
             if (DECODE_FORMAT_CHANGE == status) {
 
@@ -26,13 +26,26 @@ public:
     VppInputDecode()
         : m_eos(false)
         , m_error(false)
+        , m_bytesRead(0)
     {
+        memset(&m_nativeDisplay, 0, sizeof(m_nativeDisplay));
     }
     bool init(const char* inputFileName, uint32_t fourcc = 0, int width = 0, int height = 0);
     bool read(SharedPtr<VideoFrame>& frame);
     const char *getMimeType() const { return m_input->getMimeType(); }
+    bool setLoop(const SharedPtr<InputLoop>& loop)
+    {
+        m_loop = loop;
+        return true;
+    }
+    //written by the thread that reads, see VppInput
+    uint64_t getBytesRead() { return __atomic_load_n(&m_bytesRead, __ATOMIC_RELAXED); }
 
     bool config(NativeDisplay& nativeDisplay);
+    //play another file, or the same one again, after config()
+    //the decoder is kept if the codec is the same. On failure the input
+    //is closed, only reopen() may be called then
+    bool reopen(const char* inputFileName);
     void setTargetLayer(uint32_t temporal = 0, uint32_t spacial = 0, uint32_t quality = 0)
     {
         m_temporalLayer = temporal;
@@ -47,9 +60,12 @@ public:
 private:
     bool m_eos;
     bool m_error;
+    uint64_t m_bytesRead;
     SharedPtr<IVideoDecoder> m_decoder;
     SharedPtr<DecodeInput>   m_input;
+    SharedPtr<InputLoop>     m_loop;
     SharedPtr<VideoFrame>    m_first;
+    NativeDisplay m_nativeDisplay;
     //m_xxxLayer layer number, 0: decode all layers, >0: decode up to target layer.
     uint32_t m_temporalLayer;
     uint32_t m_spacialLayer;
@@ -77,7 +77,7 @@ bool VppInputDecodeCapi::read(SharedPtr<VideoFrame>& frame)
         memset(&inputBuffer, 0, sizeof(inputBuffer));
 
         Decode_Status status = DECODE_FAIL;
-        if (m_input->getNextDecodeUnit(inputBuffer)) {
+        if (m_input->getLoopedDecodeUnit(inputBuffer, m_loop.get())) {
             status = decodeDecode(m_decoder, &inputBuffer);
             if (DECODE_FORMAT_CHANGE == status) {
                 const VideoFormatInfo* info = decodeGetFormatInfo(m_decoder);
@@ -33,6 +33,11 @@ public:
     bool init(const char* inputFileName, uint32_t fourcc = 0, int width = 0, int height = 0);
     bool read(SharedPtr<VideoFrame>& frame);
     const char *getMimeType() const { return m_input->getMimeType(); }
+    bool setLoop(const SharedPtr<InputLoop>& loop)
+    {
+        m_loop = loop;
+        return true;
+    }
     bool config(NativeDisplay& nativeDisplay);
 
 private:
@@ -40,6 +45,7 @@ private:
     bool m_error;
     DecodeHandler m_decoder;
     SharedPtr<DecodeInput> m_input;
+    SharedPtr<InputLoop> m_loop;
 };
 
 #endif //vppinputdecodecapi_h
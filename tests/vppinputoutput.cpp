@@ -91,6 +91,12 @@ SharedPtr<VppInput> VppInput::create(const char* inputFileName, uint32_t fourcc,
     if (!inputFileName)
         return input;
 
+    if (SyntheticFrame::isSpec(inputFileName)) {
+        input.reset(new VppInputSynthetic);
+        if (!input->init(inputFileName))
+            input.reset();
+        return input;
+    }
     if(useCAPI)
         input.reset(new VppInputDecodeCapi);
     else
@@ -109,6 +115,10 @@ SharedPtr<VppInput> VppInput::create(const char* inputFileName, uint32_t fourcc,
 VppInputFile::VppInputFile()
     : m_ifs()
     , m_readToEOS(false)
+    , m_bytesRead(0)
+    , m_bytesLooped(0)
+    , m_frameSize(0)
+    , m_mapped(false)
 {
 }
 
@@ -152,6 +162,76 @@ bool VppInputFile::init(const char* inputFileName, uint32_t fourcc, int width, i
         fprintf(stderr, "fail to open input file: %s", inputFileName);
         return false;
     }
+    m_fileName = inputFileName;
+
+    uint32_t planes, byteWidth[3], byteHeight[3];
+    if (getPlaneResolution(m_fourcc, m_width, m_height, byteWidth, byteHeight, planes)) {
+        for (uint32_t i = 0; i < planes; i++)
+            m_frameSize += byteWidth[i] * byteHeight[i];
+    }
+    return true;
+}
+
+bool VppInputFile::setMapped(bool mapped)
+{
+    if (!mapped) {
+        m_map.close();
+        m_mapped = false;
+        return true;
+    }
+    if (!m_frameSize || !m_map.open(m_fileName.c_str(), m_frameSize)) {
+        ERROR("can't map %s, read it instead", m_fileName.c_str());
+        return false;
+    }
+    //the mapping starts where the stream is
+    uint64_t frame = m_bytesRead / m_frameSize;
+    m_map.seek(frame);
+    m_mapped = true;
+    return true;
+}
+
+bool VppInputFile::seekFrame(uint64_t frame)
+{
+    if (!m_frameSize)
+        return false;
+    if (m_mapped) {
+        if (frame >= m_map.getFrameCount() || !m_map.seek(frame)) {
+            ERROR("%s has no frame %d", m_fileName.c_str(), (int)frame);
+            return false;
+        }
+    } else {
+        m_ifs.clear();
+        m_ifs.seekg(0, std::ios::end);
+        uint64_t size = m_ifs.tellg();
+        if ((frame + 1) * m_frameSize > size) {
+            ERROR("%s has no frame %d", m_fileName.c_str(), (int)frame);
+            return false;
+        }
+        m_ifs.seekg(frame * m_frameSize);
+    }
+    __atomic_store_n(&m_bytesRead, frame * m_frameSize, __ATOMIC_RELAXED);
+    m_readToEOS = false;
+    return true;
+}
+
+bool VppInputFile::setLoop(const SharedPtr<InputLoop>& loop)
+{
+    m_loop = loop;
+    return true;
+}
+
+bool VppInputFile::readFrame(const SharedPtr<VideoFrame>& frame)
+{
+    if (m_mapped) {
+        const uint8_t* data = m_map.next();
+        if (!data || !m_reader->read(data, frame))
+            return false;
+        __atomic_store_n(&m_bytesRead, m_bytesRead + m_frameSize, __ATOMIC_RELAXED);
+        return true;
+    }
+    if (!m_reader->read(m_ifs, frame))
+        return false;
+    __atomic_store_n(&m_bytesRead, (uint64_t)m_ifs.tellg(), __ATOMIC_RELAXED);
     return true;
 }
 
@@ -163,6 +243,10 @@ bool VppInputFile::read(SharedPtr<VideoFrame>& frame)
     }
     if (m_readToEOS)
         return false;
+    if (m_loop && m_loop->expired()) {
+        m_readToEOS = true;
+        return false;
+    }
 
     frame = m_allocator->alloc();
     if (!frame) {
@@ -170,17 +254,96 @@ bool VppInputFile::read(SharedPtr<VideoFrame>& frame)
         return false;
     }
 
-    if (!m_reader->read(m_ifs, frame))
-        m_readToEOS = true;
-    return !m_readToEOS;
+    if (readFrame(frame))
+        return true;
+    //another pass, a short tail of the file is dropped
+    uint64_t bytes = m_bytesRead;
+    if (m_loop && m_loop->again() && seekFrame(0)) {
+        m_loop->addPass();
+        __atomic_store_n(&m_bytesLooped, m_bytesLooped + bytes, __ATOMIC_RELAXED);
+        if (readFrame(frame))
+            return true;
+    }
+    m_readToEOS = true;
+    return false;
 }
 
 VppInputFile::~VppInputFile()
 {
 }
 
+VppInputSynthetic::VppInputSynthetic()
+    : m_nextFrame(0)
+    , m_framesMade(0)
+    , m_readToEOS(false)
+{
+}
+
+bool VppInputSynthetic::init(const char* inputFileName, uint32_t /*fourcc*/, int /*width*/, int /*height*/)
+{
+    if (!m_generator.parse(inputFileName))
+        return false;
+    m_fourcc = m_generator.getFourcc();
+    m_width = m_generator.getWidth();
+    m_height = m_generator.getHeight();
+    return true;
+}
+
+bool VppInputSynthetic::config(const SharedPtr<FrameAllocator>& allocator, const SharedPtr<FrameReader>& reader)
+{
+    if (!allocator->setFormat(m_fourcc, m_width, m_height)) {
+        ERROR("set format to %x, %dx%d failed", m_fourcc, m_width, m_height);
+        return false;
+    }
+    m_reader = reader;
+    m_allocator = allocator;
+    return true;
+}
+
+bool VppInputSynthetic::setLoop(const SharedPtr<InputLoop>& loop)
+{
+    m_loop = loop;
+    return true;
+}
+
+bool VppInputSynthetic::read(SharedPtr<VideoFrame>& frame)
+{
+    if (!m_allocator || !m_reader) {
+        ERROR("config VppInputSynthetic with allocator and reader, please!");
+        return false;
+    }
+    if (m_readToEOS)
+        return false;
+    if (m_loop && m_loop->expired()) {
+        m_readToEOS = true;
+        return false;
+    }
+    uint64_t frames = m_generator.getFrameCount();
+    if (frames && m_nextFrame >= frames) {
+        if (!m_loop || !m_loop->again()) {
+            m_readToEOS = true;
+            return false;
+        }
+        m_loop->addPass();
+        m_nextFrame = 0;
+    }
+
+    frame = m_allocator->alloc();
+    if (!frame) {
+        ERROR("allocate frame failed");
+        return false;
+    }
+    if (!m_reader->read(m_generator, m_nextFrame, frame)) {
+        m_readToEOS = true;
+        return false;
+    }
+    m_nextFrame++;
+    __atomic_store_n(&m_framesMade, m_framesMade + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
 VppOutput::VppOutput()
-    :m_fourcc(0), m_width(0), m_height(0)
+    :m_fourcc(0), m_width(0), m_height(0), m_bytesWritten(0)
 {
 }
 
@@ -262,7 +425,10 @@ bool VppOutputFile::write(const SharedPtr<VideoFrame>& frame)
     }
     if (!frame)
         return true;
-    return m_writer->write(m_ofs, frame);
+    if (!m_writer->write(m_ofs, frame))
+        return false;
+    __atomic_store_n(&m_bytesWritten, (uint64_t)m_ofs.tellp(), __ATOMIC_RELAXED);
+    return true;
 }
 
 VppOutputFile::VppOutputFile()
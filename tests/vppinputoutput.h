@@ -16,9 +16,13 @@
 #ifndef vppinputoutput_h
 #define vppinputoutput_h
 
+#include "common/InputLoop.h"
 #include "common/log.h"
+#include "common/MappedFrameFile.h"
+#include "common/SyntheticFrame.h"
 #include "common/utils.h"
 #include "common/VaapiUtils.h"
+#include "common/VaapiImageCache.h"
 #include "common/PooledFrameAllocator.h"
 #include <Yami.h>
 
@@ -55,13 +59,45 @@ class FrameReader
 {
 public:
     virtual bool read(std::ifstream&, const SharedPtr<VideoFrame>& frame) = 0;
+    //a frame in memory, laid out as in the file
+    virtual bool read(const uint8_t* data, const SharedPtr<VideoFrame>& frame) { return false; }
+    //frame n of a generator, made in place
+    virtual bool read(SyntheticFrame& generator, uint64_t n, const SharedPtr<VideoFrame>& frame) { return false; }
     virtual ~FrameReader() {}
 };
 
+//frame memory read like a file, for VaapiFrameIO
+struct FrameMemory {
+    explicit FrameMemory(const uint8_t* data)
+        : data(data)
+    {
+    }
+    bool operator!() const { return !data; }
+    bool is_open() const { return data != NULL; }
+    const uint8_t* data;
+};
+
+//rows of a synthetic frame, in the order VaapiFrameIO asks for them
+struct SyntheticRows {
+    explicit SyntheticRows(SyntheticFrame* generator)
+        : generator(generator)
+        , plane(0)
+        , row(0)
+    {
+    }
+    bool operator!() const { return !generator; }
+    bool is_open() const { return generator != NULL; }
+    SyntheticFrame* generator;
+    uint32_t plane;
+    uint32_t row;
+};
+
 class FrameWriter
 {
 public:
     virtual bool write(std::ofstream&, const SharedPtr<VideoFrame>& frame) = 0;
+    //the surfaces written so far are destroyed, forget their mappings
+    virtual void resetCache() {}
     virtual ~FrameWriter() {}
 };
 
@@ -70,8 +106,10 @@ class VaapiFrameIO
 {
 public:
     typedef bool (*FileIoFunc)(char* ptr, int size, T& fs);
-    VaapiFrameIO(const SharedPtr<VADisplay>& display, FileIoFunc io)
-        :m_display(display), m_io(io)
+    //keepMapped: the frames are read back from a pool the cpu never writes,
+    //their mappings are cached. Otherwise each frame is mapped and unmapped
+    VaapiFrameIO(const SharedPtr<VADisplay>& display, FileIoFunc io, bool keepMapped)
+        :m_display(display), m_io(io), m_keepMapped(keepMapped), m_images(*display)
     {
 
     };
@@ -81,14 +119,6 @@ public:
             ERROR("invalid param");
             return false;
         }
-        VASurfaceID surface = (VASurfaceID)frame->surface;
-        VAImage image;
-
-        VAStatus status = vaDeriveImage(*m_display,surface,&image);
-        if (status != VA_STATUS_SUCCESS) {
-            ERROR("vaDeriveImage failed = %d", status);
-            return false;
-        }
         uint32_t byteWidth[3], byteHeight[3], planes;
         uint32_t byteX[3], byteY[3];
         //image.width is not equal to frame->crop.width.
@@ -101,34 +131,53 @@ public:
             ERROR("get left-top coordinate(%d,%d) failed", frame->crop.x, frame->crop.y);
             return false;
         }
+        VAImage image;
         char* buf;
-        status = vaMapBuffer(*m_display, image.buf, (void**)&buf);
-        if (status != VA_STATUS_SUCCESS) {
-            vaDestroyImage(*m_display, image.image_id);
-            ERROR("vaMapBuffer failed = %d", status);
+        SharedPtr<ScopedImageMapping> mapping;
+        if (m_keepMapped) {
+            buf = (char*)m_images.map(frame, image);
+        }
+        else {
+            //uploads reach the surface at unmap on some drivers
+            mapping.reset(new ScopedImageMapping(*m_display, frame));
+            buf = (char*)mapping->data();
+            image = mapping->image();
+        }
+        if (!buf) {
+            ERROR("map surface %x failed", (uint32_t)frame->surface);
             return false;
         }
-        bool ret = true;
         for (uint32_t i = 0; i < planes; i++) {
             char* ptr = buf + image.offsets[i];
             ptr += image.pitches[i] * byteY[i];
             int w = byteWidth[i];
             for (uint32_t j = 0; j < byteHeight[i]; j++) {
-                ret = m_io(ptr + byteX[i], w, fs);
-                if (!ret)
-                    goto out;
+                if (!m_io(ptr + byteX[i], w, fs))
+                    return false;
                 ptr += image.pitches[i];
             }
         }
-    out:
-        vaUnmapBuffer(*m_display, image.buf);
-        vaDestroyImage(*m_display, image.image_id);
-        return ret;
-
+        return true;
+    }
+    //only while no frame is in doIO()
+    void setKeepMapped(bool keepMapped)
+    {
+        m_keepMapped = keepMapped;
+    }
+    //call this when the surface pool is reset
+    void resetCache()
+    {
+        m_images.clear();
+    }
+    const VaapiImageCache& imageCache() const
+    {
+        return m_images;
     }
 private:
     SharedPtr<VADisplay>  m_display;
     FileIoFunc  m_io;
+    bool m_keepMapped;
+    VaapiImageCache m_images;
 };
 
 
@@ -136,32 +185,75 @@ class VaapiFrameReader:public FrameReader
 {
 public:
     VaapiFrameReader(const SharedPtr<VADisplay>& display)
-        :m_frameio(new VaapiFrameIO<std::ifstream>(display, readFromFile))
+        :m_frameio(new VaapiFrameIO<std::ifstream>(display, readFromFile, false))
+        , m_memoryio(new VaapiFrameIO<FrameMemory>(display, readFromMemory, false))
+        , m_syntheticio(new VaapiFrameIO<SyntheticRows>(display, readFromGenerator, false))
     {
     }
     bool read(std::ifstream& ifs, const SharedPtr<VideoFrame>& frame)
     {
         return m_frameio->doIO(ifs, frame);
     }
+    bool read(const uint8_t* data, const SharedPtr<VideoFrame>& frame)
+    {
+        FrameMemory memory(data);
+        return m_memoryio->doIO(memory, frame);
+    }
+    bool read(SyntheticFrame& generator, uint64_t n, const SharedPtr<VideoFrame>& frame)
+    {
+        generator.begin(n);
+        SyntheticRows rows(&generator);
+        return m_syntheticio->doIO(rows, frame);
+    }
 private:
     SharedPtr< VaapiFrameIO<std::ifstream> > m_frameio;
+    SharedPtr< VaapiFrameIO<FrameMemory> > m_memoryio;
+    SharedPtr< VaapiFrameIO<SyntheticRows> > m_syntheticio;
     static bool readFromFile(char* ptr, int size, std::ifstream& ifs)
     {
         return ifs.read(ptr, size).good();
     }
+    static bool readFromMemory(char* ptr, int size, FrameMemory& memory)
+    {
+        memcpy(ptr, memory.data, size);
+        memory.data += size;
+        return true;
+    }
+    static bool readFromGenerator(char* ptr, int size, SyntheticRows& rows)
+    {
+        SyntheticFrame& generator = *rows.generator;
+        if (rows.plane >= generator.getPlaneCount())
+            return false;
+        generator.row(rows.plane, rows.row, (uint8_t*)ptr, size);
+        if (++rows.row == generator.getPlaneHeight(rows.plane)) {
+            rows.plane++;
+            rows.row = 0;
+        }
+        return true;
+    }
 };
 
 class VaapiFrameWriter:public FrameWriter
 {
 public:
     VaapiFrameWriter(const SharedPtr<VADisplay>& display)
-        :m_frameio(new VaapiFrameIO<std::ofstream>(display, writeToFile))
+        :m_frameio(new VaapiFrameIO<std::ofstream>(display, writeToFile, true))
     {
     }
     bool write(std::ofstream& ofs, const SharedPtr<VideoFrame>& frame)
     {
         return m_frameio->doIO(ofs, frame);
     }
+    void resetCache()
+    {
+        m_frameio->resetCache();
+    }
+    //false for frames the writer doesn't own, like the decoder's surfaces.
+    //Only while no frame is written
+    void setKeepMapped(bool keepMapped)
+    {
+        m_frameio->setKeepMapped(keepMapped);
+    }
 private:
     SharedPtr< VaapiFrameIO<std::ofstream> > m_frameio;
     static bool writeToFile(char* ptr, int size, std::ofstream& ofs)
@@ -173,6 +265,7 @@ private:
 
 class VppInput;
 class VppInputFile;
+class VppInputSynthetic;
 
 class VppInput {
 public:
@@ -184,6 +277,12 @@ public:
     virtual int getWidth() { return m_width; }
     virtual int getHeight() { return m_height; }
     virtual uint32_t getFourcc() { return m_fourcc; }
+    //bytes consumed from the input file so far, for stats.
+    //Safe from other threads, the counters are written atomically
+    virtual uint64_t getBytesRead() { return 0; }
+    //rewind at EOF while the loop says so, EOS is only seen after the last pass.
+    //false if the input can't do it. Set it before the first read
+    virtual bool setLoop(const SharedPtr<InputLoop>& /*loop*/) { return false; }
 
     virtual ~VppInput() {}
 protected:
@@ -198,12 +297,57 @@ public:
     bool init(const char* inputFileName, uint32_t fourcc, int width, int height);
     virtual bool read(SharedPtr<VideoFrame>& frame);
     const char *getMimeType() const { return "unknown"; }
+    uint64_t getBytesRead()
+    {
+        return __atomic_load_n(&m_bytesLooped, __ATOMIC_RELAXED) + __atomic_load_n(&m_bytesRead, __ATOMIC_RELAXED);
+    }
+    bool setLoop(const SharedPtr<InputLoop>& loop);
     bool config(const SharedPtr<FrameAllocator>& allocator, const SharedPtr<FrameReader>& reader);
+    //read frames from a mapping of the file, instead of the stream
+    bool setMapped(bool mapped);
+    //go on from frame n, and leave EOS
+    bool seekFrame(uint64_t frame);
     VppInputFile();
     ~VppInputFile();
 protected:
+    bool readFrame(const SharedPtr<VideoFrame>& frame);
+
+    std::string m_fileName;
     std::ifstream m_ifs;
     bool m_readToEOS;
+    uint64_t m_bytesRead;
+    //bytes of the passes before this one
+    uint64_t m_bytesLooped;
+    SharedPtr<InputLoop> m_loop;
+    uint32_t m_frameSize;
+    MappedFrameFile m_map;
+    bool m_mapped;
+    SharedPtr<FrameReader> m_reader;
+    SharedPtr<FrameAllocator> m_allocator;
+};
+
+/**
+ * Generated frames made straight into the allocator's surfaces, see
+ * SyntheticFrame for the "synthetic:..." names.
+ */
+class VppInputSynthetic : public VppInput {
+public:
+    //fourcc, width and height come from the name
+    bool init(const char* inputFileName, uint32_t fourcc, int width, int height);
+    virtual bool read(SharedPtr<VideoFrame>& frame);
+    const char* getMimeType() const { return "unknown"; }
+    //bytes generated, as if read from a file
+    uint64_t getBytesRead() { return __atomic_load_n(&m_framesMade, __ATOMIC_RELAXED) * m_generator.getFrameSize(); }
+    bool setLoop(const SharedPtr<InputLoop>& loop);
+    bool config(const SharedPtr<FrameAllocator>& allocator, const SharedPtr<FrameReader>& reader);
+    VppInputSynthetic();
+
+private:
+    SyntheticFrame m_generator;
+    uint64_t m_nextFrame;
+    uint64_t m_framesMade;
+    bool m_readToEOS;
+    SharedPtr<InputLoop> m_loop;
     SharedPtr<FrameReader> m_reader;
     SharedPtr<FrameAllocator> m_allocator;
 };
@@ -218,6 +362,8 @@ public:
         int fps = 30);
     bool getFormat(uint32_t& fourcc, int& width, int& height);
     virtual bool output(const SharedPtr<VideoFrame>& frame) = 0;
+    //bytes written to the output file so far, for stats, safe from other threads
+    uint64_t getBytesWritten() const { return __atomic_load_n(&m_bytesWritten, __ATOMIC_RELAXED); }
     VppOutput();
     virtual ~VppOutput(){}
 protected:
@@ -227,6 +373,7 @@ protected:
     uint32_t m_fourcc;
     int m_width;
     int m_height;
+    uint64_t m_bytesWritten;
 };
 
 class VppOutputFile : public VppOutput
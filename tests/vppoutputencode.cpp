@@ -17,6 +17,7 @@
 #include "config.h"
 #endif
 #include "vppoutputencode.h"
+#include "common/trace.h"
 #include <Yami.h>
 
 EncodeParamsVP9::EncodeParamsVP9()
@@ -61,6 +62,9 @@ TranscodeParams::TranscodeParams()
     , oWidth(0)
     , oHeight(0)
     , fourcc(0)
+    , statsInterval(1000)
+    , loopCount(-1)
+    , loopSeconds(0)
 {
     /*nothing to do*/
 }
@@ -210,6 +214,7 @@ bool VppOutputEncode::config(NativeDisplay& nativeDisplay, const EncodeParams* e
 
 bool VppOutputEncode::output(const SharedPtr<VideoFrame>& frame)
 {
+    TRACE_SCOPE("VppOutputEncode::output");
     Encode_Status status = ENCODE_SUCCESS;
     bool drain = !frame;
     if (frame) {
@@ -225,9 +230,11 @@ bool VppOutputEncode::output(const SharedPtr<VideoFrame>& frame)
     }
     do {
         status = m_encoder->getOutput(&m_outputBuffer, drain);
-        if (status == ENCODE_SUCCESS
-            && !m_output->write(m_outputBuffer.data, m_outputBuffer.dataSize))
-             assert(0);
+        if (status == ENCODE_SUCCESS) {
+            if (!m_output->write(m_outputBuffer.data, m_outputBuffer.dataSize))
+                assert(0);
+            __atomic_store_n(&m_bytesWritten, m_bytesWritten + m_outputBuffer.dataSize, __ATOMIC_RELAXED);
+        }
 
         if (status == ENCODE_BUFFER_TOO_SMALL) {
             m_outputBuffer.bufferSize = (m_outputBuffer.bufferSize * 3) / 2;
@@ -74,6 +74,12 @@ public:
     uint32_t fourcc;
     string inputFileName;
     string outputFileName;
+    string statsTarget; /*stats file or fd:N, empty for none*/
+    string statsFormat; /*json or csv*/
+    uint32_t statsInterval; /*in ms*/
+    string statsSocket; /*unix socket serving live counters*/
+    int loopCount; /*input passes, 0 for no limit, -1 if not given*/
+    uint32_t loopSeconds; /*stop feeding after this long, 0 for no limit*/
 };
 
 class VppOutputEncode : public VppOutput
@@ -22,7 +22,12 @@
 #include "vppoutputencode.h"
 #include "encodeinput.h"
 #include "tests/vppinputasync.h"
+#include "common/CountedFrameAllocator.h"
 #include "common/log.h"
+#include "common/latency.h"
+#include "common/StatsSink.h"
+#include "common/StatsServer.h"
+#include "common/trace.h"
 #include <Yami.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,6 +39,8 @@ static void print_help(const char* app)
 {
     printf("%s <options>\n", app);
     printf("   -i <source filename> load a raw yuv file or a compressed video file\n");
+    printf("      or synthetic:<w>x<h>:<nv12|i420|yv12>:<pattern>[:<frames>[:<seed>]] for generated frames,\n");
+    printf("      pattern is gradient, noise, moving-boxes, moving-bars or scene-cuts, 300 frames by default\n");
     printf("   -W <width> -H <height>\n");
     printf("   -o <coded file> optional\n");
     printf("   -b <bitrate: kbps> optional\n");
@@ -68,6 +75,13 @@ static void print_help(const char* app)
            "JPEG valid range[1, 100], HEVC|AVC|VP8|VP9 valid range[%d, %d], "
            "a value of 0 means CODEC will use its own internal default value> "
            "optional\n", VIDEO_PARAMS_QUALITYLEVEL_NONE, VIDEO_PARAMS_QUALITYLEVEL_MAX);
+    printf("   --stats <file|fd:N> write periodic stats (frames, fps, bytes, pool, stage latency) to file or fd, optional\n");
+    printf("   --stats-format <json|csv> default: csv for .csv file, else json lines\n");
+    printf("   --stats-interval <ms> how often stats are written, default 1000\n");
+    printf("   --stats-socket <path> serve live counters on a unix socket, in Prometheus text or json, optional\n");
+    printf("   --trace <file.json> record pipeline stages, write a chrome trace (chrome://tracing, ui.perfetto.dev) on exit, optional\n");
+    printf("   --loop <n> transcode the input n times without restarting the decoder or encoder, 0 for no limit, optional\n");
+    printf("   --duration <s> stop after s seconds, the input is looped until then unless --loop is given, optional\n");
     printf("   VP9 encoder specific options:\n");
     printf("   --refmode <VP9 Reference frames mode (default 0 last(previous), "
            "gold/alt (previous key frame) | 1 last (previous) gold (one before "
@@ -130,6 +144,13 @@ static bool processCmdLine(int argc, char *argv[], TranscodeParams& para)
         { "vbv-buffer-fullness", required_argument, NULL, 0 },
         { "vbv-buffer-size", required_argument, NULL, 0 },
         { "quality-level", required_argument, NULL, 0 },
+        { "stats", required_argument, NULL, 0 },
+        { "stats-format", required_argument, NULL, 0 },
+        { "stats-interval", required_argument, NULL, 0 },
+        { "stats-socket", required_argument, NULL, 0 },
+        { "trace", required_argument, NULL, 0 },
+        { "loop", required_argument, NULL, 0 },
+        { "duration", required_argument, NULL, 0 },
         { NULL, no_argument, NULL, 0 }
     };
     int option_index;
@@ -260,6 +281,36 @@ static bool processCmdLine(int argc, char *argv[], TranscodeParams& para)
                 case 27:
                     para.m_encParams.qualityLevel = atoi(optarg);
                     break;
+                case 28:
+                    para.statsTarget = optarg;
+                    break;
+                case 29:
+                    para.statsFormat = optarg;
+                    break;
+                case 30:
+                    para.statsInterval = atoi(optarg);
+                    break;
+                case 31:
+                    para.statsSocket = optarg;
+                    break;
+                case 32:
+                    if (!Trace::instance().open(optarg))
+                        return false;
+                    break;
+                case 33:
+                    para.loopCount = atoi(optarg);
+                    if (para.loopCount < 0) {
+                        fprintf(stderr, "invalid loop count: %s\n", optarg);
+                        return false;
+                    }
+                    break;
+                case 34:
+                    if (atoi(optarg) < 0) {
+                        fprintf(stderr, "invalid duration: %s\n", optarg);
+                        return false;
+                    }
+                    para.loopSeconds = atoi(optarg);
+                    break;
             }
         }
     }
@@ -305,13 +356,16 @@ static bool processCmdLine(int argc, char *argv[], TranscodeParams& para)
     return true;
 }
 
-SharedPtr<VppInput> createInput(TranscodeParams& para, const SharedPtr<VADisplay>& display)
+SharedPtr<VppInput> createInput(TranscodeParams& para, const SharedPtr<VADisplay>& display, const SharedPtr<InputLoop>& loop)
 {
     SharedPtr<VppInput> input(VppInput::create(para.inputFileName.c_str(), para.fourcc, para.iWidth, para.iHeight));
     if (!input) {
         ERROR("creat input failed");
         return input;
     }
+    //before the decoder reads its first frame, and before the async thread starts
+    if (!input->setLoop(loop) && (para.loopCount >= 0 || para.loopSeconds))
+        printf("--loop and --duration are not supported by this input, ignored\n");
     SharedPtr<VppInputFile> inputFile = DynamicPointerCast<VppInputFile>(input);
     if (inputFile) {
         SharedPtr<FrameReader> reader(new VaapiFrameReader(display));
@@ -321,6 +375,20 @@ SharedPtr<VppInput> createInput(TranscodeParams& para, const SharedPtr<VADisplay
             input.reset();
         }
     }
+    SharedPtr<VppInputSynthetic> inputSynthetic = DynamicPointerCast<VppInputSynthetic>(input);
+    if (inputSynthetic) {
+        SharedPtr<FrameReader> reader(new VaapiFrameReader(display));
+        SharedPtr<FrameAllocator> alloctor(new PooledFrameAllocator(display, 5));
+        if (!inputSynthetic->config(alloctor, reader)) {
+            ERROR("config input failed");
+            input.reset();
+        }
+        //the size is in the name, encode at it unless told otherwise
+        if (!para.oWidth)
+            para.oWidth = inputSynthetic->getWidth();
+        if (!para.oHeight)
+            para.oHeight = inputSynthetic->getHeight();
+    }
     SharedPtr<VppInputDecode> inputDecode = DynamicPointerCast<VppInputDecode>(input);
     if (inputDecode) {
         NativeDisplay nativeDisplay;
@@ -368,7 +436,8 @@ SharedPtr<FrameAllocator> createAllocator(const SharedPtr<VppOutput>& output, co
 {
     uint32_t fourcc;
     int width, height;
-    SharedPtr<FrameAllocator> allocator(new PooledFrameAllocator(display, std::max(extraSize, 5)));
+    int32_t size = std::max(extraSize, 5);
+    SharedPtr<FrameAllocator> allocator(new CountedFrameAllocator(SharedPtr<FrameAllocator>(new PooledFrameAllocator(display, size)), size));
     if (!output->getFormat(fourcc, width, height)
         || !allocator->setFormat(fourcc, width,height)) {
         allocator.reset();
@@ -394,14 +463,22 @@ public:
             ERROR("create vpp failed");
             return false;
         }
-        m_input = createInput(m_cmdParam, m_display);
+        m_loop.reset(new InputLoop(m_cmdParam.loopCount, m_cmdParam.loopSeconds));
+        m_input = createInput(m_cmdParam, m_display, m_loop);
         m_output = createOutput(m_cmdParam, m_display, m_input->getFourcc());
         if (!m_input || !m_output) {
             ERROR("create input or output failed");
             return false;
         }
         m_allocator = createAllocator(m_output, m_display, m_cmdParam.m_encParams.ipPeriod);
-        return bool(m_allocator);
+        if (!m_allocator)
+            return false;
+        if (!m_cmdParam.statsSocket.empty()) {
+            addStats();
+            if (!m_server.start(m_cmdParam.statsSocket.c_str()))
+                return false;
+        }
+        return true;
     }
 
     bool run()
@@ -409,8 +486,20 @@ public:
 
         SharedPtr<VideoFrame> src;
         FpsCalc fps;
+        StageTimer timer;
+        StatsSink stats("yamitranscode");
+        if (!m_cmdParam.statsTarget.empty()
+            && !stats.open(m_cmdParam.statsTarget.c_str(), m_cmdParam.statsFormat.empty() ? NULL : m_cmdParam.statsFormat.c_str(), m_cmdParam.statsInterval))
+            return false;
+        stats.setStageTimer(&timer);
+        SharedPtr<CountedFrameAllocator> pool = DynamicPointerCast<CountedFrameAllocator>(m_allocator);
         uint32_t count = 0;
+        //setup and the first frame init() decoded don't use up the duration
+        m_loop->start();
+        timer.begin();
         while (m_input->read(src)) {
+            timer.mark(StageTimer::STAGE_DECODE);
+            m_decoded.add();
             SharedPtr<VideoFrame> dest = m_allocator->alloc();
             if (!dest) {
                 ERROR("failed to get output frame");
@@ -419,7 +508,11 @@ public:
 //disable scale for performance measure
 //#define DISABLE_SCALE 1
 #ifndef DISABLE_SCALE
-            YamiStatus status = m_vpp->process(src, dest);
+            YamiStatus status;
+            {
+                TRACE_SCOPE("IVideoPostProcess::process");
+                status = m_vpp->process(src, dest);
+            }
             if (status != YAMI_SUCCESS) {
                 ERROR("failed to scale yami return %d", status);
                 break;
@@ -427,22 +520,54 @@ public:
 #else
             dest = src;
 #endif
+            timer.mark(StageTimer::STAGE_VPP);
+            m_processed.add();
 
             if(!m_output->output(dest))
                 break;
+            timer.mark(StageTimer::STAGE_ENCODE);
+            m_encoded.add();
+            timer.end();
             count++;
             fps.addFrame();
+            stats.addFrames();
+            stats.setBytesIn(m_input->getBytesRead());
+            stats.setBytesOut(m_output->getBytesWritten());
+            if (pool)
+                stats.setPool(pool->used(), pool->size());
+            stats.tick();
             if(count >= m_cmdParam.frameCount)
                 break;
+            timer.begin();
         }
         src.reset();
         m_output->output(src);
 
         fps.log();
+        m_loop->log("yamitranscode");
+        timer.log("yamitranscode");
+        stats.setBytesOut(m_output->getBytesWritten());
+        stats.close();
 
         return true;
     }
 private:
+    void addStats()
+    {
+        const char* frames = "frames through each stage";
+        m_server.add("yami_frames_total", frames, m_decoded, "stage=decode");
+        m_server.add("yami_frames_total", frames, m_processed, "stage=vpp");
+        m_server.add("yami_frames_total", frames, m_encoded, "stage=encode");
+        m_server.add("yami_bytes_read_total", "compressed bytes read", m_input.get(), &VppInput::getBytesRead, "", StatsServer::COUNTER);
+        m_server.add("yami_bytes_written_total", "bytes written", m_output.get(), &VppOutput::getBytesWritten, "", StatsServer::COUNTER);
+        SharedPtr<VppInputAsync> async = DynamicPointerCast<VppInputAsync>(m_input);
+        if (async)
+            m_server.add("yami_queue_depth", "decoded frames waiting in the async input", async.get(), &VppInputAsync::getQueueSize);
+        SharedPtr<CountedFrameAllocator> pool = DynamicPointerCast<CountedFrameAllocator>(m_allocator);
+        if (pool)
+            m_server.add("yami_free_surfaces", "free surfaces in the pool", pool.get(), &CountedFrameAllocator::freeCount, "pool=vpp");
+    }
+
     bool createVpp()
     {
         NativeDisplay nativeDisplay;
@@ -453,11 +578,17 @@ private:
     }
 
     SharedPtr<VADisplay> m_display;
+    SharedPtr<InputLoop> m_loop;
     SharedPtr<VppInput> m_input;
     SharedPtr<VppOutput> m_output;
     SharedPtr<FrameAllocator> m_allocator;
     SharedPtr<IVideoPostProcess> m_vpp;
     TranscodeParams m_cmdParam;
+    StatsCounter m_decoded;
+    StatsCounter m_processed;
+    StatsCounter m_encoded;
+    //last, so it stops before the objects it reads are gone
+    StatsServer m_server;
 };
 
 int main(int argc, char** argv)
@@ -0,0 +1,129 @@
+#!/bin/bash
+
+print_help()
+{
+    echo "Usage: v4l2_fake_test.sh [path/to/v4l2decode]"
+    echo "Run v4l2decode on the fake v4l2 device, no codec or driver needed."
+    echo "Every input memory type must hand the device the same bytes,"
+    echo "and every mmap buffer must be unmapped before the device closes."
+    echo ""
+    echo "default v4l2decode is ../tests/v4l2decode next to this script,"
+    echo "make check in tests/ runs it on the one just built"
+    echo
+    exit 0
+}
+
+if [ "$1" = "-h" ] || [ "$1" = "--help" ]; then
+    print_help
+fi
+
+v4l2decode=${1:-`dirname $0`/../tests/v4l2decode}
+if [ ! -x "${v4l2decode}" ]; then
+    echo "can't run ${v4l2decode}, build it with --enable-v4l2"
+    exit 1
+fi
+
+tmpdir=`mktemp -d`
+trap "rm -rf ${tmpdir}" EXIT
+stream=${tmpdir}/fake.h264
+frames=60
+failnumber=0
+
+#nal units with a start code each, the fake device only checksums them
+make_stream()
+{
+    i=0
+    while [ $i -lt ${frames} ]; do
+        printf '\000\000\001\145\210frame %04d of the fake stream\n' $i
+        i=$(($i+1))
+    done > ${stream}
+}
+
+#run_decode <fake spec> <v4l2decode options>, the output is in ${output}
+run_decode()
+{
+    spec=$1
+    shift
+    output=`YAMI_V4L2_FAKE="${spec}" ${v4l2decode} -i ${stream} -m -1 "$@" 2>&1`
+}
+
+checksum()
+{
+    echo "${output}" | sed -n 's/^fake v4l2 decoder: .*checksum \([0-9a-f]*\)$/\1/p'
+}
+
+report()
+{
+    name=$1
+    result=$2
+    echo "${name}    ${result}"
+    case "${result}" in
+        pass*) ;;
+        *) failnumber=$(($failnumber+1)) ;;
+    esac
+}
+
+#check <name> <expected input memory> <fake spec> <v4l2decode options>
+check()
+{
+    name=$1
+    memory=$2
+    spec=$3
+    shift 3
+    if ! run_decode "${spec}" "$@"; then
+        report "${name}" "fail, v4l2decode returned an error"
+        echo "${output}"
+        return
+    fi
+    if ! echo "${output}" | grep -q ": ${frames} frames, .*${memory} input"; then
+        report "${name}" "fail, expected ${frames} frames on ${memory} input"
+        echo "${output}"
+        return
+    fi
+    if echo "${output}" | grep -q "still mapped"; then
+        report "${name}" "fail, buffers left mapped"
+        echo "${output}"
+        return
+    fi
+    if [ "`checksum`" != "${reference}" ]; then
+        report "${name}" "fail, checksum `checksum`, expected ${reference}"
+        return
+    fi
+    report "${name}" "pass"
+}
+
+make_stream
+if ! run_decode "" --input-memory mmap || [ -z "`checksum`" ] || echo "${output}" | grep -q "still mapped"; then
+    echo "mmap    fail, no checksum from the fake device, or buffers left mapped"
+    echo "${output}"
+    exit 1
+fi
+reference=`checksum`
+echo "mmap    pass, checksum ${reference}"
+
+check userptr userptr "" --input-memory userptr
+if [ -e /dev/udmabuf ]; then
+    check dmabuf dmabuf "" --input-memory dmabuf
+else
+    check "dmabuf (no /dev/udmabuf, falls back)" mmap "" --input-memory dmabuf
+fi
+check "dmabuf refused by the device" mmap "dmabuf=0" --input-memory dmabuf
+check "2 input buffers, slow device" mmap "buffers=2,latency=1000" --input-memory mmap
+check "2 input buffers, userptr" userptr "buffers=2" --input-memory userptr
+#input buffers smaller than the stream, units with a buffer size of the file
+#after them go without a copy, the device checks the plane covers sizeimage
+check "userptr, 512 byte input buffers" userptr "insize=512" --input-memory userptr
+if ! echo "${output}" | grep -q "([1-9][0-9]* zero copy"; then
+    report "userptr zero copy" "fail, no unit was queued without a copy"
+    echo "${output}"
+fi
+#output buffers are freed and requested again for each new size
+check "resize every 7 frames" mmap "resize=7" --input-memory mmap
+check "resize every 5 frames, 2 buffers" mmap "resize=5,buffers=2" --input-memory mmap
+
+if [ ${failnumber} -ne 0 ]; then
+    echo "${failnumber} checks failed"
+    exit 1
+fi
+echo "all checks passed"
+exit 0